@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "async_output.h"
+
+// stdio buffer of the stream, so the queue sees few large pushes
+#define ASYNC_OUTPUT_BUFFER 65536
+
+enum {
+    ASYNC_DATA = 1,
+    ASYNC_END,
+};
+
+static int write_all(void* ctx, const void* data, size_t len)
+{
+    struct async_output* output = ctx;
+    const char* bytes = data;
+    while (len && !output->error) {
+        ssize_t written = write(output->fd, bytes, len);
+        if (written < 0) {
+            if (errno != EINTR)
+                __atomic_store_n(&output->error, errno, __ATOMIC_RELAXED);
+            continue;
+        }
+        bytes += written;
+        len -= written;
+    }
+    return output->error ? -1 : 0;
+}
+
+static void* writer_main(void* arg)
+{
+    struct async_output* output = arg;
+    unsigned int attempt = 0;
+    for (;;) {
+        struct spsc_message* message = spsc_queue_peek(&output->queue);
+        if (!message) {
+            spsc_queue_wait(&output->queue, &attempt);
+            continue;
+        }
+        attempt = 0;
+        if (message->type == ASYNC_END) {
+            spsc_queue_pop(&output->queue);
+            if (output->compressor && !output->error && compressor_flush(output->compressor, write_all, output) != 0
+                && !output->error)
+                __atomic_store_n(&output->error, EIO, __ATOMIC_RELAXED);
+            return NULL;
+        }
+
+        // The message size is padded, the length comes first
+        size_t len = *(uint64_t*)message->data;
+        const char* data = message->data + sizeof(uint64_t);
+        if (!output->compressor)
+            write_all(output, data, len);
+        else if (!output->error && compressor_write(output->compressor, data, len, write_all, output) != 0 && !output->error)
+            __atomic_store_n(&output->error, EIO, __ATOMIC_RELAXED);
+        spsc_queue_pop(&output->queue);
+    }
+}
+
+static void push(struct async_output* output, uint32_t type, const char* buf, size_t size)
+{
+    uint64_t len = size;
+    unsigned int attempt = 0;
+    while (spsc_queue_push(&output->queue, type, &len, sizeof(len), buf, size, 0) != 0) {
+        if (attempt == 0)
+            output->stalls++;
+        spsc_queue_backoff(&attempt);
+    }
+}
+
+static ssize_t cookie_write(void* cookie, const char* buf, size_t size)
+{
+    struct async_output* output = cookie;
+    int error = __atomic_load_n(&output->error, __ATOMIC_RELAXED);
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    // Messages may take at most half the queue
+    size_t chunk = output->queue.capacity / 4;
+    for (size_t offset = 0; offset < size; offset += chunk)
+        push(output, ASYNC_DATA, buf + offset, size - offset < chunk ? size - offset : chunk);
+    output->bytes += size;
+    return size;
+}
+
+static int cookie_close(void* cookie)
+{
+    push(cookie, ASYNC_END, NULL, 0);
+    return 0;
+}
+
+FILE* async_output_open(struct async_output* output, int fd, size_t capacity, struct compressor* compressor)
+{
+    memset(output, 0, sizeof(*output));
+    output->fd = fd;
+    output->compressor = compressor;
+    if (spsc_queue_init(&output->queue, capacity) != 0)
+        return NULL;
+
+    cookie_io_functions_t io = { .write = cookie_write, .close = cookie_close };
+    FILE* stream = fopencookie(output, "w", io);
+    if (!stream) {
+        spsc_queue_free(&output->queue);
+        return NULL;
+    }
+    setvbuf(stream, NULL, _IOFBF, ASYNC_OUTPUT_BUFFER);
+
+    if (pthread_create(&output->thread, NULL, writer_main, output) != 0) {
+        // Nothing was written yet, the close message just stays queued
+        fclose(stream);
+        spsc_queue_free(&output->queue);
+        return NULL;
+    }
+    return stream;
+}
+
+int async_output_join(struct async_output* output)
+{
+    pthread_join(output->thread, NULL);
+    spsc_queue_free(&output->queue);
+    return output->error ? -1 : 0;
+}
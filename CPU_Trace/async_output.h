@@ -0,0 +1,33 @@
+#ifndef ASYNC_OUTPUT_H
+#define ASYNC_OUTPUT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "compressor.h"
+#include "spsc_queue.h"
+
+// A stdio stream whose bytes are written to a file descriptor by a thread
+// of its own, so a slow pipe or disk stalls that thread rather than the
+// one formatting the output. The stream must be used by a single thread.
+// With a compressor, that thread also compresses what it writes.
+
+struct async_output {
+    int fd;
+    struct compressor* compressor;
+    struct spsc_queue queue;
+    pthread_t thread;
+    uint64_t stalls;  // writes that waited for room in the queue
+    uint64_t bytes;   // before compression
+    int error;        // errno of the first failed write(), 0 otherwise
+};
+
+// capacity is the queue size in bytes, a power of two. fd and compressor,
+// which may be NULL, stay owned by the caller. Returns NULL on failure.
+FILE* async_output_open(struct async_output* output, int fd, size_t capacity, struct compressor* compressor);
+
+// Call after fclose() on the stream: waits until every byte reached fd.
+// Returns -1 when a write failed.
+int async_output_join(struct async_output* output);
+
+#endif
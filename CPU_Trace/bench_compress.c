@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "compressor.h"
+#include "trace_reader.h"
+
+// Cost of compressing dw-pid output with each codec and level: the bytes
+// per second it produces, the bytes per second that reach the disk at the
+// rate the trace was recorded, and the CPU time per sample spent by the
+// output thread. Every codec is checked by decompressing its output again.
+
+static const char* default_specs[] = { "lz4", "lz4:9", "zstd:1", "zstd:3", "zstd:9", "zstd:19" };
+
+struct memory_sink {
+    char* data;
+    size_t size;
+    size_t capacity;
+};
+
+static int memory_write(void* ctx, const void* data, size_t len)
+{
+    struct memory_sink* sink = ctx;
+    if (sink->size + len > sink->capacity) {
+        size_t capacity = sink->capacity ? sink->capacity : 1 << 20;
+        while (capacity < sink->size + len)
+            capacity *= 2;
+        char* grown = realloc(sink->data, capacity);
+        if (!grown)
+            return -1;
+        sink->data = grown;
+        sink->capacity = capacity;
+    }
+    memcpy(sink->data + sink->size, data, len);
+    sink->size += len;
+    return 0;
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Whole file in memory, decompressed if it was compressed
+static int load(const char* path, struct memory_sink* input)
+{
+    FILE* in = compressed_fopen(path, NULL);
+    if (!in)
+        return -1;
+    char buffer[65536];
+    size_t n;
+    int ret = 0;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0 && ret == 0)
+        ret = memory_write(input, buffer, n);
+    if (ferror(in))
+        ret = -1;
+    fclose(in);
+    return ret;
+}
+
+static double parse_timestamp(const char* text)
+{
+    struct tm tm = { 0 };
+    double seconds;
+    if (sscanf(text, "%d-%d-%dT%d:%d:%lf", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &seconds) != 6)
+        return 0;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return timegm(&tm) + seconds;
+}
+
+// Samples and traced seconds: sample records and interval timestamps of a
+// binary trace, callchains and the timestamp column of a CSV
+static void count_samples(const char* path, const struct memory_sink* input, unsigned long* samples, double* seconds)
+{
+    *samples = 0;
+    *seconds = 0;
+    double first = 0, last = 0;
+    if (input->size >= sizeof(TRACE_MAGIC) && memcmp(input->data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0) {
+        struct trace_reader reader;
+        struct trace_record record;
+        if (trace_reader_open(&reader, path) != 0)
+            return;
+        while (trace_reader_next(&reader, &record) > 0) {
+            if (record.type == TRACE_RECORD_SAMPLE)
+                (*samples)++;
+            else if (record.type == TRACE_RECORD_INTERVAL) {
+                last = record.interval->timestamp_ns / 1e9;
+                if (first == 0)
+                    first = last - record.interval->duration_ns / 1e9;
+            }
+        }
+        trace_reader_close(&reader);
+        *seconds = last - first;
+        return;
+    }
+
+    // The callchains run from the first comma to the numeric columns, five
+    // or eight columns in all depending on the dw-pid version
+    const char* end = input->data + input->size;
+    const char* line = memchr(input->data, '\n', input->size);
+    int trailing = 0;
+    for (const char* p = input->data; p < (line ? line : end); p++)
+        trailing += *p == ',';
+    trailing -= 1;
+    while (line && ++line < end) {
+        const char* eol = memchr(line, '\n', end - line);
+        if (!eol)
+            eol = end;
+        const char* chains = memchr(line, ',', eol - line);
+        const char* chains_end = eol;
+        for (int commas = 0; chains && chains_end > chains && commas < trailing;)
+            commas += *--chains_end == ',';
+        if (*line != '#' && chains && chains_end > chains) {
+            int empty = 1;
+            for (const char* p = chains + 1; p < chains_end; p++) {
+                if (*p == '|') {
+                    *samples += !empty;
+                    empty = 1;
+                }
+                else if (*p != ' ')
+                    empty = 0;
+            }
+            *samples += !empty;
+            last = parse_timestamp(line);
+            if (first == 0)
+                first = last;
+        }
+        line = eol;
+    }
+    *seconds = last - first;
+}
+
+// Decompress through compressed_fopen, as the readers do, and compare
+static int check(const struct memory_sink* compressed, const struct memory_sink* input, double* ns)
+{
+    char path[] = "/tmp/bench_compress.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+    int ret = write(fd, compressed->data, compressed->size) == (ssize_t)compressed->size ? 0 : -1;
+    close(fd);
+
+    double start = now_ns();
+    FILE* in = ret == 0 ? compressed_fopen(path, NULL) : NULL;
+    if (in) {
+        char buffer[65536];
+        size_t offset = 0;
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+            if (offset + n > input->size || memcmp(buffer, input->data + offset, n) != 0)
+                ret = -1;
+            offset += n;
+        }
+        if (offset != input->size)
+            ret = -1;
+        fclose(in);
+    }
+    else
+        ret = -1;
+    *ns = now_ns() - start;
+    unlink(path);
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace.csv|trace.bin> [codec[:level[:frame_kib]]...]\n", *argv);
+        return 1;
+    }
+    const char* path = argv[1];
+    const char** specs = argc > 2 ? (const char**)argv + 2 : default_specs;
+    int spec_count = argc > 2 ? argc - 2 : (int)(sizeof(default_specs) / sizeof(*default_specs));
+
+    struct memory_sink input = { 0 };
+    if (load(path, &input) != 0 || input.size == 0) {
+        perror(path);
+        return 1;
+    }
+    unsigned long samples;
+    double seconds;
+    count_samples(path, &input, &samples, &seconds);
+    printf("%s: %zu bytes, %lu samples, %.1f s traced (%.0f bytes/s uncompressed)\n",
+        path, input.size, samples, seconds, seconds > 0 ? input.size / seconds : 0.0);
+    printf("%-14s %7s %12s %14s %12s %12s %12s\n", "codec", "ratio", "in MB/s", "out bytes/s",
+        "disk B/s", "ns/sample", "decomp MB/s");
+
+    int status = 0;
+    for (int i = 0; i < spec_count; i++) {
+        struct compressor compressor;
+        if (compressor_open(&compressor, specs[i]) != 0) {
+            status = 1;
+            continue;
+        }
+
+        // Written in the output thread's 64 KiB stdio chunks
+        struct memory_sink output = { 0 };
+        int ret = 0;
+        for (size_t offset = 0; offset < input.size && ret == 0; offset += 65536) {
+            size_t len = input.size - offset < 65536 ? input.size - offset : 65536;
+            ret = compressor_write(&compressor, input.data + offset, len, memory_write, &output);
+        }
+        if (ret == 0)
+            ret = compressor_flush(&compressor, memory_write, &output);
+
+        double decompress_ns = 0;
+        if (ret != 0 || check(&output, &input, &decompress_ns) != 0) {
+            fprintf(stderr, "%s: round trip failed\n", specs[i]);
+            status = 1;
+        }
+        else {
+            double cpu_seconds = compressor.cpu_ns / 1e9;
+            printf("%-14s %6.1fx %12.1f %14.0f %12.0f %12.0f %12.1f\n", specs[i],
+                (double)input.size / output.size, input.size / cpu_seconds / 1e6, output.size / cpu_seconds,
+                seconds > 0 ? output.size / seconds : 0.0, samples ? (double)compressor.cpu_ns / samples : 0.0,
+                input.size / decompress_ns * 1e3);
+        }
+        free(output.data);
+        compressor_close(&compressor);
+    }
+
+    free(input.data);
+    return status;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "procstat.h"
+
+// Per-call cost of the CPU time readings dw-pid takes every interval: the
+// stdio versions it used before procstat against the procstat module.
+
+static long stdio_process_time(pid_t pid) {
+    char path[256];
+    FILE* fp;
+    char line[1024];
+    long utime = 0, stime = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if ((fp = fopen(path, "r")) == NULL) return -1;
+
+    if (fgets(line, sizeof(line), fp) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    char* start = strchr(line, '(');
+    char* end = strrchr(line, ')');
+    if (!start || !end) return -1;
+
+    char* p = end + 1;
+    int field = 2;
+    while (*p && field < 14) {
+        if (*p == ' ') {
+            field++;
+            while (*++p == ' ');
+        }
+        else
+            p++;
+    }
+    sscanf(p, "%ld %ld", &utime, &stime);
+    return utime + stime;
+}
+
+static long stdio_total_cpu_time() {
+    FILE* fp;
+    char line[1024];
+    long user, nice, system, idle, iowait, irq, softirq;
+
+    if ((fp = fopen("/proc/stat", "r")) == NULL) return -1;
+    if (!fgets(line, sizeof(line), fp)) line[0] = '\0';
+    fclose(fp);
+
+    if (sscanf(line, "cpu  %ld %ld %ld %ld %ld %ld %ld",
+        &user, &nice, &system, &idle, &iowait, &irq, &softirq) != 7)
+        return -1;
+
+    return user + nice + system + irq + softirq;
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+    pid_t pid = argc > 1 ? atoi(argv[1]) : getpid();
+    long iterations = argc > 2 ? atol(argv[2]) : 20000;
+
+    struct procstat stat;
+    if (procstat_open(&stat, pid) != 0) {
+        fprintf(stderr, "Error opening /proc/%d/stat\n", pid);
+        return 1;
+    }
+
+    long check = 0;
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++)
+        check += stdio_process_time(pid);
+    double stdio_process = (now_ns() - start) / iterations;
+
+    start = now_ns();
+    for (long i = 0; i < iterations; i++)
+        check += procstat_process_time(&stat);
+    double procstat_process = (now_ns() - start) / iterations;
+
+    start = now_ns();
+    for (long i = 0; i < iterations; i++)
+        check += stdio_total_cpu_time();
+    double stdio_total = (now_ns() - start) / iterations;
+
+    start = now_ns();
+    for (long i = 0; i < iterations; i++)
+        check += procstat_total_time(&stat);
+    double procstat_total = (now_ns() - start) / iterations;
+
+    start = now_ns();
+    long nthreads = 0;
+    for (long i = 0; i < iterations; i++)
+        nthreads = procstat_read_threads(&stat);
+    double procstat_threads = (now_ns() - start) / iterations;
+
+    printf("pid %d, %ld iterations\n", pid, iterations);
+    printf("/proc/<pid>/stat  stdio %8.0f ns/call  procstat %8.0f ns/call\n", stdio_process, procstat_process);
+    printf("/proc/stat        stdio %8.0f ns/call  procstat %8.0f ns/call\n", stdio_total, procstat_total);
+    printf("%ld thread(s)      procstat_read_threads %8.0f ns/call\n", nthreads, procstat_threads);
+    printf("values: process %ld / %ld, total %ld / %ld (checksum %ld)\n",
+        stdio_process_time(pid), procstat_process_time(&stat), stdio_total_cpu_time(), procstat_total_time(&stat), check);
+
+    procstat_close(&stat);
+    return 0;
+}
@@ -0,0 +1,450 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bucket_index.h"
+#include "trace_fold.h"
+
+// A sample's energy in one bucket, merged per (bucket, node) once the
+// bucket can receive nothing more
+struct contribution {
+    uint64_t bucket;
+    uint32_t node;
+    uint32_t count;
+    double energy;
+};
+
+struct bucket_builder {
+    uint64_t start_ns;
+    uint64_t bucket_ns;
+
+    struct contribution* pending;
+    size_t npending;
+    size_t pending_capacity;
+    uint64_t flushed; // buckets before this one are final
+    uint64_t late;    // contributions to final buckets, dropped
+
+    struct bucket* buckets;
+    size_t nbuckets;
+    size_t buckets_capacity;
+    struct bucket_entry* entries;
+    size_t nentries;
+    size_t entries_capacity;
+};
+
+static int compare_contributions(const void* a, const void* b)
+{
+    const struct contribution* ca = a;
+    const struct contribution* cb = b;
+    if (ca->bucket != cb->bucket)
+        return ca->bucket < cb->bucket ? -1 : 1;
+    return (ca->node > cb->node) - (ca->node < cb->node);
+}
+
+static int grow(void** array, size_t* capacity, size_t needed, size_t size)
+{
+    if (needed <= *capacity)
+        return 0;
+    size_t grown = *capacity ? *capacity : 1024;
+    while (grown < needed)
+        grown *= 2;
+    char* data = realloc(*array, grown * size);
+    if (!data)
+        return -1;
+    memset(data + *capacity * size, 0, (grown - *capacity) * size);
+    *array = data;
+    *capacity = grown;
+    return 0;
+}
+
+static int ensure_buckets(struct bucket_builder* builder, uint64_t count)
+{
+    if (grow((void**)&builder->buckets, &builder->buckets_capacity, count, sizeof(struct bucket)) != 0)
+        return -1;
+    if (count > builder->nbuckets)
+        builder->nbuckets = count;
+    return 0;
+}
+
+static int contribute(struct bucket_builder* builder, uint64_t bucket, uint32_t node, double energy)
+{
+    if (bucket < builder->flushed) {
+        builder->late++;
+        return 0;
+    }
+    if (grow((void**)&builder->pending, &builder->pending_capacity, builder->npending + 1,
+            sizeof(struct contribution)) != 0)
+        return -1;
+    builder->pending[builder->npending++] = (struct contribution) { bucket, node, 1, energy };
+    return 0;
+}
+
+// Merge the contributions to buckets before upto into their entries
+static int flush(struct bucket_builder* builder, uint64_t upto)
+{
+    qsort(builder->pending, builder->npending, sizeof(struct contribution), compare_contributions);
+    size_t i = 0;
+    while (i < builder->npending && builder->pending[i].bucket < upto) {
+        struct contribution merged = builder->pending[i++];
+        while (i < builder->npending && builder->pending[i].bucket == merged.bucket
+            && builder->pending[i].node == merged.node) {
+            merged.count += builder->pending[i].count;
+            merged.energy += builder->pending[i].energy;
+            i++;
+        }
+        if (grow((void**)&builder->entries, &builder->entries_capacity, builder->nentries + 1,
+                sizeof(struct bucket_entry)) != 0)
+            return -1;
+        struct bucket* bucket = &builder->buckets[merged.bucket];
+        if (bucket->nentries == 0)
+            bucket->first_entry = builder->nentries;
+        bucket->nentries++;
+        builder->entries[builder->nentries++] = (struct bucket_entry) { merged.node, merged.count, merged.energy };
+    }
+    memmove(builder->pending, builder->pending + i, (builder->npending - i) * sizeof(struct contribution));
+    builder->npending -= i;
+    if (upto > builder->flushed)
+        builder->flushed = upto;
+    return 0;
+}
+
+// The interval's samples and energy go to every bucket it overlaps, under
+// the rules trace-energy applies to a window
+static int add_interval(struct bucket_builder* builder, struct trace_fold* fold, const struct trace_interval* interval)
+{
+    double energy = trace_fold_shares(fold, interval);
+    uint64_t end = interval->timestamp_ns, duration = interval->duration_ns;
+    if (end <= builder->start_ns)
+        return 0;
+    uint64_t start = end - duration > builder->start_ns ? end - duration - builder->start_ns : 0;
+    uint64_t first = start / builder->bucket_ns;
+    uint64_t last = (end - builder->start_ns - 1) / builder->bucket_ns;
+    if (first > last)
+        return 0;
+    if (first > builder->flushed && flush(builder, first) != 0)
+        return -1;
+    if (ensure_buckets(builder, last + 1) != 0)
+        return -1;
+    builder->buckets[last].intervals++;
+
+    for (uint64_t b = first; b <= last; b++) {
+        uint64_t from = builder->start_ns + b * builder->bucket_ns;
+        uint64_t to = from + builder->bucket_ns;
+        double fraction = trace_fold_overlap(from, to, end, duration);
+        struct bucket* bucket = &builder->buckets[b];
+        bucket->energy += energy * fraction;
+        double attributed = 0;
+        for (size_t i = 0; i < fold->count; i++) {
+            const struct chain_tag* tag = &fold->tags[i];
+            double share = fold->shares[i];
+            if (tag->tagged) {
+                if (tag->time_ns < from || tag->time_ns >= to)
+                    continue;
+            }
+            else
+                share *= fraction;
+            if (contribute(builder, b, fold->nodes[i], share) != 0)
+                return -1;
+            attributed += share;
+            bucket->samples++;
+        }
+        if (attributed == 0)
+            bucket->unattributed += energy * fraction;
+    }
+    return 0;
+}
+
+static int write_padding(FILE* out, uint64_t size)
+{
+    static const char padding[8];
+    size_t pad = (8 - size % 8) % 8;
+    return pad && fwrite(padding, 1, pad, out) != pad ? -1 : 0;
+}
+
+static int write_table(FILE* out, const void* data, size_t size)
+{
+    if (size && fwrite(data, 1, size, out) != size)
+        return -1;
+    return write_padding(out, size);
+}
+
+static int write_index(const struct bucket_builder* builder, const struct stack_trie* trie,
+    struct bucket_index_header* header, FILE* out)
+{
+    header->nbuckets = builder->nbuckets;
+    header->nframes = trie->nframes;
+    header->nstacks = trie->nnodes;
+    header->nentries = builder->nentries;
+
+    struct bucket_frame* frames = calloc(trie->nframes + 1, sizeof(struct bucket_frame));
+    struct bucket_stack* stacks = calloc(trie->nnodes, sizeof(struct bucket_stack));
+    if (!frames || !stacks) {
+        free(frames);
+        free(stacks);
+        return -1;
+    }
+    header->frames_offset = sizeof(*header);
+    uint64_t names_offset = header->frames_offset + trie->nframes * sizeof(struct bucket_frame);
+    uint64_t names_size = 0;
+    for (size_t i = 0; i < trie->nframes; i++) {
+        frames[i].offset = names_offset + names_size;
+        frames[i].len = trie->frames[i].len;
+        names_size += trie->frames[i].len;
+    }
+    for (size_t i = 0; i < trie->nnodes; i++) {
+        stacks[i].parent = trie->nodes[i].parent;
+        stacks[i].frame = i == STACK_TRIE_ROOT ? UINT32_MAX : trie->nodes[i].frame;
+    }
+    header->stacks_offset = names_offset + names_size + (8 - names_size % 8) % 8;
+    header->buckets_offset = header->stacks_offset + trie->nnodes * sizeof(struct bucket_stack);
+    header->entries_offset = header->buckets_offset + builder->nbuckets * sizeof(struct bucket);
+
+    int ret = write_table(out, header, sizeof(*header));
+    if (ret == 0)
+        ret = write_table(out, frames, trie->nframes * sizeof(struct bucket_frame));
+    for (size_t i = 0; ret == 0 && i < trie->nframes; i++) {
+        if (trie->frames[i].len && fwrite(trie->frames[i].name, 1, trie->frames[i].len, out) != trie->frames[i].len)
+            ret = -1;
+    }
+    if (ret == 0)
+        ret = write_padding(out, names_size);
+    if (ret == 0)
+        ret = write_table(out, stacks, trie->nnodes * sizeof(struct bucket_stack));
+    if (ret == 0)
+        ret = write_table(out, builder->buckets, builder->nbuckets * sizeof(struct bucket));
+    if (ret == 0)
+        ret = write_table(out, builder->entries, builder->nentries * sizeof(struct bucket_entry));
+    free(frames);
+    free(stacks);
+    return ret;
+}
+
+static int trace_stat(const char* trace_path, uint64_t* size, uint64_t* mtime_ns)
+{
+    struct stat st;
+    if (stat(trace_path, &st) != 0) {
+        perror(trace_path);
+        return -1;
+    }
+    *size = st.st_size;
+    *mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+int bucket_index_build(const struct trace_view* view, const char* trace_path, uint32_t bucket_ms, const char* path)
+{
+    struct bucket_index_header header = { .magic = BUCKET_INDEX_MAGIC, .version = BUCKET_INDEX_VERSION,
+        .bucket_ms = bucket_ms, .start_ns = view->header->start_ns };
+    if (bucket_ms == 0 || trace_stat(trace_path, &header.trace_size, &header.trace_mtime_ns) != 0)
+        return -1;
+
+    struct stack_trie trie;
+    if (stack_trie_init(&trie) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        return -1;
+    }
+    struct trace_fold fold;
+    trace_fold_init(&fold, view, &trie);
+    struct bucket_builder builder = { .start_ns = view->header->start_ns, .bucket_ns = bucket_ms * 1000000ULL };
+
+    struct trace_cursor cursor;
+    trace_cursor_seek(&cursor, view, 0);
+    struct trace_record record;
+    int ret;
+    while ((ret = trace_cursor_next(&cursor, &record)) > 0) {
+        if (record.type == TRACE_RECORD_SAMPLE)
+            ret = trace_fold_sample(&fold, &record);
+        else if (record.type == TRACE_RECORD_INTERVAL) {
+            ret = add_interval(&builder, &fold, record.interval);
+            trace_fold_clear(&fold);
+        }
+        if (ret < 0) {
+            fprintf(stderr, "ERROR: Memory allocation failed while indexing %s\n", trace_path);
+            break;
+        }
+    }
+    if (ret == 0 && flush(&builder, UINT64_MAX) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed while indexing %s\n", trace_path);
+        ret = -1;
+    }
+    if (builder.late)
+        fprintf(stderr, "%s: %lu samples of intervals out of time order left out of the bucket index\n",
+            trace_path, builder.late);
+
+    // Written aside and renamed, so a reader never maps a partial index
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* out = ret == 0 ? fopen(tmp, "w") : NULL;
+    if (ret == 0 && !out) {
+        perror(tmp);
+        ret = -1;
+    }
+    if (out) {
+        if (write_index(&builder, &trie, &header, out) != 0 || fclose(out) != 0 || rename(tmp, path) != 0) {
+            perror(path);
+            unlink(tmp);
+            ret = -1;
+        }
+    }
+
+    free(builder.pending);
+    free(builder.buckets);
+    free(builder.entries);
+    trace_fold_free(&fold);
+    stack_trie_free(&trie);
+    return ret < 0 ? -1 : 0;
+}
+
+// Every table inside the file
+static int check_index(const struct bucket_index* index)
+{
+    const struct bucket_index_header* header = index->header;
+    uint64_t size = index->size;
+    if (header->frames_offset + header->nframes * sizeof(struct bucket_frame) > size
+        || header->stacks_offset + header->nstacks * sizeof(struct bucket_stack) > size
+        || header->buckets_offset + header->nbuckets * sizeof(struct bucket) > size
+        || header->entries_offset + header->nentries * sizeof(struct bucket_entry) > size
+        || header->nstacks == 0 || header->nstacks > UINT32_MAX || header->nframes > UINT32_MAX)
+        return -1;
+    for (uint64_t i = 0; i < header->nframes; i++) {
+        if (index->frames[i].offset + index->frames[i].len > size)
+            return -1;
+    }
+    for (uint64_t i = 1; i < header->nstacks; i++) {
+        if (index->stacks[i].parent >= i || index->stacks[i].frame >= header->nframes)
+            return -1;
+    }
+    for (uint64_t i = 0; i < header->nbuckets; i++) {
+        const struct bucket* bucket = &index->buckets[i];
+        if (bucket->first_entry + bucket->nentries > header->nentries)
+            return -1;
+    }
+    for (uint64_t i = 0; i < header->nentries; i++) {
+        if (index->entries[i].stack >= header->nstacks)
+            return -1;
+    }
+    return 0;
+}
+
+// 1 when the file is not a current index of the trace
+static int map_index(struct bucket_index* index, const char* path, const char* trace_path, uint32_t bucket_ms)
+{
+    memset(index, 0, sizeof(*index));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct bucket_index_header)) {
+        close(fd);
+        return 1;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+    index->data = data;
+    index->size = st.st_size;
+    index->header = data;
+
+    const struct bucket_index_header* header = index->header;
+    uint64_t trace_size, trace_mtime_ns;
+    if (trace_stat(trace_path, &trace_size, &trace_mtime_ns) != 0) {
+        bucket_index_close(index);
+        return -1;
+    }
+    if (memcmp(header->magic, BUCKET_INDEX_MAGIC, sizeof(BUCKET_INDEX_MAGIC)) != 0
+        || header->version != BUCKET_INDEX_VERSION || header->bucket_ms == 0
+        || (bucket_ms && header->bucket_ms != bucket_ms)
+        || header->trace_size != trace_size || header->trace_mtime_ns != trace_mtime_ns) {
+        bucket_index_close(index);
+        return 1;
+    }
+    index->frames = (const struct bucket_frame*)(index->data + header->frames_offset);
+    index->stacks = (const struct bucket_stack*)(index->data + header->stacks_offset);
+    index->buckets = (const struct bucket*)(index->data + header->buckets_offset);
+    index->entries = (const struct bucket_entry*)(index->data + header->entries_offset);
+    if (check_index(index) != 0) {
+        fprintf(stderr, "%s: corrupt bucket index, rebuilding it\n", path);
+        bucket_index_close(index);
+        return 1;
+    }
+    return 0;
+}
+
+int bucket_index_load(struct bucket_index* index, const char* path, const struct trace_view* view,
+    const char* trace_path, uint32_t bucket_ms)
+{
+    int ret = map_index(index, path, trace_path, bucket_ms);
+    if (ret <= 0)
+        return ret;
+    if (bucket_index_build(view, trace_path, bucket_ms ? bucket_ms : BUCKET_INDEX_DEFAULT_MS, path) != 0)
+        return -1;
+    ret = map_index(index, path, trace_path, bucket_ms);
+    if (ret > 0)
+        fprintf(stderr, "%s: could not load the bucket index just built\n", path);
+    return ret ? -1 : 0;
+}
+
+void bucket_index_close(struct bucket_index* index)
+{
+    if (index->data)
+        munmap((void*)index->data, index->size);
+    memset(index, 0, sizeof(*index));
+}
+
+// Trie node of an index stack, interning its missing ancestors from the
+// root down. nodes[stack] is 0 until resolved, only the root is node 0.
+static uint32_t resolve(const struct bucket_index* index, struct stack_trie* trie, uint32_t* nodes, uint32_t stack)
+{
+    while (stack != STACK_TRIE_ROOT && !nodes[stack]) {
+        uint32_t s = stack;
+        while (index->stacks[s].parent != STACK_TRIE_ROOT && !nodes[index->stacks[s].parent])
+            s = index->stacks[s].parent;
+        const struct bucket_frame* frame = &index->frames[index->stacks[s].frame];
+        uint32_t id = stack_trie_frame(trie, index->data + frame->offset, frame->len);
+        uint32_t node = id == UINT32_MAX ? UINT32_MAX : stack_trie_child(trie, nodes[index->stacks[s].parent], id);
+        if (node == UINT32_MAX)
+            return UINT32_MAX;
+        nodes[s] = node;
+    }
+    return nodes[stack];
+}
+
+int bucket_index_fold(const struct bucket_index* index, uint64_t first, uint64_t last, struct stack_trie* trie,
+    struct bucket* sum)
+{
+    const struct bucket_index_header* header = index->header;
+    if (last > header->nbuckets)
+        last = header->nbuckets;
+    if (first >= last)
+        return 0;
+
+    uint32_t* nodes = calloc(header->nstacks, sizeof(uint32_t));
+    if (!nodes)
+        return -1;
+    int ret = 0;
+    for (uint64_t b = first; b < last && ret == 0; b++) {
+        const struct bucket* bucket = &index->buckets[b];
+        sum->intervals += bucket->intervals;
+        sum->samples += bucket->samples;
+        sum->energy += bucket->energy;
+        sum->unattributed += bucket->unattributed;
+        for (uint32_t e = 0; e < bucket->nentries; e++) {
+            const struct bucket_entry* entry = &index->entries[bucket->first_entry + e];
+            uint32_t node = resolve(index, trie, nodes, entry->stack);
+            if (node == UINT32_MAX) {
+                ret = -1;
+                break;
+            }
+            trie->nodes[node].count += entry->count;
+            trie->nodes[node].value += entry->energy;
+        }
+    }
+    free(nodes);
+    return ret;
+}
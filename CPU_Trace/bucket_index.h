@@ -0,0 +1,104 @@
+#ifndef BUCKET_INDEX_H
+#define BUCKET_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stack_trie.h"
+#include "trace_view.h"
+
+// Energy per stack in fixed time buckets of a binary trace, precomputed in
+// one pass and kept next to it (<trace>.buckets). A time range is then the
+// sum of the buckets it covers plus the two partial buckets at its edges,
+// folded from the trace, so its cost no longer grows with its length.
+// Each bucket holds exactly what trace-energy prints for its window, so
+// sums match a query of the whole range to rounding.
+//
+//   bucket_index_header
+//   bucket_frame[nframes], then the names
+//   bucket_stack[nstacks]  stack 0 is the root, a parent before its children
+//   bucket[nbuckets]       bucket k starts bucket_ms * k after start_ns
+//   bucket_entry[nentries] the stacks of each bucket, by bucket
+//
+// Little endian, every table aligned to 8 bytes.
+
+#define BUCKET_INDEX_MAGIC "DWBUCKT"
+#define BUCKET_INDEX_VERSION 1
+#define BUCKET_INDEX_DEFAULT_MS 100
+
+struct bucket_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t bucket_ms;
+    uint64_t start_ns;       // the trace's start_ns
+    uint64_t trace_size;     // of the trace it was built from, to notice a stale index
+    uint64_t trace_mtime_ns;
+    uint64_t nbuckets;
+    uint64_t nframes;
+    uint64_t nstacks;
+    uint64_t nentries;
+    uint64_t frames_offset;
+    uint64_t stacks_offset;
+    uint64_t buckets_offset;
+    uint64_t entries_offset;
+};
+
+struct bucket_frame {
+    uint64_t offset; // of the name, not NUL terminated
+    uint32_t len;
+    uint32_t reserved;
+};
+
+struct bucket_stack {
+    uint32_t parent;
+    uint32_t frame;
+};
+
+struct bucket {
+    uint64_t first_entry;
+    uint32_t nentries;
+    uint32_t intervals; // ending in the bucket
+    uint64_t samples;
+    double energy;       // joules of the intervals' parts inside the bucket
+    double unattributed; // of that, in intervals without samples
+};
+
+struct bucket_entry {
+    uint32_t stack;
+    uint32_t count;
+    double energy;
+};
+
+struct bucket_index {
+    const char* data;
+    size_t size;
+    const struct bucket_index_header* header;
+    const struct bucket_frame* frames;
+    const struct bucket_stack* stacks;
+    const struct bucket* buckets;
+    const struct bucket_entry* entries;
+};
+
+// Fold the whole trace into buckets of bucket_ms and write the index to
+// path. Returns -1 with the reason on stderr.
+int bucket_index_build(const struct trace_view* view, const char* trace_path, uint32_t bucket_ms, const char* path);
+
+// Map the index at path, or build it first when it is missing, was built
+// from another version of the trace, or has buckets other than bucket_ms
+// (0 takes any, BUCKET_INDEX_DEFAULT_MS when building).
+// Returns -1 with the reason on stderr.
+int bucket_index_load(struct bucket_index* index, const char* path, const struct trace_view* view,
+    const char* trace_path, uint32_t bucket_ms);
+
+void bucket_index_close(struct bucket_index* index);
+
+static inline uint64_t bucket_index_start(const struct bucket_index* index, uint64_t bucket)
+{
+    return index->header->start_ns + bucket * index->header->bucket_ms * 1000000ULL;
+}
+
+// Add the stacks of buckets [first, last) to trie, and their totals to sum.
+// Returns -1 when out of memory.
+int bucket_index_fold(const struct bucket_index* index, uint64_t first, uint64_t last, struct stack_trie* trie,
+    struct bucket* sum);
+
+#endif
@@ -0,0 +1,396 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include "compressor.h"
+
+// The few zstd and lz4 declarations used, so that neither header is
+// needed to build
+typedef struct { const void* src; size_t size; size_t pos; } zstd_in_buffer;
+typedef struct { void* dst; size_t size; size_t pos; } zstd_out_buffer;
+
+typedef struct {
+    int block_size_id;
+    int block_mode;
+    int content_checksum;
+    int frame_type;
+    unsigned long long content_size;
+    unsigned dict_id;
+    int block_checksum;
+} lz4f_frame_info;
+
+typedef struct {
+    lz4f_frame_info frame_info;
+    int compression_level;
+    unsigned auto_flush;
+    unsigned favor_dec_speed;
+    unsigned reserved[3];
+} lz4f_preferences;
+
+#define LZ4F_VERSION 100
+
+enum {
+    CODEC_ZSTD,
+    CODEC_LZ4,
+    CODEC_COUNT,
+};
+
+struct codec {
+    const char* name;
+    const char* library;
+    const char* suffix;
+    unsigned char magic[4];
+    int default_level;
+    pthread_once_t once;
+    void* lib;
+
+    // zstd
+    void* (*zstd_create_cctx)(void);
+    size_t (*zstd_free_cctx)(void* cctx);
+    size_t (*zstd_compress_cctx)(void* cctx, void* dst, size_t capacity, const void* src, size_t size, int level);
+    size_t (*zstd_compress_bound)(size_t size);
+    void* (*zstd_create_dstream)(void);
+    size_t (*zstd_init_dstream)(void* dstream);
+    size_t (*zstd_free_dstream)(void* dstream);
+    size_t (*zstd_decompress_stream)(void* dstream, zstd_out_buffer* out, zstd_in_buffer* in);
+
+    // lz4 frame format
+    size_t (*lz4_compress_frame_bound)(size_t size, const lz4f_preferences* prefs);
+    size_t (*lz4_compress_frame)(void* dst, size_t capacity, const void* src, size_t size, const lz4f_preferences* prefs);
+    size_t (*lz4_create_dctx)(void** dctx, unsigned version);
+    size_t (*lz4_free_dctx)(void* dctx);
+    size_t (*lz4_decompress)(void* dctx, void* dst, size_t* dst_size, const void* src, size_t* src_size, const void* options);
+
+    // Shared shape, both return nonzero for error codes
+    unsigned (*is_error)(size_t code);
+    const char* (*error_name)(size_t code);
+};
+
+static struct codec codecs[CODEC_COUNT] = {
+    [CODEC_ZSTD] = { "zstd", "libzstd.so.1", ".zst", { 0x28, 0xb5, 0x2f, 0xfd }, 3, PTHREAD_ONCE_INIT },
+    [CODEC_LZ4] = { "lz4", "liblz4.so.1", ".lz4", { 0x04, 0x22, 0x4d, 0x18 }, 0, PTHREAD_ONCE_INIT },
+};
+
+#define LOAD(codec, field, symbol) (*(void**)&(codec)->field = dlsym((codec)->lib, symbol))
+
+static void load_zstd(void)
+{
+    struct codec* codec = &codecs[CODEC_ZSTD];
+    codec->lib = dlopen(codec->library, RTLD_NOW | RTLD_LOCAL);
+    if (!codec->lib)
+        return;
+    if (!LOAD(codec, zstd_create_cctx, "ZSTD_createCCtx") || !LOAD(codec, zstd_free_cctx, "ZSTD_freeCCtx")
+        || !LOAD(codec, zstd_compress_cctx, "ZSTD_compressCCtx") || !LOAD(codec, zstd_compress_bound, "ZSTD_compressBound")
+        || !LOAD(codec, zstd_create_dstream, "ZSTD_createDStream") || !LOAD(codec, zstd_init_dstream, "ZSTD_initDStream")
+        || !LOAD(codec, zstd_free_dstream, "ZSTD_freeDStream") || !LOAD(codec, zstd_decompress_stream, "ZSTD_decompressStream")
+        || !LOAD(codec, is_error, "ZSTD_isError") || !LOAD(codec, error_name, "ZSTD_getErrorName")) {
+        dlclose(codec->lib);
+        codec->lib = NULL;
+    }
+}
+
+static void load_lz4(void)
+{
+    struct codec* codec = &codecs[CODEC_LZ4];
+    codec->lib = dlopen(codec->library, RTLD_NOW | RTLD_LOCAL);
+    if (!codec->lib)
+        return;
+    if (!LOAD(codec, lz4_compress_frame_bound, "LZ4F_compressFrameBound") || !LOAD(codec, lz4_compress_frame, "LZ4F_compressFrame")
+        || !LOAD(codec, lz4_create_dctx, "LZ4F_createDecompressionContext")
+        || !LOAD(codec, lz4_free_dctx, "LZ4F_freeDecompressionContext") || !LOAD(codec, lz4_decompress, "LZ4F_decompress")
+        || !LOAD(codec, is_error, "LZ4F_isError") || !LOAD(codec, error_name, "LZ4F_getErrorName")) {
+        dlclose(codec->lib);
+        codec->lib = NULL;
+    }
+}
+
+// Loaded once per process, readers may open files from several threads
+static struct codec* load_codec(int id)
+{
+    struct codec* codec = &codecs[id];
+    pthread_once(&codec->once, id == CODEC_ZSTD ? load_zstd : load_lz4);
+    if (!codec->lib) {
+        fprintf(stderr, "%s is needed for %s compression\n", codec->library, codec->name);
+        return NULL;
+    }
+    return codec;
+}
+
+static uint64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int compressor_open(struct compressor* compressor, const char* spec)
+{
+    memset(compressor, 0, sizeof(*compressor));
+    size_t name_len = strcspn(spec, ":");
+    int id = CODEC_COUNT;
+    for (int i = 0; i < CODEC_COUNT; i++) {
+        if (strlen(codecs[i].name) == name_len && strncmp(spec, codecs[i].name, name_len) == 0)
+            id = i;
+    }
+    if (id == CODEC_COUNT) {
+        fprintf(stderr, "Unknown compression %.*s, use zstd or lz4\n", (int)name_len, spec);
+        return -1;
+    }
+
+    int level = codecs[id].default_level;
+    long frame_kib = COMPRESSOR_FRAME_KIB;
+    const char* rest = spec + name_len;
+    char* end = (char*)rest;
+    if (*rest == ':' && rest[1] != ':')
+        level = strtol(rest + 1, &end, 10);
+    else if (*rest == ':')
+        end = (char*)rest + 1;
+    if (*end == ':')
+        frame_kib = strtol(end + 1, &end, 10);
+    if (*end != '\0' || frame_kib <= 0) {
+        fprintf(stderr, "Invalid compression %s, expected codec[:level[:frame_kib]]\n", spec);
+        return -1;
+    }
+
+    struct codec* codec = load_codec(id);
+    if (!codec)
+        return -1;
+    compressor->name = codec->name;
+    compressor->codec = id;
+    compressor->level = level;
+    compressor->frame_size = (size_t)frame_kib << 10;
+
+    // Sized once for a full frame, nothing is allocated while tracing
+    if (id == CODEC_ZSTD) {
+        compressor->cctx = codec->zstd_create_cctx();
+        compressor->out_capacity = codec->zstd_compress_bound(compressor->frame_size);
+    }
+    else {
+        lz4f_preferences prefs = { .compression_level = level };
+        compressor->out_capacity = codec->lz4_compress_frame_bound(compressor->frame_size, &prefs);
+    }
+    compressor->frame = malloc(compressor->frame_size);
+    compressor->out = malloc(compressor->out_capacity);
+    if ((id == CODEC_ZSTD && !compressor->cctx) || !compressor->frame || !compressor->out) {
+        fprintf(stderr, "ERROR: Memory allocation failed for %s compression\n", codec->name);
+        compressor_close(compressor);
+        return -1;
+    }
+    return 0;
+}
+
+static int compress_frame(struct compressor* compressor, const void* data, size_t len,
+    compressor_sink sink, void* ctx)
+{
+    struct codec* codec = &codecs[compressor->codec];
+    uint64_t start = thread_cpu_ns();
+    size_t size;
+    if (compressor->codec == CODEC_ZSTD)
+        size = codec->zstd_compress_cctx(compressor->cctx, compressor->out, compressor->out_capacity, data, len, compressor->level);
+    else {
+        lz4f_preferences prefs = { .compression_level = compressor->level };
+        prefs.frame_info.content_size = len;
+        size = codec->lz4_compress_frame(compressor->out, compressor->out_capacity, data, len, &prefs);
+    }
+    compressor->cpu_ns += thread_cpu_ns() - start;
+    if (codec->is_error(size)) {
+        fprintf(stderr, "ERROR: %s compression failed: %s\n", codec->name, codec->error_name(size));
+        return -1;
+    }
+
+    compressor->in_bytes += len;
+    compressor->out_bytes += size;
+    compressor->frames++;
+    return sink(ctx, compressor->out, size);
+}
+
+int compressor_write(struct compressor* compressor, const void* data, size_t len,
+    compressor_sink sink, void* ctx)
+{
+    const char* bytes = data;
+    while (len) {
+        // Whole frames straight from the caller's buffer
+        if (compressor->frame_used == 0 && len >= compressor->frame_size) {
+            if (compress_frame(compressor, bytes, compressor->frame_size, sink, ctx) != 0)
+                return -1;
+            bytes += compressor->frame_size;
+            len -= compressor->frame_size;
+            continue;
+        }
+        size_t room = compressor->frame_size - compressor->frame_used;
+        size_t chunk = len < room ? len : room;
+        memcpy(compressor->frame + compressor->frame_used, bytes, chunk);
+        compressor->frame_used += chunk;
+        bytes += chunk;
+        len -= chunk;
+        if (compressor->frame_used == compressor->frame_size && compressor_flush(compressor, sink, ctx) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int compressor_flush(struct compressor* compressor, compressor_sink sink, void* ctx)
+{
+    if (compressor->frame_used == 0)
+        return 0;
+    size_t used = compressor->frame_used;
+    compressor->frame_used = 0;
+    return compress_frame(compressor, compressor->frame, used, sink, ctx);
+}
+
+void compressor_close(struct compressor* compressor)
+{
+    if (compressor->cctx)
+        codecs[CODEC_ZSTD].zstd_free_cctx(compressor->cctx);
+    free(compressor->frame);
+    free(compressor->out);
+    compressor->cctx = NULL;
+    compressor->frame = NULL;
+    compressor->out = NULL;
+}
+
+// Reading side
+
+#define DECOMPRESS_BUFFER 65536
+
+struct decompressor {
+    FILE* in;
+    struct codec* codec;
+    void* dctx;
+    int pending;  // inside a frame
+    size_t size;
+    size_t pos;
+    char buffer[DECOMPRESS_BUFFER];
+};
+
+static ssize_t decompress_read(void* cookie, char* buf, size_t size)
+{
+    struct decompressor* d = cookie;
+    struct codec* codec = d->codec;
+    size_t produced = 0;
+    while (produced == 0 && size) {
+        if (d->pos == d->size) {
+            d->size = fread(d->buffer, 1, sizeof(d->buffer), d->in);
+            d->pos = 0;
+            if (d->size == 0) {
+                if (ferror(d->in)) {
+                    errno = EIO;
+                    return -1;
+                }
+                if (d->pending)
+                    fprintf(stderr, "WARNING: the last %s frame is truncated\n", codec->name);
+                return 0;
+            }
+        }
+
+        size_t ret;
+        if (codec == &codecs[CODEC_ZSTD]) {
+            zstd_in_buffer in = { d->buffer, d->size, d->pos };
+            zstd_out_buffer out = { buf, size, 0 };
+            ret = codec->zstd_decompress_stream(d->dctx, &out, &in);
+            d->pos = in.pos;
+            produced = out.pos;
+        }
+        else {
+            size_t src_size = d->size - d->pos;
+            produced = size;
+            ret = codec->lz4_decompress(d->dctx, buf, &produced, d->buffer + d->pos, &src_size, NULL);
+            d->pos += src_size;
+        }
+        if (codec->is_error(ret)) {
+            fprintf(stderr, "ERROR: %s decompression failed: %s\n", codec->name, codec->error_name(ret));
+            errno = EIO;
+            return -1;
+        }
+        // Both return 0 once a frame is complete, the next one may follow
+        d->pending = ret != 0;
+    }
+    return produced;
+}
+
+static int decompress_close(void* cookie)
+{
+    struct decompressor* d = cookie;
+    if (d->codec == &codecs[CODEC_ZSTD])
+        d->codec->zstd_free_dstream(d->dctx);
+    else
+        d->codec->lz4_free_dctx(d->dctx);
+    int ret = fclose(d->in);
+    free(d);
+    return ret;
+}
+
+FILE* compressed_fopen(const char* path, const char** codec_name)
+{
+    if (codec_name)
+        *codec_name = NULL;
+    FILE* in = fopen(path, "rb");
+    if (!in)
+        return NULL;
+
+    unsigned char magic[4];
+    int id = CODEC_COUNT;
+    if (fread(magic, 1, sizeof(magic), in) == sizeof(magic)) {
+        for (int i = 0; i < CODEC_COUNT; i++) {
+            if (memcmp(magic, codecs[i].magic, sizeof(magic)) == 0)
+                id = i;
+        }
+    }
+    rewind(in);
+    if (id == CODEC_COUNT)
+        return in;
+
+    struct codec* codec = load_codec(id);
+    if (!codec) {
+        fclose(in);
+        errno = ENOTSUP;
+        return NULL;
+    }
+    struct decompressor* d = calloc(1, sizeof(struct decompressor));
+    if (!d) {
+        fclose(in);
+        return NULL;
+    }
+    d->in = in;
+    d->codec = codec;
+    if (id == CODEC_ZSTD) {
+        d->dctx = codec->zstd_create_dstream();
+        if (d->dctx && codec->is_error(codec->zstd_init_dstream(d->dctx))) {
+            codec->zstd_free_dstream(d->dctx);
+            d->dctx = NULL;
+        }
+    }
+    else if (codec->is_error(codec->lz4_create_dctx(&d->dctx, LZ4F_VERSION)))
+        d->dctx = NULL;
+    if (!d->dctx) {
+        fprintf(stderr, "ERROR: Could not start %s decompression of %s\n", codec->name, path);
+        fclose(in);
+        free(d);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    cookie_io_functions_t io = { .read = decompress_read, .close = decompress_close };
+    FILE* stream = fopencookie(d, "rb", io);
+    if (!stream) {
+        decompress_close(d);
+        return NULL;
+    }
+    if (codec_name)
+        *codec_name = codec->name;
+    return stream;
+}
+
+size_t compressed_base_len(const char* path)
+{
+    size_t len = strlen(path);
+    for (int i = 0; i < CODEC_COUNT; i++) {
+        size_t suffix_len = strlen(codecs[i].suffix);
+        if (len > suffix_len && strcmp(path + len - suffix_len, codecs[i].suffix) == 0)
+            return len - suffix_len;
+    }
+    return len;
+}
@@ -0,0 +1,62 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streaming zstd or lz4 compression of dw-pid output, and the matching
+// transparent decompression for the tools that read it. Both libraries are
+// loaded with dlopen, so neither is needed to build, and plain traces read
+// without them. Output is cut into independent frames of frame_size input
+// bytes: a trace whose tracer was killed stays readable up to its last
+// complete frame, and the zstd and lz4 command line tools decompress the
+// concatenated frames as one file.
+
+#define COMPRESSOR_FRAME_KIB 1024
+
+// Where compressed frames go. Returns -1 on failure.
+typedef int (*compressor_sink)(void* ctx, const void* data, size_t len);
+
+struct compressor {
+    const char* name;    // "zstd" or "lz4"
+    int codec;
+    int level;
+    size_t frame_size;   // input bytes per frame
+    void* cctx;
+
+    char* frame;         // input of the frame being filled
+    size_t frame_used;
+    char* out;
+    size_t out_capacity;
+
+    uint64_t in_bytes;
+    uint64_t out_bytes;
+    uint64_t frames;
+    uint64_t cpu_ns;     // CPU time of the compressing thread
+};
+
+// spec is codec[:level[:frame_kib]], codec zstd or lz4, e.g. zstd, lz4:9
+// or zstd:3:4096. Returns -1 with the reason on stderr when the spec is
+// invalid or the library is missing.
+int compressor_open(struct compressor* compressor, const char* spec);
+
+// Buffer data, passing each complete frame to sink.
+int compressor_write(struct compressor* compressor, const void* data, size_t len,
+    compressor_sink sink, void* ctx);
+
+// End the current frame early, e.g. at the end of the output.
+int compressor_flush(struct compressor* compressor, compressor_sink sink, void* ctx);
+
+void compressor_close(struct compressor* compressor);
+
+// fopen(path, "rb") that decompresses zstd and lz4 files on the fly, told
+// apart from plain files by their magic number. *codec is set to the
+// codec name, or NULL for a plain file; a decompressing stream cannot
+// seek. Returns NULL with errno set, ENOTSUP when the library is missing.
+FILE* compressed_fopen(const char* path, const char** codec);
+
+// Length of path without a .zst or .lz4 suffix.
+size_t compressed_base_len(const char* path);
+
+#endif
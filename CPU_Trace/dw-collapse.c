@@ -0,0 +1,679 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "compressor.h"
+#include "sample_weights.h"
+#include "stack_trie.h"
+#include "trace_reader.h"
+
+// Native replacement for the folding done by collapse_report.py. Reads
+// dw-pid CSV output or binary traces and writes <target>_cpu.collapsed
+// (samples per stack) and <target>_joules.collapsed (energy per stack,
+// attributed the same way as the script). Callchains are folded into a
+// trie of interned frames; several inputs are processed in parallel, one
+// file per thread.
+
+// Callchains of one interval: the trie node each stack ends at, and its tag.
+struct interval_samples {
+    uint32_t* nodes;
+    struct chain_tag* tags;
+    double* weights;
+    size_t count;
+    size_t capacity;
+};
+
+struct collapse_job {
+    const char* input;
+    const char* output_dir; // NULL for ./Result/<target>
+    int scinot;
+    struct stack_trie trie;
+    struct interval_samples samples;
+    struct interval_samples held; // first CSV row, until its duration is known
+    uint64_t lost_samples;
+    uint64_t throttled;
+    double total_energy;
+    double total_duration;
+    double unattributed_energy;
+    int status;
+};
+
+static int samples_push(struct interval_samples* samples, uint32_t node, const struct chain_tag* tag)
+{
+    if (samples->count == samples->capacity) {
+        size_t capacity = samples->capacity ? samples->capacity * 2 : 256;
+        uint32_t* nodes = realloc(samples->nodes, capacity * sizeof(uint32_t));
+        if (nodes)
+            samples->nodes = nodes;
+        struct chain_tag* tags = realloc(samples->tags, capacity * sizeof(struct chain_tag));
+        if (tags)
+            samples->tags = tags;
+        double* weights = realloc(samples->weights, capacity * sizeof(double));
+        if (weights)
+            samples->weights = weights;
+        if (!nodes || !tags || !weights)
+            return -1;
+        samples->capacity = capacity;
+    }
+    samples->nodes[samples->count] = node;
+    samples->tags[samples->count] = *tag;
+    samples->count++;
+    return 0;
+}
+
+static void samples_free(struct interval_samples* samples)
+{
+    free(samples->nodes);
+    free(samples->tags);
+    free(samples->weights);
+    memset(samples, 0, sizeof(*samples));
+}
+
+// Integrate one interval's effective power and hand the energy to its samples.
+static void fold_interval(struct collapse_job* job, struct interval_samples* samples, double power,
+    double usage, double gpu_power, double duration, double end_time)
+{
+    double energy = ((usage / 100.0) * power + gpu_power) * duration;
+    job->total_energy += energy;
+    job->total_duration += duration;
+
+    if (samples->count == 0) {
+        job->unattributed_energy += energy;
+        return;
+    }
+
+    sample_weights(samples->tags, samples->count, (uint64_t)((end_time - duration) * 1e9), samples->weights);
+    double total_weight = 0;
+    for (size_t i = 0; i < samples->count; i++)
+        total_weight += samples->weights[i];
+
+    for (size_t i = 0; i < samples->count; i++) {
+        struct stack_node* node = &job->trie.nodes[samples->nodes[i]];
+        node->count++;
+        node->value += energy * samples->weights[i] / total_weight;
+    }
+    samples->count = 0;
+}
+
+// "2024-01-02T03:04:05.123456Z" -> seconds since the epoch
+static double parse_timestamp(const char* str)
+{
+    struct tm tm = { 0 };
+    double seconds = 0;
+    while (*str == ' ')
+        str++;
+    if (sscanf(str, "%d-%d-%dT%d:%d:%lf", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+            &tm.tm_hour, &tm.tm_min, &seconds) != 6)
+        return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return (double)timegm(&tm) + seconds;
+}
+
+// "@<ns>/<cpu>/<tid>[/<period>]"
+static void parse_tag(const char* str, size_t len, struct chain_tag* tag)
+{
+    char buffer[96];
+    if (len >= sizeof(buffer))
+        return;
+    memcpy(buffer, str, len);
+    buffer[len] = '\0';
+
+    unsigned long time_ns, period = 0;
+    unsigned int cpu, tid;
+    int fields = sscanf(buffer + 1, "%lu/%u/%u/%lu", &time_ns, &cpu, &tid, &period);
+    if (fields < 3)
+        return;
+    tag->tagged = 1;
+    tag->time_ns = time_ns;
+    tag->cpu = cpu;
+    tag->tid = tid;
+    tag->period = fields > 3 ? period : 0;
+}
+
+struct frame_span {
+    const char* str;
+    size_t len;
+};
+
+// Frame and stack ids of an interned CSV mapped to the trie, UINT32_MAX
+// where an id has not been defined.
+struct csv_ids {
+    uint32_t* frames;
+    size_t frames_capacity;
+    uint32_t* stacks;  // stack 0 is the empty stack, the root
+    size_t stacks_capacity;
+};
+
+static int csv_ids_set(uint32_t** ids, size_t* capacity, unsigned long id, uint32_t value)
+{
+    if (id >= *capacity) {
+        size_t grown_capacity = *capacity ? *capacity : 1024;
+        while (grown_capacity <= id)
+            grown_capacity *= 2;
+        uint32_t* grown = realloc(*ids, grown_capacity * sizeof(uint32_t));
+        if (!grown)
+            return -1;
+        memset(grown + *capacity, 0xff, (grown_capacity - *capacity) * sizeof(uint32_t));
+        *ids = grown;
+        *capacity = grown_capacity;
+    }
+    (*ids)[id] = value;
+    return 0;
+}
+
+static uint32_t csv_ids_get(const uint32_t* ids, size_t capacity, unsigned long id)
+{
+    return id < capacity ? ids[id] : UINT32_MAX;
+}
+
+// "#frame,<id>,<name>" or "#stack,<id>,<parent>,<frame>"
+static int add_csv_definition(struct collapse_job* job, struct csv_ids* ids, char* line, size_t len)
+{
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        line[--len] = '\0';
+
+    char* p;
+    if (strncmp(line, TRACE_CSV_FRAME ",", sizeof(TRACE_CSV_FRAME)) == 0) {
+        unsigned long id = strtoul(line + sizeof(TRACE_CSV_FRAME), &p, 10);
+        if (*p != ',')
+            return 0;
+        p++;
+        uint32_t frame = stack_trie_frame(&job->trie, p, line + len - p);
+        if (frame == UINT32_MAX || csv_ids_set(&ids->frames, &ids->frames_capacity, id, frame) != 0)
+            return -1;
+    }
+    else if (strncmp(line, TRACE_CSV_STACK ",", sizeof(TRACE_CSV_STACK)) == 0) {
+        unsigned long id = strtoul(line + sizeof(TRACE_CSV_STACK), &p, 10);
+        unsigned long parent_id = strtoul(p + 1, &p, 10);
+        unsigned long frame_id = strtoul(p + 1, &p, 10);
+        uint32_t parent = parent_id ? csv_ids_get(ids->stacks, ids->stacks_capacity, parent_id) : STACK_TRIE_ROOT;
+        uint32_t frame = csv_ids_get(ids->frames, ids->frames_capacity, frame_id);
+        if (parent == UINT32_MAX || frame == UINT32_MAX) {
+            fprintf(stderr, "WARNING: %s: stack %lu refers to an undefined stack or frame\n", job->input, id);
+            return 0;
+        }
+        uint32_t node = stack_trie_child(&job->trie, parent, frame);
+        if (node == UINT32_MAX || csv_ids_set(&ids->stacks, &ids->stacks_capacity, id, node) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// One "@tag;leaf;...;root;" or "@tag;$<stack id>;" callchain into the trie.
+static int add_csv_chain(struct collapse_job* job, struct interval_samples* samples, const struct csv_ids* ids,
+    const char* chain, size_t len, struct frame_span** spans, size_t* spans_capacity)
+{
+    while (len && (*chain == ' ' || *chain == '\t' || *chain == '\r' || *chain == '\n')) {
+        chain++;
+        len--;
+    }
+    while (len && (chain[len - 1] == ' ' || chain[len - 1] == '\t' || chain[len - 1] == '\r' || chain[len - 1] == '\n'))
+        len--;
+
+    // Every frame is terminated by ';', anything after the last one is dropped
+    size_t nspans = 0;
+    const char* start = chain;
+    const char* end = chain + len;
+    for (const char* p = chain; p < end; p++) {
+        if (*p != ';')
+            continue;
+        if (nspans == *spans_capacity) {
+            size_t capacity = *spans_capacity ? *spans_capacity * 2 : 128;
+            struct frame_span* grown = realloc(*spans, capacity * sizeof(struct frame_span));
+            if (!grown)
+                return -1;
+            *spans = grown;
+            *spans_capacity = capacity;
+        }
+        (*spans)[nspans].str = start;
+        (*spans)[nspans].len = p - start;
+        nspans++;
+        start = p + 1;
+    }
+
+    struct chain_tag tag = { 0 };
+    size_t first = 0;
+    if (nspans && (*spans)[0].len && (*spans)[0].str[0] == '@') {
+        parse_tag((*spans)[0].str, (*spans)[0].len, &tag);
+        first = 1;
+    }
+
+    // Interned stacks are already in the trie
+    if (nspans == first + 1 && (*spans)[first].len > 1 && (*spans)[first].str[0] == TRACE_CSV_STACK_REF) {
+        unsigned long id = strtoul((*spans)[first].str + 1, NULL, 10);
+        uint32_t node = id ? csv_ids_get(ids->stacks, ids->stacks_capacity, id) : STACK_TRIE_ROOT;
+        if (node != UINT32_MAX)
+            return samples_push(samples, node, &tag);
+    }
+
+    uint32_t node = STACK_TRIE_ROOT;
+    for (size_t i = nspans; i-- > first;) {
+        uint32_t frame = stack_trie_frame(&job->trie, (*spans)[i].str, (*spans)[i].len);
+        if (frame == UINT32_MAX)
+            return -1;
+        node = stack_trie_child(&job->trie, node, frame);
+        if (node == UINT32_MAX)
+            return -1;
+    }
+    return samples_push(samples, node, &tag);
+}
+
+static int collapse_csv(struct collapse_job* job, FILE* in)
+{
+    char* line = NULL;
+    size_t line_size = 0;
+    struct frame_span* spans = NULL;
+    size_t spans_capacity = 0;
+    struct csv_ids ids = { 0 };
+    int ret = 0;
+
+    // Values of the held first row
+    double held_power = 0, held_usage = 0, held_gpu = 0, held_time = 0;
+    int holding = 0;
+    double prev_time = -1;
+
+    // Header row
+    if (getline(&line, &line_size, in) < 0) {
+        free(line);
+        return 0;
+    }
+
+    ssize_t len;
+    while ((len = getline(&line, &line_size, in)) > 0) {
+        if (line[0] == '#') {
+            if (add_csv_definition(job, &ids, line, len) != 0) {
+                fprintf(stderr, "ERROR: Memory allocation failed while folding %s\n", job->input);
+                ret = -1;
+                goto out;
+            }
+            continue;
+        }
+
+        // timestamp, callchains, power, usage, gpu_power[, lost, throttled[, duration]]
+        char* fields[8];
+        size_t nfields = 0;
+        char* p = line;
+        fields[nfields++] = p;
+        while ((p = strchr(p, ',')) != NULL && nfields < 8) {
+            *p++ = '\0';
+            fields[nfields++] = p;
+        }
+        if (nfields < 5)
+            continue;
+
+        double time = parse_timestamp(fields[0]);
+        if (time < 0)
+            continue;
+        double power = strtod(fields[2], NULL);
+        double usage = strtod(fields[3], NULL);
+        double gpu_power = strtod(fields[4], NULL);
+        if (nfields > 5)
+            job->lost_samples += strtoul(fields[5], NULL, 10);
+        if (nfields > 6)
+            job->throttled += strtoul(fields[6], NULL, 10);
+        int has_duration = nfields > 7;
+        double duration = has_duration ? strtod(fields[7], NULL) : 0;
+
+        // Older CSVs have no duration column: use the gap to the previous
+        // row, and hold the first row back to borrow the gap to the second
+        int hold = 0;
+        if (!has_duration) {
+            if (prev_time >= 0)
+                duration = time > prev_time ? time - prev_time : 0;
+            else
+                hold = 1;
+        }
+        struct interval_samples* samples = hold ? &job->held : &job->samples;
+
+        char* chains = fields[1];
+        char* bar;
+        while ((bar = strchr(chains, '|')) != NULL) {
+            if (add_csv_chain(job, samples, &ids, chains, bar - chains, &spans, &spans_capacity) != 0) {
+                fprintf(stderr, "ERROR: Memory allocation failed while folding %s\n", job->input);
+                ret = -1;
+                goto out;
+            }
+            chains = bar + 1;
+        }
+
+        if (hold) {
+            holding = 1;
+            held_power = power;
+            held_usage = usage;
+            held_gpu = gpu_power;
+            held_time = time;
+        }
+        else {
+            if (holding) {
+                fold_interval(job, &job->held, held_power, held_usage, held_gpu, duration, held_time);
+                holding = 0;
+            }
+            fold_interval(job, samples, power, usage, gpu_power, duration, time);
+        }
+        prev_time = time;
+    }
+    if (holding)
+        fold_interval(job, &job->held, held_power, held_usage, held_gpu, 0, held_time);
+    if (ferror(in))
+        ret = -1;
+
+out:
+    free(ids.frames);
+    free(ids.stacks);
+    free(spans);
+    free(line);
+    return ret;
+}
+
+static int collapse_trace(struct collapse_job* job)
+{
+    struct trace_reader reader;
+    if (trace_reader_open(&reader, job->input) != 0)
+        return -1;
+
+    // string id -> frame id, interned on first use
+    uint32_t* symbol_frames = NULL;
+    size_t symbol_frames_capacity = 0;
+
+    struct trace_record record;
+    int ret;
+    while ((ret = trace_reader_next(&reader, &record)) > 0) {
+        if (record.type == TRACE_RECORD_INTERVAL) {
+            const struct trace_interval* interval = record.interval;
+            job->lost_samples += interval->lost_samples;
+            job->throttled += interval->throttled;
+            fold_interval(job, &job->samples, interval->power, interval->usage, interval->gpu_power,
+                interval->duration_ns / 1e9, interval->timestamp_ns / 1e9);
+            continue;
+        }
+        if (record.type != TRACE_RECORD_SAMPLE)
+            continue;
+
+        const struct trace_sample* sample = record.sample;
+        uint32_t node = STACK_TRIE_ROOT;
+        for (uint32_t i = sample->nr; i-- > 0 && node != UINT32_MAX;) {
+            uint32_t id = record.symbols[i];
+            uint32_t frame = UINT32_MAX;
+            if (id && id < symbol_frames_capacity && symbol_frames[id])
+                frame = symbol_frames[id] - 1;
+            else if (id && trace_reader_string(&reader, id)) {
+                const char* symbol = trace_reader_string(&reader, id);
+                frame = stack_trie_frame(&job->trie, symbol, strlen(symbol));
+                if (id >= symbol_frames_capacity) {
+                    size_t capacity = symbol_frames_capacity ? symbol_frames_capacity : 1024;
+                    while (capacity <= id)
+                        capacity *= 2;
+                    uint32_t* grown = realloc(symbol_frames, capacity * sizeof(uint32_t));
+                    if (grown) {
+                        memset(grown + symbol_frames_capacity, 0, (capacity - symbol_frames_capacity) * sizeof(uint32_t));
+                        symbol_frames = grown;
+                        symbol_frames_capacity = capacity;
+                    }
+                }
+                if (frame != UINT32_MAX && id < symbol_frames_capacity)
+                    symbol_frames[id] = frame + 1;
+            }
+            else {
+                char hex[20];
+                int len = snprintf(hex, sizeof(hex), "0x%lx", record.ips[i]);
+                frame = stack_trie_frame(&job->trie, hex, len);
+            }
+            node = frame == UINT32_MAX ? UINT32_MAX : stack_trie_child(&job->trie, node, frame);
+        }
+
+        struct chain_tag tag = { 0 };
+        if (sample->time_ns) {
+            tag.tagged = 1;
+            tag.time_ns = sample->time_ns;
+            tag.cpu = sample->cpu;
+            tag.tid = sample->tid;
+            tag.period = sample->period;
+        }
+        if (node == UINT32_MAX || samples_push(&job->samples, node, &tag) != 0) {
+            fprintf(stderr, "ERROR: Memory allocation failed while folding %s\n", job->input);
+            ret = -1;
+            break;
+        }
+    }
+
+    free(symbol_frames);
+    trace_reader_close(&reader);
+    return ret < 0 ? -1 : 0;
+}
+
+struct collapsed_output {
+    FILE* out;
+    const char* target;
+    int joules;
+    double scale;
+};
+
+static int write_stack(const struct stack_trie* trie, const uint32_t* frames, size_t depth,
+    const struct stack_node* node, void* ctx)
+{
+    struct collapsed_output* output = ctx;
+    fputs(output->target, output->out);
+    if (depth == 0)
+        fputc(';', output->out);
+    for (size_t i = 0; i < depth; i++) {
+        fputc(';', output->out);
+        fputs(stack_trie_frame_name(trie, frames[i]), output->out);
+    }
+    if (output->joules)
+        fprintf(output->out, " %.6f\n", node->value * output->scale);
+    else
+        fprintf(output->out, " %lu\n", node->count);
+    return ferror(output->out) ? -1 : 0;
+}
+
+static int write_collapsed(struct collapse_job* job, const char* dir, const char* target, const char* suffix, int joules)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s_%s.collapsed", dir, target, suffix);
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        return -1;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    struct collapsed_output output = { .out = out, .target = target, .joules = joules, .scale = 1.0 };
+    for (int i = 0; i < job->scinot; i++)
+        output.scale *= 10;
+    for (int i = 0; i > job->scinot; i--)
+        output.scale /= 10;
+
+    int ret = stack_trie_walk(&job->trie, write_stack, &output);
+    if (fclose(out) != 0)
+        ret = -1;
+    if (ret != 0)
+        fprintf(stderr, "ERROR: could not write %s\n", path);
+    return ret;
+}
+
+static int make_dirs(const char* path)
+{
+    char buffer[4096];
+    snprintf(buffer, sizeof(buffer), "%s", path);
+    for (char* p = buffer + 1; *p; p++) {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        if (mkdir(buffer, 0755) != 0 && errno != EEXIST)
+            return -1;
+        *p = '/';
+    }
+    return mkdir(buffer, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+static void run_job(struct collapse_job* job)
+{
+    job->status = -1;
+    if (stack_trie_init(&job->trie) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed for %s\n", job->input);
+        return;
+    }
+
+    // zstd and lz4 files are decompressed on the fly. Such a stream cannot
+    // rewind, so the CSV is opened again after looking at the magic.
+    FILE* in = compressed_fopen(job->input, NULL);
+    if (!in) {
+        perror(job->input);
+        return;
+    }
+    char magic[sizeof(TRACE_MAGIC)] = { 0 };
+    int binary = fread(magic, 1, sizeof(magic), in) == sizeof(magic) && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+    fclose(in);
+
+    int ret;
+    if (binary)
+        ret = collapse_trace(job);
+    else {
+        in = compressed_fopen(job->input, NULL);
+        if (!in) {
+            perror(job->input);
+            return;
+        }
+        setvbuf(in, NULL, _IOFBF, 1 << 20);
+        ret = collapse_csv(job, in);
+        fclose(in);
+    }
+    if (ret != 0)
+        return;
+
+    // Target name as collapse_report.py derives it: the file name without
+    // its compression suffix and extension
+    const char* base = strrchr(job->input, '/');
+    base = base ? base + 1 : job->input;
+    char target[1024];
+    snprintf(target, sizeof(target), "%.*s", (int)compressed_base_len(base), base);
+    char* dot = strrchr(target, '.');
+    if (dot && dot != target)
+        *dot = '\0';
+
+    char dir[4096];
+    if (job->output_dir)
+        snprintf(dir, sizeof(dir), "%s", job->output_dir);
+    else
+        snprintf(dir, sizeof(dir), "./Result/%s", target);
+    if (make_dirs(dir) != 0) {
+        perror(dir);
+        return;
+    }
+
+    if (write_collapsed(job, dir, target, "cpu", 0) != 0 || write_collapsed(job, dir, target, "joules", 1) != 0)
+        return;
+    job->status = 0;
+}
+
+struct job_queue {
+    struct collapse_job* jobs;
+    size_t count;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+static void* worker(void* arg)
+{
+    struct job_queue* queue = arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t i = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (i >= queue->count)
+            return NULL;
+
+        struct collapse_job* job = &queue->jobs[i];
+        run_job(job);
+        // The trie is only needed until the files are written
+        stack_trie_free(&job->trie);
+        samples_free(&job->samples);
+        samples_free(&job->held);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* output_dir = NULL;
+    int scinot = 0;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:j:o:")) != -1) {
+        switch (opt) {
+        case 'e':
+            scinot = atoi(optarg);
+            break;
+        case 'j':
+            threads = atol(optarg);
+            break;
+        case 'o':
+            output_dir = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind >= argc) {
+usage:
+        fprintf(stderr, "Usage: %s [-e scinot] [-j threads] [-o dir] <trace.csv|trace.bin>...\n", *argv);
+        fprintf(stderr, "  -e N     multiply energy by 10^N (6 gives microjoules)\n");
+        fprintf(stderr, "  -j N     files folded in parallel (default: online CPUs)\n");
+        fprintf(stderr, "  -o DIR   output directory (default ./Result/<target>)\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct job_queue queue = { .count = argc - optind };
+    pthread_mutex_init(&queue.lock, NULL);
+    queue.jobs = calloc(queue.count, sizeof(struct collapse_job));
+    if (!queue.jobs) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < queue.count; i++) {
+        queue.jobs[i].input = argv[optind + i];
+        queue.jobs[i].output_dir = output_dir;
+        queue.jobs[i].scinot = scinot;
+    }
+
+    if (threads < 1)
+        threads = 1;
+    if ((size_t)threads > queue.count)
+        threads = queue.count;
+    pthread_t* workers = calloc(threads, sizeof(pthread_t));
+    long started = 0;
+    for (; workers && started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, worker, &queue) != 0)
+            break;
+    }
+    // Fall back to this thread when none could be started
+    if (started == 0)
+        worker(&queue);
+    for (long i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    int failed = 0;
+    for (size_t i = 0; i < queue.count; i++) {
+        struct collapse_job* job = &queue.jobs[i];
+        if (job->status != 0) {
+            failed = 1;
+            continue;
+        }
+        if (job->lost_samples || job->throttled)
+            fprintf(stderr, "%s: warning: %lu samples lost, %lu throttle events; consider a larger dw-pid ring buffer (-p)\n",
+                job->input, job->lost_samples, job->throttled);
+        fprintf(stderr, "%s: %.6f J over %.3f s, %.6f J in intervals without samples\n",
+            job->input, job->total_energy, job->total_duration, job->unattributed_energy);
+    }
+
+    pthread_mutex_destroy(&queue.lock);
+    free(queue.jobs);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
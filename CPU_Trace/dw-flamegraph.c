@@ -0,0 +1,1693 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include "stack_trie.h"
+
+// Flame graph SVGs from collapsed stacks, a native flamegraph.pl. It takes
+// the same options and writes the same SVG: frame positions, colors and the
+// zoom and search script match, so either can render the .collapsed files
+// of collapse_report.py and dw-collapse, and differential "stack before
+// after" lines as written by collapse_diff.py. Stacks are merged into a stack_trie
+// while the input is read instead of sorting every line first, and the tree
+// is then cut into subtrees that are laid out and rendered on separate
+// threads, one buffer each, written out in order.
+
+#define XPAD 10     // left and right
+#define FRAMEPAD 1  // between frames
+
+// flamegraph.pl's stylesheet and script, with its bgcolor1, bgcolor2,
+// fonttype, fontsize, titlesize, nametype, fontsize, fontwidth and inverted
+static const char svg_script[] =
+    "<defs>\n"
+    "\t<linearGradient id=\"background\" y1=\"0\" y2=\"1\" x1=\"0\" x2=\"0\" >\n"
+    "\t\t<stop stop-color=\"%s\" offset=\"5%%\" />\n"
+    "\t\t<stop stop-color=\"%s\" offset=\"95%%\" />\n"
+    "\t</linearGradient>\n"
+    "</defs>\n"
+    "<style type=\"text/css\">\n"
+    "\ttext { font-family:%s; font-size:%spx; fill:rgb(0,0,0); }\n"
+    "\t#search, #ignorecase { opacity:0.1; cursor:pointer; }\n"
+    "\t#search:hover, #search.show, #ignorecase:hover, #ignorecase.show { opacity:1; }\n"
+    "\t#subtitle { text-anchor:middle; font-color:rgb(160,160,160); }\n"
+    "\t#title { text-anchor:middle; font-size:%spx}\n"
+    "\t#unzoom { cursor:pointer; }\n"
+    "\t#frames > *:hover { stroke:black; stroke-width:0.5; cursor:pointer; }\n"
+    "\t.hide { display:none; }\n"
+    "\t.parent { opacity:0.5; }\n"
+    "</style>\n"
+    "<script type=\"text/ecmascript\">\n"
+    "<![CDATA[\n"
+    "\t\"use strict\";\n"
+    "\tvar details, searchbtn, unzoombtn, matchedtxt, svg, searching, currentSearchTerm, ignorecase, ignorecaseBtn;\n"
+    "\tfunction init(evt) {\n"
+    "\t\tdetails = document.getElementById(\"details\").firstChild;\n"
+    "\t\tsearchbtn = document.getElementById(\"search\");\n"
+    "\t\tignorecaseBtn = document.getElementById(\"ignorecase\");\n"
+    "\t\tunzoombtn = document.getElementById(\"unzoom\");\n"
+    "\t\tmatchedtxt = document.getElementById(\"matched\");\n"
+    "\t\tsvg = document.getElementsByTagName(\"svg\")[0];\n"
+    "\t\tsearching = 0;\n"
+    "\t\tcurrentSearchTerm = null;\n"
+    "\n"
+    "\t\t// use GET parameters to restore a flamegraphs state.\n"
+    "\t\tvar params = get_params();\n"
+    "\t\tif (params.x && params.y)\n"
+    "\t\t\tzoom(find_group(document.querySelector('[x=\"' + params.x + '\"][y=\"' + params.y + '\"]')));\n"
+    "                if (params.s) search(params.s);\n"
+    "\t}\n"
+    "\n"
+    "\t// event listeners\n"
+    "\twindow.addEventListener(\"click\", function(e) {\n"
+    "\t\tvar target = find_group(e.target);\n"
+    "\t\tif (target) {\n"
+    "\t\t\tif (target.nodeName == \"a\") {\n"
+    "\t\t\t\tif (e.ctrlKey === false) return;\n"
+    "\t\t\t\te.preventDefault();\n"
+    "\t\t\t}\n"
+    "\t\t\tif (target.classList.contains(\"parent\")) unzoom(true);\n"
+    "\t\t\tzoom(target);\n"
+    "\t\t\tif (!document.querySelector('.parent')) {\n"
+    "\t\t\t\t// we have basically done a clearzoom so clear the url\n"
+    "\t\t\t\tvar params = get_params();\n"
+    "\t\t\t\tif (params.x) delete params.x;\n"
+    "\t\t\t\tif (params.y) delete params.y;\n"
+    "\t\t\t\thistory.replaceState(null, null, parse_params(params));\n"
+    "\t\t\t\tunzoombtn.classList.add(\"hide\");\n"
+    "\t\t\t\treturn;\n"
+    "\t\t\t}\n"
+    "\n"
+    "\t\t\t// set parameters for zoom state\n"
+    "\t\t\tvar el = target.querySelector(\"rect\");\n"
+    "\t\t\tif (el && el.attributes && el.attributes.y && el.attributes._orig_x) {\n"
+    "\t\t\t\tvar params = get_params()\n"
+    "\t\t\t\tparams.x = el.attributes._orig_x.value;\n"
+    "\t\t\t\tparams.y = el.attributes.y.value;\n"
+    "\t\t\t\thistory.replaceState(null, null, parse_params(params));\n"
+    "\t\t\t}\n"
+    "\t\t}\n"
+    "\t\telse if (e.target.id == \"unzoom\") clearzoom();\n"
+    "\t\telse if (e.target.id == \"search\") search_prompt();\n"
+    "\t\telse if (e.target.id == \"ignorecase\") toggle_ignorecase();\n"
+    "\t}, false)\n"
+    "\n"
+    "\t// mouse-over for info\n"
+    "\t// show\n"
+    "\twindow.addEventListener(\"mouseover\", function(e) {\n"
+    "\t\tvar target = find_group(e.target);\n"
+    "\t\tif (target) details.nodeValue = \"%s \" + g_to_text(target);\n"
+    "\t}, false)\n"
+    "\n"
+    "\t// clear\n"
+    "\twindow.addEventListener(\"mouseout\", function(e) {\n"
+    "\t\tvar target = find_group(e.target);\n"
+    "\t\tif (target) details.nodeValue = ' ';\n"
+    "\t}, false)\n"
+    "\n"
+    "\t// ctrl-F for search\n"
+    "\t// ctrl-I to toggle case-sensitive search\n"
+    "\twindow.addEventListener(\"keydown\",function (e) {\n"
+    "\t\tif (e.keyCode === 114 || (e.ctrlKey && e.keyCode === 70)) {\n"
+    "\t\t\te.preventDefault();\n"
+    "\t\t\tsearch_prompt();\n"
+    "\t\t}\n"
+    "\t\telse if (e.ctrlKey && e.keyCode === 73) {\n"
+    "\t\t\te.preventDefault();\n"
+    "\t\t\ttoggle_ignorecase();\n"
+    "\t\t}\n"
+    "\t}, false)\n"
+    "\n"
+    "\t// functions\n"
+    "\tfunction get_params() {\n"
+    "\t\tvar params = {};\n"
+    "\t\tvar paramsarr = window.location.search.substr(1).split('&');\n"
+    "\t\tfor (var i = 0; i < paramsarr.length; ++i) {\n"
+    "\t\t\tvar tmp = paramsarr[i].split(\"=\");\n"
+    "\t\t\tif (!tmp[0] || !tmp[1]) continue;\n"
+    "\t\t\tparams[tmp[0]]  = decodeURIComponent(tmp[1]);\n"
+    "\t\t}\n"
+    "\t\treturn params;\n"
+    "\t}\n"
+    "\tfunction parse_params(params) {\n"
+    "\t\tvar uri = \"?\";\n"
+    "\t\tfor (var key in params) {\n"
+    "\t\t\turi += key + '=' + encodeURIComponent(params[key]) + '&';\n"
+    "\t\t}\n"
+    "\t\tif (uri.slice(-1) == \"&\")\n"
+    "\t\t\turi = uri.substring(0, uri.length - 1);\n"
+    "\t\tif (uri == '?')\n"
+    "\t\t\turi = window.location.href.split('?')[0];\n"
+    "\t\treturn uri;\n"
+    "\t}\n"
+    "\tfunction find_child(node, selector) {\n"
+    "\t\tvar children = node.querySelectorAll(selector);\n"
+    "\t\tif (children.length) return children[0];\n"
+    "\t}\n"
+    "\tfunction find_group(node) {\n"
+    "\t\tvar parent = node.parentElement;\n"
+    "\t\tif (!parent) return;\n"
+    "\t\tif (parent.id == \"frames\") return node;\n"
+    "\t\treturn find_group(parent);\n"
+    "\t}\n"
+    "\tfunction orig_save(e, attr, val) {\n"
+    "\t\tif (e.attributes[\"_orig_\" + attr] != undefined) return;\n"
+    "\t\tif (e.attributes[attr] == undefined) return;\n"
+    "\t\tif (val == undefined) val = e.attributes[attr].value;\n"
+    "\t\te.setAttribute(\"_orig_\" + attr, val);\n"
+    "\t}\n"
+    "\tfunction orig_load(e, attr) {\n"
+    "\t\tif (e.attributes[\"_orig_\"+attr] == undefined) return;\n"
+    "\t\te.attributes[attr].value = e.attributes[\"_orig_\" + attr].value;\n"
+    "\t\te.removeAttribute(\"_orig_\"+attr);\n"
+    "\t}\n"
+    "\tfunction g_to_text(e) {\n"
+    "\t\tvar text = find_child(e, \"title\").firstChild.nodeValue;\n"
+    "\t\treturn (text)\n"
+    "\t}\n"
+    "\tfunction g_to_func(e) {\n"
+    "\t\tvar func = g_to_text(e);\n"
+    "\t\t// if there's any manipulation we want to do to the function\n"
+    "\t\t// name before it's searched, do it here before returning.\n"
+    "\t\treturn (func);\n"
+    "\t}\n"
+    "\tfunction update_text(e) {\n"
+    "\t\tvar r = find_child(e, \"rect\");\n"
+    "\t\tvar t = find_child(e, \"text\");\n"
+    "\t\tvar w = parseFloat(r.attributes.width.value) -3;\n"
+    "\t\tvar txt = find_child(e, \"title\").textContent.replace(/\\([^(]*\\)$/,\"\");\n"
+    "\t\tt.attributes.x.value = parseFloat(r.attributes.x.value) + 3;\n"
+    "\n"
+    "\t\t// Smaller than this size won't fit anything\n"
+    "\t\tif (w < 2 * %s * %s) {\n"
+    "\t\t\tt.textContent = \"\";\n"
+    "\t\t\treturn;\n"
+    "\t\t}\n"
+    "\n"
+    "\t\tt.textContent = txt;\n"
+    "\t\tvar sl = t.getSubStringLength(0, txt.length);\n"
+    "\t\t// check if only whitespace or if we can fit the entire string into width w\n"
+    "\t\tif (/^ *$/.test(txt) || sl < w)\n"
+    "\t\t\treturn;\n"
+    "\n"
+    "\t\t// this isn't perfect, but gives a good starting point\n"
+    "\t\t// and avoids calling getSubStringLength too often\n"
+    "\t\tvar start = Math.floor((w/sl) * txt.length);\n"
+    "\t\tfor (var x = start; x > 0; x = x-2) {\n"
+    "\t\t\tif (t.getSubStringLength(0, x + 2) <= w) {\n"
+    "\t\t\t\tt.textContent = txt.substring(0, x) + \"..\";\n"
+    "\t\t\t\treturn;\n"
+    "\t\t\t}\n"
+    "\t\t}\n"
+    "\t\tt.textContent = \"\";\n"
+    "\t}\n"
+    "\n"
+    "\t// zoom\n"
+    "\tfunction zoom_reset(e) {\n"
+    "\t\tif (e.attributes != undefined) {\n"
+    "\t\t\torig_load(e, \"x\");\n"
+    "\t\t\torig_load(e, \"width\");\n"
+    "\t\t}\n"
+    "\t\tif (e.childNodes == undefined) return;\n"
+    "\t\tfor (var i = 0, c = e.childNodes; i < c.length; i++) {\n"
+    "\t\t\tzoom_reset(c[i]);\n"
+    "\t\t}\n"
+    "\t}\n"
+    "\tfunction zoom_child(e, x, ratio) {\n"
+    "\t\tif (e.attributes != undefined) {\n"
+    "\t\t\tif (e.attributes.x != undefined) {\n"
+    "\t\t\t\torig_save(e, \"x\");\n"
+    "\t\t\t\te.attributes.x.value = (parseFloat(e.attributes.x.value) - x - 10) * ratio + 10;\n"
+    "\t\t\t\tif (e.tagName == \"text\")\n"
+    "\t\t\t\t\te.attributes.x.value = find_child(e.parentNode, \"rect[x]\").attributes.x.value + 3;\n"
+    "\t\t\t}\n"
+    "\t\t\tif (e.attributes.width != undefined) {\n"
+    "\t\t\t\torig_save(e, \"width\");\n"
+    "\t\t\t\te.attributes.width.value = parseFloat(e.attributes.width.value) * ratio;\n"
+    "\t\t\t}\n"
+    "\t\t}\n"
+    "\n"
+    "\t\tif (e.childNodes == undefined) return;\n"
+    "\t\tfor (var i = 0, c = e.childNodes; i < c.length; i++) {\n"
+    "\t\t\tzoom_child(c[i], x - 10, ratio);\n"
+    "\t\t}\n"
+    "\t}\n"
+    "\tfunction zoom_parent(e) {\n"
+    "\t\tif (e.attributes) {\n"
+    "\t\t\tif (e.attributes.x != undefined) {\n"
+    "\t\t\t\torig_save(e, \"x\");\n"
+    "\t\t\t\te.attributes.x.value = 10;\n"
+    "\t\t\t}\n"
+    "\t\t\tif (e.attributes.width != undefined) {\n"
+    "\t\t\t\torig_save(e, \"width\");\n"
+    "\t\t\t\te.attributes.width.value = parseInt(svg.width.baseVal.value) - (10 * 2);\n"
+    "\t\t\t}\n"
+    "\t\t}\n"
+    "\t\tif (e.childNodes == undefined) return;\n"
+    "\t\tfor (var i = 0, c = e.childNodes; i < c.length; i++) {\n"
+    "\t\t\tzoom_parent(c[i]);\n"
+    "\t\t}\n"
+    "\t}\n"
+    "\tfunction zoom(node) {\n"
+    "\t\tvar attr = find_child(node, \"rect\").attributes;\n"
+    "\t\tvar width = parseFloat(attr.width.value);\n"
+    "\t\tvar xmin = parseFloat(attr.x.value);\n"
+    "\t\tvar xmax = parseFloat(xmin + width);\n"
+    "\t\tvar ymin = parseFloat(attr.y.value);\n"
+    "\t\tvar ratio = (svg.width.baseVal.value - 2 * 10) / width;\n"
+    "\n"
+    "\t\t// XXX: Workaround for JavaScript float issues (fix me)\n"
+    "\t\tvar fudge = 0.0001;\n"
+    "\n"
+    "\t\tunzoombtn.classList.remove(\"hide\");\n"
+    "\n"
+    "\t\tvar el = document.getElementById(\"frames\").children;\n"
+    "\t\tfor (var i = 0; i < el.length; i++) {\n"
+    "\t\t\tvar e = el[i];\n"
+    "\t\t\tvar a = find_child(e, \"rect\").attributes;\n"
+    "\t\t\tvar ex = parseFloat(a.x.value);\n"
+    "\t\t\tvar ew = parseFloat(a.width.value);\n"
+    "\t\t\tvar upstack;\n"
+    "\t\t\t// Is it an ancestor\n"
+    "\t\t\tif (%s == 0) {\n"
+    "\t\t\t\tupstack = parseFloat(a.y.value) > ymin;\n"
+    "\t\t\t} else {\n"
+    "\t\t\t\tupstack = parseFloat(a.y.value) < ymin;\n"
+    "\t\t\t}\n"
+    "\t\t\tif (upstack) {\n"
+    "\t\t\t\t// Direct ancestor\n"
+    "\t\t\t\tif (ex <= xmin && (ex+ew+fudge) >= xmax) {\n"
+    "\t\t\t\t\te.classList.add(\"parent\");\n"
+    "\t\t\t\t\tzoom_parent(e);\n"
+    "\t\t\t\t\tupdate_text(e);\n"
+    "\t\t\t\t}\n"
+    "\t\t\t\t// not in current path\n"
+    "\t\t\t\telse\n"
+    "\t\t\t\t\te.classList.add(\"hide\");\n"
+    "\t\t\t}\n"
+    "\t\t\t// Children maybe\n"
+    "\t\t\telse {\n"
+    "\t\t\t\t// no common path\n"
+    "\t\t\t\tif (ex < xmin || ex + fudge >= xmax) {\n"
+    "\t\t\t\t\te.classList.add(\"hide\");\n"
+    "\t\t\t\t}\n"
+    "\t\t\t\telse {\n"
+    "\t\t\t\t\tzoom_child(e, xmin, ratio);\n"
+    "\t\t\t\t\tupdate_text(e);\n"
+    "\t\t\t\t}\n"
+    "\t\t\t}\n"
+    "\t\t}\n"
+    "\t\tsearch();\n"
+    "\t}\n"
+    "\tfunction unzoom(dont_update_text) {\n"
+    "\t\tunzoombtn.classList.add(\"hide\");\n"
+    "\t\tvar el = document.getElementById(\"frames\").children;\n"
+    "\t\tfor(var i = 0; i < el.length; i++) {\n"
+    "\t\t\tel[i].classList.remove(\"parent\");\n"
+    "\t\t\tel[i].classList.remove(\"hide\");\n"
+    "\t\t\tzoom_reset(el[i]);\n"
+    "\t\t\tif(!dont_update_text) update_text(el[i]);\n"
+    "\t\t}\n"
+    "\t\tsearch();\n"
+    "\t}\n"
+    "\tfunction clearzoom() {\n"
+    "\t\tunzoom();\n"
+    "\n"
+    "\t\t// remove zoom state\n"
+    "\t\tvar params = get_params();\n"
+    "\t\tif (params.x) delete params.x;\n"
+    "\t\tif (params.y) delete params.y;\n"
+    "\t\thistory.replaceState(null, null, parse_params(params));\n"
+    "\t}\n"
+    "\n"
+    "\t// search\n"
+    "\tfunction toggle_ignorecase() {\n"
+    "\t\tignorecase = !ignorecase;\n"
+    "\t\tif (ignorecase) {\n"
+    "\t\t\tignorecaseBtn.classList.add(\"show\");\n"
+    "\t\t} else {\n"
+    "\t\t\tignorecaseBtn.classList.remove(\"show\");\n"
+    "\t\t}\n"
+    "\t\treset_search();\n"
+    "\t\tsearch();\n"
+    "\t}\n"
+    "\tfunction reset_search() {\n"
+    "\t\tvar el = document.querySelectorAll(\"#frames rect\");\n"
+    "\t\tfor (var i = 0; i < el.length; i++) {\n"
+    "\t\t\torig_load(el[i], \"fill\")\n"
+    "\t\t}\n"
+    "\t\tvar params = get_params();\n"
+    "\t\tdelete params.s;\n"
+    "\t\thistory.replaceState(null, null, parse_params(params));\n"
+    "\t}\n"
+    "\tfunction search_prompt() {\n"
+    "\t\tif (!searching) {\n"
+    "\t\t\tvar term = prompt(\"Enter a search term (regexp \" +\n"
+    "\t\t\t    \"allowed, eg: ^ext4_)\"\n"
+    "\t\t\t    + (ignorecase ? \", ignoring case\" : \"\")\n"
+    "\t\t\t    + \"\\nPress Ctrl-i to toggle case sensitivity\", \"\");\n"
+    "\t\t\tif (term != null) search(term);\n"
+    "\t\t} else {\n"
+    "\t\t\treset_search();\n"
+    "\t\t\tsearching = 0;\n"
+    "\t\t\tcurrentSearchTerm = null;\n"
+    "\t\t\tsearchbtn.classList.remove(\"show\");\n"
+    "\t\t\tsearchbtn.firstChild.nodeValue = \"Search\"\n"
+    "\t\t\tmatchedtxt.classList.add(\"hide\");\n"
+    "\t\t\tmatchedtxt.firstChild.nodeValue = \"\"\n"
+    "\t\t}\n"
+    "\t}\n"
+    "\tfunction search(term) {\n"
+    "\t\tif (term) currentSearchTerm = term;\n"
+    "\n"
+    "\t\tvar re = new RegExp(currentSearchTerm, ignorecase ? 'i' : '');\n"
+    "\t\tvar el = document.getElementById(\"frames\").children;\n"
+    "\t\tvar matches = new Object();\n"
+    "\t\tvar maxwidth = 0;\n"
+    "\t\tfor (var i = 0; i < el.length; i++) {\n"
+    "\t\t\tvar e = el[i];\n"
+    "\t\t\tvar func = g_to_func(e);\n"
+    "\t\t\tvar rect = find_child(e, \"rect\");\n"
+    "\t\t\tif (func == null || rect == null)\n"
+    "\t\t\t\tcontinue;\n"
+    "\n"
+    "\t\t\t// Save max width. Only works as we have a root frame\n"
+    "\t\t\tvar w = parseFloat(rect.attributes.width.value);\n"
+    "\t\t\tif (w > maxwidth)\n"
+    "\t\t\t\tmaxwidth = w;\n"
+    "\n"
+    "\t\t\tif (func.match(re)) {\n"
+    "\t\t\t\t// highlight\n"
+    "\t\t\t\tvar x = parseFloat(rect.attributes.x.value);\n"
+    "\t\t\t\torig_save(rect, \"fill\");\n"
+    "\t\t\t\trect.attributes.fill.value = \"rgb(230,0,230)\";\n"
+    "\n"
+    "\t\t\t\t// remember matches\n"
+    "\t\t\t\tif (matches[x] == undefined) {\n"
+    "\t\t\t\t\tmatches[x] = w;\n"
+    "\t\t\t\t} else {\n"
+    "\t\t\t\t\tif (w > matches[x]) {\n"
+    "\t\t\t\t\t\t// overwrite with parent\n"
+    "\t\t\t\t\t\tmatches[x] = w;\n"
+    "\t\t\t\t\t}\n"
+    "\t\t\t\t}\n"
+    "\t\t\t\tsearching = 1;\n"
+    "\t\t\t}\n"
+    "\t\t}\n"
+    "\t\tif (!searching)\n"
+    "\t\t\treturn;\n"
+    "\t\tvar params = get_params();\n"
+    "\t\tparams.s = currentSearchTerm;\n"
+    "\t\thistory.replaceState(null, null, parse_params(params));\n"
+    "\n"
+    "\t\tsearchbtn.classList.add(\"show\");\n"
+    "\t\tsearchbtn.firstChild.nodeValue = \"Reset Search\";\n"
+    "\n"
+    "\t\t// calculate percent matched, excluding vertical overlap\n"
+    "\t\tvar count = 0;\n"
+    "\t\tvar lastx = -1;\n"
+    "\t\tvar lastw = 0;\n"
+    "\t\tvar keys = Array();\n"
+    "\t\tfor (k in matches) {\n"
+    "\t\t\tif (matches.hasOwnProperty(k))\n"
+    "\t\t\t\tkeys.push(k);\n"
+    "\t\t}\n"
+    "\t\t// sort the matched frames by their x location\n"
+    "\t\t// ascending, then width descending\n"
+    "\t\tkeys.sort(function(a, b){\n"
+    "\t\t\treturn a - b;\n"
+    "\t\t});\n"
+    "\t\t// Step through frames saving only the biggest bottom-up frames\n"
+    "\t\t// thanks to the sort order. This relies on the tree property\n"
+    "\t\t// where children are always smaller than their parents.\n"
+    "\t\tvar fudge = 0.0001;\t// JavaScript floating point\n"
+    "\t\tfor (var k in keys) {\n"
+    "\t\t\tvar x = parseFloat(keys[k]);\n"
+    "\t\t\tvar w = matches[keys[k]];\n"
+    "\t\t\tif (x >= lastx + lastw - fudge) {\n"
+    "\t\t\t\tcount += w;\n"
+    "\t\t\t\tlastx = x;\n"
+    "\t\t\t\tlastw = w;\n"
+    "\t\t\t}\n"
+    "\t\t}\n"
+    "\t\t// display matched percent\n"
+    "\t\tmatchedtxt.classList.remove(\"hide\");\n"
+    "\t\tvar pct = 100 * count / maxwidth;\n"
+    "\t\tif (pct != 100) pct = pct.toFixed(1)\n"
+    "\t\tmatchedtxt.firstChild.nodeValue = \"Matched: \" + pct + \"%%\";\n"
+    "\t}\n"
+    "]]>\n"
+    "</script>\n";
+
+enum palette {
+    PALETTE_HOT,
+    PALETTE_MEM,
+    PALETTE_IO,
+    PALETTE_WAKEUP,
+    PALETTE_CHAIN,
+    PALETTE_JAVA,
+    PALETTE_JS,
+    PALETTE_PERL,
+    PALETTE_RED,
+    PALETTE_GREEN,
+    PALETTE_BLUE,
+    PALETTE_AQUA,
+    PALETTE_YELLOW,
+    PALETTE_PURPLE,
+    PALETTE_ORANGE,
+};
+
+static const char* palette_names[] = { "hot", "mem", "io", "wakeup", "chain", "java", "js", "perl",
+    "red", "green", "blue", "aqua", "yellow", "purple", "orange" };
+
+struct options {
+    const char* title;
+    const char* subtitle;
+    const char* fonttype;
+    const char* countname;
+    const char* nametype;
+    const char* notes;
+    const char* encoding;
+    const char* bgcolors;
+    enum palette palette;
+    int imagewidth;
+    int frameheight;
+    double fontsize;
+    double fontwidth;
+    double minwidth;
+    int minwidth_percent;
+    double total;
+    double factor;
+    int hash;
+    int random;
+    int reverse;
+    int inverted;
+    int negate;
+    long threads;
+};
+
+struct svg_buffer {
+    char* data;
+    size_t size;
+    size_t capacity;
+    int failed;
+};
+
+static int svg_reserve(struct svg_buffer* out, size_t len)
+{
+    if (out->size + len <= out->capacity)
+        return 0;
+    size_t capacity = out->capacity ? out->capacity : 65536;
+    while (capacity < out->size + len)
+        capacity *= 2;
+    char* grown = realloc(out->data, capacity);
+    if (!grown) {
+        out->failed = 1;
+        return -1;
+    }
+    out->data = grown;
+    out->capacity = capacity;
+    return 0;
+}
+
+static void svg_append(struct svg_buffer* out, const char* str, size_t len)
+{
+    if (svg_reserve(out, len) != 0)
+        return;
+    memcpy(out->data + out->size, str, len);
+    out->size += len;
+}
+
+static void svg_printf(struct svg_buffer* out, const char* fmt, ...)
+{
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        size_t room = out->capacity - out->size;
+        int n = vsnprintf(out->data ? out->data + out->size : NULL, room, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            out->failed = 1;
+            return;
+        }
+        if ((size_t)n < room) {
+            out->size += n;
+            return;
+        }
+        if (svg_reserve(out, n + 1) != 0)
+            return;
+    }
+}
+
+// Text for SVG, with quotes escaped too inside attributes and titles
+static void svg_escape(struct svg_buffer* out, const char* str, size_t len, int quotes)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        const char* entity;
+        switch (str[i]) {
+        case '&':
+            entity = "&amp;";
+            break;
+        case '<':
+            entity = "&lt;";
+            break;
+        case '>':
+            entity = "&gt;";
+            break;
+        case '"':
+            entity = quotes ? "&quot;" : NULL;
+            break;
+        default:
+            entity = NULL;
+        }
+        if (!entity)
+            continue;
+        svg_append(out, str + start, i - start);
+        svg_append(out, entity, strlen(entity));
+        start = i + 1;
+    }
+    svg_append(out, str + start, len - start);
+}
+
+// Numbers as perl prints them
+static const char* perl_number(char* buf, size_t size, double value)
+{
+    snprintf(buf, size, "%.15g", value);
+    return buf;
+}
+
+// Next character of a UTF-8 string, as perl's :utf8 layer reads it. Bytes
+// that do not start a valid sequence are taken as they are.
+static uint32_t next_char(const unsigned char** p, const unsigned char* end)
+{
+    const unsigned char* s = *p;
+    uint32_t c = *s;
+    size_t len = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1;
+    if (len > (size_t)(end - s))
+        len = 1;
+    for (size_t i = 1; i < len; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            len = 1;
+            break;
+        }
+    }
+    if (len > 1) {
+        c &= 0x3f >> (len - 1);
+        for (size_t i = 1; i < len; i++)
+            c = (c << 6) | (s[i] & 0x3f);
+    }
+    *p = s + len;
+    return c;
+}
+
+static size_t char_count(const char* str, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)str;
+    const unsigned char* end = p + len;
+    size_t count = 0;
+    while (p < end) {
+        next_char(&p, end);
+        count++;
+    }
+    return count;
+}
+
+// Bytes of the first chars characters
+static size_t char_prefix(const char* str, size_t len, size_t chars)
+{
+    const unsigned char* p = (const unsigned char*)str;
+    const unsigned char* end = p + len;
+    while (p < end && chars-- > 0)
+        next_char(&p, end);
+    return p - (const unsigned char*)str;
+}
+
+// Length without a perf-style _[k], _[w], _[i] or _[j] annotation
+static size_t strip_annotation(const char* name, size_t len)
+{
+    if (len >= 4 && name[len - 4] == '_' && name[len - 3] == '[' && name[len - 1] == ']'
+        && strchr("kwij", name[len - 2]))
+        return len - 4;
+    return len;
+}
+
+static int ends_with(const char* name, size_t len, const char* suffix)
+{
+    size_t n = strlen(suffix);
+    return len >= n && memcmp(name + len - n, suffix, n) == 0;
+}
+
+// flamegraph.pl's namehash() for --hash: the first characters after any
+// module prefix ("mod`"), weighted early over late
+static double namehash(const uint32_t* chars, size_t n)
+{
+    size_t start = 0;
+    for (size_t i = 1; i < n; i++) {
+        if (chars[i] == '`') {
+            start = i + 1;
+            break;
+        }
+    }
+    double vector = 0, weight = 1, max = 1;
+    int mod = 10;
+    for (size_t i = start; i < n; i++) {
+        int c = chars[i] % mod;
+        vector += ((double)c / (mod++ - 1)) * weight;
+        max += weight;
+        weight *= 0.70;
+        if (mod > 12)
+            break;
+    }
+    return 1 - vector / max;
+}
+
+// flamegraph.pl's random_namehash(): rand(1) right after srand() with the
+// sum of the name's characters. Perl's rand() is drand48, so this gives the
+// same colors as the Perl version.
+static double random_namehash(const char* name, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)name;
+    const unsigned char* end = p + len;
+    uint32_t sum = 0;
+    while (p < end)
+        sum += next_char(&p, end);
+    uint64_t x = ((uint64_t)sum << 16) + 0x330e;
+    x = (x * 0x5deece66dULL + 0xb) & ((1ULL << 48) - 1);
+    return (double)x / (1ULL << 48);
+}
+
+// Palettes that pick a color by the kind of function
+static enum palette name_palette(enum palette palette, const char* name, size_t len)
+{
+    switch (palette) {
+    case PALETTE_JAVA: {
+        static const char* packages[] = { "java/", "javax/", "jdk/", "net/", "org/", "com/", "io/", "sun/" };
+        const char* package = name[0] == 'L' ? name + 1 : name;
+        int java = 0;
+        for (size_t i = 0; i < sizeof(packages) / sizeof(*packages); i++)
+            java |= strncmp(name, packages[i], strlen(packages[i])) == 0
+                || strncmp(package, packages[i], strlen(packages[i])) == 0;
+        if (ends_with(name, len, "_[j]"))
+            return PALETTE_GREEN;
+        if (ends_with(name, len, "_[i]"))
+            return PALETTE_AQUA;
+        if (java || strstr(name, ":::"))
+            return PALETTE_GREEN;
+        if (strstr(name, "::"))
+            return PALETTE_YELLOW;
+        if (ends_with(name, len, "_[k]"))
+            return PALETTE_ORANGE;
+        return PALETTE_RED;
+    }
+    case PALETTE_PERL:
+        if (strstr(name, "::"))
+            return PALETTE_YELLOW;
+        if (strstr(name, "Perl") || strstr(name, ".pl"))
+            return PALETTE_GREEN;
+        if (ends_with(name, len, "_[k]"))
+            return PALETTE_ORANGE;
+        return PALETTE_RED;
+    case PALETTE_JS: {
+        const char* slash = strchr(name, '/');
+        if (ends_with(name, len, "_[j]"))
+            return slash ? PALETTE_GREEN : PALETTE_AQUA;
+        if (strstr(name, "::"))
+            return PALETTE_YELLOW;
+        if (slash && strstr(slash + 1, ".js"))
+            return PALETTE_GREEN;
+        if (strchr(name, ':'))
+            return PALETTE_AQUA;
+        if (strcmp(name, " ") == 0)
+            return PALETTE_GREEN;
+        if (strstr(name, "_[k]"))
+            return PALETTE_ORANGE;
+        return PALETTE_RED;
+    }
+    case PALETTE_WAKEUP:
+        return PALETTE_AQUA;
+    case PALETTE_CHAIN:
+        return strstr(name, "_[w]") ? PALETTE_AQUA : PALETTE_BLUE;
+    default:
+        return palette;
+    }
+}
+
+// flamegraph.pl's color(). name is NUL terminated.
+static void frame_color(const struct options* opt, const char* name, size_t len, unsigned short seed[3],
+    char* color, size_t size)
+{
+    double v1, v2, v3;
+    if (opt->hash) {
+        uint32_t* chars = calloc(len + 1, sizeof(uint32_t));
+        size_t n = 0;
+        const unsigned char* p = (const unsigned char*)name;
+        while (chars && p < (const unsigned char*)name + len)
+            chars[n++] = next_char(&p, (const unsigned char*)name + len);
+        v1 = chars ? namehash(chars, n) : 0;
+        for (size_t i = 0; chars && i < n / 2; i++) {
+            uint32_t c = chars[i];
+            chars[i] = chars[n - 1 - i];
+            chars[n - 1 - i] = c;
+        }
+        v2 = v3 = chars ? namehash(chars, n) : 0;
+        free(chars);
+    }
+    else if (opt->random) {
+        v1 = erand48(seed);
+        v2 = erand48(seed);
+        v3 = erand48(seed);
+    }
+    else
+        v1 = v2 = v3 = random_namehash(name, len);
+
+    int r = 0, g = 0, b = 0;
+    switch (name_palette(opt->palette, name, len)) {
+    case PALETTE_HOT:
+        r = 205 + (int)(50 * v3);
+        g = (int)(230 * v1);
+        b = (int)(55 * v2);
+        break;
+    case PALETTE_MEM:
+        g = 190 + (int)(50 * v2);
+        b = (int)(210 * v1);
+        break;
+    case PALETTE_IO:
+        r = g = 80 + (int)(60 * v1);
+        b = 190 + (int)(55 * v2);
+        break;
+    case PALETTE_RED:
+        r = 200 + (int)(55 * v1);
+        g = b = 50 + (int)(80 * v1);
+        break;
+    case PALETTE_GREEN:
+        g = 200 + (int)(55 * v1);
+        r = b = 50 + (int)(60 * v1);
+        break;
+    case PALETTE_BLUE:
+        b = 205 + (int)(50 * v1);
+        r = g = 80 + (int)(60 * v1);
+        break;
+    case PALETTE_YELLOW:
+        r = g = 175 + (int)(55 * v1);
+        b = 50 + (int)(20 * v1);
+        break;
+    case PALETTE_PURPLE:
+        r = b = 190 + (int)(65 * v1);
+        g = 80 + (int)(60 * v1);
+        break;
+    case PALETTE_AQUA:
+        r = 50 + (int)(60 * v1);
+        g = b = 165 + (int)(55 * v1);
+        break;
+    case PALETTE_ORANGE:
+        r = 190 + (int)(65 * v1);
+        g = 90 + (int)(65 * v1);
+        break;
+    default:
+        break;
+    }
+    snprintf(color, size, "rgb(%d,%d,%d)", r, g, b);
+}
+
+// flamegraph.pl's color_scale(): red where a frame grew, blue where it shrank
+static void delta_color(const struct options* opt, double delta, double maxdelta, char* color, size_t size)
+{
+    int r = 255, g = 255, b = 255;
+    if (opt->negate)
+        delta = -delta;
+    if (delta > 0)
+        g = b = (int)(210 * (maxdelta - delta) / maxdelta);
+    else if (delta < 0)
+        r = g = (int)(210 * (maxdelta + delta) / maxdelta);
+    snprintf(color, size, "rgb(%d,%d,%d)", r, g, b);
+}
+
+struct flamegraph {
+    const struct options* opt;
+    struct stack_trie trie;
+    uint64_t ignored;        // lines without a count
+
+    // Differential input: second count minus first, of the stacks ending
+    // at each node; only their leaves are colored by it, as in flamegraph.pl
+    int differential;
+    double* deltas;
+    size_t deltas_capacity;
+    double maxdelta;
+
+    double* totals;          // value of each node and everything above it
+    uint32_t* sizes;         // frames drawn in each subtree
+    uint32_t* ranks;         // frame id -> position of the name in sorted order
+    double time;             // sum of all counts
+    double timemax;          // width of the graph, --total if larger
+    double widthpertime;
+    double minwidth_time;
+    int depthmax;
+    double imageheight;
+    double ypad1;
+    double ypad2;
+};
+
+// flamegraph.pl sorts whole lines, so a frame name that ends where another
+// continues compares as if followed by the ';' of its children
+static int compare_names(const char* a, size_t alen, const char* b, size_t blen)
+{
+    size_t n = alen < blen ? alen : blen;
+    int c = memcmp(a, b, n);
+    if (c || alen == blen)
+        return c;
+    return alen < blen ? ';' - (unsigned char)b[n] : (unsigned char)a[n] - ';';
+}
+
+static int compare_frames(const void* a, const void* b)
+{
+    const struct stack_frame* fa = *(const struct stack_frame* const*)a;
+    const struct stack_frame* fb = *(const struct stack_frame* const*)b;
+    return compare_names(fa->name, fa->len, fb->name, fb->len);
+}
+
+static int compare_keys(const void* a, const void* b)
+{
+    uint64_t ka = *(const uint64_t*)a, kb = *(const uint64_t*)b;
+    return ka < kb ? -1 : ka > kb;
+}
+
+// "stack count", the count being everything after the last whitespace and
+// matching \d+(\.\d*)? as in flamegraph.pl
+static int split_line(const char* line, size_t len, size_t* stack_len, double* value)
+{
+    size_t i = len;
+    while (i > 0 && !isspace((unsigned char)line[i - 1]))
+        i--;
+    if (i == 0)
+        return -1;
+    const char* count = line + i;
+    size_t count_len = len - i;
+    size_t j = 0;
+    while (j < count_len && isdigit((unsigned char)count[j]))
+        j++;
+    if (j == 0)
+        return -1;
+    if (j < count_len && count[j] == '.') {
+        j++;
+        while (j < count_len && isdigit((unsigned char)count[j]))
+            j++;
+    }
+    if (j != count_len)
+        return -1;
+    *stack_len = i - 1;
+    *value = strtod(count, NULL);
+    return 0;
+}
+
+static uint32_t descend(struct stack_trie* trie, uint32_t node, const char* name, size_t len)
+{
+    uint32_t frame = stack_trie_frame(trie, name, len);
+    return frame == UINT32_MAX ? UINT32_MAX : stack_trie_child(trie, node, frame);
+}
+
+// Returns the stack's node, or UINT32_MAX when out of memory
+static uint32_t add_stack(struct flamegraph* graph, const char* stack, size_t len, double value)
+{
+    // Trailing empty frames are dropped, as perl's split does
+    while (len > 0 && stack[len - 1] == ';')
+        len--;
+
+    uint32_t node = STACK_TRIE_ROOT;
+    const char* end = stack + len;
+    if (len > 0 && !graph->opt->reverse) {
+        for (const char* p = stack; node != UINT32_MAX;) {
+            const char* sep = memchr(p, ';', end - p);
+            const char* stop = sep ? sep : end;
+            node = descend(&graph->trie, node, p, stop - p);
+            if (!sep)
+                break;
+            p = sep + 1;
+        }
+    }
+    else if (len > 0) {
+        for (const char* stop = end; node != UINT32_MAX;) {
+            const char* p = stop;
+            while (p > stack && p[-1] != ';')
+                p--;
+            node = descend(&graph->trie, node, p, stop - p);
+            if (p == stack)
+                break;
+            stop = p - 1;
+        }
+    }
+    if (node != UINT32_MAX)
+        graph->trie.nodes[node].value += value;
+    return node;
+}
+
+// Zero-filled deltas for every node of the trie
+static int grow_deltas(struct flamegraph* graph)
+{
+    size_t n = graph->trie.nnodes;
+    if (n <= graph->deltas_capacity)
+        return 0;
+    size_t capacity = graph->deltas_capacity ? graph->deltas_capacity : 4096;
+    while (capacity < n)
+        capacity *= 2;
+    double* grown = realloc(graph->deltas, capacity * sizeof(double));
+    if (!grown)
+        return -1;
+    memset(grown + graph->deltas_capacity, 0, (capacity - graph->deltas_capacity) * sizeof(double));
+    graph->deltas = grown;
+    graph->deltas_capacity = capacity;
+    return 0;
+}
+
+static int read_stacks(struct flamegraph* graph, FILE* in, const char* path)
+{
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    int ret = 0;
+    while (ret == 0 && (len = getline(&line, &capacity, in)) != -1) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+        size_t stack_len, before_len;
+        double value, before;
+        if (split_line(line, len, &stack_len, &value) != 0) {
+            graph->ignored++;
+            continue;
+        }
+        // A differential line is drawn with its second count
+        int differential = split_line(line, stack_len, &before_len, &before) == 0;
+        uint32_t node = add_stack(graph, line, differential ? before_len : stack_len, value);
+        if (node != UINT32_MAX && differential && grow_deltas(graph) == 0) {
+            double delta = value - before;
+            graph->deltas[node] += delta;
+            if (fabs(delta) > graph->maxdelta)
+                graph->maxdelta = fabs(delta);
+            graph->differential = 1;
+        }
+        else if (node == UINT32_MAX || differential) {
+            fprintf(stderr, "ERROR: Memory allocation failed while reading %s\n", path);
+            ret = -1;
+        }
+    }
+    if (ferror(in)) {
+        perror(path);
+        ret = -1;
+    }
+    if (ret == 0 && graph->differential && grow_deltas(graph) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed while reading %s\n", path);
+        ret = -1;
+    }
+    free(line);
+    return ret;
+}
+
+// Totals, pruning and depth, in passes over the node array: a node is
+// always created after its parent
+static int layout(struct flamegraph* graph)
+{
+    const struct options* opt = graph->opt;
+    struct stack_trie* trie = &graph->trie;
+    size_t n = trie->nnodes;
+    graph->totals = malloc(n * sizeof(double));
+    graph->sizes = calloc(n, sizeof(uint32_t));
+    graph->ranks = malloc((trie->nframes + 1) * sizeof(uint32_t));
+    uint32_t* depths = malloc(n * sizeof(uint32_t));
+    const struct stack_frame** order = malloc((trie->nframes + 1) * sizeof(struct stack_frame*));
+    if (!graph->totals || !graph->sizes || !graph->ranks || !depths || !order) {
+        free(depths);
+        free(order);
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; i++)
+        graph->totals[i] = trie->nodes[i].value;
+    for (size_t i = n - 1; i > 0; i--)
+        graph->totals[trie->nodes[i].parent] += graph->totals[i];
+    graph->time = graph->totals[STACK_TRIE_ROOT];
+    graph->timemax = opt->total > graph->time ? opt->total : graph->time;
+    graph->widthpertime = (opt->imagewidth - 2 * XPAD) / graph->timemax;
+    graph->minwidth_time = opt->minwidth_percent ? graph->timemax * opt->minwidth / 100
+                                                 : opt->minwidth / graph->widthpertime;
+
+    depths[STACK_TRIE_ROOT] = 0;
+    graph->depthmax = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i != STACK_TRIE_ROOT)
+            depths[i] = depths[trie->nodes[i].parent] + 1;
+        if (graph->totals[i] >= graph->minwidth_time && (int)depths[i] > graph->depthmax)
+            graph->depthmax = depths[i];
+    }
+    for (size_t i = n; i-- > 0;) {
+        graph->sizes[i] += graph->totals[i] >= graph->minwidth_time;
+        if (i != STACK_TRIE_ROOT)
+            graph->sizes[trie->nodes[i].parent] += graph->sizes[i];
+    }
+
+    for (size_t i = 0; i < trie->nframes; i++)
+        order[i] = &trie->frames[i];
+    qsort(order, trie->nframes, sizeof(*order), compare_frames);
+    for (size_t i = 0; i < trie->nframes; i++)
+        graph->ranks[order[i] - trie->frames] = i;
+
+    graph->ypad1 = opt->fontsize * 3;
+    graph->ypad2 = opt->fontsize * 2 + 10;
+    graph->imageheight = (graph->depthmax + 1) * opt->frameheight + graph->ypad1 + graph->ypad2;
+    if (opt->subtitle[0])
+        graph->imageheight += opt->fontsize * 2;
+    free(depths);
+    free(order);
+    return 0;
+}
+
+// Children of a node appended to keys in name order, as (rank << 32) | node
+struct child_list {
+    uint64_t* keys;
+    size_t count;
+    size_t capacity;
+};
+
+static int sorted_children(const struct flamegraph* graph, uint32_t node, struct child_list* list)
+{
+    size_t base = list->count;
+    for (uint32_t c = graph->trie.nodes[node].first_child; c; c = graph->trie.nodes[c].next_sibling) {
+        if (list->count == list->capacity) {
+            size_t capacity = list->capacity ? list->capacity * 2 : 256;
+            uint64_t* grown = realloc(list->keys, capacity * sizeof(uint64_t));
+            if (!grown)
+                return -1;
+            list->keys = grown;
+            list->capacity = capacity;
+        }
+        list->keys[list->count++] = (uint64_t)graph->ranks[graph->trie.nodes[c].frame] << 32 | c;
+    }
+    qsort(list->keys + base, list->count - base, sizeof(uint64_t), compare_keys);
+    return 0;
+}
+
+// "1234567" -> "1,234,567"
+static void add_commas(const char* digits, char* out)
+{
+    if (*digits == '-')
+        *out++ = *digits++;
+    size_t len = strlen(digits);
+    for (size_t i = 0; i < len; i++) {
+        if (i > 0 && (len - i) % 3 == 0)
+            *out++ = ',';
+        *out++ = digits[i];
+    }
+    *out = '\0';
+}
+
+static void render_frame(const struct flamegraph* graph, struct svg_buffer* out, uint32_t node, double stime,
+    double etime, uint32_t depth, unsigned short seed[3])
+{
+    const struct options* opt = graph->opt;
+    const struct stack_frame* frame = node == STACK_TRIE_ROOT ? NULL : &graph->trie.frames[graph->trie.nodes[node].frame];
+    const char* func = frame ? frame->name : "";
+    size_t len = frame ? frame->len : 0;
+    // flamegraph.pl keeps the end in a hash key, as perl prints numbers
+    char end[32];
+    etime = frame ? strtod(perl_number(end, sizeof(end), etime), NULL) : graph->timemax;
+
+    double x1 = XPAD + stime * graph->widthpertime;
+    double x2 = XPAD + etime * graph->widthpertime;
+    double y1, y2;
+    if (!opt->inverted) {
+        y1 = graph->imageheight - graph->ypad2 - (depth + 1.0) * opt->frameheight + FRAMEPAD;
+        y2 = graph->imageheight - graph->ypad2 - (double)depth * opt->frameheight;
+    }
+    else {
+        y1 = graph->ypad1 + (double)depth * opt->frameheight;
+        y2 = graph->ypad1 + (depth + 1.0) * opt->frameheight - FRAMEPAD;
+    }
+
+    char samples[64], samples_txt[96];
+    snprintf(samples, sizeof(samples), "%.0f", (etime - stime) * opt->factor);
+    add_commas(samples, samples_txt);
+    size_t name_len = strip_annotation(func, len);
+    svg_append(out, "<g >\n<title>", 12);
+    if (!frame)
+        svg_printf(out, "all (%s %s, 100%%)", samples_txt, opt->countname);
+    else {
+        svg_escape(out, func, name_len, 1);
+        svg_printf(out, " (%s %s, %.2f%%", samples_txt, opt->countname,
+            100 * strtod(samples, NULL) / (graph->timemax * opt->factor));
+        if (graph->differential) {
+            double delta = opt->negate ? -graph->deltas[node] : graph->deltas[node];
+            if (delta == 0)
+                delta = 0; // perl negates an unchanged count to 0, not -0
+            svg_printf(out, "; %s%.2f%%", delta > 0 ? "+" : "", 100 * delta / (graph->timemax * opt->factor));
+        }
+        svg_append(out, ")", 1);
+    }
+
+    char color[48];
+    if (len == 2 && memcmp(func, "--", 2) == 0)
+        snprintf(color, sizeof(color), "rgb(160,160,160)");
+    else if (len == 1 && func[0] == '-')
+        snprintf(color, sizeof(color), "rgb(200,200,200)");
+    else if (graph->differential)
+        delta_color(opt, graph->deltas[node], graph->maxdelta, color, sizeof(color));
+    else
+        frame_color(opt, func, len, seed, color, sizeof(color));
+
+    // The width is taken between the rounded edges, as flamegraph.pl does
+    char left[32], right[32], y[32], text_y[32];
+    snprintf(left, sizeof(left), "%0.1f", x1);
+    snprintf(right, sizeof(right), "%0.1f", x2);
+    svg_printf(out, "</title><rect x=\"%s\" y=\"%s\" width=\"%0.1f\" height=\"%0.1f\" fill=\"%s\" rx=\"2\" ry=\"2\" />\n",
+        left, perl_number(y, sizeof(y), y1), strtod(right, NULL) - strtod(left, NULL), y2 - y1, color);
+
+    // As many characters as fit, at least one and two dots
+    svg_printf(out, "<text  x=\"%0.2f\" y=\"%s\" >", x1 + 3, perl_number(text_y, sizeof(text_y), 3 + (y1 + y2) / 2));
+    size_t chars = (size_t)((x2 - x1) / (opt->fontsize * opt->fontwidth));
+    if (chars >= 3) {
+        size_t total = char_count(func, name_len);
+        if (chars < total) {
+            svg_escape(out, func, char_prefix(func, name_len, chars - 2), 0);
+            svg_append(out, "..", 2);
+        }
+        else
+            svg_escape(out, func, name_len, 0);
+    }
+    svg_append(out, "</text>\n</g>\n", 13);
+}
+
+// Returns where the node ends. Counts are summed in drawing order, through
+// frames too narrow to draw as well, the way flamegraph.pl sums its sorted
+// lines, so that the edges round the same way.
+static double render_subtree(const struct flamegraph* graph, struct svg_buffer* out, struct child_list* scratch,
+    uint32_t node, double stime, uint32_t depth, unsigned short seed[3])
+{
+    const struct stack_node* n = &graph->trie.nodes[node];
+    double time = stime + n->value;
+    if (!n->first_child) {
+        if (graph->totals[node] >= graph->minwidth_time)
+            render_frame(graph, out, node, stime, time, depth, seed);
+        return time;
+    }
+
+    size_t base = scratch->count;
+    if (sorted_children(graph, node, scratch) != 0) {
+        out->failed = 1;
+        return stime + graph->totals[node];
+    }
+    // A stack's own count is drawn left of its callees
+    for (size_t i = base; i < scratch->count; i++)
+        time = render_subtree(graph, out, scratch, (uint32_t)scratch->keys[i], time, depth + 1, seed);
+    scratch->count = base;
+
+    if (graph->totals[node] >= graph->minwidth_time)
+        render_frame(graph, out, node, stime, time, depth, seed);
+    return time;
+}
+
+// A piece of the graph rendered by one thread: a whole subtree, or the
+// frame of a node whose subtree was split further
+struct segment {
+    uint32_t node;
+    uint32_t depth;
+    double stime;
+    int subtree;
+    struct svg_buffer out;
+};
+
+struct render_plan {
+    const struct flamegraph* graph;
+    struct segment* segments;
+    size_t count;
+    size_t capacity;
+    uint32_t grain;         // subtrees up to this many frames are not split
+    size_t next;            // next segment to render
+    pthread_mutex_t lock;
+};
+
+static int add_segment(struct render_plan* plan, uint32_t node, double stime, uint32_t depth, int subtree)
+{
+    if (plan->count == plan->capacity) {
+        size_t capacity = plan->capacity ? plan->capacity * 2 : 64;
+        struct segment* grown = realloc(plan->segments, capacity * sizeof(struct segment));
+        if (!grown)
+            return -1;
+        plan->segments = grown;
+        plan->capacity = capacity;
+    }
+    struct segment* segment = &plan->segments[plan->count++];
+    memset(segment, 0, sizeof(*segment));
+    segment->node = node;
+    segment->stime = stime;
+    segment->depth = depth;
+    segment->subtree = subtree;
+    return 0;
+}
+
+// Split the tree, depth first so the segments keep the drawing order,
+// until every subtree has at most grain frames
+static int split(struct render_plan* plan, uint32_t node, double stime, uint32_t depth)
+{
+    const struct flamegraph* graph = plan->graph;
+    if (graph->totals[node] < graph->minwidth_time)
+        return 0;
+    if (graph->sizes[node] <= plan->grain || !graph->trie.nodes[node].first_child)
+        return add_segment(plan, node, stime, depth, 1);
+    if (add_segment(plan, node, stime, depth, 0) != 0)
+        return -1;
+
+    struct child_list children = { 0 };
+    if (sorted_children(graph, node, &children) != 0)
+        return -1;
+    int ret = 0;
+    double x = stime + graph->trie.nodes[node].value;
+    for (size_t i = 0; i < children.count && ret == 0; i++) {
+        uint32_t child = (uint32_t)children.keys[i];
+        ret = split(plan, child, x, depth + 1);
+        x += graph->totals[child];
+    }
+    free(children.keys);
+    return ret;
+}
+
+static void* render_worker(void* arg)
+{
+    struct render_plan* plan = arg;
+    struct child_list scratch = { 0 };
+    unsigned short seed[3] = { 0x330e, (unsigned short)time(NULL), (unsigned short)getpid() };
+    for (;;) {
+        pthread_mutex_lock(&plan->lock);
+        size_t i = plan->next++;
+        pthread_mutex_unlock(&plan->lock);
+        if (i >= plan->count)
+            break;
+
+        struct segment* segment = &plan->segments[i];
+        seed[0] ^= (unsigned short)i;
+        if (segment->subtree)
+            render_subtree(plan->graph, &segment->out, &scratch, segment->node, segment->stime, segment->depth, seed);
+        else
+            render_frame(plan->graph, &segment->out, segment->node, segment->stime,
+                segment->stime + plan->graph->totals[segment->node], segment->depth, seed);
+    }
+    free(scratch.keys);
+    return NULL;
+}
+
+static void write_header(const struct options* opt, double height, struct svg_buffer* out)
+{
+    char h[32];
+    perl_number(h, sizeof(h), height);
+    svg_printf(out, "<?xml version=\"1.0\"");
+    if (opt->encoding)
+        svg_printf(out, " encoding=\"%s\"", opt->encoding);
+    svg_printf(out, " standalone=\"no\"?>\n"
+                    "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n"
+                    "<svg version=\"1.1\" width=\"%d\" height=\"%s\" onload=\"init(evt)\" viewBox=\"0 0 %d %s\" "
+                    "xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\">\n"
+                    "<!-- Flame graph stack visualization. See https://github.com/brendangregg/FlameGraph for latest "
+                    "version, and http://www.brendangregg.com/flamegraphs.html for examples. -->\n"
+                    "<!-- NOTES: %s -->\n",
+        opt->imagewidth, h, opt->imagewidth, h, opt->notes);
+}
+
+static void write_text(struct svg_buffer* out, const char* id, double x, double y, const char* text, const char* extra)
+{
+    char ybuf[32];
+    svg_printf(out, "<text id=\"%s\" x=\"%0.2f\" y=\"%s\" %s>", id, x, perl_number(ybuf, sizeof(ybuf), y), extra);
+    svg_escape(out, text, strlen(text), 0);
+    svg_printf(out, "</text>\n");
+}
+
+static int write_svg(const struct flamegraph* graph, FILE* out, struct render_plan* plan)
+{
+    const struct options* opt = graph->opt;
+    struct svg_buffer head = { 0 };
+    const char* bgcolor1 = "#eeeeee";
+    const char* bgcolor2 = "#eeeeb0";
+    if (strcmp(opt->bgcolors, "blue") == 0)
+        bgcolor2 = "#e0e0ff";
+    else if (strcmp(opt->bgcolors, "green") == 0) {
+        bgcolor1 = "#eef2ee";
+        bgcolor2 = "#e0ffe0";
+    }
+    else if (strcmp(opt->bgcolors, "grey") == 0) {
+        bgcolor1 = "#f8f8f8";
+        bgcolor2 = "#e8e8e8";
+    }
+    else if (opt->bgcolors[0] == '#')
+        bgcolor1 = bgcolor2 = opt->bgcolors;
+
+    char fontsize[32], titlesize[32], fontwidth[32], inverted[8];
+    perl_number(fontsize, sizeof(fontsize), opt->fontsize);
+    perl_number(titlesize, sizeof(titlesize), opt->fontsize + 5);
+    perl_number(fontwidth, sizeof(fontwidth), opt->fontwidth);
+    snprintf(inverted, sizeof(inverted), "%d", opt->inverted);
+
+    double width = opt->imagewidth, height = graph->imageheight;
+    write_header(opt, height, &head);
+    svg_printf(&head, svg_script, bgcolor1, bgcolor2, opt->fonttype, fontsize, titlesize, opt->nametype,
+        fontsize, fontwidth, inverted);
+    svg_printf(&head, "<rect x=\"0.0\" y=\"0\" width=\"%0.1f\" height=\"%0.1f\" fill=\"url(#background)\"  />\n",
+        width, height);
+    write_text(&head, "title", (int)(width / 2), opt->fontsize * 2, opt->title, "");
+    if (opt->subtitle[0])
+        write_text(&head, "subtitle", (int)(width / 2), opt->fontsize * 4, opt->subtitle, "");
+    write_text(&head, "details", XPAD, height - graph->ypad2 / 2, " ", "");
+    write_text(&head, "unzoom", XPAD, opt->fontsize * 2, "Reset Zoom", "class=\"hide\"");
+    write_text(&head, "search", width - XPAD - 100, opt->fontsize * 2, "Search", "");
+    write_text(&head, "ignorecase", width - XPAD - 16, opt->fontsize * 2, "ic", "");
+    write_text(&head, "matched", width - XPAD - 100, height - graph->ypad2 / 2, " ", "");
+    svg_printf(&head, "<g id=\"frames\">\n");
+
+    int ret = head.failed ? -1 : 0;
+    if (ret == 0 && fwrite(head.data, 1, head.size, out) != head.size)
+        ret = -1;
+    free(head.data);
+    for (size_t i = 0; i < plan->count; i++) {
+        struct svg_buffer* segment = &plan->segments[i].out;
+        if (segment->failed)
+            ret = -1;
+        if (ret == 0 && segment->size && fwrite(segment->data, 1, segment->size, out) != segment->size)
+            ret = -1;
+        free(segment->data);
+        segment->data = NULL;
+    }
+    if (ret == 0 && fputs("</g>\n</svg>\n", out) == EOF)
+        ret = -1;
+    return ret;
+}
+
+// The SVG flamegraph.pl writes when there is nothing to draw
+static void write_empty(const struct options* opt, FILE* out)
+{
+    struct svg_buffer svg = { 0 };
+    write_header(opt, opt->fontsize * 5, &svg);
+    char y[32];
+    svg_printf(&svg, "<text  x=\"%0.2f\" y=\"%s\" >ERROR: No valid input provided to dw-flamegraph.</text>\n</svg>\n",
+        (double)(int)(opt->imagewidth / 2), perl_number(y, sizeof(y), opt->fontsize * 2));
+    if (!svg.failed)
+        fwrite(svg.data, 1, svg.size, out);
+    free(svg.data);
+}
+
+enum {
+    OPT_TITLE = 256,
+    OPT_SUBTITLE,
+    OPT_WIDTH,
+    OPT_HEIGHT,
+    OPT_ENCODING,
+    OPT_FONTSIZE,
+    OPT_FONTWIDTH,
+    OPT_MINWIDTH,
+    OPT_FONTTYPE,
+    OPT_NAMETYPE,
+    OPT_COUNTNAME,
+    OPT_TOTAL,
+    OPT_FACTOR,
+    OPT_COLORS,
+    OPT_BGCOLORS,
+    OPT_HASH,
+    OPT_RANDOM,
+    OPT_REVERSE,
+    OPT_INVERTED,
+    OPT_NEGATE,
+    OPT_NOTES,
+    OPT_UNSUPPORTED,
+};
+
+static const struct option long_options[] = {
+    { "title", required_argument, NULL, OPT_TITLE },
+    { "subtitle", required_argument, NULL, OPT_SUBTITLE },
+    { "width", required_argument, NULL, OPT_WIDTH },
+    { "height", required_argument, NULL, OPT_HEIGHT },
+    { "encoding", required_argument, NULL, OPT_ENCODING },
+    { "fontsize", required_argument, NULL, OPT_FONTSIZE },
+    { "fontwidth", required_argument, NULL, OPT_FONTWIDTH },
+    { "minwidth", required_argument, NULL, OPT_MINWIDTH },
+    { "fonttype", required_argument, NULL, OPT_FONTTYPE },
+    { "nametype", required_argument, NULL, OPT_NAMETYPE },
+    { "countname", required_argument, NULL, OPT_COUNTNAME },
+    { "total", required_argument, NULL, OPT_TOTAL },
+    { "factor", required_argument, NULL, OPT_FACTOR },
+    { "colors", required_argument, NULL, OPT_COLORS },
+    { "bgcolors", required_argument, NULL, OPT_BGCOLORS },
+    { "hash", no_argument, NULL, OPT_HASH },
+    { "random", no_argument, NULL, OPT_RANDOM },
+    { "reverse", no_argument, NULL, OPT_REVERSE },
+    { "inverted", no_argument, NULL, OPT_INVERTED },
+    { "negate", no_argument, NULL, OPT_NEGATE },
+    { "notes", required_argument, NULL, OPT_NOTES },
+    { "threads", required_argument, NULL, 'j' },
+    { "help", no_argument, NULL, 'h' },
+    // Need flamegraph.pl
+    { "nameattr", required_argument, NULL, OPT_UNSUPPORTED },
+    { "cp", no_argument, NULL, OPT_UNSUPPORTED },
+    { "flamechart", no_argument, NULL, OPT_UNSUPPORTED },
+    { NULL, 0, NULL, 0 },
+};
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [options] [infile...] > outfile.svg\n", name);
+    fprintf(stderr, "  --title TEXT     change title text\n");
+    fprintf(stderr, "  --subtitle TEXT  second level title (optional)\n");
+    fprintf(stderr, "  --width NUM      width of image (default 1200)\n");
+    fprintf(stderr, "  --height NUM     height of each frame (default 16)\n");
+    fprintf(stderr, "  --minwidth NUM   omit smaller functions, in pixels or with \"%%\" in percent of\n");
+    fprintf(stderr, "                   the total (default 0.1 pixels)\n");
+    fprintf(stderr, "  --fonttype FONT  font type (default \"Verdana\")\n");
+    fprintf(stderr, "  --fontsize NUM   font size (default 12)\n");
+    fprintf(stderr, "  --fontwidth NUM  average character width relative to the font size (default 0.59)\n");
+    fprintf(stderr, "  --countname TEXT count type label (default \"samples\")\n");
+    fprintf(stderr, "  --nametype TEXT  name type label (default \"Function:\")\n");
+    fprintf(stderr, "  --total NUM      width of the graph in counts, when larger than their sum\n");
+    fprintf(stderr, "  --factor NUM     factor to scale counts by in the labels\n");
+    fprintf(stderr, "  --colors PALETTE hot (default), mem, io, wakeup, chain, java, js, perl, red,\n");
+    fprintf(stderr, "                   green, blue, aqua, yellow, purple, orange\n");
+    fprintf(stderr, "  --bgcolors COLOR yellow (default), blue, green, grey or \"#rrggbb\"\n");
+    fprintf(stderr, "  --hash           colors are keyed by function name hash\n");
+    fprintf(stderr, "  --random         colors are randomly generated\n");
+    fprintf(stderr, "  --reverse        generate stack-reversed flame graph\n");
+    fprintf(stderr, "  --inverted       icicle graph\n");
+    fprintf(stderr, "  --negate         switch differential hues (blue<->red)\n");
+    fprintf(stderr, "  --notes TEXT     add notes comment in SVG (for debugging)\n");
+    fprintf(stderr, "  -j, --threads N  threads rendering subtrees (default: online CPUs)\n");
+    fprintf(stderr, "--nameattr, --cp and --flamechart need flamegraph.pl.\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    struct options opt = {
+        .title = NULL,
+        .subtitle = "",
+        .fonttype = "Verdana",
+        .countname = "samples",
+        .nametype = "Function:",
+        .notes = "",
+        .bgcolors = NULL,
+        .palette = PALETTE_HOT,
+        .imagewidth = 1200,
+        .frameheight = 16,
+        .fontsize = 12,
+        .fontwidth = 0.59,
+        .minwidth = 0.1,
+        .factor = 1,
+        .threads = sysconf(_SC_NPROCESSORS_ONLN),
+    };
+
+    int opt_char;
+    char* end;
+    while ((opt_char = getopt_long_only(argc, argv, "j:h", long_options, NULL)) != -1) {
+        switch (opt_char) {
+        case OPT_TITLE:
+            opt.title = optarg;
+            break;
+        case OPT_SUBTITLE:
+            opt.subtitle = optarg;
+            break;
+        case OPT_WIDTH:
+            opt.imagewidth = atoi(optarg);
+            break;
+        case OPT_HEIGHT:
+            opt.frameheight = atoi(optarg);
+            break;
+        case OPT_ENCODING:
+            opt.encoding = optarg;
+            break;
+        case OPT_FONTSIZE:
+            opt.fontsize = atof(optarg);
+            break;
+        case OPT_FONTWIDTH:
+            opt.fontwidth = atof(optarg);
+            break;
+        case OPT_MINWIDTH:
+            opt.minwidth = strtod(optarg, &end);
+            opt.minwidth_percent = *end == '%';
+            if (end == optarg || *optarg == '-' || *optarg == '+' || (*end && strcmp(end, "%") != 0)) {
+                fprintf(stderr, "Value '%s' is invalid for minwidth, expected a float.\n", optarg);
+                usage(*argv);
+            }
+            break;
+        case OPT_FONTTYPE:
+            opt.fonttype = optarg;
+            break;
+        case OPT_NAMETYPE:
+            opt.nametype = optarg;
+            break;
+        case OPT_COUNTNAME:
+            opt.countname = optarg;
+            break;
+        case OPT_TOTAL:
+            opt.total = atof(optarg);
+            break;
+        case OPT_FACTOR:
+            opt.factor = atof(optarg);
+            break;
+        case OPT_COLORS: {
+            size_t i = 0;
+            while (i < sizeof(palette_names) / sizeof(*palette_names) && strcmp(optarg, palette_names[i]) != 0)
+                i++;
+            if (i == sizeof(palette_names) / sizeof(*palette_names)) {
+                fprintf(stderr, "Unrecognized color palette \"%s\"\n", optarg);
+                usage(*argv);
+            }
+            opt.palette = i;
+            break;
+        }
+        case OPT_BGCOLORS:
+            opt.bgcolors = optarg;
+            if (strcmp(optarg, "yellow") != 0 && strcmp(optarg, "blue") != 0 && strcmp(optarg, "green") != 0
+                && strcmp(optarg, "grey") != 0 && (optarg[0] != '#' || strlen(optarg) != 7)) {
+                fprintf(stderr, "Unrecognized bgcolor option \"%s\"\n", optarg);
+                usage(*argv);
+            }
+            break;
+        case OPT_HASH:
+            opt.hash = 1;
+            break;
+        case OPT_RANDOM:
+            opt.random = 1;
+            break;
+        case OPT_REVERSE:
+            opt.reverse = 1;
+            break;
+        case OPT_INVERTED:
+            opt.inverted = 1;
+            break;
+        case OPT_NEGATE:
+            opt.negate = 1;
+            break;
+        case OPT_NOTES:
+            opt.notes = optarg;
+            if (strpbrk(optarg, "<>")) {
+                fprintf(stderr, "Notes string can't contain < or >\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'j':
+            opt.threads = atol(optarg);
+            break;
+        case OPT_UNSUPPORTED:
+            fprintf(stderr, "%s: unsupported option, use flamegraph.pl\n", argv[optind - 1]);
+            exit(EXIT_FAILURE);
+        default:
+            usage(*argv);
+        }
+    }
+    if (!opt.title)
+        opt.title = opt.inverted ? "Icicle Graph" : "Flame Graph";
+    if (!opt.bgcolors) {
+        if (opt.palette == PALETTE_MEM)
+            opt.bgcolors = "green";
+        else if (opt.palette == PALETTE_IO || opt.palette == PALETTE_WAKEUP || opt.palette == PALETTE_CHAIN)
+            opt.bgcolors = "blue";
+        else if (opt.palette >= PALETTE_RED)
+            opt.bgcolors = "grey";
+        else
+            opt.bgcolors = "yellow";
+    }
+    if (opt.threads < 1)
+        opt.threads = 1;
+
+    struct flamegraph graph = { .opt = &opt, .maxdelta = 1 };
+    if (stack_trie_init(&graph.trie) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    int ret = 0;
+    if (optind == argc)
+        ret = read_stacks(&graph, stdin, "stdin");
+    for (int i = optind; i < argc && ret == 0; i++) {
+        FILE* in = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "r");
+        if (!in) {
+            perror(argv[i]);
+            ret = -1;
+            break;
+        }
+        setvbuf(in, NULL, _IOFBF, 1 << 20);
+        ret = read_stacks(&graph, in, argv[i]);
+        if (in != stdin)
+            fclose(in);
+    }
+    if (ret != 0)
+        exit(EXIT_FAILURE);
+
+    if (layout(&graph) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    char number[32];
+    if (strcmp(opt.countname, "samples") == 0 && graph.time < 100)
+        fprintf(stderr, "Stack count is low (%s). Did something go wrong?\n", perl_number(number, sizeof(number), graph.time));
+    if (graph.ignored)
+        fprintf(stderr, "Ignored %lu lines with invalid format\n", graph.ignored);
+    if (graph.time == 0) {
+        fprintf(stderr, "ERROR: No stack counts found\n");
+        write_empty(&opt, stdout);
+        exit(2);
+    }
+    char total[32];
+    if (opt.total && opt.total < graph.time && opt.total / graph.time > 0.02)
+        fprintf(stderr, "Specified --total %s is less than actual total %s, so ignored\n",
+            perl_number(total, sizeof(total), opt.total), perl_number(number, sizeof(number), graph.time));
+
+    // Enough segments per thread to even out subtrees of different cost
+    struct render_plan plan = { .graph = &graph, .grain = UINT32_MAX };
+    pthread_mutex_init(&plan.lock, NULL);
+    if (opt.threads > 1) {
+        uint32_t grain = graph.sizes[STACK_TRIE_ROOT] / (opt.threads * 16);
+        plan.grain = grain > 4096 ? grain : 4096;
+    }
+    if (split(&plan, STACK_TRIE_ROOT, 0, 0) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    long threads = opt.threads < (long)plan.count ? opt.threads : (long)plan.count;
+    pthread_t* workers = calloc(threads > 1 ? threads - 1 : 1, sizeof(pthread_t));
+    long started = 0;
+    while (workers && started < threads - 1 && pthread_create(&workers[started], NULL, render_worker, &plan) == 0)
+        started++;
+    render_worker(&plan);
+    for (long i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    if (write_svg(&graph, stdout, &plan) != 0 || fflush(stdout) != 0) {
+        fprintf(stderr, "ERROR: Failed to write the SVG\n");
+        ret = -1;
+    }
+
+    free(plan.segments);
+    free(graph.totals);
+    free(graph.sizes);
+    free(graph.ranks);
+    free(graph.deltas);
+    stack_trie_free(&graph.trie);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
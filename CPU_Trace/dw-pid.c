@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -13,11 +14,27 @@
 #include <libelf.h>
 #include <signal.h> // Needed for kill()
 #include <assert.h>
-#include <czmq.h> // Include czmq's zclock functions
-#include <nvml.h>
 #include <time.h>
-
-#define PAGE_SIZE 4096
+#include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include "async_output.h"
+#include "compressor.h"
+#include "perf_streams.h"
+#include "procmaps.h"
+#include "procstat.h"
+#include "gpu_provider.h"
+#include "live_top.h"
+#include "metrics_server.h"
+#include "rapl.h"
+#include "spsc_queue.h"
+#include "stack_trie.h"
+#include "symcache.h"
+#include "trace_writer.h"
+#include "window_queue.h"
 
 // libdw initialization
 static Dwfl_Callbacks callbacks = {
@@ -47,6 +64,20 @@ Dwfl* init_dwfl(pid_t pid) {
     return dwfl;
 }
 
+// Re-read /proc/<pid>/maps after the target mapped new code.
+int refresh_dwfl(Dwfl* dwfl, pid_t pid) {
+    dwfl_report_begin(dwfl);
+    if (dwfl_linux_proc_report(dwfl, pid)) {
+        fprintf(stderr, "dwfl_linux_proc_report error: %s\n", dwfl_errmsg(-1));
+        return -1;
+    }
+    if (dwfl_report_end(dwfl, NULL, NULL) != 0) {
+        fprintf(stderr, "dwfl_report_end error: %s\n", dwfl_errmsg(-1));
+        return -1;
+    }
+    return 0;
+}
+
 typedef unsigned long u64;
 
 struct read_format {
@@ -57,12 +88,52 @@ struct read_format {
     u64 lost;
 };
 
+// Layout for PERF_SAMPLE_TID | TIME | CPU | PERIOD | CALLCHAIN
 struct sample {
     struct perf_event_header header;
+    uint32_t pid;
+    uint32_t tid;
+    u64 time; // CLOCK_MONOTONIC, see use_clockid
+    uint32_t cpu;
+    uint32_t res;
+    u64 period; // events since the previous sample, varies with attr.freq
     u64 nr;
     u64 ips[];
 };
 
+// With sample_id_all the other records end with the same fields.
+struct sample_id {
+    uint32_t pid;
+    uint32_t tid;
+    u64 time;
+    uint32_t cpu;
+    uint32_t res;
+};
+
+// CLOCK_REALTIME - CLOCK_MONOTONIC, to report sample times as wall-clock time.
+// Updated by the reader thread, read by the symbolizer thread.
+static int64_t realtime_offset_ns = 0;
+
+static int64_t get_realtime_offset() {
+    return __atomic_load_n(&realtime_offset_ns, __ATOMIC_RELAXED);
+}
+
+struct lost_event {
+    struct perf_event_header header;
+    u64 id;
+    u64 lost;
+};
+
+struct mmap_event {
+    struct perf_event_header header;
+    uint32_t pid;
+    uint32_t tid;
+    u64 addr;
+    u64 len;
+    u64 pgoff;
+    char filename[];
+};
+
 void print_mmap_page(struct perf_event_mmap_page* header) {
     printf("struct perf_event_mmap_page\n");
     printf("\tversion: %u\n", header->version);
@@ -116,10 +187,14 @@ void print_sample(struct sample* sample, Dwfl* dwfl) {
     printf("\n\n");
 }
 
+// Callchain text of one interval. It is cleared, not freed, after every
+// interval, so once it has grown to the largest interval it is reused
+// without further allocations.
 struct strbuffer {
     char* buffer;
     size_t buffsize;
     size_t currsize;
+    unsigned long allocs; // malloc and realloc calls so far
 };
 
 struct strbuffer* strnew(size_t size)
@@ -139,14 +214,15 @@ struct strbuffer* strnew(size_t size)
 
     strbuffer->buffsize = size;
     strbuffer->currsize = 0;
+    strbuffer->buffer[0] = '\0';
+    strbuffer->allocs = 2;
 
     return strbuffer;
 }
 
-void strapp(struct strbuffer* strbuffer, const char* to_append)
+// Append append_len bytes of to_append, which need not be NUL terminated.
+void strappn(struct strbuffer* strbuffer, const char* to_append, size_t append_len)
 {
-    size_t append_len = strlen(to_append);
-
     size_t new_size = strbuffer->buffsize;
     while (new_size <= strbuffer->currsize + append_len)
         new_size *= 2;
@@ -159,10 +235,18 @@ void strapp(struct strbuffer* strbuffer, const char* to_append)
 
         strbuffer->buffer = new_buff;
         strbuffer->buffsize = new_size;
+        strbuffer->allocs++;
     }
 
-    strncpy(strbuffer->buffer + strbuffer->currsize, to_append, append_len + 1);
+    memcpy(strbuffer->buffer + strbuffer->currsize, to_append, append_len);
     strbuffer->currsize += append_len;
+    strbuffer->buffer[strbuffer->currsize] = '\0';
+}
+
+void strclear(struct strbuffer* strbuffer)
+{
+    strbuffer->currsize = 0;
+    strbuffer->buffer[0] = '\0';
 }
 
 char* strfreewrap(struct strbuffer* strbuffer)
@@ -172,7 +256,85 @@ char* strfreewrap(struct strbuffer* strbuffer)
     return buffer;
 }
 
-void append_symbols_from_sample(struct strbuffer* callchains, struct sample* sample, Dwfl* dwfl)
+// Symbol lookups go through an ip -> symbol cache, libdw is only consulted on a miss.
+struct symbolizer {
+    Dwfl* dwfl;
+    pid_t pid;
+    struct symcache cache;
+};
+
+const struct symcache_entry* resolve_ip(struct symbolizer* sym, u64 ip)
+{
+    const struct symcache_entry* entry = symcache_find(&sym->cache, ip);
+    if (entry)
+        return entry;
+
+    Dwfl_Module* mod = dwfl_addrmodule(sym->dwfl, ip);
+    const char* symbol = NULL;
+    if (mod)
+        symbol = dwfl_module_addrname(mod, ip);
+    return symcache_insert(&sym->cache, ip, symbol);
+}
+
+// Frame and stack ids of the interned CSV (see trace_format.h). The stacks
+// are the nodes of a trie, so a stack is defined by its parent and the
+// frame on top, and every new id is the next one.
+struct stack_ids {
+    struct stack_trie trie;
+    size_t frames_defined;
+    size_t stacks_defined;  // the root included
+    struct strbuffer* defs; // definition lines for the next row
+};
+
+int append_stack_id(struct strbuffer* callchains, struct stack_ids* ids, struct sample* sample, struct symbolizer* sym)
+{
+    char ip_buffer[20];
+    char line[64];
+    int len;
+
+    // Root first, so that every stack extends one already defined
+    uint32_t node = STACK_TRIE_ROOT;
+    for (uint64_t i = sample->nr; i-- > 0;) {
+        const struct symcache_entry* entry = sym->dwfl ? resolve_ip(sym, sample->ips[i]) : NULL;
+        const char* name = ip_buffer;
+        size_t name_len;
+        if (entry && entry->symbol) {
+            name = entry->symbol;
+            name_len = entry->len;
+        }
+        else {
+            name_len = snprintf(ip_buffer, sizeof(ip_buffer), "0x%lx", sample->ips[i]);
+        }
+
+        uint32_t frame = stack_trie_frame(&ids->trie, name, name_len);
+        if (frame == UINT32_MAX)
+            return -1;
+        if (frame >= ids->frames_defined) {
+            len = snprintf(line, sizeof(line), TRACE_CSV_FRAME ",%u,", frame);
+            strappn(ids->defs, line, len);
+            strappn(ids->defs, name, name_len);
+            strappn(ids->defs, "\n", 1);
+            ids->frames_defined = frame + 1;
+        }
+
+        uint32_t child = stack_trie_child(&ids->trie, node, frame);
+        if (child == UINT32_MAX)
+            return -1;
+        if (child >= ids->stacks_defined) {
+            len = snprintf(line, sizeof(line), TRACE_CSV_STACK ",%u,%u,%u\n", child, node, frame);
+            strappn(ids->defs, line, len);
+            ids->stacks_defined = child + 1;
+        }
+        node = child;
+    }
+
+    len = snprintf(line, sizeof(line), "%c%u;", TRACE_CSV_STACK_REF, node);
+    strappn(callchains, line, len);
+    return 0;
+}
+
+void append_symbols_from_sample(struct strbuffer* callchains, struct stack_ids* ids, struct sample* sample,
+    struct symbolizer* sym)
 {
     if (sample->nr > 100) {
         fprintf(stderr, "ERROR: sample at loc %p reported nr %lu\n", (void*)sample, sample->nr);
@@ -182,45 +344,221 @@ void append_symbols_from_sample(struct strbuffer* callchains, struct sample* sam
     // Create a stack buffer of size = 20 bytes per ip.
     char ip_buffer[20];
 
-    if (dwfl) {
+    // Lengths are known throughout, nothing is measured with strlen
+    char tag[80];
+    int len = snprintf(tag, sizeof(tag), TRACE_SAMPLE_TAG_FORMAT, sample->time + get_realtime_offset(), sample->cpu,
+        sample->tid, sample->period);
+    strappn(callchains, tag, len);
+
+    if (ids) {
+        if (append_stack_id(callchains, ids, sample, sym) != 0)
+            fprintf(stderr, "ERROR: Memory allocation failed for the stack table\n");
+    }
+    else if (sym->dwfl) {
         for (uint64_t i = 0; i < sample->nr; i++) {
-            Dwfl_Module* mod = dwfl_addrmodule(dwfl, sample->ips[i]);
-            const char* symbol = NULL;
-            if (mod)
-                symbol = dwfl_module_addrname(mod, sample->ips[i]);
-            if (symbol) {
-                strapp(callchains, symbol);
-                strapp(callchains, ";");
+            const struct symcache_entry* entry = resolve_ip(sym, sample->ips[i]);
+            if (entry && entry->symbol) {
+                strappn(callchains, entry->symbol, entry->len);
+                strappn(callchains, ";", 1);
             }
             else {
-                snprintf(ip_buffer, sizeof(ip_buffer), "0x%lx;", sample->ips[i]);
-                strapp(callchains, ip_buffer);
+                len = snprintf(ip_buffer, sizeof(ip_buffer), "0x%lx;", sample->ips[i]);
+                strappn(callchains, ip_buffer, len);
             }
         }
     }
     else {
         for (uint64_t i = 0; i < sample->nr; i++) {
-            snprintf(ip_buffer, sizeof(ip_buffer), "0x%lx;", sample->ips[i]);
-            strapp(callchains, ip_buffer);
+            len = snprintf(ip_buffer, sizeof(ip_buffer), "0x%lx;", sample->ips[i]);
+            strappn(callchains, ip_buffer, len);
         }
     }
-    strapp(callchains, "|");
+    strappn(callchains, "|", 1);
 }
 
-char* get_callchains(struct perf_event_mmap_page* buffer, Dwfl* dwfl)
+// Binary trace counterpart of append_symbols_from_sample(): raw ips plus string table ids.
+void write_sample(struct trace_writer* writer, struct sample* sample, struct symbolizer* sym)
 {
+    if (sample->nr > 100) {
+        fprintf(stderr, "ERROR: sample at loc %p reported nr %lu\n", (void*)sample, sample->nr);
+        return;
+    }
+
+    uint32_t symbols[100];
+    for (uint64_t i = 0; i < sample->nr; i++) {
+        symbols[i] = 0;
+        if (sym->dwfl) {
+            const struct symcache_entry* entry = resolve_ip(sym, sample->ips[i]);
+            if (entry && entry->symbol)
+                symbols[i] = trace_writer_string(writer, entry->symbol, entry->len);
+        }
+    }
+
+    struct trace_sample record = {
+        .time_ns = sample->time + get_realtime_offset(),
+        .pid = sample->pid,
+        .tid = sample->tid,
+        .cpu = sample->cpu,
+        .nr = sample->nr,
+        .period = sample->period,
+    };
+    trace_writer_sample(writer, &record, sample->ips, symbols);
+}
+
+// Live view counterpart of append_symbols_from_sample(): the same frames,
+// added to the rolling aggregate, without the PERF_CONTEXT_* markers so
+// that the innermost frame is a function.
+void live_sample(struct live_top* live, struct sample* sample, struct symbolizer* sym)
+{
+    if (sample->nr > 100)
+        return;
+
+    // A later miss of the same sample can start the symbol cache over and
+    // reuse its string pool, so each name is copied out as it is resolved.
+    // Once names is full, the remaining frames are shown as addresses.
+    char names[16384];
+    size_t used = 0;
+    struct live_frame frames[100];
+    size_t nr = 0;
+    for (uint64_t i = 0; i < sample->nr; i++) {
+        if (sample->ips[i] >= PERF_CONTEXT_MAX)
+            continue;
+        const struct symcache_entry* entry = sym->dwfl ? resolve_ip(sym, sample->ips[i]) : NULL;
+        frames[nr].name = names + used;
+        if (entry && entry->symbol && entry->len <= sizeof(names) - used) {
+            memcpy(names + used, entry->symbol, entry->len);
+            frames[nr].len = entry->len;
+        }
+        else if (sizeof(names) - used > 20)
+            frames[nr].len = snprintf(names + used, 20, "0x%lx", sample->ips[i]);
+        else
+            break;
+        used += frames[nr].len;
+        nr++;
+    }
+
+    struct chain_tag tag = {
+        .tagged = 1,
+        .time_ns = sample->time + get_realtime_offset(),
+        .cpu = sample->cpu,
+        .tid = sample->tid,
+        .period = sample->period,
+    };
+    if (live_top_sample(live, &tag, frames, nr) != 0)
+        fprintf(stderr, "ERROR: Memory allocation failed for the live view\n");
+}
+
+// Interval in which a reused buffer last allocated, to show that the
+// sampling loop settles into a steady state without heap allocations.
+struct alloc_watch {
+    unsigned long allocs;
+    u64 intervals;
+    u64 last_alloc;
+};
+
+void alloc_watch_update(struct alloc_watch* watch, unsigned long allocs) {
+    watch->intervals++;
+    if (allocs != watch->allocs) {
+        watch->allocs = allocs;
+        watch->last_alloc = watch->intervals;
+    }
+}
+
+void alloc_watch_print(const struct alloc_watch* watch, const char* name) {
+    fprintf(stderr, "%s: %lu allocations, the last in interval %lu of %lu\n", name, watch->allocs,
+        watch->last_alloc, watch->intervals);
+}
+
+// Per-interval accounting of what the kernel could not deliver.
+struct ring_stats {
+    u64 samples;
+    u64 lost;        // samples dropped because the ring buffer was full
+    u64 throttled;   // times the kernel throttled the event for sampling too fast
+    u64 unthrottled;
+    u64 other;       // records of any other type
+    u64 dropped;     // samples the pipeline queue had no room for
+};
+
+void ring_stats_add(struct ring_stats* total, const struct ring_stats* interval) {
+    total->samples += interval->samples;
+    total->lost += interval->lost;
+    total->throttled += interval->throttled;
+    total->unthrottled += interval->unthrottled;
+    total->other += interval->other;
+    total->dropped += interval->dropped;
+}
+
+// Where drained records go. In text mode the callchains are appended to
+// callchains, as stack ids unless ids is NULL, and the rows printed to out;
+// with a trace writer the samples are written out instead. Samples also go
+// to live when the live view is on.
+struct record_sink {
+    struct symbolizer* sym;
+    struct trace_writer* writer;
+    struct strbuffer* callchains;
+    struct stack_ids* ids;
+    FILE* out;
+    struct ring_stats* stats;
+    struct live_top* live;
+};
+
+void handle_record(struct perf_event_header* record, void* ctx)
+{
+    struct record_sink* sink = ctx;
+    struct ring_stats* stats = sink->stats;
+    switch (record->type) {
+    case PERF_RECORD_SAMPLE:
+        stats->samples++;
+        if (sink->writer)
+            write_sample(sink->writer, (struct sample*)record, sink->sym);
+        else
+            append_symbols_from_sample(sink->callchains, sink->ids, (struct sample*)record, sink->sym);
+        if (sink->live)
+            live_sample(sink->live, (struct sample*)record, sink->sym);
+        break;
+    case PERF_RECORD_MMAP: {
+        struct mmap_event* event = (struct mmap_event*)record;
+        if (sink->writer)
+            trace_writer_mmap(sink->writer, event->pid, event->tid, event->addr, event->len, event->pgoff, event->filename);
+        if (sink->sym->dwfl) {
+            // New executable mapping, cached symbols may now be wrong
+            symcache_invalidate(&sink->sym->cache);
+            refresh_dwfl(sink->sym->dwfl, sink->sym->pid);
+        }
+        break;
+    }
+    case PERF_RECORD_LOST:
+        stats->lost += ((struct lost_event*)record)->lost;
+        break;
+    case PERF_RECORD_THROTTLE:
+        stats->throttled++;
+        break;
+    case PERF_RECORD_UNTHROTTLE:
+        stats->unthrottled++;
+        break;
+    default:
+        stats->other++;
+        break;
+    }
+}
+
+typedef void (*record_fn)(struct perf_event_header* record, void* ctx);
+
+// Drain one ring buffer, passing every record to handle. Records that wrap
+// around the end of the buffer are copied out first, into a scratch buffer
+// big enough for any record (header.size is 16 bits). Only the reader
+// thread drains.
+void drain_ring_buffer(struct perf_event_mmap_page* buffer, record_fn handle, void* ctx)
+{
+    static char scratch[1 << 16] __attribute__((aligned(8)));
+
     uint64_t head = buffer->data_head;
     __sync_synchronize();
 
     if (head == buffer->data_tail)
-        return NULL;
+        return;
 
     void* buffer_start = (void*)buffer + buffer->data_offset;
-    struct strbuffer* callchains = strnew(1024);
-    if (!callchains) {
-        fprintf(stderr, "ERROR: Memory allocation failed in perf.c:get_callchains\n");
-        return NULL;
-    }
 
     struct perf_event_header header;
     while (buffer->data_tail < head) {
@@ -232,138 +570,759 @@ char* get_callchains(struct perf_event_mmap_page* buffer, Dwfl* dwfl)
         memcpy(&header, buffer_start + relative_loc, header_bytes_remaining);
         memcpy((void*)&header + header_bytes_remaining, buffer_start, sizeof(struct perf_event_header) - header_bytes_remaining);
 
-        struct sample* sample = buffer_start + relative_loc;
-        int used_malloc = 0;
+        struct perf_event_header* record = buffer_start + relative_loc;
         if (bytes_remaining < header.size) {
-            sample = malloc(header.size);
-            used_malloc = 1;
-            memcpy(sample, buffer_start + relative_loc, bytes_remaining);
-            memcpy((void*)sample + bytes_remaining, buffer_start, header.size - bytes_remaining);
+            record = (struct perf_event_header*)scratch;
+            memcpy(record, buffer_start + relative_loc, bytes_remaining);
+            memcpy((void*)record + bytes_remaining, buffer_start, header.size - bytes_remaining);
         }
-        append_symbols_from_sample(callchains, sample, dwfl);
-        if (used_malloc)
-            free(sample);
+        handle(record, ctx);
 
         buffer->data_tail += header.size;
     }
 
     __sync_synchronize();
-    return strfreewrap(callchains);
 }
 
-long long get_energy() {
-    FILE* fp;
-    char energy_buffer[256];
-    fp = fopen("/sys/class/powercap/intel-rapl/intel-rapl:0/energy_uj", "r");
-    if (fp == NULL) {
-        perror("fopen");
-        exit(EXIT_FAILURE);
-    }
-    if (!fgets(energy_buffer, sizeof(energy_buffer), fp)) {
-        perror("fgets");
-        exit(EXIT_FAILURE);
+void drain_all(struct perf_streams* streams, record_fn handle, void* ctx)
+{
+    for (size_t i = 0; i < streams->count; i++)
+        drain_ring_buffer(streams->streams[i].buffer, handle, ctx);
+}
+
+// Event-driven mode parks records in the window covering their timestamp
+// until the window is reported.
+struct window_sink {
+    struct window_queue* windows;
+    uint64_t time_ns; // CLOCK_MONOTONIC time of the drain
+};
+
+// Kernel timestamp of a record, or the drain time for records without one.
+uint64_t record_time(struct perf_event_header* record, uint64_t drain_ns)
+{
+    if (record->type == PERF_RECORD_SAMPLE)
+        return ((struct sample*)record)->time;
+    if (record->size >= sizeof(struct perf_event_header) + sizeof(struct sample_id)) {
+        struct sample_id* id = (void*)record + record->size - sizeof(struct sample_id);
+        return id->time;
     }
-    fclose(fp);
-    return atoll(energy_buffer);
+    return drain_ns;
 }
 
-long get_process_time(pid_t pid) {
-    char path[256];
-    FILE* fp;
-    char line[1024];
-    long utime = 0, stime = 0;
+void queue_record(struct perf_event_header* record, void* ctx)
+{
+    struct window_sink* sink = ctx;
+    if (window_queue_add(sink->windows, record_time(record, sink->time_ns), record, record->size) != 0)
+        fprintf(stderr, "ERROR: Memory allocation failed for a sample window\n");
+}
 
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
-    if ((fp = fopen(path, "r")) == NULL) return -1;
+void get_utc_timestamp(uint64_t realtime_ns, char *buffer, size_t buffer_size) {
+    struct timespec ts = { .tv_sec = realtime_ns / 1000000000ULL, .tv_nsec = realtime_ns % 1000000000ULL };
+    struct tm tm_utc;
+    gmtime_r(&ts.tv_sec, &tm_utc);
+    
+    // Format base time (YYYY-MM-DDTHH:MM:SS)
+    strftime(buffer, buffer_size, "%Y-%m-%dT%H:%M:%S", &tm_utc);
+    
+    // Append microseconds (6 digits) and 'Z'
+    int microsec = ts.tv_nsec / 1000; // Convert nanoseconds to microseconds
+    snprintf(buffer + strlen(buffer), buffer_size - strlen(buffer), 
+            ".%06dZ", microsec);
+}
 
-    if (fgets(line, sizeof(line), fp) == NULL) {
-        fclose(fp);
+// Record the executable mappings that existed before sampling started, so
+// the trace can be symbolized offline without the saved maps file.
+int write_proc_maps(struct trace_writer* writer, pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    FILE* fp = fopen(path, "r");
+    if (!fp)
         return -1;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        struct procmap map;
+        if (procmaps_parse_line(line, &map) == 0 && map.exec && map.path)
+            trace_writer_mmap(writer, pid, pid, map.start, map.end - map.start, map.pgoff, map.path);
     }
     fclose(fp);
+    return 0;
+}
 
-    char* start = strchr(line, '(');
-    char* end = strrchr(line, ')');
-    if (!start || !end) return -1;
+uint64_t get_monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-    char* p = end + 1;
-    int field = 2;
-    while (*p && field < 14) {
-        if (*p == ' ') {
-            field++;
-            while (*++p == ' ');
+uint64_t get_realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Sample the offset between the two clocks, taking the tightest of a few
+// reads.
+void update_realtime_offset() {
+    uint64_t best_gap = UINT64_MAX;
+    for (int i = 0; i < 3; i++) {
+        uint64_t before = get_monotonic_ns();
+        uint64_t realtime = get_realtime_ns();
+        uint64_t after = get_monotonic_ns();
+        if (after - before < best_gap) {
+            best_gap = after - before;
+            __atomic_store_n(&realtime_offset_ns, (int64_t)realtime - (int64_t)(before + (after - before) / 2), __ATOMIC_RELAXED);
         }
-        else
-            p++;
     }
-    sscanf(p, "%ld %ld", &utime, &stime);
-    return utime + stime;
 }
 
-long get_total_cpu_time() {
-    FILE* fp;
-    char line[1024];
-    long user, nice, system, idle, iowait, irq, softirq;
+static volatile sig_atomic_t stop_requested = 0;
 
-    if ((fp = fopen("/proc/stat", "r")) == NULL) return -1;
-    fgets(line, sizeof(line), fp);
-    fclose(fp);
+void handle_stop(int signum) {
+    (void)signum;
+    stop_requested = 1;
+}
 
-    if (sscanf(line, "cpu  %ld %ld %ld %ld %ld %ld %ld",
-        &user, &nice, &system, &idle, &iowait, &irq, &softirq) != 7)
+// Energy and CPU time counters as of the previous reading.
+struct usage_meter {
+    pid_t pid;
+    struct rapl rapl;
+    uint64_t energy_uj; // all packages
+    struct procstat procstat;
+    struct gpu_sampler* gpu;  // NULL without a GPU provider
+    double gpu_energy;        // joules
+    long process_time;
+    long total_time;
+    uint64_t time_ns; // CLOCK_MONOTONIC
+    uint64_t kind_uj[RAPL_OTHER + 1]; // totals per domain kind, for the metrics thread
+};
+
+int usage_meter_start(struct usage_meter* meter, pid_t pid) {
+    meter->pid = pid;
+    rapl_read(&meter->rapl);
+    meter->energy_uj = rapl_energy_uj(&meter->rapl, RAPL_PACKAGE);
+    meter->gpu_energy = meter->gpu ? gpu_sampler_energy(meter->gpu) : 0;
+    meter->time_ns = get_monotonic_ns();
+    if (procstat_open(&meter->procstat, pid) != 0)
+        return -1;
+    meter->process_time = procstat_process_time(&meter->procstat);
+    meter->total_time = procstat_total_time(&meter->procstat);
+    if (meter->process_time == -1 || meter->total_time == -1)
         return -1;
+    return 0;
+}
+
+// Power and CPU usage since the previous reading.
+void usage_meter_read(struct usage_meter* meter, struct trace_interval* interval) {
+    if (rapl_read(&meter->rapl) != 0)
+        fprintf(stderr, "Error reading RAPL energy counters\n");
+    uint64_t energy_uj = rapl_energy_uj(&meter->rapl, RAPL_PACKAGE);
+    uint64_t delta_energy = energy_uj - meter->energy_uj;
+    meter->energy_uj = energy_uj;
+    for (int kind = 0; kind <= RAPL_OTHER; kind++)
+        __atomic_store_n(&meter->kind_uj[kind], rapl_energy_uj(&meter->rapl, kind), __ATOMIC_RELAXED);
+
+    uint64_t now = get_monotonic_ns();
+    double interval_seconds = (now - meter->time_ns) / 1e9;
+    update_realtime_offset();
+    interval->timestamp_ns = now + get_realtime_offset();
+    interval->duration_ns = now - meter->time_ns;
+    meter->time_ns = now;
+    interval->power = (delta_energy / 1e6) / interval_seconds;
+    interval->gpu_power = 0;
+    if (meter->gpu) {
+        double gpu_energy = gpu_sampler_energy(meter->gpu);
+        interval->gpu_power = (gpu_energy - meter->gpu_energy) / interval_seconds;
+        meter->gpu_energy = gpu_energy;
+    }
+
+    long curr_process_time = procstat_process_time(&meter->procstat);
+    long curr_total_time = procstat_total_time(&meter->procstat);
+    interval->usage = 0.0;
+    if (curr_process_time == -1 || curr_total_time == -1) {
+        fprintf(stderr, "Error reading CPU time values\n");
+    }
+    else {
+        long delta_process = curr_process_time - meter->process_time;
+        long delta_total = curr_total_time - meter->total_time;
+        if (delta_total > 0)
+            interval->usage = 100.0 * delta_process / delta_total;
+        else
+            fprintf(stderr, "No CPU time elapsed\n");
 
-    return user + nice + system + irq + softirq;
+        meter->process_time = curr_process_time;
+        meter->total_time = curr_total_time;
+    }
 }
 
-// double get_gpu_power(unsigned int gpu_count) {
-//     for (unsigned int i = 0; i < gpu_count; i++) {
-//         nvmlDevice_t device;
-//         nvmlReturn_t result = nvmlDeviceGetHandleByIndex(i, &device);
-//         if (result != NVML_SUCCESS) {
-//             fprintf(stderr, "Failed to get device handle\n");
-//             continue;
-//         }
+// The live top-N view (-L): the rolling aggregate kept by the symbolizer
+// thread, redrawn on stderr about once a second or written to a snapshot
+// file, which is replaced whole so that readers never see half of one.
+#define LIVE_REFRESH_NS 1000000000ULL
+
+struct live_view {
+    struct live_top top;
+    pid_t pid;
+    size_t n;
+    const char* path;  // NULL for stderr
+    char tmp_path[4096];
+    int tty;           // stderr is a terminal, redraw in place
+    uint64_t next_ns;  // interval timestamp of the next refresh
+    struct alloc_watch allocs;
+};
 
-//         unsigned int power;
-//         result = nvmlDeviceGetPowerUsage(device, &power);
-//         if (result != NVML_SUCCESS) {
-//             fprintf(stderr, "Failed to get power usage for device %u\n", i);
-//             continue;
-//         }
+void live_view_show(struct live_view* view, uint64_t timestamp_ns) {
+    // Room for the watts and share columns
+    size_t width = 0;
+    struct winsize size;
+    if (!view->path && view->tty && ioctl(STDERR_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 40)
+        width = size.ws_col - 20;
+
+    char timestamp[32];
+    char header[128];
+    get_utc_timestamp(timestamp_ns, timestamp, sizeof(timestamp));
+    int header_len = snprintf(header, sizeof(header), "%sdw-pid %d at %s: ",
+        !view->path && view->tty ? "\033[H\033[J" : "", view->pid, timestamp);
+    size_t len;
+    const char* text = live_top_render(&view->top, view->n, width, &len);
+    struct iovec parts[] = {
+        { .iov_base = header, .iov_len = header_len },
+        { .iov_base = (void*)text, .iov_len = len },
+        { .iov_base = "\n", .iov_len = view->path ? 0 : 1 },
+    };
+
+    // One write each, so that other messages do not land inside the view
+    if (!view->path) {
+        if (writev(STDERR_FILENO, parts, 3) == -1)
+            perror("live view");
+        return;
+    }
+    int fd = open(view->tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror(view->tmp_path);
+        return;
+    }
+    int written = writev(fd, parts, 3) != -1;
+    if (close(fd) != 0 || !written || rename(view->tmp_path, view->path) != 0)
+        perror(view->path);
+}
 
-//         return (double)power / 1000.0; // Convert to watts
-//     }
-//     return 0;
-// }
+// Add a closed interval to the view, and show it when it is due.
+void live_view_interval(struct live_view* view, const struct trace_interval* interval) {
+    live_top_interval(&view->top, interval);
+    alloc_watch_update(&view->allocs, view->top.allocs);
+    if (interval->timestamp_ns < view->next_ns)
+        return;
+    live_view_show(view, interval->timestamp_ns);
+    view->next_ns = interval->timestamp_ns + LIVE_REFRESH_NS;
+}
 
-void get_utc_timestamp(char *buffer, size_t buffer_size) {
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    struct tm tm_utc;
-    gmtime_r(&ts.tv_sec, &tm_utc);
-    
-    // Format base time (YYYY-MM-DDTHH:MM:SS)
-    strftime(buffer, buffer_size, "%Y-%m-%dT%H:%M:%S", &tm_utc);
-    
-    // Append microseconds (6 digits) and 'Z'
-    int microsec = ts.tv_nsec / 1000; // Convert nanoseconds to microseconds
-    snprintf(buffer + strlen(buffer), buffer_size - strlen(buffer), 
-            ".%06dZ", microsec);
+// The reader thread drains the ring buffers and reads the meters, and
+// hands raw records and closed intervals to the symbolizer thread through
+// records. Symbolizing and formatting then never delay a drain, and output
+// is written by a third thread (see async_output.h).
+struct tracer {
+    pid_t pid;
+    struct perf_streams streams;
+    struct perf_event_attr attr;
+    int per_thread;
+    struct usage_meter meter;
+
+    // Reader side
+    struct spsc_queue records;
+    u64 dropped;                   // samples dropped since the last interval
+    u64 dropped_records;           // records of any type dropped, in total
+
+    // Symbolizer side
+    pthread_t symbolizer;
+    struct record_sink sink;
+    struct ring_stats stats;       // current interval
+    struct ring_stats total_stats;
+    struct alloc_watch callchain_allocs;
+    struct live_view* live;        // NULL without -L
+
+    // Copies of the totals above for the metrics thread (-M), which reads
+    // them with relaxed atomics
+    struct ring_stats published;
+    u64 published_intervals;
+    u64 published_hits;
+    u64 published_misses;
+};
+
+// Messages from the reader to the symbolizer thread
+enum {
+    PIPELINE_RECORD = 1,    // a perf record
+    PIPELINE_INTERVAL,      // struct pipeline_interval, after its records
+    PIPELINE_STOP,
+};
+
+struct pipeline_interval {
+    struct trace_interval interval;
+    u64 dropped;
+};
+
+// Queue space only intervals may use, so that a full queue drops records
+// but never the interval they belong to
+#define PIPELINE_RESERVE 16384
+
+int target_exited(pid_t pid) {
+    if (kill(pid, 0) == -1 && errno == ESRCH) {
+        fprintf(stderr, "Process %d has exited. Exiting program.\n", pid);
+        return 1;
+    }
+    return 0;
+}
+
+// The records left in the ring buffer of a thread that exited.
+struct drain_target {
+    record_fn handle;
+    void* ctx;
+};
+
+void drain_stream(struct perf_stream* stream, void* ctx) {
+    struct drain_target* target = ctx;
+    drain_ring_buffer(stream->buffer, target->handle, target->ctx);
+}
+
+// Pick up threads started since the last scan and drop those that exited,
+// draining their records into handle.
+void rescan_threads(struct tracer* tracer, record_fn handle, void* ctx) {
+    struct drain_target target = { .handle = handle, .ctx = ctx };
+    tracer->attr.disabled = 0;
+    perf_streams_open_threads(&tracer->streams, &tracer->attr, tracer->pid, drain_stream, &target);
+}
+
+// Symbolizer side: the totals as of the interval just closed.
+void publish_totals(struct tracer* tracer) {
+    const struct ring_stats* total = &tracer->total_stats;
+    struct ring_stats* published = &tracer->published;
+    __atomic_store_n(&published->samples, total->samples, __ATOMIC_RELAXED);
+    __atomic_store_n(&published->lost, total->lost, __ATOMIC_RELAXED);
+    __atomic_store_n(&published->throttled, total->throttled, __ATOMIC_RELAXED);
+    __atomic_store_n(&published->dropped, total->dropped, __ATOMIC_RELAXED);
+    __atomic_store_n(&tracer->published_intervals, tracer->published_intervals + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&tracer->published_hits, tracer->sink.sym->cache.hits, __ATOMIC_RELAXED);
+    __atomic_store_n(&tracer->published_misses, tracer->sink.sym->cache.misses, __ATOMIC_RELAXED);
+}
+
+// Metrics thread: render the running totals in the Prometheus text format.
+void render_metrics(FILE* out, void* ctx) {
+    struct tracer* tracer = ctx;
+    struct usage_meter* meter = &tracer->meter;
+    char labels[64];
+
+    metrics_describe(out, "dwpid_energy_joules_total", "counter", "RAPL energy since tracing started, per domain kind.");
+    for (int kind = 0; kind <= RAPL_OTHER; kind++) {
+        int present = 0;
+        for (size_t i = 0; i < meter->rapl.count; i++)
+            present |= meter->rapl.domains[i].kind == (enum rapl_kind)kind;
+        if (!present)
+            continue;
+        snprintf(labels, sizeof(labels), "domain=\"%s\"", rapl_kind_name(kind));
+        metrics_sample(out, "dwpid_energy_joules_total", labels,
+            __atomic_load_n(&meter->kind_uj[kind], __ATOMIC_RELAXED) / 1e6);
+    }
+    if (meter->gpu) {
+        metrics_describe(out, "dwpid_gpu_energy_joules_total", "counter", "GPU energy since tracing started.");
+        metrics_sample(out, "dwpid_gpu_energy_joules_total", NULL, gpu_sampler_energy(meter->gpu));
+    }
+
+    struct ring_stats* published = &tracer->published;
+    metrics_describe(out, "dwpid_samples_total", "counter", "Samples taken.");
+    metrics_sample(out, "dwpid_samples_total", NULL, __atomic_load_n(&published->samples, __ATOMIC_RELAXED));
+    metrics_describe(out, "dwpid_samples_lost_total", "counter", "Samples lost, by where they were lost.");
+    metrics_sample(out, "dwpid_samples_lost_total", "where=\"ring_buffer\"",
+        __atomic_load_n(&published->lost, __ATOMIC_RELAXED));
+    metrics_sample(out, "dwpid_samples_lost_total", "where=\"queue\"",
+        __atomic_load_n(&published->dropped, __ATOMIC_RELAXED));
+    metrics_describe(out, "dwpid_throttle_events_total", "counter", "Times the kernel throttled sampling.");
+    metrics_sample(out, "dwpid_throttle_events_total", NULL, __atomic_load_n(&published->throttled, __ATOMIC_RELAXED));
+    metrics_describe(out, "dwpid_intervals_total", "counter", "Intervals reported.");
+    metrics_sample(out, "dwpid_intervals_total", NULL, __atomic_load_n(&tracer->published_intervals, __ATOMIC_RELAXED));
+
+    u64 hits = __atomic_load_n(&tracer->published_hits, __ATOMIC_RELAXED);
+    u64 misses = __atomic_load_n(&tracer->published_misses, __ATOMIC_RELAXED);
+    metrics_describe(out, "dwpid_symcache_lookups_total", "counter", "Symbol cache lookups, by result.");
+    metrics_sample(out, "dwpid_symcache_lookups_total", "result=\"hit\"", hits);
+    metrics_sample(out, "dwpid_symcache_lookups_total", "result=\"miss\"", misses);
+    metrics_describe(out, "dwpid_symcache_hit_ratio", "gauge", "Share of symbol cache lookups that hit.");
+    metrics_sample(out, "dwpid_symcache_hit_ratio", NULL, hits + misses ? (double)hits / (hits + misses) : 0.0);
+
+    struct spsc_queue* records = &tracer->records;
+    metrics_describe(out, "dwpid_queue_depth_bytes", "gauge", "Records waiting between the reader and the symbolizer.");
+    metrics_sample(out, "dwpid_queue_depth_bytes", NULL, spsc_queue_depth(records));
+    metrics_describe(out, "dwpid_queue_peak_bytes", "gauge", "Deepest the record queue has been.");
+    metrics_sample(out, "dwpid_queue_peak_bytes", NULL, __atomic_load_n(&records->peak, __ATOMIC_RELAXED));
+    metrics_describe(out, "dwpid_queue_capacity_bytes", "gauge", "Size of the record queue.");
+    metrics_sample(out, "dwpid_queue_capacity_bytes", NULL, records->capacity);
+    metrics_describe(out, "dwpid_queue_dropped_records_total", "counter", "Records of any type the full queue dropped.");
+    metrics_sample(out, "dwpid_queue_dropped_records_total", NULL,
+        __atomic_load_n(&tracer->dropped_records, __ATOMIC_RELAXED));
+
+    struct timespec cpu;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    metrics_describe(out, "dwpid_cpu_seconds_total", "counter", "CPU time dw-pid itself used, all threads.");
+    metrics_sample(out, "dwpid_cpu_seconds_total", NULL, cpu.tv_sec + cpu.tv_nsec / 1e9);
+    metrics_describe(out, "dwpid_target_pid", "gauge", "Process being traced.");
+    metrics_sample(out, "dwpid_target_pid", NULL, tracer->pid);
+}
+
+// Write one interval with the samples handled since the previous one.
+// Samples the pipeline dropped count as lost.
+void report_interval(struct tracer* tracer, struct trace_interval* interval, u64 dropped) {
+    struct record_sink* sink = &tracer->sink;
+    tracer->stats.dropped = dropped;
+    interval->lost_samples = tracer->stats.lost + dropped;
+    interval->throttled = tracer->stats.throttled;
+    ring_stats_add(&tracer->total_stats, &tracer->stats);
+    memset(&tracer->stats, 0, sizeof(tracer->stats));
+    publish_totals(tracer);
+    if (tracer->live)
+        live_view_interval(tracer->live, interval);
+
+    if (sink->writer) {
+        trace_writer_interval(sink->writer, interval);
+        return;
+    }
+
+    // Frames and stacks first seen in this interval
+    if (sink->ids && sink->ids->defs->currsize) {
+        fwrite(sink->ids->defs->buffer, 1, sink->ids->defs->currsize, sink->out);
+        strclear(sink->ids->defs);
+    }
+
+    char timestamp[32];
+    get_utc_timestamp(interval->timestamp_ns, timestamp, sizeof(timestamp));
+    fprintf(sink->out, "%s, %s, %.6f, %.2f, %.6f, %lu, %lu, %.6f\n", timestamp, sink->callchains->buffer,
+        interval->power, interval->usage, interval->gpu_power, interval->lost_samples, interval->throttled,
+        interval->duration_ns / 1e9);
+    strclear(sink->callchains);
+    alloc_watch_update(&tracer->callchain_allocs, sink->callchains->allocs);
+}
+
+void* symbolizer_main(void* arg) {
+    struct tracer* tracer = arg;
+    unsigned int attempt = 0;
+    for (;;) {
+        struct spsc_message* message = spsc_queue_peek(&tracer->records);
+        if (!message) {
+            spsc_queue_wait(&tracer->records, &attempt);
+            continue;
+        }
+        attempt = 0;
+        if (message->type == PIPELINE_STOP) {
+            spsc_queue_pop(&tracer->records);
+            return NULL;
+        }
+        if (message->type == PIPELINE_RECORD) {
+            handle_record((struct perf_event_header*)message->data, &tracer->sink);
+        }
+        else if (message->type == PIPELINE_INTERVAL) {
+            struct pipeline_interval* closed = (struct pipeline_interval*)message->data;
+            report_interval(tracer, &closed->interval, closed->dropped);
+        }
+        spsc_queue_pop(&tracer->records);
+    }
+}
+
+// Reader side: copy a drained record into the queue, or count it dropped.
+void forward_record(struct perf_event_header* record, void* ctx) {
+    struct tracer* tracer = ctx;
+    if (spsc_queue_push(&tracer->records, PIPELINE_RECORD, record, record->size, NULL, 0, PIPELINE_RESERVE) == 0)
+        return;
+    __atomic_store_n(&tracer->dropped_records, tracer->dropped_records + 1, __ATOMIC_RELAXED);
+    if (record->type == PERF_RECORD_SAMPLE)
+        tracer->dropped++;
+}
+
+// Push a message that must not be dropped, waiting for room if needed.
+void push_message(struct tracer* tracer, uint32_t type, const void* data, size_t len) {
+    unsigned int attempt = 0;
+    while (spsc_queue_push(&tracer->records, type, data, len, NULL, 0, 0) != 0)
+        spsc_queue_backoff(&attempt);
+}
+
+// Close the interval holding the records forwarded since the previous one.
+void close_interval(struct tracer* tracer, struct trace_interval* interval) {
+    struct pipeline_interval closed = { .interval = *interval, .dropped = tracer->dropped };
+    push_message(tracer, PIPELINE_INTERVAL, &closed, sizeof(closed));
+    tracer->dropped = 0;
+}
+
+// Fixed cadence: every report_ms read the power and CPU counters and report
+// whatever the ring buffers hold, draining any buffer that crosses its
+// wakeup watermark in between.
+void run_polling(struct tracer* tracer, unsigned int report_ms) {
+    struct perf_stream* ready[64];
+    uint64_t report_ns = report_ms * 1000000ULL;
+    uint64_t next_report = get_monotonic_ns() + report_ns;
+    unsigned int intervals = 0;
+    while (!stop_requested) {
+        while (!stop_requested) {
+            uint64_t now = get_monotonic_ns();
+            if (now >= next_report)
+                break;
+            int timeout_ms = (next_report - now + 999999) / 1000000;
+            int n = perf_streams_wait(&tracer->streams, ready, 64, timeout_ms, NULL);
+            if (n < 0) {
+                perror("epoll_wait");
+                return;
+            }
+            for (int i = 0; i < n; i++)
+                drain_ring_buffer(ready[i]->buffer, forward_record, tracer);
+        }
+        next_report += report_ns;
+        uint64_t now = get_monotonic_ns();
+        if (next_report < now)
+            next_report = now + report_ns;
+
+        if (target_exited(tracer->pid))
+            return;
+
+        struct trace_interval interval = { 0 };
+        usage_meter_read(&tracer->meter, &interval);
+        drain_all(&tracer->streams, forward_record, tracer);
+
+        // About once a second
+        if (tracer->per_thread && ++intervals % (1000 / report_ms + 1) == 0)
+            rescan_threads(tracer, forward_record, tracer);
+
+        close_interval(tracer, &interval);
+    }
+}
+
+// Closed windows kept back so that records drained late still reach them.
+#define WINDOW_LAG 1
+
+// Report the closed windows beyond the newest keep.
+void report_windows(struct tracer* tracer, struct window_queue* windows, size_t keep) {
+    struct window* window;
+    while (windows->count - 1 > keep && (window = window_queue_oldest(windows)) != NULL) {
+        for (size_t offset = 0; offset < window->len;) {
+            struct perf_event_header* record = (struct perf_event_header*)(window->records + offset);
+            forward_record(record, tracer);
+            offset += record->size;
+        }
+        close_interval(tracer, &window->interval);
+        window_queue_pop(windows);
+    }
+}
+
+// Event driven: ring buffers are drained when they pass their wakeup
+// watermark, power and CPU time are read on a timerfd of their own every
+// power_ms, and records are matched to the power windows by timestamp.
+void run_event_driven(struct tracer* tracer, unsigned int power_ms) {
+    uint64_t power_ns = power_ms * 1000000ULL;
+    struct itimerspec spec = {
+        .it_interval = { .tv_sec = power_ns / 1000000000ULL, .tv_nsec = power_ns % 1000000000ULL },
+        .it_value = { .tv_sec = power_ns / 1000000000ULL, .tv_nsec = power_ns % 1000000000ULL },
+    };
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer_fd == -1 || timerfd_settime(timer_fd, 0, &spec, NULL) == -1
+        || perf_streams_watch(&tracer->streams, timer_fd) == -1) {
+        perror("timerfd");
+        if (timer_fd != -1)
+            close(timer_fd);
+        return;
+    }
+
+    struct window_queue windows;
+    if (window_queue_init(&windows, WINDOW_LAG + 2, tracer->meter.time_ns) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed for the sample windows\n");
+        close(timer_fd);
+        return;
+    }
+    struct window_sink sink = { .windows = &windows };
+    struct alloc_watch window_allocs = { 0 };
+
+    struct perf_stream* ready[64];
+    unsigned int ticks = 0;
+    while (!stop_requested) {
+        int ticked;
+        int n = perf_streams_wait(&tracer->streams, ready, 64, -1, &ticked);
+        if (n < 0) {
+            perror("epoll_wait");
+            break;
+        }
+        sink.time_ns = get_monotonic_ns();
+        for (int i = 0; i < n; i++)
+            drain_ring_buffer(ready[i]->buffer, queue_record, &sink);
+
+        uint64_t expirations;
+        if (!ticked || read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            continue;
+
+        if (target_exited(tracer->pid))
+            break;
+
+        // Buffers below their watermark are only looked at here, once per
+        // power reading
+        sink.time_ns = get_monotonic_ns();
+        drain_all(&tracer->streams, queue_record, &sink);
+
+        struct trace_interval interval = { 0 };
+        usage_meter_read(&tracer->meter, &interval);
+        window_queue_close(&windows, tracer->meter.time_ns, &interval);
+        alloc_watch_update(&window_allocs, windows.allocs);
+
+        if (tracer->per_thread && ++ticks % (1000 / power_ms + 1) == 0)
+            rescan_threads(tracer, queue_record, &sink);
+
+        report_windows(tracer, &windows, WINDOW_LAG);
+    }
+    report_windows(tracer, &windows, 0);
+    if (windows.late)
+        fprintf(stderr, "%lu records arrived after their window was reported\n", windows.late);
+    alloc_watch_print(&window_allocs, "sample windows");
+
+    window_queue_free(&windows);
+    close(timer_fd);
 }
 
 int main(int argc, char** argv) {
     // Default values for optional arguments.
     unsigned int callchains_per_report = 20;
     unsigned int report_sleep_ms = 5;
+    const char* trace_path = NULL;
+    int raw_ips = 0;
+    unsigned int data_pages = 64;
+    const char* cgroup_path = NULL;
+    int event_driven = 0;
+    unsigned int power_ms = 0;
+    const char* rapl_root = RAPL_DEFAULT_ROOT;
+    const char* energy_backend = "auto";
+    const char* gpu_backend = "auto";
+    int reader_cpu = -1;
+    int full_chains = 0;
+    size_t queue_kib = 8192;
+    const char* compression = NULL;
+    size_t live_n = 0;
+    const char* live_path = NULL;
+    double half_life_s = 10;
+    const char* metrics_address = NULL;
+    const char* prog = *argv;
+
+    struct tracer tracer = { 0 };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:rp:g:tEP:R:B:G:C:Q:FZ:L:S:H:M:")) != -1) {
+        switch (opt) {
+        case 'o':
+            trace_path = optarg;
+            break;
+        case 'r':
+            raw_ips = 1;
+            break;
+        case 'p':
+            data_pages = atoi(optarg);
+            if (data_pages == 0 || (data_pages & (data_pages - 1)) != 0) {
+                fprintf(stderr, "-p: the number of data pages must be a power of two\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'g':
+            cgroup_path = optarg;
+            break;
+        case 't':
+            tracer.per_thread = 1;
+            break;
+        case 'E':
+            event_driven = 1;
+            break;
+        case 'P':
+            power_ms = atoi(optarg);
+            if (power_ms == 0) {
+                fprintf(stderr, "-P: the power interval must be at least 1 ms\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'R':
+            rapl_root = optarg;
+            break;
+        case 'B':
+            if (strcmp(optarg, "sysfs") != 0 && strcmp(optarg, "pmu") != 0 && strcmp(optarg, "auto") != 0) {
+                fprintf(stderr, "-B: the energy backend must be sysfs, pmu or auto\n");
+                exit(EXIT_FAILURE);
+            }
+            energy_backend = optarg;
+            break;
+        case 'G':
+            gpu_backend = optarg;
+            break;
+        case 'C':
+            reader_cpu = atoi(optarg);
+            break;
+        case 'F':
+            full_chains = 1;
+            break;
+        case 'Z':
+            compression = optarg;
+            break;
+        case 'Q':
+            queue_kib = atoi(optarg);
+            if (queue_kib < 64 || (queue_kib & (queue_kib - 1)) != 0) {
+                fprintf(stderr, "-Q: the queue size must be a power of two of at least 64 KiB\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'L':
+            live_n = atoi(optarg);
+            if (live_n == 0) {
+                fprintf(stderr, "-L: the live view must show at least one stack\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            live_path = optarg;
+            break;
+        case 'M':
+            metrics_address = optarg;
+            break;
+        case 'H':
+            half_life_s = atof(optarg);
+            if (!(half_life_s > 0)) {
+                fprintf(stderr, "-H: the half-life must be more than 0 seconds\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            goto usage;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
 
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <pid> [callchains_per_report] [report_sleep_ms]\n", *argv);
+usage:
+        fprintf(stderr, "Usage: %s [-o trace.bin] [-r] [-p pages] [-g cgroup | -t] [-E [-P ms]] [-B backend] [-R dir] [-G gpu] [-C cpu] [-Q KiB] [-F] [-Z codec] [-L n [-S file] [-H s]] [-M addr] <pid> [callchains_per_report] [report_sleep_ms]\n", prog);
+        fprintf(stderr, "  -o FILE  write a binary trace to FILE instead of CSV to stdout\n");
+        fprintf(stderr, "  -r       record raw ips only, symbolize later with dw-symbolize\n");
+        fprintf(stderr, "  -p N     ring buffer data pages, a power of two (default 64)\n");
+        fprintf(stderr, "  -g DIR   sample every task in the perf_event cgroup DIR, one event per CPU\n");
+        fprintf(stderr, "  -t       one event per thread of <pid> instead of per-CPU events with inherit\n");
+        fprintf(stderr, "  -E       drain ring buffers on their wakeup watermark only, read power on a timer\n");
+        fprintf(stderr, "  -P MS    power and CPU time interval with -E (default report_sleep_ms)\n");
+        fprintf(stderr, "  -B NAME  energy counters: sysfs, pmu (perf power PMU) or auto, pmu if present (default)\n");
+        fprintf(stderr, "  -R DIR   powercap sysfs root holding intel-rapl (default " RAPL_DEFAULT_ROOT ")\n");
+        fprintf(stderr, "  -G GPU   GPU power: nvml, mock:FILE (watts per device, one per line), none or auto,\n");
+        fprintf(stderr, "           nvml when the driver is present (default)\n");
+        fprintf(stderr, "  -C CPU   pin the thread draining the ring buffers to CPU\n");
+        fprintf(stderr, "  -Q KiB   queue between the ring buffer reader and the symbolizer (default 8192)\n");
+        fprintf(stderr, "  -F       full callchains in the CSV instead of frame and stack ids\n");
+        fprintf(stderr, "  -Z SPEC  compress the output, zstd or lz4[:level[:frame_kib]] (default level 3\n");
+        fprintf(stderr, "           for zstd, 0 for lz4, %d KiB frames)\n", COMPRESSOR_FRAME_KIB);
+        fprintf(stderr, "  -L N     live view of the N stacks and functions drawing the most power, redrawn\n");
+        fprintf(stderr, "           on stderr every second\n");
+        fprintf(stderr, "  -S FILE  write the live view to FILE every second instead (default -L 20)\n");
+        fprintf(stderr, "  -H SEC   half-life of the energy in the live view (default 10)\n");
+        fprintf(stderr, "  -M ADDR  serve running counters in the Prometheus text format over HTTP on\n");
+        fprintf(stderr, "           unix:PATH or [IPV4:]PORT (127.0.0.1 by default), at /metrics\n");
         exit(EXIT_FAILURE);
     }
 
     pid_t pid = atoi(argv[1]);
     fprintf(stderr, "Got pid %i\n", pid);
+    tracer.pid = pid;
 
     // Check if optional arguments are provided.
     if (argc > 2) {
@@ -372,130 +1331,278 @@ int main(int argc, char** argv) {
     if (argc > 3) {
         report_sleep_ms = atoi(argv[3]);
     }
+    if (power_ms == 0)
+        power_ms = report_sleep_ms;
+    if (live_path && live_n == 0)
+        live_n = 20;
+
+    // Output, CSV to stdout or a binary trace, goes through a writer thread
+    int out_fd = STDOUT_FILENO;
+    if (trace_path) {
+        out_fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out_fd == -1) {
+            perror(trace_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct compressor compressor;
+    if (compression && compressor_open(&compressor, compression) != 0)
+        exit(EXIT_FAILURE);
+    if (compression && isatty(out_fd))
+        fprintf(stderr, "WARNING: writing compressed output to a terminal\n");
+    struct async_output output;
+    FILE* out = async_output_open(&output, out_fd, 1 << 22, compression ? &compressor : NULL);
+    if (!out) {
+        fprintf(stderr, "ERROR: Could not start the output thread\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // Initialize NVML
-    // nvmlReturn_t nvmlRet = nvmlInit();
-    // if (nvmlRet != NVML_SUCCESS) {
-    //     fprintf(stderr, "Failed to initialize NVML\n");
-    // }
-
-    // Get the number of devices
-    // unsigned int gpuCount;
-    // nvmlRet = nvmlDeviceGetCount(&gpuCount);
-    // if (nvmlRet != NVML_SUCCESS) {
-    //     fprintf(stderr, "Failed to get device count\n");
-    //     nvmlShutdown();
-    // }
-
-    struct perf_event_attr attr = { 0 };
-    attr.size = sizeof(struct perf_event_attr);
-    attr.type = PERF_TYPE_HARDWARE;
-    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
-    attr.sample_type = PERF_SAMPLE_CALLCHAIN;
-    attr.sample_freq = callchains_per_report * report_sleep_ms;
-    attr.mmap = 1;
-    attr.freq = 1;
-    attr.ksymbol = 0;
-    attr.disabled = 1;
-
-    int fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
-    if (fd == -1) {
+    // Binary trace output
+    struct trace_writer trace_writer;
+    struct trace_writer* writer = NULL;
+    if (trace_path) {
+        if (trace_writer_open(&trace_writer, out, pid, get_realtime_ns()) != 0) {
+            fprintf(stderr, "ERROR: could not start trace %s\n", trace_path);
+            exit(EXIT_FAILURE);
+        }
+        writer = &trace_writer;
+        if (raw_ips && write_proc_maps(writer, pid) != 0)
+            fprintf(stderr, "WARNING: could not read /proc/%d/maps, pass the saved maps file to dw-symbolize\n", pid);
+    }
+
+    // Finish the trace cleanly when interrupted
+    signal(SIGINT, handle_stop);
+    signal(SIGTERM, handle_stop);
+
+    struct perf_event_attr* attr = &tracer.attr;
+    attr->size = sizeof(struct perf_event_attr);
+    attr->type = PERF_TYPE_HARDWARE;
+    attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr->sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CPU | PERF_SAMPLE_PERIOD | PERF_SAMPLE_CALLCHAIN;
+    attr->sample_id_all = 1;
+    attr->use_clockid = 1;
+    attr->clockid = CLOCK_MONOTONIC;
+    attr->sample_freq = callchains_per_report * report_sleep_ms;
+    attr->mmap = 1;
+    attr->freq = 1;
+    attr->ksymbol = 0;
+    attr->disabled = 1;
+
+    struct perf_streams* streams = &tracer.streams;
+    if (perf_streams_init(streams, data_pages) != 0)
+        exit(EXIT_FAILURE);
+
+    int opened;
+    if (cgroup_path)
+        opened = perf_streams_open_cgroup(streams, attr, cgroup_path) == 0;
+    else if (tracer.per_thread)
+        opened = perf_streams_open_threads(streams, attr, pid, NULL, NULL) > 0;
+    else
+        opened = perf_streams_open_cpus(streams, attr, pid) == 0;
+    if (!opened) {
         perror("perf_event_open");
         exit(EXIT_FAILURE);
     }
+    fprintf(stderr, "Opened %zu sampling events\n", streams->count);
+
+    perf_streams_enable(streams);
 
-    void* buffer = mmap(NULL, 2 * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (buffer == MAP_FAILED) {
-        perror("mmap");
-        close(fd);
+    // In raw mode libdw stays off the sampling path entirely
+    struct symbolizer sym = { .dwfl = raw_ips ? NULL : init_dwfl(pid), .pid = pid };
+    if (symcache_init(&sym.cache, SYMCACHE_DEFAULT_CAPACITY) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed for the symbol cache\n");
         exit(EXIT_FAILURE);
     }
 
-    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
-    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    tracer.sink.sym = &sym;
+    tracer.sink.writer = writer;
+    tracer.sink.out = out;
+    tracer.sink.stats = &tracer.stats;
+    if (!writer) {
+        tracer.sink.callchains = strnew(1024);
+        if (!tracer.sink.callchains) {
+            fprintf(stderr, "ERROR: Memory allocation failed for the callchain buffer\n");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(out, TRACE_CSV_HEADER "\n");
+    }
+    struct stack_ids ids = { 0 };
+    if (!writer && !full_chains) {
+        ids.defs = strnew(1024);
+        if (!ids.defs || stack_trie_init(&ids.trie) != 0) {
+            fprintf(stderr, "ERROR: Memory allocation failed for the stack table\n");
+            exit(EXIT_FAILURE);
+        }
+        ids.stacks_defined = 1; // the empty stack
+        tracer.sink.ids = &ids;
+    }
+    struct live_view live = { .pid = pid, .n = live_n, .path = live_path };
+    if (live_n) {
+        size_t capacity = live_n * 4 > LIVE_TOP_DEFAULT_CAPACITY ? live_n * 4 : LIVE_TOP_DEFAULT_CAPACITY;
+        if (live_top_init(&live.top, capacity, half_life_s) != 0) {
+            fprintf(stderr, "ERROR: Memory allocation failed for the live view\n");
+            exit(EXIT_FAILURE);
+        }
+        if (live_path)
+            snprintf(live.tmp_path, sizeof(live.tmp_path), "%s.tmp", live_path);
+        live.tty = isatty(STDERR_FILENO);
+        tracer.live = &live;
+        tracer.sink.live = &live.top;
+    }
 
-    struct perf_event_mmap_page* buffer_info = buffer;
-    Dwfl* dwfl = init_dwfl(pid);
+    if (spsc_queue_init(&tracer.records, queue_kib * 1024) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed for the record queue\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_create(&tracer.symbolizer, NULL, symbolizer_main, &tracer) != 0) {
+        fprintf(stderr, "ERROR: Could not start the symbolizer thread\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // Use zclock to get the start time in milliseconds.
-    // long start_ms = zclock_mono();
-    printf("timestamp, callchains, power, resource_usage, gpu_power\n");
-    struct timespec prev_ts;
-    clock_gettime(CLOCK_MONOTONIC, &prev_ts);
+    struct rapl* rapl = &tracer.meter.rapl;
+    int rapl_ret = -1;
+    if (strcmp(energy_backend, "sysfs") != 0) {
+        rapl_ret = rapl_open_pmu(rapl, RAPL_PMU_DEFAULT_DIR);
+        // The power column needs package counters, some PMUs only offer psys
+        int has_package = 0;
+        for (size_t i = 0; rapl_ret == 0 && i < rapl->count; i++)
+            has_package |= rapl->domains[i].kind == RAPL_PACKAGE;
+        if (rapl_ret == 0 && !has_package && strcmp(energy_backend, "auto") == 0) {
+            fprintf(stderr, "The power PMU has no energy-pkg event\n");
+            rapl_close(rapl);
+            rapl_ret = -1;
+        }
+        if (rapl_ret != 0 && strcmp(energy_backend, "pmu") == 0)
+            exit(EXIT_FAILURE);
+        if (rapl_ret != 0)
+            fprintf(stderr, "Falling back to the powercap sysfs counters\n");
+    }
+    if (rapl_ret != 0 && rapl_open(rapl, rapl_root) != 0)
+        exit(EXIT_FAILURE);
+    for (size_t i = 0; i < rapl->count; i++) {
+        const struct rapl_domain* domain = &rapl->domains[i];
+        fprintf(stderr, "RAPL domain %s (%s, %s)\n", domain->name, rapl_kind_name(domain->kind), rapl->pmu ? "pmu" : "sysfs");
+    }
 
-    long long prevEnergy = get_energy();
-    // long prev_time_ms = start_ms;
+    struct gpu_provider gpu = { 0 };
+    struct gpu_sampler gpu_sampler;
+    int gpu_ret = -1;
+    if (strncmp(gpu_backend, "mock:", 5) == 0)
+        gpu_ret = gpu_provider_open_mock(&gpu, gpu_backend + 5);
+    else if (strcmp(gpu_backend, "nvml") == 0 || strcmp(gpu_backend, "auto") == 0)
+        gpu_ret = gpu_provider_open_nvml(&gpu);
+    else if (strcmp(gpu_backend, "none") != 0) {
+        fprintf(stderr, "-G: the GPU provider must be nvml, mock:FILE, none or auto\n");
+        exit(EXIT_FAILURE);
+    }
+    if (gpu_ret != 0 && strcmp(gpu_backend, "auto") != 0 && strcmp(gpu_backend, "none") != 0) {
+        fprintf(stderr, "Could not open the GPU provider %s\n", gpu_backend);
+        exit(EXIT_FAILURE);
+    }
+    if (gpu_ret == 0) {
+        if (gpu_sampler_start(&gpu_sampler, &gpu, GPU_SAMPLE_MS) != 0) {
+            fprintf(stderr, "ERROR: Could not start the GPU sampler thread\n");
+            exit(EXIT_FAILURE);
+        }
+        tracer.meter.gpu = &gpu_sampler;
+        fprintf(stderr, "GPU %s from %s, %u device(s)\n", gpu.read_energy ? "energy counters" : "power samples", gpu.name, gpu.devices);
+    }
 
-    long prev_process_time = get_process_time(pid);
-    long prev_total_time = get_total_cpu_time();
-    if (prev_process_time == -1 || prev_total_time == -1) {
+    update_realtime_offset();
+    if (usage_meter_start(&tracer.meter, pid) != 0) {
         fprintf(stderr, "Error reading initial CPU time values\n");
         exit(EXIT_FAILURE);
     }
 
-    while (1) {
-        // Sleep for the report interval (converted to milliseconds)
-        zclock_sleep(report_sleep_ms);  // Sleep for the specified interval
-
-        if (kill(pid, 0) == -1) {
-            if (errno == ESRCH) {
-                fprintf(stderr, "Process %d has exited. Exiting program.\n", pid);
-                break;
-            }
-        }
-
-        // long now_ms = zclock_mono();
-        // double overall_elapsed = (now_ms - start_ms) / 1000.0;
-        long long currentEnergy = get_energy();
-        long long deltaEnergy = currentEnergy - prevEnergy;
-        prevEnergy = currentEnergy;
-
-        // double interval_seconds = (now_ms - prev_time_ms) / 1000.0;
-        // prev_time_ms = now_ms;
-        struct timespec curr_ts;
-        clock_gettime(CLOCK_MONOTONIC, &curr_ts);
-        double interval_seconds = (curr_ts.tv_sec - prev_ts.tv_sec) + 
-                                (curr_ts.tv_nsec - prev_ts.tv_nsec) / 1e9;
-        prev_ts = curr_ts;
-        double power = (deltaEnergy / 1e6) / interval_seconds;
-        double gpu_power = 0; //get_gpu_power(gpuCount);
-
-        long curr_process_time = get_process_time(pid);
-        long curr_total_time = get_total_cpu_time();
-        double usage = 0.0;
-        if (curr_process_time == -1 || curr_total_time == -1) {
-            fprintf(stderr, "Error reading CPU time values\n");
-        }
-        else {
-            long delta_process = curr_process_time - prev_process_time;
-            long delta_total = curr_total_time - prev_total_time;
-            if (delta_total > 0)
-                usage = 100.0 * delta_process / delta_total;
-            else
-                fprintf(stderr, "No CPU time elapsed\n");
-
-            prev_process_time = curr_process_time;
-            prev_total_time = curr_total_time;
-        }
+    struct metrics_server metrics;
+    if (metrics_address) {
+        if (metrics_server_start(&metrics, metrics_address, render_metrics, &tracer) != 0)
+            exit(EXIT_FAILURE);
+        fprintf(stderr, "Serving metrics on %s\n", metrics_address);
+    }
 
-        char* callchains = get_callchains(buffer_info, dwfl);
-        char timestamp[32];
-        get_utc_timestamp(timestamp, sizeof(timestamp));
-        if (callchains)
-            printf("%s, %s, %.6f, %.2f, %.6f\n", timestamp, callchains, power, usage, gpu_power);
+    // Only the reader, the other threads were started unpinned
+    if (reader_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(reader_cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+            perror("sched_setaffinity");
         else
-            printf("%s, , %.6f, %.2f, %.6f\n", timestamp, power, usage, gpu_power);
+            fprintf(stderr, "Reader pinned to CPU %d\n", reader_cpu);
+    }
 
-        free(callchains);
+    uint64_t started_ns = get_monotonic_ns();
+    if (event_driven)
+        run_event_driven(&tracer, power_ms);
+    else
+        run_polling(&tracer, report_sleep_ms);
+
+    perf_streams_disable(streams);
+    push_message(&tracer, PIPELINE_STOP, NULL, 0);
+    pthread_join(tracer.symbolizer, NULL);
+    if (metrics_address) {
+        metrics_server_stop(&metrics);
+        fprintf(stderr, "metrics: %lu scrapes\n", metrics.scrapes);
     }
 
-    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
-    munmap(buffer, 2 * PAGE_SIZE);
-    close(fd);
-    dwfl_end(dwfl);
-    // nvmlRet = nvmlShutdown();
-    // if (nvmlRet != NVML_SUCCESS) {
-    //     fprintf(stderr, "Failed to shutdown NVML\n");
-    // }
+    struct ring_stats* total_stats = &tracer.total_stats;
+    fprintf(stderr, "ring buffer: %lu samples, %lu lost (%.2f%%), %lu throttle / %lu unthrottle events\n",
+        total_stats->samples, total_stats->lost,
+        total_stats->samples + total_stats->lost ? 100.0 * total_stats->lost / (total_stats->samples + total_stats->lost) : 0.0,
+        total_stats->throttled, total_stats->unthrottled);
+    fprintf(stderr, "pipeline: %lu records queued, %lu dropped (%lu samples), peak depth %zu of %zu KiB\n",
+        tracer.records.pushed, tracer.dropped_records, total_stats->dropped,
+        (tracer.records.peak + 1023) / 1024, tracer.records.capacity / 1024);
+    spsc_queue_free(&tracer.records);
+    rapl_read(rapl);
+    for (size_t i = 0; i < rapl->count; i++) {
+        const struct rapl_domain* domain = &rapl->domains[i];
+        fprintf(stderr, "energy: %s %.6f J\n", domain->name, domain->total_uj / 1e6);
+    }
+    rapl_close(rapl);
+    procstat_close(&tracer.meter.procstat);
+    if (tracer.meter.gpu) {
+        fprintf(stderr, "energy: gpu %.6f J (%lu failed readings)\n", gpu_sampler_energy(&gpu_sampler), gpu_sampler.errors);
+        gpu_sampler_stop(&gpu_sampler);
+        gpu_provider_close(&gpu);
+    }
+    perf_streams_close(streams);
+    if (writer)
+        trace_writer_close(writer);
+    else {
+        alloc_watch_print(&tracer.callchain_allocs, "callchain buffer");
+        free(strfreewrap(tracer.sink.callchains));
+    }
+    if (tracer.live) {
+        live_view_show(&live, get_realtime_ns());
+        alloc_watch_print(&live.allocs, "live view");
+        live_top_free(&live.top);
+    }
+    if (tracer.sink.ids) {
+        fprintf(stderr, "stack table: %zu frames, %zu stacks\n", ids.frames_defined, ids.stacks_defined - 1);
+        free(strfreewrap(ids.defs));
+        stack_trie_free(&ids.trie);
+    }
+    fclose(out);
+    if (async_output_join(&output) != 0)
+        fprintf(stderr, "ERROR: writing the %s failed: %s\n", trace_path ? trace_path : "output", strerror(output.error));
+    fprintf(stderr, "output: %lu bytes, %lu writes waited for the output thread\n", output.bytes, output.stalls);
+    if (compression) {
+        double seconds = (get_monotonic_ns() - started_ns) / 1e9;
+        fprintf(stderr, "compression: %s level %d, %lu frames, %lu -> %lu bytes (%.1fx), %.0f bytes/s, %.3f s CPU (%.0f ns per sample)\n",
+            compressor.name, compressor.level, compressor.frames, compressor.in_bytes, compressor.out_bytes,
+            compressor.out_bytes ? (double)compressor.in_bytes / compressor.out_bytes : 0.0,
+            compressor.out_bytes / seconds, compressor.cpu_ns / 1e9,
+            total_stats->samples ? (double)compressor.cpu_ns / total_stats->samples : 0.0);
+        compressor_close(&compressor);
+    }
+    if (trace_path)
+        close(out_fd);
+    if (sym.dwfl) {
+        symcache_print_stats(&sym.cache, stderr);
+        dwfl_end(sym.dwfl);
+    }
+    symcache_free(&sym.cache);
     return EXIT_SUCCESS;
 }
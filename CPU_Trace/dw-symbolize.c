@@ -0,0 +1,397 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <libelf.h>
+#include <gelf.h>
+#include "compressor.h"
+#include "procmaps.h"
+#include "symcache.h"
+#include "trace_reader.h"
+
+// Offline symbolizer for traces recorded with `dw-pid -r`. Instruction
+// pointers are resolved against the saved /proc/<pid>/maps file, the mmap
+// records in the trace and the symbol tables of the mapped ELF files, and
+// the result is printed in dw-pid's CSV format.
+
+struct elf_symbol {
+    uint64_t addr;
+    uint64_t size;
+    const char* name;
+};
+
+struct elf_segment {
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t filesz;
+};
+
+struct elf_file {
+    char* path;
+    int loaded; // 1 ok, -1 unreadable
+    struct elf_symbol* symbols;
+    size_t nsymbols;
+    char* names; // backing storage for the symbol names
+    struct elf_segment* segments;
+    size_t nsegments;
+    struct elf_file* next;
+};
+
+struct symbolizer {
+    struct procmaps maps;
+    struct symcache cache;
+    struct elf_file* files;
+};
+
+static int compare_symbols(const void* a, const void* b)
+{
+    const struct elf_symbol* sa = a;
+    const struct elf_symbol* sb = b;
+    return (sa->addr > sb->addr) - (sa->addr < sb->addr);
+}
+
+static int load_elf(struct elf_file* file)
+{
+    int fd = open(file->path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    Elf* elf = elf_begin(fd, ELF_C_READ, NULL);
+    if (!elf) {
+        close(fd);
+        return -1;
+    }
+
+    // PT_LOAD segments translate file offsets into link-time addresses
+    size_t phnum = 0;
+    if (elf_getphdrnum(elf, &phnum) == 0 && phnum > 0) {
+        file->segments = calloc(phnum, sizeof(struct elf_segment));
+        for (size_t i = 0; file->segments && i < phnum; i++) {
+            GElf_Phdr phdr;
+            if (!gelf_getphdr(elf, i, &phdr) || phdr.p_type != PT_LOAD)
+                continue;
+            struct elf_segment* segment = &file->segments[file->nsegments++];
+            segment->offset = phdr.p_offset;
+            segment->vaddr = phdr.p_vaddr;
+            segment->filesz = phdr.p_filesz;
+        }
+    }
+
+    // Collect function symbols from .symtab and .dynsym
+    size_t names_size = 0, names_used = 0, capacity = 0;
+    Elf_Scn* scn = NULL;
+    for (int pass = 0; pass < 2; pass++) {
+        while ((scn = elf_nextscn(elf, scn)) != NULL) {
+            GElf_Shdr shdr;
+            if (!gelf_getshdr(scn, &shdr) || (shdr.sh_type != SHT_SYMTAB && shdr.sh_type != SHT_DYNSYM))
+                continue;
+            Elf_Data* data = elf_getdata(scn, NULL);
+            if (!data || !shdr.sh_entsize)
+                continue;
+
+            size_t count = shdr.sh_size / shdr.sh_entsize;
+            for (size_t i = 0; i < count; i++) {
+                GElf_Sym sym;
+                if (!gelf_getsym(data, i, &sym) || GELF_ST_TYPE(sym.st_info) != STT_FUNC || sym.st_value == 0)
+                    continue;
+                const char* name = elf_strptr(elf, shdr.sh_link, sym.st_name);
+                if (!name || !*name)
+                    continue;
+
+                size_t len = strlen(name) + 1;
+                if (pass == 0) {
+                    names_size += len;
+                    capacity++;
+                    continue;
+                }
+                memcpy(file->names + names_used, name, len);
+                struct elf_symbol* symbol = &file->symbols[file->nsymbols++];
+                symbol->addr = sym.st_value;
+                symbol->size = sym.st_size;
+                symbol->name = file->names + names_used;
+                names_used += len;
+            }
+        }
+
+        if (pass == 0) {
+            file->names = malloc(names_size ? names_size : 1);
+            file->symbols = malloc((capacity ? capacity : 1) * sizeof(struct elf_symbol));
+            if (!file->names || !file->symbols)
+                break;
+        }
+    }
+
+    elf_end(elf);
+    close(fd);
+
+    if (!file->names || !file->symbols)
+        return -1;
+    qsort(file->symbols, file->nsymbols, sizeof(struct elf_symbol), compare_symbols);
+    return 0;
+}
+
+static struct elf_file* get_elf(struct symbolizer* sym, const char* path)
+{
+    for (struct elf_file* file = sym->files; file; file = file->next) {
+        if (strcmp(file->path, path) == 0)
+            return file->loaded > 0 ? file : NULL;
+    }
+
+    struct elf_file* file = calloc(1, sizeof(struct elf_file));
+    if (!file)
+        return NULL;
+    file->path = strdup(path);
+    file->next = sym->files;
+    sym->files = file;
+
+    if (!file->path || load_elf(file) != 0) {
+        fprintf(stderr, "dw-symbolize: cannot read symbols from %s\n", path);
+        file->loaded = -1;
+        return NULL;
+    }
+    file->loaded = 1;
+    return file;
+}
+
+static const char* lookup_symbol(struct symbolizer* sym, uint64_t ip)
+{
+    const struct procmap* map = procmaps_find(&sym->maps, ip);
+    if (!map || !map->path || map->path[0] != '/')
+        return NULL;
+
+    struct elf_file* file = get_elf(sym, map->path);
+    if (!file)
+        return NULL;
+
+    // ip -> file offset -> address as linked
+    uint64_t offset = ip - map->start + map->pgoff;
+    uint64_t addr = offset;
+    for (size_t i = 0; i < file->nsegments; i++) {
+        const struct elf_segment* segment = &file->segments[i];
+        if (offset >= segment->offset && offset < segment->offset + segment->filesz) {
+            addr = offset - segment->offset + segment->vaddr;
+            break;
+        }
+    }
+
+    // Last symbol starting at or below addr
+    size_t lo = 0, hi = file->nsymbols;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (file->symbols[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+
+    const struct elf_symbol* symbol = &file->symbols[lo - 1];
+    if (symbol->size && addr >= symbol->addr + symbol->size)
+        return NULL;
+    return symbol->name;
+}
+
+static const char* resolve(struct symbolizer* sym, uint64_t ip)
+{
+    const struct symcache_entry* entry = symcache_find(&sym->cache, ip);
+    if (!entry)
+        entry = symcache_insert(&sym->cache, ip, lookup_symbol(sym, ip));
+    return entry ? entry->symbol : NULL;
+}
+
+static void print_frame(struct symbolizer* sym, uint64_t ip, FILE* out)
+{
+    const char* symbol = resolve(sym, ip);
+    if (symbol)
+        fprintf(out, "%s;", symbol);
+    else
+        fprintf(out, "0x%lx;", ip);
+}
+
+// Binary trace: samples are buffered per interval because the CSV row
+// starts with the interval's timestamp.
+static int symbolize_trace(struct symbolizer* sym, const char* path, FILE* out)
+{
+    struct trace_reader reader;
+    if (trace_reader_open(&reader, path) != 0)
+        return -1;
+
+    char* chains = NULL;
+    size_t chains_size = 0;
+    FILE* row = open_memstream(&chains, &chains_size);
+    if (!row) {
+        trace_reader_close(&reader);
+        return -1;
+    }
+
+    fprintf(out, TRACE_CSV_HEADER "\n");
+
+    struct trace_record record;
+    int ret;
+    while ((ret = trace_reader_next(&reader, &record)) > 0) {
+        switch (record.type) {
+        case TRACE_RECORD_MMAP:
+            procmaps_add(&sym->maps, record.mmap->addr, record.mmap->addr + record.mmap->len,
+                record.mmap->pgoff, record.filename);
+            symcache_invalidate(&sym->cache);
+            break;
+        case TRACE_RECORD_SAMPLE:
+            if (record.sample->time_ns)
+                fprintf(row, TRACE_SAMPLE_TAG_FORMAT, record.sample->time_ns, record.sample->cpu, record.sample->tid,
+                    record.sample->period);
+            for (uint32_t i = 0; i < record.sample->nr; i++) {
+                // Frames symbolized online are kept as they are
+                const char* symbol = trace_reader_string(&reader, record.symbols[i]);
+                if (symbol)
+                    fprintf(row, "%s;", symbol);
+                else
+                    print_frame(sym, record.ips[i], row);
+            }
+            fputc('|', row);
+            break;
+        case TRACE_RECORD_INTERVAL:
+            fflush(row);
+            trace_print_csv_row(out, record.interval, chains);
+            rewind(row);
+            fflush(row);
+            break;
+        }
+    }
+
+    fclose(row);
+    free(chains);
+    trace_reader_close(&reader);
+    return ret;
+}
+
+// The name of a #frame,<id>,<name> line of the interned CSV, when it is
+// an unresolved 0x... address. Returns 0 for any other line.
+static int parse_hex_frame(const char* line, unsigned long* id, uint64_t* ip)
+{
+    if (strncmp(line, TRACE_CSV_FRAME ",", sizeof(TRACE_CSV_FRAME)) != 0)
+        return 0;
+    char* end;
+    *id = strtoul(line + sizeof(TRACE_CSV_FRAME), &end, 10);
+    if (end[0] != ',' || end[1] != '0' || end[2] != 'x')
+        return 0;
+    *ip = strtoull(end + 1, &end, 16);
+    return *end == '\n' || *end == '\0';
+}
+
+// CSV with hex frames (dw-pid -r without -o): rewrite every 0x... frame,
+// in the callchains of full CSV rows and in the #frame lines of the
+// interned CSV.
+static int symbolize_csv(struct symbolizer* sym, FILE* in, FILE* out)
+{
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_size, in)) > 0) {
+        unsigned long id;
+        uint64_t ip;
+        if (parse_hex_frame(line, &id, &ip)) {
+            const char* symbol = resolve(sym, ip);
+            if (symbol)
+                fprintf(out, TRACE_CSV_FRAME ",%lu,%s\n", id, symbol);
+            else
+                fprintf(out, TRACE_CSV_FRAME ",%lu,0x%lx\n", id, ip);
+            continue;
+        }
+
+        char* p = line;
+        char prev = ' ';
+        while (*p) {
+            if ((prev == ' ' || prev == ';' || prev == '|') && p[0] == '0' && p[1] == 'x') {
+                char* end;
+                uint64_t ip = strtoull(p, &end, 16);
+                if (*end == ';') {
+                    print_frame(sym, ip, out);
+                    prev = ';';
+                    p = end + 1;
+                    continue;
+                }
+            }
+            prev = *p;
+            fputc(*p++, out);
+        }
+    }
+    free(line);
+    return ferror(in) ? -1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* maps_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+        switch (opt) {
+        case 'm':
+            maps_path = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 1) {
+usage:
+        fprintf(stderr, "Usage: %s [-m <pid>.maps] <trace.bin|trace.csv>\n", *argv);
+        exit(EXIT_FAILURE);
+    }
+    const char* input = argv[optind];
+
+    elf_version(EV_CURRENT);
+
+    struct symbolizer sym = { 0 };
+    if (symcache_init(&sym.cache, SYMCACHE_DEFAULT_CAPACITY) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed for the symbol cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (maps_path) {
+        FILE* maps = fopen(maps_path, "r");
+        if (!maps || procmaps_load(&sym.maps, maps) != 0) {
+            perror(maps_path);
+            exit(EXIT_FAILURE);
+        }
+        fclose(maps);
+    }
+
+    // Compressed input cannot rewind, the CSV is opened again instead
+    FILE* in = compressed_fopen(input, NULL);
+    if (!in) {
+        perror(input);
+        exit(EXIT_FAILURE);
+    }
+    char magic[sizeof(TRACE_MAGIC)] = { 0 };
+    int binary = fread(magic, 1, sizeof(magic), in) == sizeof(magic) && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+    fclose(in);
+
+    int ret;
+    if (binary)
+        ret = symbolize_trace(&sym, input, stdout);
+    else if (!(in = compressed_fopen(input, NULL))) {
+        perror(input);
+        ret = -1;
+    }
+    else {
+        ret = symbolize_csv(&sym, in, stdout);
+        fclose(in);
+    }
+
+    symcache_print_stats(&sym.cache, stderr);
+    symcache_free(&sym.cache);
+    procmaps_free(&sym.maps);
+    while (sym.files) {
+        struct elf_file* next = sym.files->next;
+        free(sym.files->path);
+        free(sym.files->symbols);
+        free(sym.files->names);
+        free(sym.files->segments);
+        free(sym.files);
+        sym.files = next;
+    }
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
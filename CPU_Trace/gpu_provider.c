@@ -0,0 +1,341 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include "gpu_provider.h"
+
+// The few NVML declarations used, so that neither nvml.h nor the driver
+// is needed to build
+typedef int nvmlReturn_t;
+typedef struct nvmlDevice_st* nvmlDevice_t;
+#define NVML_SUCCESS 0
+
+struct nvml_state {
+    void* lib;
+    nvmlReturn_t (*shutdown)(void);
+    nvmlReturn_t (*get_power_usage)(nvmlDevice_t device, unsigned int* milliwatts);
+    nvmlReturn_t (*get_total_energy)(nvmlDevice_t device, unsigned long long* millijoules);
+    const char* (*error_string)(nvmlReturn_t result);
+    nvmlDevice_t* devices;
+};
+
+static int nvml_read_power(struct gpu_provider* provider, double* watts)
+{
+    struct nvml_state* nvml = provider->state;
+    double total = 0;
+    int ret = 0;
+    for (unsigned int i = 0; i < provider->devices; i++) {
+        unsigned int milliwatts;
+        if (nvml->get_power_usage(nvml->devices[i], &milliwatts) != NVML_SUCCESS) {
+            ret = -1;
+            continue;
+        }
+        total += milliwatts / 1000.0;
+    }
+    *watts = total;
+    return ret;
+}
+
+// Millijoules since the driver was loaded, only on Volta and newer
+static int nvml_read_energy(struct gpu_provider* provider, double* joules)
+{
+    struct nvml_state* nvml = provider->state;
+    unsigned long long total = 0;
+    for (unsigned int i = 0; i < provider->devices; i++) {
+        unsigned long long millijoules;
+        if (nvml->get_total_energy(nvml->devices[i], &millijoules) != NVML_SUCCESS)
+            return -1;
+        total += millijoules;
+    }
+    *joules = total / 1000.0;
+    return 0;
+}
+
+static void nvml_close(struct gpu_provider* provider)
+{
+    struct nvml_state* nvml = provider->state;
+    if (nvml->shutdown)
+        nvml->shutdown();
+    dlclose(nvml->lib);
+    free(nvml->devices);
+    free(nvml);
+}
+
+int gpu_provider_open_nvml(struct gpu_provider* provider)
+{
+    memset(provider, 0, sizeof(*provider));
+    void* lib = dlopen("libnvidia-ml.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!lib)
+        return -1;
+
+    nvmlReturn_t (*init)(void) = (nvmlReturn_t (*)(void))dlsym(lib, "nvmlInit_v2");
+    nvmlReturn_t (*get_count)(unsigned int*) = (nvmlReturn_t (*)(unsigned int*))dlsym(lib, "nvmlDeviceGetCount_v2");
+    nvmlReturn_t (*get_handle)(unsigned int, nvmlDevice_t*) =
+        (nvmlReturn_t (*)(unsigned int, nvmlDevice_t*))dlsym(lib, "nvmlDeviceGetHandleByIndex_v2");
+    struct nvml_state* nvml = calloc(1, sizeof(struct nvml_state));
+    if (!nvml) {
+        dlclose(lib);
+        return -1;
+    }
+    nvml->lib = lib;
+    nvml->get_power_usage = (nvmlReturn_t (*)(nvmlDevice_t, unsigned int*))dlsym(lib, "nvmlDeviceGetPowerUsage");
+    nvml->error_string = (const char* (*)(nvmlReturn_t))dlsym(lib, "nvmlErrorString");
+    nvml->get_total_energy =
+        (nvmlReturn_t (*)(nvmlDevice_t, unsigned long long*))dlsym(lib, "nvmlDeviceGetTotalEnergyConsumption");
+    if (!init || !get_count || !get_handle || !nvml->get_power_usage) {
+        fprintf(stderr, "libnvidia-ml.so.1 lacks the NVML functions needed\n");
+        dlclose(lib);
+        free(nvml);
+        return -1;
+    }
+
+    nvmlReturn_t result = init();
+    if (result != NVML_SUCCESS) {
+        fprintf(stderr, "Failed to initialize NVML: %s\n", nvml->error_string ? nvml->error_string(result) : "unknown error");
+        dlclose(lib);
+        free(nvml);
+        return -1;
+    }
+    nvml->shutdown = (nvmlReturn_t (*)(void))dlsym(lib, "nvmlShutdown");
+    provider->name = "nvml";
+    provider->read_power = nvml_read_power;
+    provider->close = nvml_close;
+    provider->state = nvml;
+
+    unsigned int count = 0;
+    if (get_count(&count) != NVML_SUCCESS || count == 0) {
+        fprintf(stderr, "NVML reports no GPU\n");
+        gpu_provider_close(provider);
+        return -1;
+    }
+    nvml->devices = calloc(count, sizeof(nvmlDevice_t));
+    if (!nvml->devices) {
+        gpu_provider_close(provider);
+        return -1;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        if (get_handle(i, &nvml->devices[provider->devices]) == NVML_SUCCESS)
+            provider->devices++;
+        else
+            fprintf(stderr, "Failed to get the handle of GPU %u\n", i);
+    }
+    if (provider->devices == 0) {
+        gpu_provider_close(provider);
+        return -1;
+    }
+
+    // The counters only help when every device has one
+    double joules;
+    if (nvml->get_total_energy) {
+        provider->read_energy = nvml_read_energy;
+        if (nvml_read_energy(provider, &joules) != 0)
+            provider->read_energy = NULL;
+    }
+    return 0;
+}
+
+struct mock_state {
+    int fd;
+    char buffer[1024];
+};
+
+// Sums the lines of the file, "watts [joules]" per device. Returns the
+// number of devices or -1, with *joules -1 when a line has no counter.
+static int mock_read(struct mock_state* mock, double* watts, double* joules)
+{
+    ssize_t len = pread(mock->fd, mock->buffer, sizeof(mock->buffer) - 1, 0);
+    if (len < 0)
+        return -1;
+    mock->buffer[len] = '\0';
+
+    int devices = 0;
+    *watts = *joules = 0;
+    for (char* line = mock->buffer; *line; ) {
+        char* next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        else
+            next = line + strlen(line);
+
+        char* end;
+        double value = strtod(line, &end);
+        if (end != line) {
+            *watts += value;
+            devices++;
+            line = end;
+            value = strtod(line, &end);
+            if (end == line || *joules < 0)
+                *joules = -1;
+            else
+                *joules += value;
+        }
+        line = next;
+    }
+    return devices;
+}
+
+static int mock_read_power(struct gpu_provider* provider, double* watts)
+{
+    double joules;
+    int devices = mock_read(provider->state, watts, &joules);
+    if (devices < 0)
+        return -1;
+    provider->devices = devices;
+    return 0;
+}
+
+static int mock_read_energy(struct gpu_provider* provider, double* joules)
+{
+    double watts;
+    if (mock_read(provider->state, &watts, joules) <= 0 || *joules < 0)
+        return -1;
+    return 0;
+}
+
+static void mock_close(struct gpu_provider* provider)
+{
+    struct mock_state* mock = provider->state;
+    close(mock->fd);
+    free(mock);
+}
+
+int gpu_provider_open_mock(struct gpu_provider* provider, const char* path)
+{
+    memset(provider, 0, sizeof(*provider));
+    struct mock_state* mock = calloc(1, sizeof(struct mock_state));
+    if (!mock)
+        return -1;
+    mock->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (mock->fd == -1) {
+        perror(path);
+        free(mock);
+        return -1;
+    }
+    provider->name = "mock";
+    provider->read_power = mock_read_power;
+    provider->close = mock_close;
+    provider->state = mock;
+
+    double watts, joules;
+    int devices = mock_read(mock, &watts, &joules);
+    if (devices < 0) {
+        gpu_provider_close(provider);
+        return -1;
+    }
+    provider->devices = devices;
+    if (devices > 0 && joules >= 0)
+        provider->read_energy = mock_read_energy;
+    return 0;
+}
+
+void gpu_provider_close(struct gpu_provider* provider)
+{
+    if (provider->close)
+        provider->close(provider);
+    memset(provider, 0, sizeof(*provider));
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void* sampler_main(void* arg)
+{
+    struct gpu_sampler* sampler = arg;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for (;;) {
+        next.tv_nsec += (long)sampler->period_ms * 1000000L;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        // The driver call happens outside the lock
+        double watts, joules;
+        int ret = sampler->provider->read_energy ?
+            sampler->provider->read_energy(sampler->provider, &joules) :
+            sampler->provider->read_power(sampler->provider, &watts);
+        uint64_t now = monotonic_ns();
+
+        pthread_mutex_lock(&sampler->lock);
+        if (sampler->stop) {
+            pthread_mutex_unlock(&sampler->lock);
+            return NULL;
+        }
+        if (ret != 0)
+            sampler->errors++;
+        if (sampler->provider->read_energy) {
+            // A failed read is skipped, the next delta covers the gap
+            if (ret == 0 && now > sampler->last_ns) {
+                double delta = joules - sampler->last_joules;
+                sampler->energy += delta;
+                sampler->last_watts = delta * 1e9 / (now - sampler->last_ns);
+                sampler->last_joules = joules;
+                sampler->last_ns = now;
+            }
+        }
+        else {
+            // The previous reading holds until this one
+            sampler->energy += sampler->last_watts * (now - sampler->last_ns) / 1e9;
+            sampler->last_ns = now;
+            if (ret == 0)
+                sampler->last_watts = watts;
+        }
+        pthread_mutex_unlock(&sampler->lock);
+    }
+}
+
+int gpu_sampler_start(struct gpu_sampler* sampler, struct gpu_provider* provider, unsigned int period_ms)
+{
+    memset(sampler, 0, sizeof(*sampler));
+    sampler->provider = provider;
+    sampler->period_ms = period_ms ? period_ms : GPU_SAMPLE_MS;
+
+    double watts = 0;
+    if (provider->read_power(provider, &watts) != 0)
+        watts = 0;
+    sampler->last_watts = watts;
+    if (provider->read_energy && provider->read_energy(provider, &sampler->last_joules) != 0)
+        return -1;
+    sampler->last_ns = monotonic_ns();
+
+    if (pthread_mutex_init(&sampler->lock, NULL) != 0)
+        return -1;
+    if (pthread_create(&sampler->thread, NULL, sampler_main, sampler) != 0) {
+        pthread_mutex_destroy(&sampler->lock);
+        return -1;
+    }
+    return 0;
+}
+
+double gpu_sampler_energy(struct gpu_sampler* sampler)
+{
+    pthread_mutex_lock(&sampler->lock);
+    double energy = sampler->energy + sampler->last_watts * (monotonic_ns() - sampler->last_ns) / 1e9;
+    // The next counter delta does not take back what the extrapolation
+    // guessed too high, so hold the total until the counter catches up
+    // rather than let it go backwards
+    if (energy < sampler->reported)
+        energy = sampler->reported;
+    sampler->reported = energy;
+    pthread_mutex_unlock(&sampler->lock);
+    return energy;
+}
+
+void gpu_sampler_stop(struct gpu_sampler* sampler)
+{
+    pthread_mutex_lock(&sampler->lock);
+    sampler->stop = 1;
+    pthread_mutex_unlock(&sampler->lock);
+    pthread_join(sampler->thread, NULL);
+    pthread_mutex_destroy(&sampler->lock);
+}
@@ -0,0 +1,62 @@
+#ifndef GPU_PROVIDER_H
+#define GPU_PROVIDER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// GPU power sources for the gpu_power column. A provider reports the power
+// of all its devices summed, and the energy they consumed when the devices
+// keep a counter; a sampler thread polls it, so a slow driver call never
+// delays the CPU sampling loop.
+
+#define GPU_SAMPLE_MS 50
+
+struct gpu_provider {
+    const char* name;
+    unsigned int devices;
+    // Summed power of all devices in watts, -1 on error
+    int (*read_power)(struct gpu_provider* provider, double* watts);
+    // Summed energy counters in joules, -1 on error. NULL when a device has
+    // none, the sampler then integrates read_power instead.
+    int (*read_energy)(struct gpu_provider* provider, double* joules);
+    void (*close)(struct gpu_provider* provider);
+    void* state;
+};
+
+// NVML, loaded with dlopen so dw-pid runs on machines without the driver.
+// Device handles are looked up once here. Returns -1 when NVML is missing
+// or reports no device.
+int gpu_provider_open_nvml(struct gpu_provider* provider);
+
+// Reads watts from a text file, one device per line, re-read on every
+// sample so a test can rewrite it while the tracer runs. When every line
+// also has a second number, it is the device's energy counter in joules.
+int gpu_provider_open_mock(struct gpu_provider* provider, const char* path);
+
+void gpu_provider_close(struct gpu_provider* provider);
+
+struct gpu_sampler {
+    struct gpu_provider* provider;
+    unsigned int period_ms;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int stop;
+
+    // Guarded by lock
+    double energy;      // joules since gpu_sampler_start()
+    double last_watts;
+    uint64_t last_ns;   // CLOCK_MONOTONIC of energy and last_watts
+    double last_joules; // counter reading at last_ns, with read_energy
+    double reported;    // latest gpu_sampler_energy() result
+    uint64_t errors;
+};
+
+int gpu_sampler_start(struct gpu_sampler* sampler, struct gpu_provider* provider, unsigned int period_ms);
+
+// Energy up to now, including the stretch since the last sample at the
+// latest power. Never less than what an earlier call returned.
+double gpu_sampler_energy(struct gpu_sampler* sampler);
+
+void gpu_sampler_stop(struct gpu_sampler* sampler);
+
+#endif
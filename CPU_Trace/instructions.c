@@ -3,60 +3,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-
-long get_process_time(pid_t pid) {
-    char path[256];
-    FILE* fp;
-    char line[1024];
-    long utime = 0, stime = 0;
-
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
-    if ((fp = fopen(path, "r")) == NULL) return -1;
-
-    if (fgets(line, sizeof(line), fp) == NULL) {
-        fclose(fp);
-        return -1;
-    }
-    fclose(fp);
-
-    char* start = strchr(line, '(');
-    char* end = strrchr(line, ')');
-    if (!start || !end) return -1;
-
-    // Parse fields after the command name
-    char* p = end + 1;
-    int field = 2; // We're now at field 3 (0-based after comm)
-
-    while (*p && field < 14) {
-        if (*p == ' ') {
-            field++;
-            while (*++p == ' ');
-        }
-        else p++;
-    }
-
-    // Field 14 (utime) and 15 (stime)
-    sscanf(p, "%ld %ld", &utime, &stime);
-    return utime + stime;
-}
-
-long get_total_cpu_time() {
-    FILE* fp;
-    char line[1024];
-    long user, nice, system, idle, iowait, irq, softirq;
-
-    if ((fp = fopen("/proc/stat", "r")) == NULL) return -1;
-    fgets(line, sizeof(line), fp);
-    fclose(fp);
-
-    if (sscanf(line, "cpu  %ld %ld %ld %ld %ld %ld %ld",
-        &user, &nice, &system, &idle, &iowait, &irq, &softirq) != 7)
-        return -1;
-
-    return user + nice + system + irq + softirq;
-}
+#include "procstat.h"
 
 int main(int argc, char* argv[]) {
     if (argc != 2) {
@@ -66,21 +13,39 @@ int main(int argc, char* argv[]) {
 
     pid_t pid = atoi(argv[1]);
 
-    long t1_process = get_process_time(pid);
-    long t1_total = get_total_cpu_time();
+    struct procstat stat;
+    if (procstat_open(&stat, pid) != 0) {
+        fprintf(stderr, "Error opening /proc/%d/stat\n", pid);
+        return 1;
+    }
+
+    long t1_process = procstat_process_time(&stat);
+    long t1_total = procstat_total_time(&stat);
+    long nthreads = procstat_read_threads(&stat);
 
-    if (t1_process == -1 || t1_total == -1) {
+    if (t1_process == -1 || t1_total == -1 || nthreads == -1) {
         fprintf(stderr, "Error reading initial values\n");
+        procstat_close(&stat);
         return 1;
     }
 
+    // Thread times before the window, matched by tid afterwards
+    struct procstat_thread* t1_threads = malloc((nthreads ? nthreads : 1) * sizeof(struct procstat_thread));
+    if (!t1_threads) {
+        procstat_close(&stat);
+        return 1;
+    }
+    memcpy(t1_threads, stat.threads, nthreads * sizeof(struct procstat_thread));
+
     sleep(1);  // Measurement window
 
-    long t2_process = get_process_time(pid);
-    long t2_total = get_total_cpu_time();
+    long t2_process = procstat_process_time(&stat);
+    long t2_total = procstat_total_time(&stat);
 
-    if (t2_process == -1 || t2_total == -1) {
+    if (t2_process == -1 || t2_total == -1 || procstat_read_threads(&stat) == -1) {
         fprintf(stderr, "Error reading final values\n");
+        free(t1_threads);
+        procstat_close(&stat);
         return 1;
     }
 
@@ -89,11 +54,26 @@ int main(int argc, char* argv[]) {
 
     if (delta_total <= 0) {
         fprintf(stderr, "No CPU time elapsed\n");
+        free(t1_threads);
+        procstat_close(&stat);
         return 1;
     }
 
     double usage = 100.0 * delta_process / delta_total;
     printf("PID %d CPU usage: %.2f%%\n", pid, usage);
 
+    // Threads started during the window count from zero
+    for (size_t i = 0; i < stat.nthreads; i++) {
+        long before = 0;
+        for (long j = 0; j < nthreads; j++) {
+            if (t1_threads[j].tid == stat.threads[i].tid)
+                before = t1_threads[j].time;
+        }
+        printf("  TID %d CPU usage: %.2f%%\n", stat.threads[i].tid,
+            100.0 * (stat.threads[i].time - before) / delta_total);
+    }
+
+    free(t1_threads);
+    procstat_close(&stat);
     return 0;
 }
@@ -0,0 +1,387 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include "live_top.h"
+
+static uint64_t hash_bytes(uint64_t hash, const char* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// FNV-1a leaves the low bits, which pick the slot, poorly mixed
+static uint64_t hash_finish(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+static size_t slots_for(size_t entries)
+{
+    size_t slots = 16;
+    while (slots < entries * 2)
+        slots *= 2;
+    return slots;
+}
+
+static int table_init(struct live_table* table, size_t capacity)
+{
+    table->count = 0;
+    table->capacity = capacity;
+    table->slots_capacity = slots_for(capacity);
+    table->entries = malloc(capacity * sizeof(struct live_entry));
+    table->slots = calloc(table->slots_capacity, sizeof(uint32_t));
+    return table->entries && table->slots ? 0 : -1;
+}
+
+static void table_free(struct live_table* table)
+{
+    free(table->entries);
+    free(table->slots);
+    table->entries = NULL;
+    table->slots = NULL;
+}
+
+// Empty slot, and close the gap by moving back the entries probing past it.
+static void table_unlink(struct live_table* table, size_t slot)
+{
+    size_t mask = table->slots_capacity - 1;
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; table->slots[next]; next = (next + 1) & mask) {
+        size_t home = table->entries[table->slots[next] - 1].key & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table->slots[hole] = table->slots[next];
+            hole = next;
+        }
+    }
+    table->slots[hole] = 0;
+}
+
+static size_t table_find(const struct live_table* table, uint64_t key)
+{
+    size_t mask = table->slots_capacity - 1;
+    size_t slot = key & mask;
+    while (table->slots[slot] && table->entries[table->slots[slot] - 1].key != key)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+static void table_add(struct live_table* table, uint64_t key, const char* name, uint32_t len, double energy)
+{
+    size_t slot = table_find(table, key);
+    if (table->slots[slot]) {
+        table->entries[table->slots[slot] - 1].energy += energy;
+        return;
+    }
+
+    struct live_entry* entry;
+    double error = 0;
+    if (table->count < table->capacity) {
+        entry = &table->entries[table->count++];
+    }
+    else {
+        // Space-saving: take over the entry with the least energy
+        entry = table->entries;
+        for (size_t i = 1; i < table->count; i++) {
+            if (table->entries[i].energy < entry->energy)
+                entry = &table->entries[i];
+        }
+        error = entry->energy;
+        table_unlink(table, table_find(table, entry->key));
+        slot = table_find(table, key);
+    }
+    entry->key = key;
+    entry->energy = error + energy;
+    entry->error = error;
+    entry->len = len < LIVE_TOP_NAME ? len : LIVE_TOP_NAME;
+    memcpy(entry->name, name, entry->len);
+    table->slots[slot] = entry - table->entries + 1;
+}
+
+static void table_decay(struct live_table* table, double factor)
+{
+    for (size_t i = 0; i < table->count; i++) {
+        table->entries[i].energy *= factor;
+        table->entries[i].error *= factor;
+    }
+}
+
+int live_top_init(struct live_top* top, size_t capacity, double half_life_s)
+{
+    *top = (struct live_top) { .half_life_s = half_life_s };
+    if (table_init(&top->stacks, capacity) != 0 || table_init(&top->functions, capacity) != 0)
+        return -1;
+    top->order = malloc(capacity * sizeof(struct live_entry*));
+    top->text = malloc(LIVE_TOP_TEXT);
+    return top->order && top->text ? 0 : -1;
+}
+
+void live_top_free(struct live_top* top)
+{
+    table_free(&top->stacks);
+    table_free(&top->functions);
+    free(top->tags);
+    free(top->sample_stacks);
+    free(top->weights);
+    free(top->pending);
+    free(top->pending_slots);
+    free(top->names);
+    free(top->order);
+    free(top->text);
+    top->tags = NULL;
+    top->sample_stacks = NULL;
+    top->weights = NULL;
+    top->pending = NULL;
+    top->pending_slots = NULL;
+    top->names = NULL;
+    top->order = NULL;
+    top->text = NULL;
+}
+
+static int grow(void** buffer, size_t* capacity, size_t needed, size_t size, unsigned long* allocs)
+{
+    if (needed <= *capacity)
+        return 0;
+    size_t new_capacity = *capacity ? *capacity : 256;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+    void* grown = realloc(*buffer, new_capacity * size);
+    if (!grown)
+        return -1;
+    *buffer = grown;
+    *capacity = new_capacity;
+    (*allocs)++;
+    return 0;
+}
+
+static int grow_samples(struct live_top* top)
+{
+    if (top->nsamples < top->samples_capacity)
+        return 0;
+    size_t capacity = top->samples_capacity ? top->samples_capacity * 2 : 256;
+    struct chain_tag* tags = realloc(top->tags, capacity * sizeof(struct chain_tag));
+    if (tags)
+        top->tags = tags;
+    uint32_t* sample_stacks = realloc(top->sample_stacks, capacity * sizeof(uint32_t));
+    if (sample_stacks)
+        top->sample_stacks = sample_stacks;
+    double* weights = realloc(top->weights, capacity * sizeof(double));
+    if (weights)
+        top->weights = weights;
+    if (!tags || !sample_stacks || !weights)
+        return -1;
+    top->samples_capacity = capacity;
+    top->allocs++;
+    return 0;
+}
+
+// Rehash the pending stacks into twice the slots.
+static int grow_pending_slots(struct live_top* top)
+{
+    size_t capacity = slots_for(top->npending + 1);
+    if (capacity <= top->pending_slots_capacity)
+        return 0;
+    uint32_t* slots = calloc(capacity, sizeof(uint32_t));
+    if (!slots)
+        return -1;
+    for (size_t i = 0; i < top->npending; i++) {
+        size_t slot = top->pending[i].key & (capacity - 1);
+        while (slots[slot])
+            slot = (slot + 1) & (capacity - 1);
+        slots[slot] = i + 1;
+    }
+    free(top->pending_slots);
+    top->pending_slots = slots;
+    top->pending_slots_capacity = capacity;
+    top->allocs++;
+    return 0;
+}
+
+// Append the folded name of the stack, root first, to the names of the
+// interval. Frames that do not fit are replaced by "...", from the root.
+static int append_name(struct live_top* top, const struct live_frame* frames, size_t nr, struct live_pending* entry)
+{
+    static const struct live_frame unknown = { "[unknown]", 9 };
+    if (nr == 0) {
+        frames = &unknown;
+        nr = 1;
+    }
+
+    size_t len = nr - 1;
+    for (size_t i = 0; i < nr; i++)
+        len += frames[i].len;
+    size_t kept = nr;
+    size_t leaf_len = frames[0].len;
+    if (len > LIVE_TOP_NAME) {
+        // Keep room for "...;", cutting the leaf itself if it is that long
+        size_t limit = LIVE_TOP_NAME - 4;
+        leaf_len = leaf_len < limit ? leaf_len : limit;
+        len = leaf_len;
+        for (kept = 1; kept < nr && len + 1 + frames[kept].len <= limit; kept++)
+            len += 1 + frames[kept].len;
+        if (kept < nr)
+            len += 4;
+    }
+
+    if (grow((void**)&top->names, &top->names_capacity, top->names_len + len, 1, &top->allocs) != 0)
+        return -1;
+    char* name = top->names + top->names_len;
+    size_t at = 0;
+    if (kept < nr) {
+        memcpy(name, "...;", 4);
+        at = 4;
+    }
+    for (size_t i = kept; i-- > 1;) {
+        memcpy(name + at, frames[i].name, frames[i].len);
+        at += frames[i].len;
+        name[at++] = ';';
+    }
+    entry->leaf = at;
+    memcpy(name + at, frames[0].name, leaf_len);
+    entry->name = top->names_len;
+    entry->len = len;
+    top->names_len += len;
+    return 0;
+}
+
+int live_top_sample(struct live_top* top, const struct chain_tag* tag, const struct live_frame* frames, size_t nr)
+{
+    uint64_t key = HASH_SEED;
+    for (size_t i = nr; i-- > 0;) {
+        key = hash_bytes(key, frames[i].name, frames[i].len);
+        key = hash_bytes(key, ";", 1);
+    }
+    key = hash_finish(key);
+
+    if (top->npending + 1 > top->pending_slots_capacity / 2 && grow_pending_slots(top) != 0)
+        return -1;
+    size_t mask = top->pending_slots_capacity - 1;
+    size_t slot = key & mask;
+    while (top->pending_slots[slot] && top->pending[top->pending_slots[slot] - 1].key != key)
+        slot = (slot + 1) & mask;
+
+    if (!top->pending_slots[slot]) {
+        if (grow((void**)&top->pending, &top->pending_capacity, top->npending + 1, sizeof(struct live_pending),
+                &top->allocs) != 0)
+            return -1;
+        struct live_pending* entry = &top->pending[top->npending];
+        if (append_name(top, frames, nr, entry) != 0)
+            return -1;
+        const char* leaf = top->names + entry->name + entry->leaf;
+        entry->key = key;
+        entry->function = hash_finish(hash_bytes(HASH_SEED, leaf, entry->len - entry->leaf));
+        entry->energy = 0;
+        top->pending_slots[slot] = ++top->npending;
+    }
+
+    if (grow_samples(top) != 0)
+        return -1;
+    top->tags[top->nsamples] = *tag;
+    top->sample_stacks[top->nsamples] = top->pending_slots[slot] - 1;
+    top->nsamples++;
+    return 0;
+}
+
+void live_top_interval(struct live_top* top, const struct trace_interval* interval)
+{
+    double seconds = interval->duration_ns / 1e9;
+    double energy = ((interval->usage / 100.0) * interval->power + interval->gpu_power) * seconds;
+    double factor = exp2(-seconds / top->half_life_s);
+    table_decay(&top->stacks, factor);
+    table_decay(&top->functions, factor);
+    top->energy = top->energy * factor + energy;
+    top->unattributed *= factor;
+    top->window_s = top->window_s * factor + seconds;
+    top->samples += top->nsamples;
+    top->intervals++;
+
+    if (top->nsamples == 0) {
+        top->unattributed += energy;
+        return;
+    }
+
+    sample_weights(top->tags, top->nsamples, interval->timestamp_ns - interval->duration_ns, top->weights);
+    double total_weight = 0;
+    for (size_t i = 0; i < top->nsamples; i++)
+        total_weight += top->weights[i];
+    for (size_t i = 0; i < top->nsamples; i++)
+        top->pending[top->sample_stacks[i]].energy += energy * top->weights[i] / total_weight;
+
+    for (size_t i = 0; i < top->npending; i++) {
+        const struct live_pending* entry = &top->pending[i];
+        const char* name = top->names + entry->name;
+        table_add(&top->stacks, entry->key, name, entry->len, entry->energy);
+        table_add(&top->functions, entry->function, name + entry->leaf, entry->len - entry->leaf, entry->energy);
+    }
+
+    top->nsamples = 0;
+    top->npending = 0;
+    top->names_len = 0;
+    memset(top->pending_slots, 0, top->pending_slots_capacity * sizeof(uint32_t));
+}
+
+static int by_energy(const void* a, const void* b)
+{
+    double x = (*(const struct live_entry* const*)a)->energy;
+    double y = (*(const struct live_entry* const*)b)->energy;
+    return (x < y) - (x > y);
+}
+
+// Append to the text, cut short when it is full.
+static void text_printf(struct live_top* top, size_t* len, const char* format, ...)
+{
+    if (*len >= LIVE_TOP_TEXT - 1)
+        return;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(top->text + *len, LIVE_TOP_TEXT - *len, format, args);
+    va_end(args);
+    if (n > 0)
+        *len = *len + n < LIVE_TOP_TEXT - 1 ? *len + n : LIVE_TOP_TEXT - 1;
+}
+
+static void render_table(struct live_top* top, struct live_table* table, const char* what, size_t n, size_t width,
+    size_t* len)
+{
+    for (size_t i = 0; i < table->count; i++)
+        top->order[i] = &table->entries[i];
+    qsort(top->order, table->count, sizeof(struct live_entry*), by_energy);
+
+    text_printf(top, len, "\n     watts   share  %s\n", what);
+    for (size_t i = 0; i < n && i < table->count; i++) {
+        const struct live_entry* entry = top->order[i];
+        const char* name = entry->name;
+        int name_len = entry->len;
+        const char* cut = "";
+        if (width && entry->len > width && width > 3) {
+            name += entry->len - (width - 3);
+            name_len = width - 3;
+            cut = "...";
+        }
+        // ~ marks an entry that took over another, by at most its error too high
+        text_printf(top, len, "%c%9.3f  %5.1f%%  %s%.*s\n", entry->error > 0 ? '~' : ' ', entry->energy / top->window_s,
+            top->energy > 0 ? 100.0 * entry->energy / top->energy : 0.0, cut, name_len, name);
+    }
+}
+
+const char* live_top_render(struct live_top* top, size_t n, size_t width, size_t* len)
+{
+    *len = 0;
+    double window_s = top->window_s > 0 ? top->window_s : 1;
+    text_printf(top, len, "%.3f W, %.3f W without samples, %lu samples in %lu intervals (half-life %g s)\n",
+        top->energy / window_s, top->unattributed / window_s, top->samples, top->intervals, top->half_life_s);
+    if (top->window_s > 0) {
+        render_table(top, &top->stacks, "stack", n, width, len);
+        render_table(top, &top->functions, "function", n, width, len);
+    }
+    return top->text;
+}
@@ -0,0 +1,109 @@
+#ifndef LIVE_TOP_H
+#define LIVE_TOP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sample_weights.h"
+#include "trace_format.h"
+
+// Rolling energy per stack and per function while the target runs, for
+// dw-pid's live top-N view. Each interval's energy is split among its
+// samples the same way the reports split it, and everything before it
+// decays with a half-life, so the view follows what the target does now.
+//
+// Memory is bounded: both tables are space-saving heavy hitters of a fixed
+// number of entries. A key not in a full table takes over the entry with
+// the least energy and inherits it as its error, so every key holding
+// more than 1/capacity of the energy is kept, and an entry's energy is at
+// most its error too high.
+
+// Longest stack name kept. Deeper stacks keep their innermost frames,
+// after a "..." frame.
+#define LIVE_TOP_NAME 480
+
+// Default number of entries of each table.
+#define LIVE_TOP_DEFAULT_CAPACITY 1024
+
+// Room for one rendered view.
+#define LIVE_TOP_TEXT 65536
+
+struct live_frame {
+    const char* name;
+    size_t len;
+};
+
+struct live_entry {
+    uint64_t key;
+    double energy; // decayed joules
+    double error;  // inherited from the entry it took over
+    uint32_t len;
+    char name[LIVE_TOP_NAME];
+};
+
+struct live_table {
+    struct live_entry* entries;
+    size_t count;
+    size_t capacity;
+    // key -> entry + 1, open addressing with linear probing
+    uint32_t* slots;
+    size_t slots_capacity;
+};
+
+// A distinct stack of the interval being filled.
+struct live_pending {
+    uint64_t key;
+    uint64_t function;
+    size_t name;   // offset into names
+    uint32_t len;
+    uint32_t leaf; // offset of the leaf frame in the name
+    double energy;
+};
+
+struct live_top {
+    struct live_table stacks;
+    struct live_table functions;
+    double half_life_s;
+    double energy;       // decayed joules, attributed or not
+    double unattributed; // decayed joules of intervals without samples
+    double window_s;     // decayed seconds, energy / window_s is the rolling power
+    uint64_t samples;
+    uint64_t intervals;
+
+    // The interval being filled, reused from one interval to the next
+    struct chain_tag* tags;
+    uint32_t* sample_stacks; // pending entry of each sample
+    double* weights;
+    size_t nsamples;
+    size_t samples_capacity;
+    struct live_pending* pending;
+    size_t npending;
+    size_t pending_capacity;
+    uint32_t* pending_slots; // key -> pending + 1
+    size_t pending_slots_capacity;
+    char* names;
+    size_t names_len;
+    size_t names_capacity;
+    unsigned long allocs; // growth of the reused buffers, see alloc_watch in dw-pid.c
+
+    struct live_entry** order; // capacity entries, for sorting
+    char* text;
+};
+
+// Returns -1 when out of memory.
+int live_top_init(struct live_top* top, size_t capacity, double half_life_s);
+
+// Add a sample to the current interval. frames[0] is the leaf, as in a
+// callchain. Returns -1 when out of memory, the sample is then left out.
+int live_top_sample(struct live_top* top, const struct chain_tag* tag, const struct live_frame* frames, size_t nr);
+
+// Close the current interval: decay what came before and add its energy,
+// split among its samples.
+void live_top_interval(struct live_top* top, const struct trace_interval* interval);
+
+// Render the n hottest stacks and functions as text, stack names cut to
+// width columns (0 for whole names). Returns the text, NUL terminated.
+const char* live_top_render(struct live_top* top, size_t n, size_t width, size_t* len);
+
+void live_top_free(struct live_top* top);
+
+#endif
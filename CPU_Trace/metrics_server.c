@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics_server.h"
+
+// How often the thread checks for stop while no client connects
+#define METRICS_POLL_MS 100
+
+// A client has this long to send its request and to take the reply
+#define METRICS_CLIENT_TIMEOUT_S 2
+
+#define METRICS_REQUEST_MAX 4096
+
+static int listen_unix(struct metrics_server* server, const char* path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Metrics socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // A socket left behind by an earlier run, never any other file
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror(path);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    strcpy(server->unix_path, path);
+    return fd;
+}
+
+static int listen_tcp(const char* address)
+{
+    char host[INET_ADDRSTRLEN] = "127.0.0.1";
+    const char* port = strrchr(address, ':');
+    if (port) {
+        size_t len = port - address;
+        if (len >= sizeof(host))
+            len = sizeof(host) - 1;
+        memcpy(host, address, len);
+        host[len] = '\0';
+        port++;
+    }
+    else
+        port = address;
+
+    char* end;
+    long number = strtol(port, &end, 10);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(number) };
+    if (*port == '\0' || *end != '\0' || number <= 0 || number > 65535 || inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid metrics address %s, expected unix:PATH or [IPV4:]PORT\n", address);
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+        || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror(address);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int send_all(int fd, const char* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read one request and answer it. Only GET /metrics (or /) is served.
+static void serve_client(struct metrics_server* server, int client)
+{
+    struct timeval timeout = { .tv_sec = METRICS_CLIENT_TIMEOUT_S };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // The request line and headers, a GET has no body
+    char request[METRICS_REQUEST_MAX];
+    size_t len = 0;
+    while (len < sizeof(request) - 1) {
+        ssize_t n = recv(client, request + len, sizeof(request) - 1 - len, 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        len += n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+    request[len] = '\0';
+
+    char* body = NULL;
+    size_t body_len = 0;
+    FILE* out = open_memstream(&body, &body_len);
+    if (!out)
+        return;
+    const char* status = "200 OK";
+    const char* content_type = "text/plain; version=0.0.4; charset=utf-8";
+    if (strncmp(request, "GET ", 4) == 0) {
+        const char* path = request + 4;
+        size_t path_len = strcspn(path, " ?\r\n");
+        if ((path_len == 8 && strncmp(path, "/metrics", 8) == 0) || (path_len == 1 && *path == '/')) {
+            server->render(out, server->ctx);
+            server->scrapes++;
+        }
+        else {
+            status = "404 Not Found";
+            content_type = "text/plain; charset=utf-8";
+            fputs("Not found, the metrics are at /metrics\n", out);
+        }
+    }
+    else {
+        status = "405 Method Not Allowed";
+        content_type = "text/plain; charset=utf-8";
+        fputs("Only GET is supported\n", out);
+    }
+    if (fclose(out) != 0) {
+        free(body);
+        return;
+    }
+
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+        "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        status, content_type, body_len);
+    if (send_all(client, header, header_len) == 0)
+        send_all(client, body, body_len);
+    free(body);
+}
+
+static void* server_main(void* arg)
+{
+    struct metrics_server* server = arg;
+    struct pollfd listening = { .fd = server->fd, .events = POLLIN };
+    while (!__atomic_load_n(&server->stop, __ATOMIC_RELAXED)) {
+        if (poll(&listening, 1, METRICS_POLL_MS) <= 0)
+            continue;
+        int client = accept4(server->fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client == -1)
+            continue;
+        serve_client(server, client);
+        close(client);
+    }
+    return NULL;
+}
+
+int metrics_server_start(struct metrics_server* server, const char* address, metrics_render_fn render, void* ctx)
+{
+    memset(server, 0, sizeof(*server));
+    server->render = render;
+    server->ctx = ctx;
+    if (strncmp(address, "unix:", 5) == 0)
+        server->fd = listen_unix(server, address + 5);
+    else
+        server->fd = listen_tcp(address);
+    if (server->fd == -1)
+        return -1;
+
+    if (listen(server->fd, 16) != 0) {
+        perror("listen");
+        metrics_server_stop(server);
+        return -1;
+    }
+    if (pthread_create(&server->thread, NULL, server_main, server) != 0) {
+        fprintf(stderr, "ERROR: Could not start the metrics thread\n");
+        metrics_server_stop(server);
+        return -1;
+    }
+    server->started = 1;
+    return 0;
+}
+
+void metrics_server_stop(struct metrics_server* server)
+{
+    if (server->started) {
+        __atomic_store_n(&server->stop, 1, __ATOMIC_RELAXED);
+        pthread_join(server->thread, NULL);
+        server->started = 0;
+    }
+    if (server->fd != -1)
+        close(server->fd);
+    server->fd = -1;
+    if (server->unix_path[0])
+        unlink(server->unix_path);
+    server->unix_path[0] = '\0';
+}
+
+void metrics_describe(FILE* out, const char* name, const char* type, const char* help)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metrics_sample(FILE* out, const char* name, const char* labels, double value)
+{
+    if (labels)
+        fprintf(out, "%s{%s} %.15g\n", name, labels, value);
+    else
+        fprintf(out, "%s %.15g\n", name, value);
+}
@@ -0,0 +1,43 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/un.h>
+
+// Running counters in the Prometheus text format, served over HTTP on a
+// local socket by a thread of its own, so a scrape never waits for the
+// sampling loop or delays it. Clients are answered one at a time and each
+// connection is closed after one reply, e.g.
+//   curl http://127.0.0.1:9464/metrics
+//   curl --unix-socket /run/dw-pid.sock http://localhost/metrics
+
+// Write the metrics to out. Called on the server thread for every scrape.
+typedef void (*metrics_render_fn)(FILE* out, void* ctx);
+
+struct metrics_server {
+    int fd;
+    pthread_t thread;
+    int started;
+    int stop;
+    metrics_render_fn render;
+    void* ctx;
+    char unix_path[sizeof(((struct sockaddr_un*)0)->sun_path)]; // empty for TCP
+    uint64_t scrapes;
+};
+
+// Listen on address, "unix:PATH" or "[IPV4:]PORT" (127.0.0.1 by default),
+// and start the server thread. Returns -1 with the reason on stderr.
+int metrics_server_start(struct metrics_server* server, const char* address, metrics_render_fn render, void* ctx);
+
+// Stop the thread, close the socket and remove a unix socket file.
+void metrics_server_stop(struct metrics_server* server);
+
+// The HELP and TYPE lines of a metric, before its samples.
+void metrics_describe(FILE* out, const char* name, const char* type, const char* help);
+
+// One sample, labels such as "domain=\"package\"" or NULL.
+void metrics_sample(FILE* out, const char* name, const char* labels, double value);
+
+#endif
@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "perf_streams.h"
+
+// epoll data of fds added with perf_streams_watch(), streams use their index
+#define WATCHED_FD UINT64_MAX
+
+int perf_streams_init(struct perf_streams* streams, unsigned int data_pages)
+{
+    memset(streams, 0, sizeof(*streams));
+    streams->data_pages = data_pages;
+    streams->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (streams->epoll_fd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+    return 0;
+}
+
+static int add_stream(struct perf_streams* streams, struct perf_event_attr* attr, pid_t pid, int cpu,
+    unsigned long flags, pid_t tid)
+{
+    int fd = syscall(SYS_perf_event_open, attr, pid, cpu, -1, flags | PERF_FLAG_FD_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    // One metadata page followed by the data pages
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t mmap_size = (1 + (size_t)streams->data_pages) * page_size;
+    void* buffer = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buffer == MAP_FAILED) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    if (streams->count == streams->capacity) {
+        size_t capacity = streams->capacity ? streams->capacity * 2 : 16;
+        struct perf_stream* grown = realloc(streams->streams, capacity * sizeof(struct perf_stream));
+        if (!grown) {
+            munmap(buffer, mmap_size);
+            close(fd);
+            errno = ENOMEM;
+            return -1;
+        }
+        streams->streams = grown;
+        streams->capacity = capacity;
+    }
+
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = streams->count };
+    if (epoll_ctl(streams->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        int saved = errno;
+        munmap(buffer, mmap_size);
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    struct perf_stream* stream = &streams->streams[streams->count++];
+    stream->fd = fd;
+    stream->buffer = buffer;
+    stream->mmap_size = mmap_size;
+    stream->cpu = cpu;
+    stream->tid = tid;
+    stream->listed = 1;
+    return 0;
+}
+
+// Close stream i and move the last stream into its slot.
+static void remove_stream(struct perf_streams* streams, size_t i, perf_stream_fn retire, void* ctx)
+{
+    struct perf_stream* stream = &streams->streams[i];
+    if (retire)
+        retire(stream, ctx);
+    epoll_ctl(streams->epoll_fd, EPOLL_CTL_DEL, stream->fd, NULL);
+    munmap(stream->buffer, stream->mmap_size);
+    close(stream->fd);
+
+    if (i != --streams->count) {
+        *stream = streams->streams[streams->count];
+        // Fails for a stream already out of the set after EPOLLHUP
+        struct epoll_event event = { .events = EPOLLIN, .data.u64 = i };
+        epoll_ctl(streams->epoll_fd, EPOLL_CTL_MOD, stream->fd, &event);
+    }
+}
+
+// The task of a per-thread event exited: its fd reports POLLHUP for good.
+static int stream_exited(struct perf_stream* stream)
+{
+    struct pollfd pfd = { .fd = stream->fd, .events = POLLIN };
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLHUP);
+}
+
+static void set_watermark(struct perf_streams* streams, struct perf_event_attr* attr)
+{
+    // Wake the reader once a buffer is half full rather than on every sample
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    attr->watermark = 1;
+    attr->wakeup_watermark = streams->data_pages * page_size / 2;
+}
+
+static int open_per_cpu(struct perf_streams* streams, struct perf_event_attr* attr, pid_t pid, unsigned long flags)
+{
+    set_watermark(streams, attr);
+
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    int opened = 0;
+    for (int cpu = 0; cpu < ncpus; cpu++) {
+        if (add_stream(streams, attr, pid, cpu, flags, -1) == 0) {
+            opened++;
+            continue;
+        }
+        // Offline CPUs are skipped
+        if (errno != ENODEV && errno != EINVAL)
+            fprintf(stderr, "perf_event_open on cpu %d: %s\n", cpu, strerror(errno));
+    }
+    return opened > 0 ? 0 : -1;
+}
+
+int perf_streams_open_cpus(struct perf_streams* streams, struct perf_event_attr* attr, pid_t pid)
+{
+    attr->inherit = 1;
+    return open_per_cpu(streams, attr, pid, 0);
+}
+
+int perf_streams_open_cgroup(struct perf_streams* streams, struct perf_event_attr* attr, const char* cgroup_path)
+{
+    int cgroup_fd = open(cgroup_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cgroup_fd == -1) {
+        perror(cgroup_path);
+        return -1;
+    }
+    int ret = open_per_cpu(streams, attr, cgroup_fd, PERF_FLAG_PID_CGROUP);
+    close(cgroup_fd);
+    return ret;
+}
+
+int perf_streams_open_threads(struct perf_streams* streams, struct perf_event_attr* attr, pid_t pid,
+    perf_stream_fn retire, void* ctx)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR* dir = opendir(path);
+    if (!dir)
+        return -1;
+
+    // inherit cannot be combined with per-thread ring buffers
+    attr->inherit = 0;
+    set_watermark(streams, attr);
+
+    for (size_t i = 0; i < streams->count; i++)
+        streams->streams[i].listed = 0;
+
+    int opened = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        pid_t tid = atoi(entry->d_name);
+        if (tid <= 0)
+            continue;
+
+        size_t i = 0;
+        while (i < streams->count && streams->streams[i].tid != tid)
+            i++;
+        if (i < streams->count) {
+            if (!stream_exited(&streams->streams[i])) {
+                streams->streams[i].listed = 1;
+                continue;
+            }
+            // The thread of the event exited and the kernel reused its tid
+            remove_stream(streams, i, retire, ctx);
+        }
+
+        if (add_stream(streams, attr, tid, -1, 0, tid) == 0)
+            opened++;
+        else if (errno != ESRCH)
+            fprintf(stderr, "perf_event_open on thread %d: %s\n", tid, strerror(errno));
+    }
+    closedir(dir);
+
+    // Threads that exited since the previous scan. Going down, the stream
+    // moved into a freed slot has been looked at already.
+    for (size_t i = streams->count; i-- > 0;) {
+        if (streams->streams[i].tid != -1 && !streams->streams[i].listed)
+            remove_stream(streams, i, retire, ctx);
+    }
+    return opened;
+}
+
+void perf_streams_enable(struct perf_streams* streams)
+{
+    for (size_t i = 0; i < streams->count; i++) {
+        ioctl(streams->streams[i].fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(streams->streams[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perf_streams_disable(struct perf_streams* streams)
+{
+    for (size_t i = 0; i < streams->count; i++)
+        ioctl(streams->streams[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+int perf_streams_watch(struct perf_streams* streams, int fd)
+{
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = WATCHED_FD };
+    return epoll_ctl(streams->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+int perf_streams_wait(struct perf_streams* streams, struct perf_stream** ready, int max, int timeout_ms, int* watched)
+{
+    struct epoll_event events[64];
+    if (max > 63)
+        max = 63;
+    if (watched)
+        *watched = 0;
+
+    // One slot more than max so a watched fd never crowds out a stream
+    int n = epoll_wait(streams->epoll_fd, events, max + 1, timeout_ms);
+    if (n == -1)
+        return errno == EINTR ? 0 : -1;
+
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.u64 == WATCHED_FD) {
+            if (watched)
+                *watched = 1;
+            continue;
+        }
+        if (count == max)
+            continue;
+        struct perf_stream* stream = &streams->streams[events[i].data.u64];
+        // The task behind the event exited. Stop polling it; whatever is
+        // left in its buffer is still drained with the other streams.
+        if (events[i].events & EPOLLHUP)
+            epoll_ctl(streams->epoll_fd, EPOLL_CTL_DEL, stream->fd, NULL);
+        ready[count++] = stream;
+    }
+    return count;
+}
+
+void perf_streams_close(struct perf_streams* streams)
+{
+    for (size_t i = 0; i < streams->count; i++) {
+        munmap(streams->streams[i].buffer, streams->streams[i].mmap_size);
+        close(streams->streams[i].fd);
+    }
+    free(streams->streams);
+    if (streams->epoll_fd != -1)
+        close(streams->epoll_fd);
+    memset(streams, 0, sizeof(*streams));
+    streams->epoll_fd = -1;
+}
@@ -0,0 +1,64 @@
+#ifndef PERF_STREAMS_H
+#define PERF_STREAMS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/perf_event.h>
+
+// One sampling event and its ring buffer.
+struct perf_stream {
+    int fd;
+    struct perf_event_mmap_page* buffer;
+    size_t mmap_size;
+    int cpu;   // -1 for per-thread events
+    pid_t tid; // -1 for per-cpu events
+    int listed; // per-thread events: tid found by the latest rescan
+};
+
+// Every ring buffer of the target, multiplexed through one epoll set.
+struct perf_streams {
+    struct perf_stream* streams;
+    size_t count;
+    size_t capacity;
+    int epoll_fd;
+    unsigned int data_pages;
+};
+
+int perf_streams_init(struct perf_streams* streams, unsigned int data_pages);
+
+// One event per CPU following pid and, through inherit, every thread and
+// child it creates from now on.
+int perf_streams_open_cpus(struct perf_streams* streams, struct perf_event_attr* attr, pid_t pid);
+
+// One event per CPU scoped to a perf_event cgroup (PERF_FLAG_PID_CGROUP).
+int perf_streams_open_cgroup(struct perf_streams* streams, struct perf_event_attr* attr, const char* cgroup_path);
+
+// Called on a stream just before it is closed, e.g. to drain what is left
+// in its ring buffer.
+typedef void (*perf_stream_fn)(struct perf_stream* stream, void* ctx);
+
+// One event per thread listed in /proc/<pid>/task. Calling it again opens
+// events for threads that appeared since and closes those of threads that
+// exited, passing each to retire (which may be NULL) first. A tid the kernel
+// reused for a new thread gets a new event. Returns the number opened.
+// Clear attr->disabled before a rescan so new threads start sampling at once.
+// Streams may move in the array, so no pointer to one is kept across calls.
+int perf_streams_open_threads(struct perf_streams* streams, struct perf_event_attr* attr, pid_t pid,
+    perf_stream_fn retire, void* ctx);
+
+void perf_streams_enable(struct perf_streams* streams);
+
+void perf_streams_disable(struct perf_streams* streams);
+
+// Add another fd, e.g. a timerfd, to the epoll set. perf_streams_wait()
+// reports it through its watched argument instead of the ready list.
+int perf_streams_watch(struct perf_streams* streams, int fd);
+
+// Wait up to timeout_ms for ring buffers to pass their wakeup watermark.
+// Ready streams are stored in ready (at most max). Returns the count, or -1.
+// When watched is not NULL it is set to whether a watched fd is readable.
+int perf_streams_wait(struct perf_streams* streams, struct perf_stream** ready, int max, int timeout_ms, int* watched);
+
+void perf_streams_close(struct perf_streams* streams);
+
+#endif
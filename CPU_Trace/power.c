@@ -2,44 +2,33 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
+#include "rapl.h"
 
-int main() {
-    FILE* fp;
-    char buffer[1024];
+int main(int argc, char** argv) {
+    struct rapl rapl;
     struct timespec start, end;
     double elapsed_seconds;
 
-    // Get the start time
-    clock_gettime(CLOCK_MONOTONIC, &start);
-
-    // Open the energy file for reading
-    fp = fopen("/sys/class/powercap/intel-rapl/intel-rapl:0/energy_uj", "r");
-    if (fp == NULL) {
-        perror("fopen");
+    // Optional powercap root, e.g. a fake tree for testing
+    const char* root = argc > 1 ? argv[1] : RAPL_DEFAULT_ROOT;
+    if (rapl_open(&rapl, root) != 0)
         return 1;
-    }
 
-    // Read the initial energy value
-    fgets(buffer, sizeof(buffer), fp);
-    long long initialEnergy = atoll(buffer);
-    fclose(fp);
+    // Get the start time
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     // Your workload here...
 
     usleep(1000000); // Simulate workload with a sleep
 
 
-    // Open and read the final energy value
-    fp = fopen("/sys/class/powercap/intel-rapl/intel-rapl:0/energy_uj", "r");
-    if (fp == NULL) {
-        perror("fopen");
+    // Read the counters again, the energy since rapl_open() is accumulated per domain
+    if (rapl_read(&rapl) != 0) {
+        fprintf(stderr, "Error reading RAPL energy counters\n");
+        rapl_close(&rapl);
         return 1;
     }
 
-    fgets(buffer, sizeof(buffer), fp);
-    long long finalEnergy = atoll(buffer);
-    fclose(fp);
-
     // Get the end time
     clock_gettime(CLOCK_MONOTONIC, &end);
 
@@ -47,16 +36,21 @@ int main() {
     elapsed_seconds = (end.tv_sec - start.tv_sec) +
         (end.tv_nsec - start.tv_nsec) / 1000000000.0;
 
-    // Calculate the energy consumed during the workload
-    long long consumedEnergy = finalEnergy - initialEnergy;
-
     // Calculate power in watts (joules per second)
     // Convert microjoules to joules by dividing by 1,000,000
+    for (size_t i = 0; i < rapl.count; i++) {
+        const struct rapl_domain* domain = &rapl.domains[i];
+        printf("%s: %lu microjoules, %.6f watts\n", domain->name, domain->total_uj,
+            (domain->total_uj / 1000000.0) / elapsed_seconds);
+    }
+
+    unsigned long consumedEnergy = rapl_energy_uj(&rapl, RAPL_PACKAGE);
     double power = (consumedEnergy / 1000000.0) / elapsed_seconds;
 
-    printf("Energy consumed: %lld microjoules\n", consumedEnergy);
+    printf("Energy consumed (all packages): %lu microjoules\n", consumedEnergy);
     printf("Time elapsed: %.6f seconds\n", elapsed_seconds);
     printf("Average power: %.6f watts\n", power);
 
+    rapl_close(&rapl);
     return 0;
 }
@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <string.h>
+#include "procmaps.h"
+
+int procmaps_parse_line(char* line, struct procmap* map)
+{
+    // start-end perms offset dev inode [path]
+    char perms[8];
+    unsigned long start, end, pgoff;
+    int path_offset = 0;
+    if (sscanf(line, "%lx-%lx %7s %lx %*s %*s %n", &start, &end, perms, &pgoff, &path_offset) < 4)
+        return -1;
+
+    map->start = start;
+    map->end = end;
+    map->pgoff = pgoff;
+    map->exec = strchr(perms, 'x') != NULL;
+    map->path = NULL;
+
+    if (path_offset > 0 && line[path_offset] != '\0') {
+        char* path = line + path_offset;
+        path[strcspn(path, "\n")] = '\0';
+        if (*path)
+            map->path = path;
+    }
+    return 0;
+}
+
+int procmaps_add(struct procmaps* maps, uint64_t start, uint64_t end, uint64_t pgoff, const char* path)
+{
+    if (end <= start)
+        return -1;
+
+    // Drop every mapping the new one overlaps
+    size_t kept = 0;
+    size_t insert_at = 0;
+    for (size_t i = 0; i < maps->count; i++) {
+        struct procmap* map = &maps->maps[i];
+        if (map->start < end && start < map->end) {
+            free(map->path);
+            continue;
+        }
+        if (map->end <= start)
+            insert_at = kept + 1;
+        maps->maps[kept++] = *map;
+    }
+    maps->count = kept;
+
+    if (maps->count == maps->capacity) {
+        size_t capacity = maps->capacity ? maps->capacity * 2 : 64;
+        struct procmap* grown = realloc(maps->maps, capacity * sizeof(struct procmap));
+        if (!grown)
+            return -1;
+        maps->maps = grown;
+        maps->capacity = capacity;
+    }
+
+    memmove(&maps->maps[insert_at + 1], &maps->maps[insert_at], (maps->count - insert_at) * sizeof(struct procmap));
+    struct procmap* map = &maps->maps[insert_at];
+    map->start = start;
+    map->end = end;
+    map->pgoff = pgoff;
+    map->exec = 1;
+    map->path = path ? strdup(path) : NULL;
+    maps->count++;
+    return 0;
+}
+
+int procmaps_load(struct procmaps* maps, FILE* in)
+{
+    char line[4096];
+    while (fgets(line, sizeof(line), in)) {
+        struct procmap map;
+        if (procmaps_parse_line(line, &map) != 0 || !map.exec)
+            continue;
+        if (procmaps_add(maps, map.start, map.end, map.pgoff, map.path) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+const struct procmap* procmaps_find(const struct procmaps* maps, uint64_t addr)
+{
+    size_t lo = 0, hi = maps->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const struct procmap* map = &maps->maps[mid];
+        if (addr < map->start)
+            hi = mid;
+        else if (addr >= map->end)
+            lo = mid + 1;
+        else
+            return map;
+    }
+    return NULL;
+}
+
+void procmaps_free(struct procmaps* maps)
+{
+    for (size_t i = 0; i < maps->count; i++)
+        free(maps->maps[i].path);
+    free(maps->maps);
+    memset(maps, 0, sizeof(*maps));
+}
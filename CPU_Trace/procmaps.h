@@ -0,0 +1,38 @@
+#ifndef PROCMAPS_H
+#define PROCMAPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct procmap {
+    uint64_t start;
+    uint64_t end;
+    uint64_t pgoff;
+    int exec;
+    char* path; // NULL for anonymous mappings
+};
+
+// Address space of the target, sorted by start address without overlaps.
+struct procmaps {
+    struct procmap* maps;
+    size_t count;
+    size_t capacity;
+};
+
+// Parse one line of /proc/<pid>/maps. path points into line (NUL terminated
+// in place). Returns 0 on success.
+int procmaps_parse_line(char* line, struct procmap* map);
+
+// Add a mapping, replacing whatever it overlaps (like mmap(MAP_FIXED) does).
+int procmaps_add(struct procmaps* maps, uint64_t start, uint64_t end, uint64_t pgoff, const char* path);
+
+// Load every executable mapping from a saved /proc/<pid>/maps file.
+int procmaps_load(struct procmaps* maps, FILE* in);
+
+// Return the mapping containing addr, or NULL.
+const struct procmap* procmaps_find(const struct procmaps* maps, uint64_t addr);
+
+void procmaps_free(struct procmaps* maps);
+
+#endif
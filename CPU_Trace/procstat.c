@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "procstat.h"
+
+int procstat_open(struct procstat* stat, pid_t pid)
+{
+    memset(stat, 0, sizeof(*stat));
+    stat->pid = pid;
+    stat->task_fd = -1;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    stat->pid_fd = open(path, O_RDONLY | O_CLOEXEC);
+    stat->stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    if (stat->pid_fd == -1 || stat->stat_fd == -1) {
+        procstat_close(stat);
+        return -1;
+    }
+    return 0;
+}
+
+// Whole file into the buffer, NUL terminated. Returns its length or -1.
+static ssize_t read_fd(int fd, char* buffer)
+{
+    ssize_t len = pread(fd, buffer, PROCSTAT_BUFFER_SIZE - 1, 0);
+    if (len <= 0)
+        return -1;
+    buffer[len] = '\0';
+    return len;
+}
+
+static const char* skip_field(const char* p)
+{
+    while (*p == ' ')
+        p++;
+    while (*p && *p != ' ')
+        p++;
+    return p;
+}
+
+static const char* scan_ulong(const char* p, unsigned long* value)
+{
+    while (*p == ' ')
+        p++;
+    const char* start = p;
+    unsigned long v = 0;
+    while (*p >= '0' && *p <= '9')
+        v = v * 10 + (*p++ - '0');
+    *value = v;
+    return p == start ? NULL : p;
+}
+
+// utime + stime from a /proc/.../stat line. The command name may contain
+// spaces and parentheses, so fields are counted from the last ')'.
+static long parse_task_time(const char* buffer, size_t len)
+{
+    const char* p = memrchr(buffer, ')', len);
+    if (!p)
+        return -1;
+    p++;
+    // state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt
+    for (int i = 0; i < 11; i++)
+        p = skip_field(p);
+
+    unsigned long utime, stime;
+    if (!(p = scan_ulong(p, &utime)) || !scan_ulong(p, &stime))
+        return -1;
+    return utime + stime;
+}
+
+long procstat_process_time(struct procstat* stat)
+{
+    ssize_t len = read_fd(stat->pid_fd, stat->buffer);
+    return len < 0 ? -1 : parse_task_time(stat->buffer, len);
+}
+
+long procstat_total_time(struct procstat* stat)
+{
+    if (read_fd(stat->stat_fd, stat->buffer) < 0 || strncmp(stat->buffer, "cpu ", 4) != 0)
+        return -1;
+
+    // cpu  user nice system idle iowait irq softirq
+    unsigned long fields[7];
+    const char* p = stat->buffer + 3;
+    for (int i = 0; i < 7; i++) {
+        if (!(p = scan_ulong(p, &fields[i])))
+            return -1;
+    }
+    return fields[0] + fields[1] + fields[2] + fields[5] + fields[6];
+}
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static int add_thread(struct procstat* stat, pid_t tid)
+{
+    for (size_t i = 0; i < stat->nthreads; i++) {
+        if (stat->threads[i].tid == tid) {
+            stat->threads[i].seen = 1;
+            return 0;
+        }
+    }
+
+    char path[32];
+    snprintf(path, sizeof(path), "%d/stat", tid);
+    int fd = openat(stat->task_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 0; // exited in the meantime
+
+    if (stat->nthreads == stat->capacity) {
+        size_t capacity = stat->capacity ? stat->capacity * 2 : 16;
+        struct procstat_thread* threads = realloc(stat->threads, capacity * sizeof(struct procstat_thread));
+        if (!threads) {
+            close(fd);
+            return -1;
+        }
+        stat->threads = threads;
+        stat->capacity = capacity;
+    }
+    struct procstat_thread* thread = &stat->threads[stat->nthreads++];
+    thread->tid = tid;
+    thread->fd = fd;
+    thread->time = 0;
+    thread->seen = 1;
+    return 0;
+}
+
+long procstat_read_threads(struct procstat* stat)
+{
+    if (stat->task_fd == -1) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task", stat->pid);
+        stat->task_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (stat->task_fd == -1)
+            return -1;
+    }
+
+    for (size_t i = 0; i < stat->nthreads; i++)
+        stat->threads[i].seen = 0;
+
+    // The directory stream is rewound and read with getdents64 into the
+    // stack, opendir() would allocate on every rescan
+    if (lseek(stat->task_fd, 0, SEEK_SET) == -1)
+        return -1;
+    char dents[4096] __attribute__((aligned(8)));
+    long nread;
+    while ((nread = syscall(SYS_getdents64, stat->task_fd, dents, sizeof(dents))) > 0) {
+        for (long offset = 0; offset < nread;) {
+            struct linux_dirent64* dent = (struct linux_dirent64*)(dents + offset);
+            offset += dent->d_reclen;
+            if (dent->d_name[0] < '0' || dent->d_name[0] > '9')
+                continue;
+            if (add_thread(stat, atoi(dent->d_name)) != 0)
+                return -1;
+        }
+    }
+    if (nread < 0)
+        return -1;
+
+    // Drop threads that are gone, read the others
+    size_t kept = 0;
+    for (size_t i = 0; i < stat->nthreads; i++) {
+        struct procstat_thread* thread = &stat->threads[i];
+        ssize_t len = thread->seen ? read_fd(thread->fd, stat->buffer) : -1;
+        long time = len < 0 ? -1 : parse_task_time(stat->buffer, len);
+        if (time < 0) {
+            close(thread->fd);
+            continue;
+        }
+        thread->time = time;
+        stat->threads[kept++] = *thread;
+    }
+    stat->nthreads = kept;
+    return kept;
+}
+
+void procstat_close(struct procstat* stat)
+{
+    for (size_t i = 0; i < stat->nthreads; i++)
+        close(stat->threads[i].fd);
+    free(stat->threads);
+    if (stat->task_fd != -1)
+        close(stat->task_fd);
+    if (stat->pid_fd != -1)
+        close(stat->pid_fd);
+    if (stat->stat_fd != -1)
+        close(stat->stat_fd);
+    stat->threads = NULL;
+    stat->nthreads = stat->capacity = 0;
+    stat->task_fd = stat->pid_fd = stat->stat_fd = -1;
+}
@@ -0,0 +1,48 @@
+#ifndef PROCSTAT_H
+#define PROCSTAT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// CPU time of a process, its threads and the whole system, in clock ticks.
+// /proc/stat, /proc/<pid>/stat and every /proc/<pid>/task/<tid>/stat stay
+// open; each reading is one pread() into a fixed buffer followed by a hand
+// scan of the fields, without stdio or allocations.
+
+#define PROCSTAT_BUFFER_SIZE 2048
+
+struct procstat_thread {
+    pid_t tid;
+    int fd;      // /proc/<pid>/task/<tid>/stat
+    long time;   // utime + stime at the last procstat_read_threads()
+    int seen;    // still listed in the task directory
+};
+
+struct procstat {
+    pid_t pid;
+    int stat_fd;      // /proc/stat
+    int pid_fd;       // /proc/<pid>/stat
+    int task_fd;      // /proc/<pid>/task, -1 until threads are first read
+    char buffer[PROCSTAT_BUFFER_SIZE];
+
+    struct procstat_thread* threads;
+    size_t nthreads;
+    size_t capacity;
+};
+
+int procstat_open(struct procstat* stat, pid_t pid);
+
+// utime + stime of every thread of the process, -1 once it is gone.
+long procstat_process_time(struct procstat* stat);
+
+// user + nice + system + irq + softirq of all CPUs, -1 on error.
+long procstat_total_time(struct procstat* stat);
+
+// Update stat->threads: threads that appeared are opened, threads that
+// exited are dropped, and every time is read. Returns the thread count,
+// or -1 when the task directory cannot be read.
+long procstat_read_threads(struct procstat* stat);
+
+void procstat_close(struct procstat* stat);
+
+#endif
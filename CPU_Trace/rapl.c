@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include "rapl.h"
+
+static const char* kind_names[] = { "package", "core", "uncore", "dram", "psys", "other" };
+
+const char* rapl_kind_name(enum rapl_kind kind)
+{
+    return kind_names[kind];
+}
+
+static enum rapl_kind kind_from_name(const char* name)
+{
+    if (strncmp(name, "package", 7) == 0)
+        return RAPL_PACKAGE;
+    for (int kind = RAPL_CORE; kind < RAPL_OTHER; kind++) {
+        if (strcmp(name, kind_names[kind]) == 0)
+            return kind;
+    }
+    return RAPL_OTHER;
+}
+
+// Read a small sysfs file into buffer, without the trailing newline.
+static int read_attr(const char* zone, const char* attr, char* buffer, size_t size)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", zone, attr);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t len = read(fd, buffer, size - 1);
+    close(fd);
+    if (len <= 0)
+        return -1;
+    buffer[len] = '\0';
+    buffer[strcspn(buffer, "\n")] = '\0';
+    return 0;
+}
+
+static int read_counter(int fd, uint64_t* value)
+{
+    char buffer[32];
+    ssize_t len = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (len <= 0)
+        return -1;
+    buffer[len] = '\0';
+    char* end;
+    *value = strtoull(buffer, &end, 10);
+    return end == buffer ? -1 : 0;
+}
+
+static struct rapl_domain* new_domain(struct rapl* rapl)
+{
+    if (rapl->count == rapl->capacity) {
+        size_t capacity = rapl->capacity ? rapl->capacity * 2 : 8;
+        struct rapl_domain* domains = realloc(rapl->domains, capacity * sizeof(struct rapl_domain));
+        if (!domains)
+            return NULL;
+        rapl->domains = domains;
+        rapl->capacity = capacity;
+    }
+    struct rapl_domain* domain = &rapl->domains[rapl->count++];
+    memset(domain, 0, sizeof(*domain));
+    domain->fd = -1;
+    domain->leader_fd = -1;
+    return domain;
+}
+
+static int add_domain(struct rapl* rapl, const char* zone, int package, const char* parent)
+{
+    char name[48];
+    if (read_attr(zone, "name", name, sizeof(name)) != 0)
+        return -1;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/energy_uj", zone);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    uint64_t value;
+    if (read_counter(fd, &value) != 0) {
+        fprintf(stderr, "%s: could not read the energy counter\n", path);
+        close(fd);
+        return -1;
+    }
+
+    struct rapl_domain* domain = new_domain(rapl);
+    if (!domain) {
+        close(fd);
+        return -1;
+    }
+    if (parent)
+        snprintf(domain->name, sizeof(domain->name), "%s/%s", parent, name);
+    else
+        snprintf(domain->name, sizeof(domain->name), "%s", name);
+    domain->kind = kind_from_name(name);
+    domain->package = package;
+    domain->fd = fd;
+    domain->last_uj = value;
+
+    char range[32];
+    if (read_attr(zone, "max_energy_range_uj", range, sizeof(range)) == 0)
+        domain->max_energy_uj = strtoull(range, NULL, 10);
+    return 0;
+}
+
+// intel-rapl:N for zones, intel-rapl:N:M for subzones
+static int is_zone(const struct dirent* entry)
+{
+    int a, len = 0;
+    return sscanf(entry->d_name, "intel-rapl:%d%n", &a, &len) == 1 && entry->d_name[len] == '\0';
+}
+
+static int is_subzone(const struct dirent* entry)
+{
+    int a, b, len = 0;
+    return sscanf(entry->d_name, "intel-rapl:%d:%d%n", &a, &b, &len) == 2 && entry->d_name[len] == '\0';
+}
+
+int rapl_open(struct rapl* rapl, const char* root)
+{
+    memset(rapl, 0, sizeof(*rapl));
+
+    char base[4096];
+    snprintf(base, sizeof(base), "%s/intel-rapl", root);
+    struct dirent** zones;
+    int nzones = scandir(base, &zones, is_zone, versionsort);
+    if (nzones < 0) {
+        perror(base);
+        return -1;
+    }
+
+    for (int z = 0; z < nzones; z++) {
+        char zone[4096];
+        if (snprintf(zone, sizeof(zone), "%s/%s", base, zones[z]->d_name) >= (int)sizeof(zone)) {
+            free(zones[z]);
+            continue;
+        }
+        int package = atoi(zones[z]->d_name + strlen("intel-rapl:"));
+        size_t parent = rapl->count;
+        if (add_domain(rapl, zone, package, NULL) == 0) {
+            // add_domain() may move the array
+            char parent_name[sizeof(rapl->domains->name)];
+            memcpy(parent_name, rapl->domains[parent].name, sizeof(parent_name));
+            struct dirent** subzones;
+            int nsubzones = scandir(zone, &subzones, is_subzone, versionsort);
+            for (int s = 0; s < nsubzones; s++) {
+                char subzone[4096];
+                if (snprintf(subzone, sizeof(subzone), "%s/%s", zone, subzones[s]->d_name) < (int)sizeof(subzone))
+                    add_domain(rapl, subzone, package, parent_name);
+                free(subzones[s]);
+            }
+            if (nsubzones >= 0)
+                free(subzones);
+        }
+        free(zones[z]);
+    }
+    free(zones);
+
+    if (rapl->count == 0) {
+        fprintf(stderr, "No readable RAPL domains under %s\n", base);
+        rapl_close(rapl);
+        return -1;
+    }
+    return 0;
+}
+
+// energy-pkg -> package, energy-ram -> dram, ...
+static const struct {
+    const char* event;
+    const char* name;
+    enum rapl_kind kind;
+} pmu_events[] = {
+    { "energy-pkg", NULL, RAPL_PACKAGE },
+    { "energy-cores", "core", RAPL_CORE },
+    { "energy-gpu", "uncore", RAPL_UNCORE },
+    { "energy-ram", "dram", RAPL_DRAM },
+    { "energy-psys", "psys", RAPL_PSYS },
+};
+
+struct pmu_event {
+    char name[32];
+    uint64_t config;
+    double scale;
+};
+
+static int is_pmu_event(const struct dirent* entry)
+{
+    return strncmp(entry->d_name, "energy-", 7) == 0 && !strchr(entry->d_name, '.');
+}
+
+// Parse "event=0x02" and the .scale and .unit files next to it.
+static int read_pmu_event(const char* events_dir, const char* name, struct pmu_event* event)
+{
+    char buffer[64], attr[64];
+    unsigned long config;
+    if (read_attr(events_dir, name, buffer, sizeof(buffer)) != 0 || sscanf(buffer, "event=%lx", &config) != 1)
+        return -1;
+
+    snprintf(attr, sizeof(attr), "%s.unit", name);
+    if (read_attr(events_dir, attr, buffer, sizeof(buffer)) != 0 || strcmp(buffer, "Joules") != 0) {
+        fprintf(stderr, "%s/%s: unit is not Joules, skipping\n", events_dir, name);
+        return -1;
+    }
+    snprintf(attr, sizeof(attr), "%s.scale", name);
+    if (read_attr(events_dir, attr, buffer, sizeof(buffer)) != 0)
+        return -1;
+
+    snprintf(event->name, sizeof(event->name), "%s", name);
+    event->config = config;
+    event->scale = strtod(buffer, NULL);
+    return event->scale > 0 ? 0 : -1;
+}
+
+static int read_pmu_group(struct rapl_domain* domains, size_t n, int init)
+{
+    uint64_t values[1 + RAPL_PMU_MAX_EVENTS];
+    ssize_t len = read(domains[0].leader_fd, values, (1 + n) * sizeof(uint64_t));
+    if (len != (ssize_t)((1 + n) * sizeof(uint64_t)) || values[0] != n)
+        return -1;
+    for (size_t k = 0; k < n; k++) {
+        if (init)
+            domains[k].start_count = values[1 + k];
+        domains[k].total_uj = (uint64_t)((values[1 + k] - domains[k].start_count) * domains[k].scale * 1e6);
+    }
+    return 0;
+}
+
+int rapl_open_pmu(struct rapl* rapl, const char* pmu_dir)
+{
+    memset(rapl, 0, sizeof(*rapl));
+    rapl->pmu = 1;
+
+    char buffer[256];
+    if (read_attr(pmu_dir, "type", buffer, sizeof(buffer)) != 0) {
+        fprintf(stderr, "No power PMU at %s\n", pmu_dir);
+        return -1;
+    }
+    uint32_t type = strtoul(buffer, NULL, 10);
+
+    // The PMU is counted on one CPU of each package
+    if (read_attr(pmu_dir, "cpumask", buffer, sizeof(buffer)) != 0)
+        return -1;
+    int cpus[64];
+    size_t ncpus = 0;
+    for (char* p = buffer; *p && ncpus < 64;) {
+        char* end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p)
+            break;
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long cpu = first; cpu <= last && ncpus < 64; cpu++)
+            cpus[ncpus++] = cpu;
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    char events_dir[4096];
+    snprintf(events_dir, sizeof(events_dir), "%s/events", pmu_dir);
+    struct dirent** entries;
+    int nentries = scandir(events_dir, &entries, is_pmu_event, alphasort);
+    if (nentries < 0) {
+        perror(events_dir);
+        return -1;
+    }
+    struct pmu_event events[RAPL_PMU_MAX_EVENTS];
+    size_t nevents = 0;
+    for (int i = 0; i < nentries; i++) {
+        if (nevents < RAPL_PMU_MAX_EVENTS && read_pmu_event(events_dir, entries[i]->d_name, &events[nevents]) == 0)
+            nevents++;
+        free(entries[i]);
+    }
+    free(entries);
+
+    for (size_t package = 0; package < ncpus; package++) {
+        int leader = -1;
+        size_t first = rapl->count;
+        for (size_t e = 0; e < nevents; e++) {
+            const char* name = events[e].name;
+            enum rapl_kind kind = RAPL_OTHER;
+            for (size_t k = 0; k < sizeof(pmu_events) / sizeof(pmu_events[0]); k++) {
+                if (strcmp(name, pmu_events[k].event) == 0) {
+                    name = pmu_events[k].name;
+                    kind = pmu_events[k].kind;
+                }
+            }
+            // psys covers the whole platform, count it once
+            if (kind == RAPL_PSYS && package > 0)
+                continue;
+
+            struct perf_event_attr attr = { 0 };
+            attr.type = type;
+            attr.size = sizeof(attr);
+            attr.config = events[e].config;
+            attr.read_format = PERF_FORMAT_GROUP;
+            int fd = syscall(SYS_perf_event_open, &attr, -1, cpus[package], leader, PERF_FLAG_FD_CLOEXEC);
+            if (fd == -1) {
+                fprintf(stderr, "perf_event_open %s on cpu %d: %s\n", events[e].name, cpus[package], strerror(errno));
+                continue;
+            }
+
+            struct rapl_domain* domain = new_domain(rapl);
+            if (!domain) {
+                close(fd);
+                break;
+            }
+            if (kind == RAPL_PSYS)
+                snprintf(domain->name, sizeof(domain->name), "psys");
+            else if (kind == RAPL_PACKAGE)
+                snprintf(domain->name, sizeof(domain->name), "package-%zu", package);
+            else
+                snprintf(domain->name, sizeof(domain->name), "package-%zu/%s", package, name);
+            domain->kind = kind;
+            domain->package = package;
+            domain->fd = fd;
+            if (leader == -1)
+                leader = fd;
+            domain->leader_fd = leader;
+            domain->scale = events[e].scale;
+        }
+        if (rapl->count > first && read_pmu_group(&rapl->domains[first], rapl->count - first, 1) != 0) {
+            fprintf(stderr, "Could not read the power PMU group of cpu %d\n", cpus[package]);
+            rapl_close(rapl);
+            return -1;
+        }
+    }
+
+    if (rapl->count == 0) {
+        fprintf(stderr, "No power PMU events could be opened at %s\n", pmu_dir);
+        rapl_close(rapl);
+        return -1;
+    }
+    return 0;
+}
+
+int rapl_read(struct rapl* rapl)
+{
+    int ret = 0;
+    if (rapl->pmu) {
+        // One read() per package group
+        for (size_t i = 0; i < rapl->count;) {
+            size_t n = 1;
+            while (i + n < rapl->count && rapl->domains[i + n].leader_fd == rapl->domains[i].leader_fd)
+                n++;
+            if (read_pmu_group(&rapl->domains[i], n, 0) != 0)
+                ret = -1;
+            i += n;
+        }
+        return ret;
+    }
+
+    for (size_t i = 0; i < rapl->count; i++) {
+        struct rapl_domain* domain = &rapl->domains[i];
+        uint64_t value;
+        if (read_counter(domain->fd, &value) != 0) {
+            ret = -1;
+            continue;
+        }
+        // energy_uj counts up to max_energy_range_uj and starts again at 0,
+        // so going from max to 0 is one more microjoule
+        if (value >= domain->last_uj)
+            domain->total_uj += value - domain->last_uj;
+        else if (domain->max_energy_uj >= domain->last_uj)
+            domain->total_uj += domain->max_energy_uj - domain->last_uj + value + 1;
+        else
+            domain->total_uj += value;
+        domain->last_uj = value;
+    }
+    return ret;
+}
+
+uint64_t rapl_energy_uj(const struct rapl* rapl, enum rapl_kind kind)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < rapl->count; i++) {
+        if (rapl->domains[i].kind == kind)
+            total += rapl->domains[i].total_uj;
+    }
+    return total;
+}
+
+void rapl_close(struct rapl* rapl)
+{
+    for (size_t i = 0; i < rapl->count; i++)
+        close(rapl->domains[i].fd);
+    free(rapl->domains);
+    memset(rapl, 0, sizeof(*rapl));
+}
@@ -0,0 +1,73 @@
+#ifndef RAPL_H
+#define RAPL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// RAPL energy counters from the powercap sysfs tree. Every package zone
+// (intel-rapl:N) and its subzones (intel-rapl:N:M: core, uncore, dram) is
+// opened once and read with pread(), and each counter is accumulated across
+// its max_energy_range_uj wraparound.
+//
+// Alternatively the same counters come from the perf power PMU: one event
+// group per package, each group read with a single read() and converted
+// with the scale sysfs gives for the event.
+
+#define RAPL_DEFAULT_ROOT "/sys/class/powercap"
+#define RAPL_PMU_DEFAULT_DIR "/sys/bus/event_source/devices/power"
+
+// energy-* events read together per package
+#define RAPL_PMU_MAX_EVENTS 8
+
+enum rapl_kind {
+    RAPL_PACKAGE,
+    RAPL_CORE,
+    RAPL_UNCORE,
+    RAPL_DRAM,
+    RAPL_PSYS,
+    RAPL_OTHER,
+};
+
+struct rapl_domain {
+    char name[64];          // "package-0", "package-0/dram", "psys", ...
+    enum rapl_kind kind;
+    int package;            // N of the intel-rapl:N zone it belongs to
+    int fd;                 // energy_uj
+    uint64_t max_energy_uj; // the counter wraps after this value, 0 if unknown
+    uint64_t last_uj;       // raw counter at the previous read
+    uint64_t total_uj;      // accumulated since rapl_open()
+
+    // PMU backend only
+    int leader_fd;          // the group this event is read with
+    double scale;           // joules per count
+    uint64_t start_count;   // at rapl_open_pmu()
+};
+
+struct rapl {
+    struct rapl_domain* domains;
+    size_t count;
+    size_t capacity;
+    int pmu;                // domains are power PMU events
+};
+
+// Discover and open every domain under root/intel-rapl (root is normally
+// RAPL_DEFAULT_ROOT). Returns -1 when no domain could be opened.
+int rapl_open(struct rapl* rapl, const char* root);
+
+// Open the power PMU at pmu_dir (normally RAPL_PMU_DEFAULT_DIR) instead,
+// one event per energy-* event and package. Returns -1 when the PMU is
+// missing or no event could be opened, e.g. without CAP_PERFMON.
+int rapl_open_pmu(struct rapl* rapl, const char* pmu_dir);
+
+// Read every counter and add the energy since the previous read to its
+// total. Returns -1 if a counter could not be read; the others still advance.
+int rapl_read(struct rapl* rapl);
+
+// Sum of the totals of every domain of one kind, e.g. all packages.
+uint64_t rapl_energy_uj(const struct rapl* rapl, enum rapl_kind kind);
+
+const char* rapl_kind_name(enum rapl_kind kind);
+
+void rapl_close(struct rapl* rapl);
+
+#endif
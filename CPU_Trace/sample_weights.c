@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include "sample_weights.h"
+
+struct time_order {
+    uint64_t time_ns;
+    size_t index;
+};
+
+static int compare_time(const void* a, const void* b)
+{
+    const struct time_order* ta = a;
+    const struct time_order* tb = b;
+    if (ta->time_ns != tb->time_ns)
+        return ta->time_ns < tb->time_ns ? -1 : 1;
+    return (ta->index > tb->index) - (ta->index < tb->index);
+}
+
+void sample_weights(const struct chain_tag* tags, size_t n, uint64_t start_ns, double* weights)
+{
+    int all_tagged = 1, all_periods = 1;
+    for (size_t i = 0; i < n; i++) {
+        all_tagged &= tags[i].tagged;
+        all_periods &= tags[i].tagged && tags[i].period > 0;
+    }
+
+    if (!all_tagged) {
+        for (size_t i = 0; i < n; i++)
+            weights[i] = 1.0;
+        return;
+    }
+    if (all_periods) {
+        for (size_t i = 0; i < n; i++)
+            weights[i] = tags[i].period;
+        return;
+    }
+
+    struct time_order* order = malloc(n * sizeof(struct time_order));
+    struct { uint32_t cpu; uint64_t last; }* cpus = malloc(n * sizeof(*cpus));
+    double total = 0;
+    if (order && cpus) {
+        for (size_t i = 0; i < n; i++) {
+            order[i].time_ns = tags[i].time_ns;
+            order[i].index = i;
+        }
+        qsort(order, n, sizeof(struct time_order), compare_time);
+
+        size_t ncpus = 0;
+        for (size_t k = 0; k < n; k++) {
+            const struct chain_tag* tag = &tags[order[k].index];
+            size_t c = 0;
+            while (c < ncpus && cpus[c].cpu != tag->cpu)
+                c++;
+            if (c == ncpus) {
+                cpus[ncpus].cpu = tag->cpu;
+                cpus[ncpus++].last = start_ns;
+            }
+            uint64_t prev = cpus[c].last;
+            double weight = tag->time_ns > prev ? (double)(tag->time_ns - prev) : 0.0;
+            weights[order[k].index] = weight;
+            total += weight;
+            if (tag->time_ns > prev)
+                cpus[c].last = tag->time_ns;
+        }
+    }
+    free(order);
+    free(cpus);
+
+    if (total == 0) {
+        for (size_t i = 0; i < n; i++)
+            weights[i] = 1.0;
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef SAMPLE_WEIGHTS_H
+#define SAMPLE_WEIGHTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// How an interval's energy is split among its samples, shared by the
+// native tools. Same rules as sample_weights() in collapse_report.py.
+
+// The timestamp tag of a callchain, tagged is 0 for older traces.
+struct chain_tag {
+    int tagged;
+    uint64_t time_ns;
+    uint32_t cpu;
+    uint32_t tid;
+    uint64_t period;
+};
+
+// Weight of each of the n samples of the interval starting at start_ns:
+// its period, else the time since the previous sample on the same CPU,
+// else equal weights.
+void sample_weights(const struct chain_tag* tags, size_t n, uint64_t start_ns, double* weights);
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "spsc_queue.h"
+
+#define SPSC_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+// Attempts that yield before spsc_queue_wait() blocks or
+// spsc_queue_backoff() starts sleeping
+#define SPSC_SPINS 64
+#define SPSC_SLEEP_NS 200000
+
+int spsc_queue_init(struct spsc_queue* queue, size_t capacity)
+{
+    memset(queue, 0, sizeof(*queue));
+    if (capacity < 64 || (capacity & (capacity - 1)) != 0)
+        return -1;
+    queue->ring = aligned_alloc(64, capacity);
+    if (!queue->ring)
+        return -1;
+    queue->capacity = capacity;
+    return 0;
+}
+
+int spsc_queue_push(struct spsc_queue* queue, uint32_t type, const void* data, size_t len,
+    const void* more, size_t more_len, size_t reserve)
+{
+    size_t size = SPSC_ALIGN(sizeof(struct spsc_message) + len + more_len);
+    uint64_t head = queue->head;
+    uint64_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    // Sizes are multiples of 8, so padding always has room for its header
+    size_t offset = head & (queue->capacity - 1);
+    size_t padding = queue->capacity - offset < size ? queue->capacity - offset : 0;
+    size_t depth = head - tail + padding + size;
+    if (size > queue->capacity / 2 || depth + reserve > queue->capacity)
+        return -1;
+
+    if (padding) {
+        struct spsc_message* pad = (struct spsc_message*)(queue->ring + offset);
+        pad->size = padding;
+        pad->type = SPSC_PADDING;
+        offset = 0;
+    }
+    struct spsc_message* message = (struct spsc_message*)(queue->ring + offset);
+    message->size = size;
+    message->type = type;
+    if (len)
+        memcpy(message->data, data, len);
+    if (more_len)
+        memcpy(message->data + len, more, more_len);
+
+    // Publish the message after its contents
+    __atomic_store_n(&queue->head, head + padding + size, __ATOMIC_RELEASE);
+    queue->pushed++;
+    if (depth > queue->peak)
+        __atomic_store_n(&queue->peak, depth, __ATOMIC_RELAXED);
+
+    // Wake a consumer asleep on the empty queue. The fence orders the head
+    // store before the load, against the opposite order in spsc_queue_wait(),
+    // so either the consumer sees this message or this sees it sleeping.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->sleeping, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&queue->sleeping, 0, __ATOMIC_RELAXED);
+        syscall(SYS_futex, &queue->sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+    return 0;
+}
+
+struct spsc_message* spsc_queue_peek(struct spsc_queue* queue)
+{
+    uint64_t tail = queue->tail;
+    uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    while (tail != head) {
+        struct spsc_message* message = (struct spsc_message*)(queue->ring + (tail & (queue->capacity - 1)));
+        if (message->type != SPSC_PADDING)
+            return message;
+        tail += message->size;
+        __atomic_store_n(&queue->tail, tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+void spsc_queue_pop(struct spsc_queue* queue)
+{
+    struct spsc_message* message = (struct spsc_message*)(queue->ring + (queue->tail & (queue->capacity - 1)));
+    // Release the slot only once the consumer is done reading it
+    __atomic_store_n(&queue->tail, queue->tail + message->size, __ATOMIC_RELEASE);
+}
+
+size_t spsc_queue_depth(struct spsc_queue* queue)
+{
+    uint64_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
+
+void spsc_queue_wait(struct spsc_queue* queue, unsigned int* attempt)
+{
+    if ((*attempt)++ < SPSC_SPINS) {
+        sched_yield();
+        return;
+    }
+    __atomic_store_n(&queue->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    // Returns at once when a push already cleared sleeping
+    if (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == queue->tail)
+        syscall(SYS_futex, &queue->sleeping, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+    __atomic_store_n(&queue->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+void spsc_queue_backoff(unsigned int* attempt)
+{
+    if ((*attempt)++ < SPSC_SPINS) {
+        sched_yield();
+        return;
+    }
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = SPSC_SLEEP_NS };
+    nanosleep(&ts, NULL);
+}
+
+void spsc_queue_free(struct spsc_queue* queue)
+{
+    free(queue->ring);
+    memset(queue, 0, sizeof(*queue));
+}
@@ -0,0 +1,67 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free queue of variable-size messages between one producer thread and
+// one consumer thread. Messages are stored back to back in a power-of-two
+// ring and are always contiguous: one that would straddle the end of the
+// ring is preceded by padding. Each side only writes its own index, so
+// neither ever waits on the other; a full queue makes the push fail. An idle
+// consumer can sleep until the next push instead of polling.
+
+// Message type 0 is the padding, callers use the others.
+#define SPSC_PADDING 0
+
+struct spsc_message {
+    uint32_t size;  // header included, a multiple of 8
+    uint32_t type;
+    char data[];    // 8-byte aligned
+};
+
+struct spsc_queue {
+    char* ring;
+    size_t capacity;
+
+    // Producer side
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t pushed;
+    size_t peak;    // deepest fill seen by a push, in bytes, may be read with relaxed loads
+
+    // Consumer side
+    uint64_t tail __attribute__((aligned(64)));
+    uint32_t sleeping;  // futex, 1 while the consumer waits in spsc_queue_wait()
+};
+
+// capacity in bytes, a power of two.
+int spsc_queue_init(struct spsc_queue* queue, size_t capacity);
+
+// Copy a message made of data followed by more (which may be NULL) into the
+// queue, e.g. the two halves of a record that wraps around a perf ring
+// buffer. Fails unless reserve bytes stay free afterwards, so that a
+// producer can keep room for messages it must not drop. Producer only.
+int spsc_queue_push(struct spsc_queue* queue, uint32_t type, const void* data, size_t len,
+    const void* more, size_t more_len, size_t reserve);
+
+// Oldest message, or NULL when the queue is empty. It stays valid until
+// spsc_queue_pop(). Consumer only.
+struct spsc_message* spsc_queue_peek(struct spsc_queue* queue);
+
+void spsc_queue_pop(struct spsc_queue* queue);
+
+// Bytes in use, safe from either side.
+size_t spsc_queue_depth(struct spsc_queue* queue);
+
+// Wait before retrying an empty peek: yield for the first attempts, then
+// block until the producer pushes. Reset attempt to 0 after progress.
+// Consumer only.
+void spsc_queue_wait(struct spsc_queue* queue, unsigned int* attempt);
+
+// Wait a little before retrying a full push: yield for the first attempts,
+// then sleep. Reset attempt to 0 after progress.
+void spsc_queue_backoff(unsigned int* attempt);
+
+void spsc_queue_free(struct spsc_queue* queue);
+
+#endif
@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+#include "stack_trie.h"
+
+static uint64_t hash_str(const char* str, size_t len)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static inline uint64_t hash_edge(uint32_t parent, uint32_t frame)
+{
+    uint64_t key = ((uint64_t)parent << 32) | frame;
+    return (key ^ (key >> 29)) * 0x9E3779B97F4A7C15ULL;
+}
+
+int stack_trie_init(struct stack_trie* trie)
+{
+    memset(trie, 0, sizeof(*trie));
+    trie->frames_capacity = 1024;
+    trie->frame_slots_capacity = 2048;
+    trie->nodes_capacity = 4096;
+    trie->child_slots_capacity = 8192;
+
+    trie->frames = malloc(trie->frames_capacity * sizeof(struct stack_frame));
+    trie->frame_slots = calloc(trie->frame_slots_capacity, sizeof(uint32_t));
+    trie->nodes = malloc(trie->nodes_capacity * sizeof(struct stack_node));
+    trie->child_slots = calloc(trie->child_slots_capacity, sizeof(uint32_t));
+    if (!trie->frames || !trie->frame_slots || !trie->nodes || !trie->child_slots) {
+        stack_trie_free(trie);
+        return -1;
+    }
+
+    memset(&trie->nodes[STACK_TRIE_ROOT], 0, sizeof(struct stack_node));
+    trie->nnodes = 1;
+    return 0;
+}
+
+static char* pool_alloc(struct stack_trie* trie, size_t size)
+{
+    struct stack_trie_block* block = trie->blocks;
+    if (!block || block->size - block->used < size) {
+        size_t block_size = size > STACK_TRIE_POOL_BLOCK ? size : STACK_TRIE_POOL_BLOCK;
+        block = malloc(sizeof(struct stack_trie_block) + block_size);
+        if (!block)
+            return NULL;
+        block->size = block_size;
+        block->used = 0;
+        block->next = trie->blocks;
+        trie->blocks = block;
+    }
+    char* ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+static int grow_frame_slots(struct stack_trie* trie)
+{
+    size_t capacity = trie->frame_slots_capacity * 2;
+    uint32_t* slots = calloc(capacity, sizeof(uint32_t));
+    if (!slots)
+        return -1;
+    for (size_t id = 0; id < trie->nframes; id++) {
+        size_t i = trie->frames[id].hash & (capacity - 1);
+        while (slots[i])
+            i = (i + 1) & (capacity - 1);
+        slots[i] = id + 1;
+    }
+    free(trie->frame_slots);
+    trie->frame_slots = slots;
+    trie->frame_slots_capacity = capacity;
+    return 0;
+}
+
+static size_t find_frame_slot(const struct stack_trie* trie, const char* name, size_t len, uint64_t hash)
+{
+    size_t mask = trie->frame_slots_capacity - 1;
+    size_t i = hash & mask;
+    while (trie->frame_slots[i]) {
+        const struct stack_frame* frame = &trie->frames[trie->frame_slots[i] - 1];
+        if (frame->hash == hash && frame->len == len && memcmp(frame->name, name, len) == 0)
+            break;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+uint32_t stack_trie_frame(struct stack_trie* trie, const char* name, size_t len)
+{
+    uint64_t hash = hash_str(name, len);
+    size_t i = find_frame_slot(trie, name, len, hash);
+    if (trie->frame_slots[i])
+        return trie->frame_slots[i] - 1;
+
+    // Keep the table at most half full
+    if ((trie->nframes + 1) * 2 > trie->frame_slots_capacity) {
+        if (grow_frame_slots(trie) != 0)
+            return UINT32_MAX;
+        i = find_frame_slot(trie, name, len, hash);
+    }
+
+    if (trie->nframes == trie->frames_capacity) {
+        size_t capacity = trie->frames_capacity * 2;
+        struct stack_frame* frames = realloc(trie->frames, capacity * sizeof(struct stack_frame));
+        if (!frames)
+            return UINT32_MAX;
+        trie->frames = frames;
+        trie->frames_capacity = capacity;
+    }
+    char* copy = pool_alloc(trie, len + 1);
+    if (!copy)
+        return UINT32_MAX;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+
+    uint32_t id = trie->nframes++;
+    trie->frames[id].name = copy;
+    trie->frames[id].len = len;
+    trie->frames[id].hash = hash;
+    trie->frame_slots[i] = id + 1;
+    return id;
+}
+
+const char* stack_trie_frame_name(const struct stack_trie* trie, uint32_t frame)
+{
+    return frame < trie->nframes ? trie->frames[frame].name : NULL;
+}
+
+static int grow_child_slots(struct stack_trie* trie)
+{
+    size_t capacity = trie->child_slots_capacity * 2;
+    uint32_t* slots = calloc(capacity, sizeof(uint32_t));
+    if (!slots)
+        return -1;
+    for (size_t n = 1; n < trie->nnodes; n++) {
+        const struct stack_node* node = &trie->nodes[n];
+        size_t i = hash_edge(node->parent, node->frame) & (capacity - 1);
+        while (slots[i])
+            i = (i + 1) & (capacity - 1);
+        slots[i] = n;
+    }
+    free(trie->child_slots);
+    trie->child_slots = slots;
+    trie->child_slots_capacity = capacity;
+    return 0;
+}
+
+static size_t find_child_slot(const struct stack_trie* trie, uint32_t parent, uint32_t frame)
+{
+    size_t mask = trie->child_slots_capacity - 1;
+    size_t i = hash_edge(parent, frame) & mask;
+    while (trie->child_slots[i]) {
+        const struct stack_node* node = &trie->nodes[trie->child_slots[i]];
+        if (node->parent == parent && node->frame == frame)
+            break;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+uint32_t stack_trie_child(struct stack_trie* trie, uint32_t parent, uint32_t frame)
+{
+    size_t i = find_child_slot(trie, parent, frame);
+    if (trie->child_slots[i])
+        return trie->child_slots[i];
+
+    if ((trie->nnodes + 1) * 2 > trie->child_slots_capacity) {
+        if (grow_child_slots(trie) != 0)
+            return UINT32_MAX;
+        i = find_child_slot(trie, parent, frame);
+    }
+
+    if (trie->nnodes == trie->nodes_capacity) {
+        size_t capacity = trie->nodes_capacity * 2;
+        struct stack_node* nodes = realloc(trie->nodes, capacity * sizeof(struct stack_node));
+        if (!nodes)
+            return UINT32_MAX;
+        trie->nodes = nodes;
+        trie->nodes_capacity = capacity;
+    }
+
+    uint32_t n = trie->nnodes++;
+    struct stack_node* node = &trie->nodes[n];
+    memset(node, 0, sizeof(*node));
+    node->frame = frame;
+    node->parent = parent;
+    node->next_sibling = trie->nodes[parent].first_child;
+    trie->nodes[parent].first_child = n;
+    trie->child_slots[i] = n;
+    return n;
+}
+
+int stack_trie_walk(const struct stack_trie* trie, stack_trie_visit_fn visit, void* ctx)
+{
+    size_t capacity = 64;
+    uint32_t* path = malloc(capacity * sizeof(uint32_t));
+    if (!path)
+        return -1;
+
+    int ret = 0;
+    size_t depth = 0;
+    uint32_t n = STACK_TRIE_ROOT;
+    while (ret == 0) {
+        const struct stack_node* node = &trie->nodes[n];
+        if (node->count || node->value)
+            ret = visit(trie, path, depth, node, ctx);
+        if (ret)
+            break;
+
+        // Down to the first child, else across to the next sibling, else up
+        if (node->first_child) {
+            if (depth == capacity) {
+                capacity *= 2;
+                uint32_t* grown = realloc(path, capacity * sizeof(uint32_t));
+                if (!grown) {
+                    ret = -1;
+                    break;
+                }
+                path = grown;
+            }
+            n = node->first_child;
+            path[depth++] = trie->nodes[n].frame;
+            continue;
+        }
+        while (n != STACK_TRIE_ROOT && !trie->nodes[n].next_sibling) {
+            n = trie->nodes[n].parent;
+            depth--;
+        }
+        if (n == STACK_TRIE_ROOT)
+            break;
+        n = trie->nodes[n].next_sibling;
+        path[depth - 1] = trie->nodes[n].frame;
+    }
+
+    free(path);
+    return ret;
+}
+
+void stack_trie_free(struct stack_trie* trie)
+{
+    while (trie->blocks) {
+        struct stack_trie_block* next = trie->blocks->next;
+        free(trie->blocks);
+        trie->blocks = next;
+    }
+    free(trie->frames);
+    free(trie->frame_slots);
+    free(trie->nodes);
+    free(trie->child_slots);
+    memset(trie, 0, sizeof(*trie));
+}
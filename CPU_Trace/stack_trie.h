@@ -0,0 +1,76 @@
+#ifndef STACK_TRIE_H
+#define STACK_TRIE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Callchains folded into a prefix tree of interned frames. Every frame name
+// is hashed once, when it is interned; walking a stack down the tree only
+// hashes (parent, frame id) pairs.
+
+#define STACK_TRIE_ROOT 0
+
+// Size of each block the frame names are carved from.
+#define STACK_TRIE_POOL_BLOCK 65536
+
+struct stack_node {
+    uint32_t frame;
+    uint32_t parent;
+    uint32_t first_child;  // 0 when there is none, the root is never a child
+    uint32_t next_sibling;
+    uint64_t count;        // samples whose stack ends at this node
+    double value;          // e.g. joules attributed to those samples
+};
+
+struct stack_frame {
+    const char* name;
+    size_t len;
+    uint64_t hash;
+};
+
+struct stack_trie_block {
+    struct stack_trie_block* next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct stack_trie {
+    // frame id -> name, and name -> frame id (open addressing, ids + 1)
+    struct stack_frame* frames;
+    size_t nframes;
+    size_t frames_capacity;
+    uint32_t* frame_slots;
+    size_t frame_slots_capacity;
+    struct stack_trie_block* blocks;
+
+    // node 0 is the root
+    struct stack_node* nodes;
+    size_t nnodes;
+    size_t nodes_capacity;
+    // (parent, frame) -> child node, open addressing, 0 is empty
+    uint32_t* child_slots;
+    size_t child_slots_capacity;
+};
+
+int stack_trie_init(struct stack_trie* trie);
+
+// Intern a frame name, returns its id or UINT32_MAX when out of memory.
+uint32_t stack_trie_frame(struct stack_trie* trie, const char* name, size_t len);
+
+const char* stack_trie_frame_name(const struct stack_trie* trie, uint32_t frame);
+
+// The child of parent for frame, created on first use. Returns the node
+// index or UINT32_MAX when out of memory.
+uint32_t stack_trie_child(struct stack_trie* trie, uint32_t parent, uint32_t frame);
+
+// Called for every node with samples, with the frame ids from the root down.
+typedef int (*stack_trie_visit_fn)(const struct stack_trie* trie, const uint32_t* frames, size_t depth,
+    const struct stack_node* node, void* ctx);
+
+// Depth-first walk. Stops and returns the callback's value when it is not 0.
+int stack_trie_walk(const struct stack_trie* trie, stack_trie_visit_fn visit, void* ctx);
+
+void stack_trie_free(struct stack_trie* trie);
+
+#endif
@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+#include "symcache.h"
+
+static size_t round_pow2(size_t n)
+{
+    size_t size = 1;
+    while (size < n)
+        size <<= 1;
+    return size;
+}
+
+static inline uint64_t hash_ip(uint64_t ip)
+{
+    // Fibonacci hashing spreads the mostly-aligned ips across the table
+    return (ip ^ (ip >> 29)) * 0x9E3779B97F4A7C15ULL;
+}
+
+static uint64_t hash_str(const char* str, size_t len)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+int symcache_init(struct symcache* cache, size_t capacity)
+{
+    memset(cache, 0, sizeof(*cache));
+    if (capacity < 16)
+        capacity = 16;
+    cache->capacity = round_pow2(capacity);
+    cache->strings_capacity = cache->capacity;
+
+    cache->entries = calloc(cache->capacity, sizeof(struct symcache_entry));
+    cache->strings = calloc(cache->strings_capacity, sizeof(struct symcache_string));
+    if (!cache->entries || !cache->strings) {
+        free(cache->entries);
+        free(cache->strings);
+        return -1;
+    }
+
+    cache->gen = 1;
+    return 0;
+}
+
+static char* pool_alloc(struct symcache* cache, size_t size)
+{
+    struct symcache_block* block = cache->current;
+    while (block && block->size - block->used < size)
+        block = block->next;
+
+    if (!block) {
+        size_t block_size = size > SYMCACHE_POOL_BLOCK ? size : SYMCACHE_POOL_BLOCK;
+        block = malloc(sizeof(struct symcache_block) + block_size);
+        if (!block)
+            return NULL;
+        block->size = block_size;
+        block->used = 0;
+        block->next = NULL;
+
+        // Append to the tail so blocks kept from earlier generations stay reusable
+        struct symcache_block** tail = &cache->blocks;
+        while (*tail)
+            tail = &(*tail)->next;
+        *tail = block;
+    }
+
+    cache->current = block;
+    char* ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+static const struct symcache_string* intern(struct symcache* cache, const char* symbol)
+{
+    size_t len = strlen(symbol);
+    uint64_t hash = hash_str(symbol, len);
+    size_t mask = cache->strings_capacity - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        struct symcache_string* slot = &cache->strings[i];
+        if (slot->gen != cache->gen) {
+            char* str = pool_alloc(cache, len + 1);
+            if (!str)
+                return NULL;
+            memcpy(str, symbol, len + 1);
+
+            slot->str = str;
+            slot->len = len;
+            slot->hash = hash;
+            slot->gen = cache->gen;
+            cache->strings_count++;
+            return slot;
+        }
+        if (slot->hash == hash && slot->len == len && memcmp(slot->str, symbol, len) == 0)
+            return slot;
+    }
+}
+
+const struct symcache_entry* symcache_find(struct symcache* cache, uint64_t ip)
+{
+    size_t mask = cache->capacity - 1;
+    for (size_t i = hash_ip(ip) & mask;; i = (i + 1) & mask) {
+        struct symcache_entry* entry = &cache->entries[i];
+        if (entry->gen != cache->gen) {
+            cache->misses++;
+            return NULL;
+        }
+        if (entry->ip == ip) {
+            cache->hits++;
+            return entry;
+        }
+    }
+}
+
+const struct symcache_entry* symcache_insert(struct symcache* cache, uint64_t ip, const char* symbol)
+{
+    // Keep the load factor below 3/4 by starting over; the working set of
+    // a steady-state workload refills the table within a few intervals.
+    if (cache->count + 1 > cache->capacity / 4 * 3) {
+        symcache_invalidate(cache);
+        cache->invalidations--;
+        cache->evictions++;
+    }
+
+    const struct symcache_string* interned = NULL;
+    if (symbol) {
+        interned = intern(cache, symbol);
+        if (!interned)
+            return NULL;
+    }
+
+    size_t mask = cache->capacity - 1;
+    for (size_t i = hash_ip(ip) & mask;; i = (i + 1) & mask) {
+        struct symcache_entry* entry = &cache->entries[i];
+        if (entry->gen == cache->gen && entry->ip != ip)
+            continue;
+
+        if (entry->gen != cache->gen)
+            cache->count++;
+        entry->ip = ip;
+        entry->symbol = interned ? interned->str : NULL;
+        entry->len = interned ? interned->len : 0;
+        entry->gen = cache->gen;
+        return entry;
+    }
+}
+
+void symcache_invalidate(struct symcache* cache)
+{
+    cache->gen++;
+    if (cache->gen == 0) {
+        // Generation counter wrapped, stale entries could look valid again
+        memset(cache->entries, 0, cache->capacity * sizeof(struct symcache_entry));
+        memset(cache->strings, 0, cache->strings_capacity * sizeof(struct symcache_string));
+        cache->gen = 1;
+    }
+    cache->count = 0;
+    cache->strings_count = 0;
+
+    for (struct symcache_block* block = cache->blocks; block; block = block->next)
+        block->used = 0;
+    cache->current = cache->blocks;
+
+    cache->invalidations++;
+}
+
+void symcache_print_stats(const struct symcache* cache, FILE* stream)
+{
+    uint64_t lookups = cache->hits + cache->misses;
+    fprintf(stream, "symcache: %lu hits, %lu misses (%.2f%% hit rate), %lu invalidations, %lu evictions\n",
+        cache->hits, cache->misses, lookups ? 100.0 * cache->hits / lookups : 0.0,
+        cache->invalidations, cache->evictions);
+}
+
+void symcache_free(struct symcache* cache)
+{
+    struct symcache_block* block = cache->blocks;
+    while (block) {
+        struct symcache_block* next = block->next;
+        free(block);
+        block = next;
+    }
+    free(cache->entries);
+    free(cache->strings);
+    memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,75 @@
+#ifndef SYMCACHE_H
+#define SYMCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Default number of cached instruction pointers. Must be a power of two.
+#define SYMCACHE_DEFAULT_CAPACITY 16384
+
+// Size of each block the interned symbol strings are carved from.
+#define SYMCACHE_POOL_BLOCK 65536
+
+struct symcache_entry {
+    uint64_t ip;
+    const char* symbol; // interned, NULL when the ip could not be resolved
+    size_t len;
+    uint32_t gen;       // entry is valid only when gen == symcache.gen
+};
+
+struct symcache_string {
+    const char* str;
+    size_t len;
+    uint64_t hash;
+    uint32_t gen;
+};
+
+struct symcache_block {
+    struct symcache_block* next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct symcache {
+    // ip -> symbol, open addressing with linear probing
+    struct symcache_entry* entries;
+    size_t capacity;
+    size_t count;
+
+    // Interned symbol strings, open addressing with linear probing
+    struct symcache_string* strings;
+    size_t strings_capacity;
+    size_t strings_count;
+
+    // Backing storage for the interned strings
+    struct symcache_block* blocks;
+    struct symcache_block* current;
+
+    // Bumping the generation invalidates every entry in O(1)
+    uint32_t gen;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+    uint64_t evictions;
+};
+
+// Initialize the cache with room for capacity ips (rounded up to a power of two).
+int symcache_init(struct symcache* cache, size_t capacity);
+
+// Look up ip. Returns the cached entry on a hit and NULL on a miss.
+const struct symcache_entry* symcache_find(struct symcache* cache, uint64_t ip);
+
+// Intern symbol (which may be NULL) and cache it for ip.
+const struct symcache_entry* symcache_insert(struct symcache* cache, uint64_t ip, const char* symbol);
+
+// Drop every cached ip, e.g. after the address space of the target changed.
+void symcache_invalidate(struct symcache* cache);
+
+void symcache_print_stats(const struct symcache* cache, FILE* stream);
+
+void symcache_free(struct symcache* cache);
+
+#endif
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "trace_reader.h"
+
+// Converts a binary dw-pid trace back into the CSV that dw-pid prints in
+// text mode, so the existing collapse scripts can consume it.
+
+struct textbuf {
+    char* data;
+    size_t size;
+    size_t len;
+};
+
+static void textbuf_append(struct textbuf* buf, const char* str, size_t len)
+{
+    if (buf->len + len + 1 > buf->size) {
+        size_t size = buf->size ? buf->size : 4096;
+        while (size < buf->len + len + 1)
+            size *= 2;
+        char* data = realloc(buf->data, size);
+        if (!data) {
+            fprintf(stderr, "ERROR: Memory allocation failed in trace-dump\n");
+            exit(EXIT_FAILURE);
+        }
+        buf->data = data;
+        buf->size = size;
+    }
+    memcpy(buf->data + buf->len, str, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+static void append_sample(struct textbuf* callchains, const struct trace_reader* reader, const struct trace_record* record)
+{
+    char ip_buffer[20];
+    if (record->sample->time_ns) {
+        char tag[80];
+        int len = snprintf(tag, sizeof(tag), TRACE_SAMPLE_TAG_FORMAT, record->sample->time_ns,
+            record->sample->cpu, record->sample->tid, record->sample->period);
+        textbuf_append(callchains, tag, len);
+    }
+    for (uint32_t i = 0; i < record->sample->nr; i++) {
+        const char* symbol = trace_reader_string(reader, record->symbols[i]);
+        if (symbol) {
+            textbuf_append(callchains, symbol, strlen(symbol));
+            textbuf_append(callchains, ";", 1);
+        }
+        else {
+            int len = snprintf(ip_buffer, sizeof(ip_buffer), "0x%lx;", record->ips[i]);
+            textbuf_append(callchains, ip_buffer, len);
+        }
+    }
+    textbuf_append(callchains, "|", 1);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <trace>\n", *argv);
+        exit(EXIT_FAILURE);
+    }
+
+    struct trace_reader reader;
+    if (trace_reader_open(&reader, argv[1]) != 0) {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct textbuf callchains = { 0 };
+    textbuf_append(&callchains, "", 0);
+
+    printf(TRACE_CSV_HEADER "\n");
+
+    struct trace_record record;
+    int ret;
+    while ((ret = trace_reader_next(&reader, &record)) > 0) {
+        if (record.type == TRACE_RECORD_SAMPLE) {
+            append_sample(&callchains, &reader, &record);
+        }
+        else if (record.type == TRACE_RECORD_INTERVAL) {
+            trace_print_csv_row(stdout, record.interval, callchains.data);
+            callchains.len = 0;
+            callchains.data[0] = '\0';
+        }
+    }
+
+    free(callchains.data);
+    trace_reader_close(&reader);
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "bucket_index.h"
+#include "stack_trie.h"
+#include "trace_fold.h"
+#include "trace_view.h"
+
+// Energy per stack between two points in time of a binary trace, printed
+// as collapsed stacks. The trace is mapped and read from the index block
+// holding the start of the window to the first interval past its end, so
+// the cost depends on the window and not on the length of the run.
+// Each interval's energy is split among its samples as dw-collapse does;
+// a tagged sample then counts when it was taken inside the window, an
+// untagged one, or an interval without samples, for the part of its
+// interval inside it. With -i, whole buckets of the bucket index are added
+// instead of read, so long windows cost no more than short ones.
+
+struct window {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    struct bucket sum; // intervals, samples, energy and unattributed energy
+    uint64_t bytes;    // of the trace read
+};
+
+static void fold_interval(struct trace_fold* fold, struct window* window, const struct trace_interval* interval)
+{
+    double fraction = trace_fold_overlap(window->start_ns, window->end_ns, interval->timestamp_ns, interval->duration_ns);
+    double energy = trace_fold_shares(fold, interval);
+    window->sum.intervals++;
+    window->sum.energy += energy * fraction;
+
+    double attributed = 0;
+    for (size_t i = 0; i < fold->count; i++) {
+        const struct chain_tag* tag = &fold->tags[i];
+        double share = fold->shares[i];
+        if (tag->tagged) {
+            if (tag->time_ns < window->start_ns || tag->time_ns >= window->end_ns)
+                continue;
+        }
+        else
+            share *= fraction;
+        struct stack_node* node = &fold->trie->nodes[fold->nodes[i]];
+        node->count++;
+        node->value += share;
+        attributed += share;
+        window->sum.samples++;
+    }
+    if (attributed == 0)
+        window->sum.unattributed += energy * fraction;
+}
+
+// Read the trace from the index block holding the start of the window to
+// the first interval past its end
+static int fold_window(struct trace_fold* fold, struct window* window)
+{
+    struct trace_cursor cursor;
+    trace_cursor_seek(&cursor, fold->view, window->start_ns);
+    uint64_t first_offset = cursor.offset;
+    struct trace_record record;
+    int ret;
+    while ((ret = trace_cursor_next(&cursor, &record)) > 0) {
+        if (record.type == TRACE_RECORD_INTERVAL) {
+            const struct trace_interval* interval = record.interval;
+            if (interval->timestamp_ns - interval->duration_ns >= window->end_ns)
+                break;
+            if (interval->timestamp_ns > window->start_ns)
+                fold_interval(fold, window, interval);
+            trace_fold_clear(fold);
+        }
+        else if (record.type == TRACE_RECORD_SAMPLE && trace_fold_sample(fold, &record) != 0) {
+            fprintf(stderr, "ERROR: Memory allocation failed while folding the trace\n");
+            ret = -1;
+            break;
+        }
+    }
+    trace_fold_clear(fold);
+    window->bytes += cursor.offset - first_offset;
+    return ret;
+}
+
+// Seconds since the start of the trace, or a timestamp as printed in the CSV
+static int parse_time(const char* str, uint64_t start_ns, uint64_t* ns)
+{
+    char* end;
+    if (strchr(str, 'T')) {
+        struct tm tm = { 0 };
+        double seconds;
+        if (sscanf(str, "%d-%d-%dT%d:%d:%lf", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                &tm.tm_hour, &tm.tm_min, &seconds) != 6)
+            return -1;
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        *ns = (uint64_t)timegm(&tm) * 1000000000ULL + (uint64_t)(seconds * 1e9);
+        return 0;
+    }
+    double seconds = strtod(str, &end);
+    if (*end != '\0' || seconds < 0)
+        return -1;
+    *ns = start_ns + (uint64_t)(seconds * 1e9);
+    return 0;
+}
+
+struct collapsed_output {
+    const char* target;
+    int counts;
+    double scale;
+};
+
+static int print_stack(const struct stack_trie* trie, const uint32_t* frames, size_t depth,
+    const struct stack_node* node, void* ctx)
+{
+    struct collapsed_output* output = ctx;
+    fputs(output->target, stdout);
+    if (depth == 0)
+        fputc(';', stdout);
+    for (size_t i = 0; i < depth; i++) {
+        fputc(';', stdout);
+        fputs(stack_trie_frame_name(trie, frames[i]), stdout);
+    }
+    if (output->counts)
+        printf(" %lu\n", node->count);
+    else
+        printf(" %.6f\n", node->value * output->scale);
+    return ferror(stdout) ? -1 : 0;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Fold [from, to) from the trace into the window's trie and totals
+static int fold_edge(struct trace_fold* fold, struct window* window, uint64_t from, uint64_t to)
+{
+    struct window edge = { .start_ns = from, .end_ns = to };
+    int ret = fold_window(fold, &edge);
+    window->sum.intervals += edge.sum.intervals;
+    window->sum.samples += edge.sum.samples;
+    window->sum.energy += edge.sum.energy;
+    window->sum.unattributed += edge.sum.unattributed;
+    window->bytes += edge.bytes;
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    int scinot = 0;
+    int counts = 0;
+    int use_index = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "ce:i")) != -1) {
+        switch (opt) {
+        case 'c':
+            counts = 1;
+            break;
+        case 'e':
+            scinot = atoi(optarg);
+            break;
+        case 'i':
+            use_index = 1;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (argc - optind != 3) {
+usage:
+        fprintf(stderr, "Usage: %s [-c] [-e scinot] [-i] <trace.bin> <from> <to>\n", *argv);
+        fprintf(stderr, "  from, to  seconds since the start of the trace, or timestamps as in the CSV\n");
+        fprintf(stderr, "            (2024-01-02T03:04:05.123456Z)\n");
+        fprintf(stderr, "  -c        samples per stack instead of energy\n");
+        fprintf(stderr, "  -e N      multiply energy by 10^N (6 gives microjoules)\n");
+        fprintf(stderr, "  -i        sum whole buckets from <trace.bin>.buckets, built first if missing\n");
+        exit(EXIT_FAILURE);
+    }
+    const char* path = argv[optind];
+
+    double started = now_ms();
+    struct trace_view view;
+    if (trace_view_open(&view, path) != 0)
+        exit(EXIT_FAILURE);
+    struct bucket_index index = { 0 };
+    char index_path[4096];
+    snprintf(index_path, sizeof(index_path), "%s.buckets", path);
+    if (use_index && bucket_index_load(&index, index_path, &view, path, 0) != 0)
+        exit(EXIT_FAILURE);
+    double opened = now_ms();
+
+    struct window window = { 0 };
+    if (parse_time(argv[optind + 1], view.header->start_ns, &window.start_ns) != 0
+        || parse_time(argv[optind + 2], view.header->start_ns, &window.end_ns) != 0
+        || window.end_ns <= window.start_ns) {
+        fprintf(stderr, "Invalid time window %s to %s\n", argv[optind + 1], argv[optind + 2]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct stack_trie trie;
+    if (stack_trie_init(&trie) != 0) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    struct trace_fold fold;
+    trace_fold_init(&fold, &view, &trie);
+
+    // Buckets wholly inside the window come from the index, the partial
+    // ones at its edges from the trace
+    uint64_t first = 0, last = 0;
+    if (use_index) {
+        uint64_t bucket_ns = index.header->bucket_ms * 1000000ULL;
+        uint64_t start_ns = index.header->start_ns;
+        if (window.start_ns > start_ns)
+            first = (window.start_ns - start_ns + bucket_ns - 1) / bucket_ns;
+        if (window.end_ns > start_ns)
+            last = (window.end_ns - start_ns) / bucket_ns;
+        if (last > index.header->nbuckets)
+            last = index.header->nbuckets;
+    }
+    int ret;
+    if (first < last) {
+        ret = bucket_index_fold(&index, first, last, &trie, &window.sum);
+        if (ret != 0)
+            fprintf(stderr, "ERROR: Memory allocation failed while reading %s\n", index_path);
+        if (ret >= 0 && window.start_ns < bucket_index_start(&index, first))
+            ret = fold_edge(&fold, &window, window.start_ns, bucket_index_start(&index, first));
+        if (ret >= 0 && bucket_index_start(&index, last) < window.end_ns)
+            ret = fold_edge(&fold, &window, bucket_index_start(&index, last), window.end_ns);
+    }
+    else
+        ret = fold_window(&fold, &window);
+    double read = now_ms();
+
+    // Target name as dw-collapse derives it: the file name without extension
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    char target[1024];
+    snprintf(target, sizeof(target), "%s", base);
+    char* dot = strrchr(target, '.');
+    if (dot && dot != target)
+        *dot = '\0';
+
+    struct collapsed_output output = { .target = target, .counts = counts, .scale = 1.0 };
+    for (int i = 0; i < scinot; i++)
+        output.scale *= 10;
+    for (int i = 0; i > scinot; i--)
+        output.scale /= 10;
+    if (ret >= 0 && stack_trie_walk(&trie, print_stack, &output) != 0)
+        ret = -1;
+
+    fprintf(stderr, "%s: %u intervals, %lu samples, %.6f J in the window, %.6f J in intervals without samples\n",
+        path, window.sum.intervals, window.sum.samples, window.sum.energy, window.sum.unattributed);
+    fprintf(stderr, "read %lu of %zu bytes", window.bytes, view.size);
+    if (first < last)
+        fprintf(stderr, " and %lu buckets of %u ms", last - first, index.header->bucket_ms);
+    fprintf(stderr, " in %.3f ms (open %.3f ms, %s index)\n", read - opened, opened - started,
+        view.scanned ? "scanned" : "footer");
+
+    trace_fold_free(&fold);
+    stack_trie_free(&trie);
+    bucket_index_close(&index);
+    trace_view_close(&view);
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
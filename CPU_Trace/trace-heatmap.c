@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include "bucket_index.h"
+#include "trace_view.h"
+
+// Subsecond-offset heatmap of the energy in a binary trace: one column per
+// second of the run, one row per bucket within the second, each cell
+// colored by the joules spent in it. Cells come from the bucket index
+// (<trace>.buckets, built on first use), so drawing an hour-long trace
+// reads no samples. Clicking two cells selects the time range between
+// them; served by heatmap_server.py the range opens as a flame graph,
+// otherwise the trace-energy command for it is shown.
+
+#define XPAD 60      // left, room for the offset labels
+#define YPAD_TOP 60  // title and subtitle
+#define YPAD_BOTTOM 50
+
+static const char heatmap_script[] =
+    "<script type=\"text/ecmascript\">\n"
+    "<![CDATA[\n"
+    "\tvar anchor = null, selection, details, trace;\n"
+    "\tfunction init(evt) {\n"
+    "\t\tselection = document.getElementById(\"selection\");\n"
+    "\t\tdetails = document.getElementById(\"details\").firstChild;\n"
+    "\t\ttrace = document.getElementById(\"details\").getAttribute(\"data-trace\");\n"
+    "\t}\n"
+    "\tfunction cell(e) {\n"
+    "\t\tvar t = e.target;\n"
+    "\t\treturn t.hasAttribute(\"data-s\") ? t : null;\n"
+    "\t}\n"
+    "\twindow.addEventListener(\"click\", function(e) {\n"
+    "\t\tvar c = cell(e);\n"
+    "\t\tif (!c) return;\n"
+    "\t\tif (anchor == null) {\n"
+    "\t\t\tanchor = c;\n"
+    "\t\t\tselect(c, c);\n"
+    "\t\t\tdetails.nodeValue = \"From \" + c.getAttribute(\"data-s\") + \" s, click the end of the range\";\n"
+    "\t\t\treturn;\n"
+    "\t\t}\n"
+    "\t\tvar range = select(anchor, c);\n"
+    "\t\tanchor = null;\n"
+    "\t\tvar query = \"from=\" + range[0] + \"&to=\" + range[1];\n"
+    "\t\tif (location.protocol.indexOf(\"http\") == 0) {\n"
+    "\t\t\tdetails.nodeValue = range[0] + \" s to \" + range[1] + \" s\";\n"
+    "\t\t\twindow.open(\"flamegraph?\" + query, \"_blank\");\n"
+    "\t\t} else\n"
+    "\t\t\tdetails.nodeValue = \"trace-energy -i -e 6 \" + trace + \" \" + range[0] + \" \" + range[1] +\n"
+    "\t\t\t\t\" | dw-flamegraph --countname microjoules > window.svg\";\n"
+    "\t}, false);\n"
+    "\t// Columns between the two cells; cells of one second per column are\n"
+    "\t// selected to the bucket, wider columns whole\n"
+    "\tfunction select(a, b) {\n"
+    "\t\tvar s = Math.min(parseFloat(a.getAttribute(\"data-s\")), parseFloat(b.getAttribute(\"data-s\")));\n"
+    "\t\tvar e = Math.max(parseFloat(a.getAttribute(\"data-e\")), parseFloat(b.getAttribute(\"data-e\")));\n"
+    "\t\tvar x1 = Math.min(parseFloat(a.getAttribute(\"x\")), parseFloat(b.getAttribute(\"x\")));\n"
+    "\t\tvar x2 = Math.max(parseFloat(a.getAttribute(\"x\")), parseFloat(b.getAttribute(\"x\"))) +\n"
+    "\t\t\tparseFloat(a.getAttribute(\"width\"));\n"
+    "\t\tselection.setAttribute(\"x\", x1);\n"
+    "\t\tselection.setAttribute(\"width\", x2 - x1);\n"
+    "\t\tselection.setAttribute(\"visibility\", \"visible\");\n"
+    "\t\treturn [s.toFixed(3), e.toFixed(3)];\n"
+    "\t}\n"
+    "]]>\n"
+    "</script>\n";
+
+static void print_escaped(const char* str)
+{
+    for (; *str; str++) {
+        if (*str == '&')
+            fputs("&amp;", stdout);
+        else if (*str == '<')
+            fputs("&lt;", stdout);
+        else if (*str == '>')
+            fputs("&gt;", stdout);
+        else if (*str == '"')
+            fputs("&quot;", stdout);
+        else
+            putchar(*str);
+    }
+}
+
+// White through yellow to red as the energy approaches the largest cell's
+static void cell_color(double fraction, char* color, size_t size)
+{
+    int r = 255, g, b;
+    if (fraction < 0.5) {
+        g = 255 - (int)(40 * fraction * 2);
+        b = 255 - (int)(215 * fraction * 2);
+    }
+    else {
+        g = 215 - (int)(215 * (fraction - 0.5) * 2);
+        b = 40 - (int)(40 * (fraction - 0.5) * 2);
+    }
+    snprintf(color, size, "rgb(%d,%d,%d)", r, g, b);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t bucket_ms = BUCKET_INDEX_DEFAULT_MS;
+    int width = 1200;
+    int cell_height = 8;
+    const char* title = "Energy Heatmap";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:w:H:t:")) != -1) {
+        switch (opt) {
+        case 'b':
+            bucket_ms = atoi(optarg);
+            break;
+        case 'w':
+            width = atoi(optarg);
+            break;
+        case 'H':
+            cell_height = atoi(optarg);
+            break;
+        case 't':
+            title = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (argc - optind != 1 || bucket_ms == 0 || 1000 % bucket_ms != 0 || width < 2 * XPAD || cell_height < 1) {
+usage:
+        fprintf(stderr, "Usage: %s [-b ms] [-w width] [-H height] [-t title] <trace.bin> > heatmap.svg\n", *argv);
+        fprintf(stderr, "  -b ms      bucket length, a divisor of 1000 (default %d)\n", BUCKET_INDEX_DEFAULT_MS);
+        fprintf(stderr, "  -w width   image width (default 1200)\n");
+        fprintf(stderr, "  -H height  height of each row (default 8)\n");
+        fprintf(stderr, "  -t title   title text\n");
+        fprintf(stderr, "The bucket index is kept in <trace.bin>.buckets and rebuilt when the trace changes.\n");
+        exit(EXIT_FAILURE);
+    }
+    const char* path = argv[optind];
+
+    struct trace_view view;
+    if (trace_view_open(&view, path) != 0)
+        exit(EXIT_FAILURE);
+    struct bucket_index index;
+    char index_path[4096];
+    snprintf(index_path, sizeof(index_path), "%s.buckets", path);
+    if (bucket_index_load(&index, index_path, &view, path, bucket_ms) != 0) {
+        trace_view_close(&view);
+        exit(EXIT_FAILURE);
+    }
+
+    // Seconds per column, so that every column is at least a pixel wide
+    uint64_t nbuckets = index.header->nbuckets;
+    uint32_t rows = 1000 / bucket_ms;
+    uint64_t seconds = (nbuckets + rows - 1) / rows;
+    if (seconds == 0)
+        seconds = 1;
+    int plot_width = width - XPAD - 20;
+    uint64_t per_column = (seconds + plot_width - 1) / plot_width;
+    uint64_t columns = (seconds + per_column - 1) / per_column;
+    double cell_width = (double)plot_width / columns;
+
+    double* cells = calloc(columns * rows, sizeof(double));
+    uint64_t* samples = calloc(columns * rows, sizeof(uint64_t));
+    if (!cells || !samples) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    double max = 0, total = 0;
+    for (uint64_t k = 0; k < nbuckets; k++) {
+        uint64_t cell = k / rows / per_column * rows + k % rows;
+        cells[cell] += index.buckets[k].energy;
+        samples[cell] += index.buckets[k].samples;
+        total += index.buckets[k].energy;
+    }
+    for (uint64_t i = 0; i < columns * rows; i++) {
+        if (cells[i] > max)
+            max = cells[i];
+    }
+
+    int plot_height = rows * cell_height;
+    int height = YPAD_TOP + plot_height + YPAD_BOTTOM;
+    printf("<?xml version=\"1.0\" standalone=\"no\"?>\n"
+           "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n"
+           "<svg version=\"1.1\" width=\"%d\" height=\"%d\" onload=\"init(evt)\" viewBox=\"0 0 %d %d\" "
+           "xmlns=\"http://www.w3.org/2000/svg\">\n",
+        width, height, width, height);
+    printf("<style type=\"text/css\">\n"
+           "\ttext { font-family:Verdana; font-size:12px; fill:rgb(0,0,0); }\n"
+           "\t#title { text-anchor:middle; font-size:17px; }\n"
+           "\t#subtitle { text-anchor:middle; fill:rgb(100,100,100); }\n"
+           "\t.cell:hover { stroke:black; stroke-width:0.5; cursor:pointer; }\n"
+           "</style>\n");
+    fputs(heatmap_script, stdout);
+    printf("<rect x=\"0\" y=\"0\" width=\"%d\" height=\"%d\" fill=\"rgb(248,248,248)\" />\n", width, height);
+    printf("<text id=\"title\" x=\"%d\" y=\"24\">", width / 2);
+    print_escaped(title);
+    printf("</text>\n<text id=\"subtitle\" x=\"%d\" y=\"44\">", width / 2);
+    print_escaped(path);
+    printf(": %.3f J, %u ms rows, %lu s per column; click two cells to select a range</text>\n",
+        total, bucket_ms, per_column);
+    printf("<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" fill=\"white\" />\n",
+        XPAD, YPAD_TOP, plot_width, plot_height);
+
+    // Offset 0 at the bottom, time to the right
+    char color[48];
+    for (uint64_t c = 0; c < columns; c++) {
+        for (uint32_t r = 0; r < rows; r++) {
+            double energy = cells[c * rows + r];
+            if (energy <= 0)
+                continue;
+            double start = per_column == 1 ? c + r * bucket_ms / 1000.0 : (double)(c * per_column);
+            double end = per_column == 1 ? start + bucket_ms / 1000.0 : (double)((c + 1) * per_column);
+            cell_color(energy / max, color, sizeof(color));
+            printf("<rect class=\"cell\" x=\"%.1f\" y=\"%d\" width=\"%.1f\" height=\"%d\" fill=\"%s\" "
+                   "data-s=\"%.3f\" data-e=\"%.3f\"><title>%.3f s +%u ms: %.6f J, %lu samples</title></rect>\n",
+                XPAD + c * cell_width, YPAD_TOP + plot_height - (int)(r + 1) * cell_height, cell_width,
+                cell_height, color, start, end, (double)(c * per_column), r * bucket_ms, energy,
+                samples[c * rows + r]);
+        }
+    }
+    printf("<rect id=\"selection\" x=\"0\" y=\"%d\" width=\"0\" height=\"%d\" fill=\"rgb(0,0,255)\" "
+           "fill-opacity=\"0.15\" stroke=\"blue\" visibility=\"hidden\" pointer-events=\"none\" />\n",
+        YPAD_TOP, plot_height);
+
+    // About ten time labels, on whole seconds
+    uint64_t step = (seconds + 9) / 10;
+    for (uint64_t s = 0; s <= seconds; s += step) {
+        double x = XPAD + (double)s / per_column * cell_width;
+        printf("<text x=\"%.1f\" y=\"%d\" text-anchor=\"middle\">%lu</text>\n", x, YPAD_TOP + plot_height + 16, s);
+    }
+    printf("<text x=\"%d\" y=\"%d\" text-anchor=\"middle\">time (s)</text>\n",
+        XPAD + plot_width / 2, YPAD_TOP + plot_height + 32);
+    printf("<text x=\"%d\" y=\"%d\" text-anchor=\"end\">0 ms</text>\n", XPAD - 4, YPAD_TOP + plot_height);
+    printf("<text x=\"%d\" y=\"%d\" text-anchor=\"end\">%u ms</text>\n", XPAD - 4, YPAD_TOP + 10,
+        1000 - bucket_ms);
+    printf("<text id=\"details\" x=\"%d\" y=\"%d\" data-trace=\"", XPAD, height - 6);
+    print_escaped(path);
+    printf("\"> </text>\n");
+    printf("</svg>\n");
+
+    int ret = fflush(stdout) != 0 || ferror(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+    if (ret != EXIT_SUCCESS)
+        fprintf(stderr, "ERROR: Failed to write the SVG\n");
+    free(cells);
+    free(samples);
+    bucket_index_close(&index);
+    trace_view_close(&view);
+    return ret;
+}
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "trace_fold.h"
+
+int trace_fold_init(struct trace_fold* fold, const struct trace_view* view, struct stack_trie* trie)
+{
+    *fold = (struct trace_fold) { .view = view, .trie = trie };
+    // A missing cache only means more lookups
+    fold->symbol_frames = calloc(view->strings_count + 1, sizeof(uint32_t));
+    return 0;
+}
+
+void trace_fold_free(struct trace_fold* fold)
+{
+    free(fold->symbol_frames);
+    free(fold->nodes);
+    free(fold->tags);
+    free(fold->shares);
+    fold->symbol_frames = NULL;
+    fold->nodes = NULL;
+    fold->tags = NULL;
+    fold->shares = NULL;
+}
+
+static int fold_push(struct trace_fold* fold, uint32_t node, const struct chain_tag* tag)
+{
+    if (fold->count == fold->capacity) {
+        size_t capacity = fold->capacity ? fold->capacity * 2 : 256;
+        uint32_t* nodes = realloc(fold->nodes, capacity * sizeof(uint32_t));
+        if (nodes)
+            fold->nodes = nodes;
+        struct chain_tag* tags = realloc(fold->tags, capacity * sizeof(struct chain_tag));
+        if (tags)
+            fold->tags = tags;
+        double* shares = realloc(fold->shares, capacity * sizeof(double));
+        if (shares)
+            fold->shares = shares;
+        if (!nodes || !tags || !shares)
+            return -1;
+        fold->capacity = capacity;
+    }
+    fold->nodes[fold->count] = node;
+    fold->tags[fold->count] = *tag;
+    fold->count++;
+    return 0;
+}
+
+int trace_fold_sample(struct trace_fold* fold, const struct trace_record* record)
+{
+    const struct trace_view* view = fold->view;
+    struct stack_trie* trie = fold->trie;
+    const struct trace_sample* sample = record->sample;
+    uint32_t node = STACK_TRIE_ROOT;
+    for (uint32_t i = sample->nr; i-- > 0 && node != UINT32_MAX;) {
+        uint32_t id = record->symbols[i];
+        uint32_t frame = UINT32_MAX;
+        uint32_t len;
+        const char* symbol;
+        if (fold->symbol_frames && id && id <= view->strings_count && fold->symbol_frames[id])
+            frame = fold->symbol_frames[id] - 1;
+        else if ((symbol = trace_view_string(view, id, &len))) {
+            frame = stack_trie_frame(trie, symbol, len);
+            if (fold->symbol_frames && frame != UINT32_MAX)
+                fold->symbol_frames[id] = frame + 1;
+        }
+        else {
+            char hex[20];
+            int hex_len = snprintf(hex, sizeof(hex), "0x%lx", record->ips[i]);
+            frame = stack_trie_frame(trie, hex, hex_len);
+        }
+        node = frame == UINT32_MAX ? UINT32_MAX : stack_trie_child(trie, node, frame);
+    }
+
+    struct chain_tag tag = { 0 };
+    if (sample->time_ns) {
+        tag.tagged = 1;
+        tag.time_ns = sample->time_ns;
+        tag.cpu = sample->cpu;
+        tag.tid = sample->tid;
+        tag.period = sample->period;
+    }
+    if (node == UINT32_MAX)
+        return -1;
+    return fold_push(fold, node, &tag);
+}
+
+double trace_fold_shares(struct trace_fold* fold, const struct trace_interval* interval)
+{
+    double energy = ((interval->usage / 100.0) * interval->power + interval->gpu_power) * interval->duration_ns / 1e9;
+    if (fold->count == 0)
+        return energy;
+
+    sample_weights(fold->tags, fold->count, interval->timestamp_ns - interval->duration_ns, fold->shares);
+    double total_weight = 0;
+    for (size_t i = 0; i < fold->count; i++)
+        total_weight += fold->shares[i];
+    for (size_t i = 0; i < fold->count; i++)
+        fold->shares[i] = energy * fold->shares[i] / total_weight;
+    return energy;
+}
+
+double trace_fold_overlap(uint64_t from_ns, uint64_t to_ns, uint64_t end_ns, uint64_t duration_ns)
+{
+    if (duration_ns == 0)
+        return end_ns >= from_ns && end_ns < to_ns ? 1.0 : 0.0;
+    uint64_t start_ns = end_ns - duration_ns;
+    uint64_t from = start_ns > from_ns ? start_ns : from_ns;
+    uint64_t to = end_ns < to_ns ? end_ns : to_ns;
+    return to > from ? (double)(to - from) / duration_ns : 0.0;
+}
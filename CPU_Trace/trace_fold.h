@@ -0,0 +1,47 @@
+#ifndef TRACE_FOLD_H
+#define TRACE_FOLD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sample_weights.h"
+#include "stack_trie.h"
+#include "trace_view.h"
+
+// The samples of one interval of a mapped trace, each resolved to its node
+// in a stack_trie, and how the interval's energy is split among them, as
+// dw-collapse splits it. Shared by the tools that fold part of a trace.
+
+struct trace_fold {
+    const struct trace_view* view;
+    struct stack_trie* trie;
+    uint32_t* symbol_frames; // string id -> frame id + 1, interned on first use
+
+    // Samples since the last interval record
+    uint32_t* nodes;
+    struct chain_tag* tags;
+    double* shares;          // energy of each sample, see trace_fold_shares()
+    size_t count;
+    size_t capacity;
+};
+
+int trace_fold_init(struct trace_fold* fold, const struct trace_view* view, struct stack_trie* trie);
+
+void trace_fold_free(struct trace_fold* fold);
+
+// Add a SAMPLE record to the current interval. Returns -1 when out of memory.
+int trace_fold_sample(struct trace_fold* fold, const struct trace_record* record);
+
+// Energy of the interval in joules, split among its samples into shares.
+// The samples are kept until trace_fold_clear().
+double trace_fold_shares(struct trace_fold* fold, const struct trace_interval* interval);
+
+static inline void trace_fold_clear(struct trace_fold* fold)
+{
+    fold->count = 0;
+}
+
+// Part of the interval ending at end_ns that lies inside [from_ns, to_ns).
+// An interval without a duration is inside when its end is.
+double trace_fold_overlap(uint64_t from_ns, uint64_t to_ns, uint64_t end_ns, uint64_t duration_ns);
+
+#endif
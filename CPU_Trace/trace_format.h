@@ -0,0 +1,141 @@
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+#include <stdint.h>
+
+// On-disk layout of the binary trace written by `dw-pid -o`.
+//
+//   trace_file_header
+//   record*            each starts with a trace_record_header
+//   INDEX record       footer time index, absent if the tracer was killed
+//   STRING_INDEX       footer offsets of the STRING records, version 3 on
+//   trace_trailer      points at the INDEX record
+//
+// All integers are little endian and every record is padded to 8 bytes.
+// Records are length prefixed, so readers skip types they do not know and
+// fields appended to the end of a record stay backwards compatible.
+
+#define TRACE_MAGIC "DWTRACE"
+#define TRACE_TRAILER_MAGIC "DWTRIDX"
+// Version 2 added trace_sample.period, version 3 made the index sparse and
+// added the string index.
+#define TRACE_VERSION 3
+
+// Intervals per index entry
+#define TRACE_INDEX_STRIDE 64
+
+enum trace_record_type {
+    TRACE_RECORD_STRING = 1,   // string table entry, referenced by id
+    TRACE_RECORD_SAMPLE = 2,   // one callchain
+    TRACE_RECORD_INTERVAL = 3, // power/usage for the samples written since the previous interval
+    TRACE_RECORD_INDEX = 4,    // footer index of the interval records
+    TRACE_RECORD_MMAP = 5,     // executable mapping, for offline symbolization
+    TRACE_RECORD_STRING_INDEX = 6, // footer offsets of the STRING records
+};
+
+struct trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t start_ns; // CLOCK_REALTIME when tracing started
+    int32_t pid;
+    uint32_t reserved;
+};
+
+struct trace_record_header {
+    uint32_t size; // total record size including this header
+    uint16_t type;
+    uint16_t flags;
+};
+
+// Followed by the string bytes (not NUL terminated) and padding.
+struct trace_string {
+    struct trace_record_header header;
+    uint32_t id; // ids start at 1, 0 means "no symbol"
+    uint32_t len;
+};
+
+// Followed by u64 ips[nr] and u32 symbols[nr] (string ids, 0 if unresolved).
+struct trace_sample {
+    struct trace_record_header header;
+    uint64_t time_ns; // CLOCK_REALTIME, 0 when the sample carries no timestamp
+    uint32_t pid;
+    uint32_t tid;
+    uint32_t cpu;
+    uint32_t nr;
+    uint64_t period; // events counted since the previous sample, 0 if unknown
+};
+
+// Followed by the file name (not NUL terminated) and padding.
+struct trace_mmap {
+    struct trace_record_header header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t addr;
+    uint64_t len;
+    uint64_t pgoff;
+    uint32_t filename_len;
+    uint32_t reserved;
+};
+
+struct trace_interval {
+    struct trace_record_header header;
+    uint64_t timestamp_ns; // CLOCK_REALTIME at the end of the interval
+    uint64_t duration_ns;
+    double power;
+    double usage;
+    double gpu_power;
+    uint32_t nr_samples;
+    uint32_t reserved;
+    uint64_t lost_samples; // reported by PERF_RECORD_LOST during the interval
+    uint64_t throttled;    // PERF_RECORD_THROTTLE events during the interval
+};
+
+// Since version 3 there is one entry per TRACE_INDEX_STRIDE intervals, the
+// start of a block of intervals: reading from offset reaches the samples of
+// every interval ending after timestamp_ns. Version 2 has one entry per
+// interval, its end and the offset of the INTERVAL record itself.
+struct trace_index_entry {
+    uint64_t timestamp_ns; // CLOCK_REALTIME start of the first interval of the block
+    uint64_t offset;       // file offset of the first record of the block
+};
+
+// Followed by struct trace_index_entry entries[count].
+struct trace_index {
+    struct trace_record_header header;
+    uint64_t count;
+};
+
+// Followed by uint64_t offsets[count], the file offset of the STRING record
+// with id i + 1, so that a reader starting mid-trace can resolve symbols.
+struct trace_string_index {
+    struct trace_record_header header;
+    uint64_t count;
+};
+
+struct trace_trailer {
+    uint64_t index_offset;
+    char magic[8];
+};
+
+// Column header of the CSV printed by dw-pid and the trace tools.
+#define TRACE_CSV_HEADER "timestamp, callchains, power, resource_usage, gpu_power, lost_samples, throttled, duration"
+
+// In the CSV a callchain with a timestamp starts with a tag frame,
+// @<CLOCK_REALTIME ns>/<cpu>/<tid>/<period>; followed by the frames leaf first.
+#define TRACE_SAMPLE_TAG_FORMAT "@%lu/%u/%u/%lu;"
+
+// dw-pid interns frames and stacks in its CSV unless run with -F. Every
+// frame and stack is defined once, on a line of its own before the first
+// row using it, and a callchain is then its tag followed by $<stack id>;
+//   #frame,<id>,<name>             the name runs to the end of the line
+//   #stack,<id>,<parent>,<frame>   stack <parent> with <frame> called on top
+// Ids count from 0 in order of definition; stack 0 is the empty stack and
+// is never defined.
+#define TRACE_CSV_FRAME "#frame"
+#define TRACE_CSV_STACK "#stack"
+#define TRACE_CSV_STACK_REF '$'
+
+#define TRACE_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+#endif
@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include "compressor.h"
+#include "trace_reader.h"
+
+int trace_reader_open(struct trace_reader* reader, const char* path)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->in = compressed_fopen(path, &reader->codec);
+    if (!reader->in)
+        return -1;
+
+    if (fread(&reader->header, sizeof(reader->header), 1, reader->in) != 1
+        || memcmp(reader->header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a dw-pid trace\n", path);
+        fclose(reader->in);
+        reader->in = NULL;
+        return -1;
+    }
+    if (reader->header.version > TRACE_VERSION) {
+        fprintf(stderr, "%s: unsupported trace version %u\n", path, reader->header.version);
+        fclose(reader->in);
+        reader->in = NULL;
+        return -1;
+    }
+
+    reader->offset = sizeof(reader->header);
+    return 0;
+}
+
+static int add_string(struct trace_reader* reader, const struct trace_string* string)
+{
+    if (string->id >= reader->strings_capacity) {
+        size_t capacity = reader->strings_capacity ? reader->strings_capacity : 1024;
+        while (capacity <= string->id)
+            capacity *= 2;
+        struct trace_reader_string* strings = realloc(reader->strings, capacity * sizeof(*strings));
+        if (!strings)
+            return -1;
+        memset(strings + reader->strings_capacity, 0, (capacity - reader->strings_capacity) * sizeof(*strings));
+        reader->strings = strings;
+        reader->strings_capacity = capacity;
+    }
+
+    struct trace_reader_string* entry = &reader->strings[string->id];
+    free(entry->str);
+    entry->str = malloc(string->len + 1);
+    if (!entry->str)
+        return -1;
+    memcpy(entry->str, (const char*)(string + 1), string->len);
+    entry->str[string->len] = '\0';
+    entry->len = string->len;
+    return 0;
+}
+
+int trace_reader_next(struct trace_reader* reader, struct trace_record* record)
+{
+    struct trace_record_header header;
+    if (reader->done || fread(&header, sizeof(header), 1, reader->in) != 1)
+        return 0;
+    if (header.size < sizeof(header)) {
+        fprintf(stderr, "trace: corrupt record at offset %lu\n", reader->offset);
+        return -1;
+    }
+
+    // One spare byte lets string-carrying records be NUL terminated in place,
+    // and records written by older versions are zero-extended to the current size
+    size_t needed = header.size + 1 + sizeof(uint64_t);
+    if (needed < sizeof(struct trace_interval))
+        needed = sizeof(struct trace_interval);
+    if (needed > reader->record_capacity) {
+        size_t capacity = reader->record_capacity ? reader->record_capacity : 4096;
+        while (capacity < needed)
+            capacity *= 2;
+        void* buffer = realloc(reader->record, capacity);
+        if (!buffer)
+            return -1;
+        reader->record = buffer;
+        reader->record_capacity = capacity;
+    }
+
+    memcpy(reader->record, &header, sizeof(header));
+    size_t remaining = header.size - sizeof(header);
+    if (remaining && fread((char*)reader->record + sizeof(header), 1, remaining, reader->in) != remaining) {
+        // Truncated tail, e.g. the tracer was killed mid-write
+        return 0;
+    }
+
+    memset(record, 0, sizeof(*record));
+    record->type = header.type;
+    record->offset = reader->offset;
+    record->header = reader->record;
+    reader->offset += header.size;
+
+    // Every length field is checked against the record size, as in
+    // trace_view.c. The buffer always holds the fixed part of a record, so
+    // the fields can be read before the check.
+    int corrupt = 0;
+    switch (header.type) {
+    case TRACE_RECORD_STRING:
+        record->string = reader->record;
+        // Ids are handed out in file order, one per record of at least
+        // sizeof(struct trace_string) bytes, which bounds the string table
+        corrupt = header.size < sizeof(struct trace_string) + (uint64_t)record->string->len
+            || record->string->id == 0 || record->string->id > record->offset / sizeof(struct trace_string);
+        if (!corrupt && add_string(reader, record->string) != 0)
+            return -1;
+        break;
+    case TRACE_RECORD_SAMPLE: {
+        // Version 1 samples end before the period field
+        size_t fixed_size = reader->header.version < 2 ? offsetof(struct trace_sample, period) : sizeof(struct trace_sample);
+        const struct trace_sample* sample = reader->record;
+        corrupt = header.size < fixed_size + (uint64_t)sample->nr * (sizeof(uint64_t) + sizeof(uint32_t));
+        if (corrupt)
+            break;
+        if (fixed_size < sizeof(struct trace_sample)) {
+            char* fields = reader->record;
+            memmove(fields + sizeof(struct trace_sample), fields + fixed_size, header.size - fixed_size);
+            memset(fields + fixed_size, 0, sizeof(struct trace_sample) - fixed_size);
+        }
+        record->sample = reader->record;
+        record->ips = (const uint64_t*)(record->sample + 1);
+        record->symbols = (const uint32_t*)(record->ips + record->sample->nr);
+        break;
+    }
+    case TRACE_RECORD_INTERVAL:
+        if (header.size < sizeof(struct trace_interval))
+            memset((char*)reader->record + header.size, 0, sizeof(struct trace_interval) - header.size);
+        record->interval = reader->record;
+        break;
+    case TRACE_RECORD_MMAP:
+        record->mmap = reader->record;
+        corrupt = header.size < sizeof(struct trace_mmap) + (uint64_t)record->mmap->filename_len;
+        if (corrupt)
+            break;
+        record->filename = (char*)(record->mmap + 1);
+        ((char*)record->filename)[record->mmap->filename_len] = '\0';
+        break;
+    case TRACE_RECORD_INDEX:
+        record->index = reader->record;
+        corrupt = header.size < sizeof(struct trace_index)
+            || record->index->count > (header.size - sizeof(struct trace_index)) / sizeof(struct trace_index_entry);
+        // Only the trailer follows the index
+        reader->done = 1;
+        break;
+    default:
+        // Unknown record types are returned as-is so callers can skip them
+        break;
+    }
+    if (corrupt) {
+        fprintf(stderr, "trace: corrupt record at offset %lu\n", record->offset);
+        return -1;
+    }
+    return 1;
+}
+
+const char* trace_reader_string(const struct trace_reader* reader, uint32_t id)
+{
+    if (id == 0 || id >= reader->strings_capacity)
+        return NULL;
+    return reader->strings[id].str;
+}
+
+long trace_reader_index(struct trace_reader* reader, struct trace_index_entry** entries)
+{
+    *entries = NULL;
+    if (reader->codec)
+        return -1;
+    long saved = ftell(reader->in);
+
+    struct trace_trailer trailer;
+    long footer_end;
+    if (fseek(reader->in, -(long)sizeof(trailer), SEEK_END) != 0
+        || (footer_end = ftell(reader->in)) < 0
+        || fread(&trailer, sizeof(trailer), 1, reader->in) != 1
+        || memcmp(trailer.magic, TRACE_TRAILER_MAGIC, sizeof(TRACE_TRAILER_MAGIC)) != 0) {
+        fseek(reader->in, saved, SEEK_SET);
+        return -1;
+    }
+
+    // The entries must fit between the index and the trailer
+    struct trace_index index;
+    long count = -1;
+    if (trailer.index_offset >= sizeof(struct trace_file_header)
+        && trailer.index_offset + sizeof(index) <= (uint64_t)footer_end
+        && fseek(reader->in, trailer.index_offset, SEEK_SET) == 0
+        && fread(&index, sizeof(index), 1, reader->in) == 1
+        && index.header.type == TRACE_RECORD_INDEX
+        && index.count <= (footer_end - trailer.index_offset - sizeof(index)) / sizeof(struct trace_index_entry)) {
+        *entries = malloc((index.count ? index.count : 1) * sizeof(struct trace_index_entry));
+        if (*entries && fread(*entries, sizeof(struct trace_index_entry), index.count, reader->in) == index.count) {
+            count = index.count;
+        }
+        else {
+            free(*entries);
+            *entries = NULL;
+        }
+    }
+
+    fseek(reader->in, saved, SEEK_SET);
+    return count;
+}
+
+int trace_reader_seek(struct trace_reader* reader, uint64_t offset)
+{
+    if (reader->codec || fseek(reader->in, offset, SEEK_SET) != 0)
+        return -1;
+    reader->offset = offset;
+    reader->done = 0;
+    return 0;
+}
+
+void trace_reader_close(struct trace_reader* reader)
+{
+    if (reader->in)
+        fclose(reader->in);
+    for (size_t i = 0; i < reader->strings_capacity; i++)
+        free(reader->strings[i].str);
+    free(reader->strings);
+    free(reader->record);
+    memset(reader, 0, sizeof(*reader));
+}
+
+void trace_format_timestamp(uint64_t ns, char* buffer, size_t buffer_size)
+{
+    time_t seconds = ns / 1000000000ULL;
+    struct tm tm_utc;
+    gmtime_r(&seconds, &tm_utc);
+
+    strftime(buffer, buffer_size, "%Y-%m-%dT%H:%M:%S", &tm_utc);
+    size_t len = strlen(buffer);
+    snprintf(buffer + len, buffer_size - len, ".%06luZ", (unsigned long)(ns % 1000000000ULL) / 1000);
+}
+
+void trace_print_csv_row(FILE* out, const struct trace_interval* interval, const char* callchains)
+{
+    char timestamp[32];
+    trace_format_timestamp(interval->timestamp_ns, timestamp, sizeof(timestamp));
+    fprintf(out, "%s, %s, %.6f, %.2f, %.6f, %lu, %lu, %.6f\n", timestamp, callchains ? callchains : "",
+        interval->power, interval->usage, interval->gpu_power, interval->lost_samples, interval->throttled,
+        interval->duration_ns / 1e9);
+}
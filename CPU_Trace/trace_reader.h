@@ -0,0 +1,76 @@
+#ifndef TRACE_READER_H
+#define TRACE_READER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "trace_format.h"
+
+struct trace_reader_string {
+    char* str; // NUL terminated copy
+    uint32_t len;
+};
+
+struct trace_reader {
+    FILE* in;
+    const char* codec; // compression of the file, NULL when plain
+    struct trace_file_header header;
+    uint64_t offset; // file offset of the next record
+    int done;        // the footer index has been read
+
+    // Buffer holding the current record
+    void* record;
+    size_t record_capacity;
+
+    // String table, indexed by id
+    struct trace_reader_string* strings;
+    size_t strings_capacity;
+};
+
+// Views into the current record, valid until the next trace_reader_next() call.
+struct trace_record {
+    uint16_t type;
+    uint64_t offset;
+    const struct trace_record_header* header;
+    union {
+        const struct trace_string* string;
+        const struct trace_interval* interval;
+        const struct trace_index* index;
+        struct {
+            const struct trace_mmap* mmap;
+            const char* filename; // NUL terminated
+        };
+        struct {
+            const struct trace_sample* sample;
+            const uint64_t* ips;
+            const uint32_t* symbols;
+        };
+    };
+};
+
+// Compressed traces are decompressed on the fly, see compressor.h.
+int trace_reader_open(struct trace_reader* reader, const char* path);
+
+// Read the next record. STRING records are added to the string table before
+// they are returned. Returns 1 on success, 0 at the end of the trace, -1 on error.
+int trace_reader_next(struct trace_reader* reader, struct trace_record* record);
+
+// Return the string with the given id, or NULL if it was not defined (yet).
+const char* trace_reader_string(const struct trace_reader* reader, uint32_t id);
+
+// Load the footer index. Returns the number of entries, or -1 when the trace
+// has no index (e.g. the tracer was killed) or is compressed, which rules
+// out seeking. The caller frees *entries.
+long trace_reader_index(struct trace_reader* reader, struct trace_index_entry** entries);
+
+// Continue reading at a record offset taken from the index.
+int trace_reader_seek(struct trace_reader* reader, uint64_t offset);
+
+void trace_reader_close(struct trace_reader* reader);
+
+// Format a CLOCK_REALTIME timestamp the way dw-pid prints it (ISO 8601, microseconds, UTC).
+void trace_format_timestamp(uint64_t ns, char* buffer, size_t buffer_size);
+
+// Print an interval as one row of the CSV described by TRACE_CSV_HEADER.
+void trace_print_csv_row(FILE* out, const struct trace_interval* interval, const char* callchains);
+
+#endif
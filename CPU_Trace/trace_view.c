@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace_view.h"
+
+static const void* at(const struct trace_view* view, uint64_t offset)
+{
+    return view->data + offset;
+}
+
+int trace_cursor_next(struct trace_cursor* cursor, struct trace_record* record)
+{
+    const struct trace_view* view = cursor->view;
+    uint64_t offset = cursor->offset;
+    if (offset + sizeof(struct trace_record_header) > view->end)
+        return 0;
+    const struct trace_record_header* header = at(view, offset);
+    if (header->size < sizeof(*header)) {
+        fprintf(stderr, "trace: corrupt record at offset %lu\n", offset);
+        return -1;
+    }
+    // Truncated tail, e.g. the tracer was killed mid-write
+    if (offset + header->size > view->end)
+        return 0;
+
+    memset(record, 0, sizeof(*record));
+    record->type = header->type;
+    record->offset = offset;
+    record->header = header;
+
+    int corrupt = 0;
+    switch (header->type) {
+    case TRACE_RECORD_STRING:
+        record->string = (const struct trace_string*)header;
+        corrupt = header->size < sizeof(struct trace_string) + (uint64_t)record->string->len;
+        break;
+    case TRACE_RECORD_SAMPLE:
+        record->sample = (const struct trace_sample*)header;
+        corrupt = header->size < sizeof(struct trace_sample)
+            + (uint64_t)record->sample->nr * (sizeof(uint64_t) + sizeof(uint32_t));
+        if (!corrupt) {
+            record->ips = (const uint64_t*)(record->sample + 1);
+            record->symbols = (const uint32_t*)(record->ips + record->sample->nr);
+        }
+        break;
+    case TRACE_RECORD_INTERVAL:
+        if (header->size < sizeof(struct trace_interval)) {
+            memset(&cursor->interval, 0, sizeof(cursor->interval));
+            memcpy(&cursor->interval, header, header->size);
+            record->interval = &cursor->interval;
+        }
+        else
+            record->interval = (const struct trace_interval*)header;
+        break;
+    case TRACE_RECORD_MMAP:
+        record->mmap = (const struct trace_mmap*)header;
+        corrupt = header->size < sizeof(struct trace_mmap) + (uint64_t)record->mmap->filename_len;
+        if (!corrupt)
+            record->filename = (const char*)(record->mmap + 1);
+        break;
+    case TRACE_RECORD_INDEX:
+        record->index = (const struct trace_index*)header;
+        break;
+    default:
+        break;
+    }
+    if (corrupt) {
+        fprintf(stderr, "trace: corrupt record at offset %lu\n", offset);
+        return -1;
+    }
+    cursor->offset = offset + header->size;
+    return 1;
+}
+
+void trace_cursor_seek(struct trace_cursor* cursor, const struct trace_view* view, uint64_t time_ns)
+{
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->view = view;
+    cursor->offset = sizeof(struct trace_file_header);
+
+    // Last block starting at or before time_ns
+    size_t lo = 0, hi = view->index_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (view->index[mid].timestamp_ns <= time_ns)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0)
+        cursor->offset = view->index[lo - 1].offset;
+}
+
+const char* trace_view_string(const struct trace_view* view, uint32_t id, uint32_t* len)
+{
+    if (id == 0 || id > view->strings_count || view->strings[id - 1] == 0)
+        return NULL;
+    const struct trace_string* string = at(view, view->strings[id - 1]);
+    *len = string->len;
+    return (const char*)(string + 1);
+}
+
+// Footer written by version 3 and later: INDEX, STRING_INDEX, trailer.
+// Every offset is checked, a bad footer is ignored and the trace scanned.
+static int load_footer(struct trace_view* view)
+{
+    if (view->header->version < 3 || view->size < sizeof(struct trace_file_header) + sizeof(struct trace_trailer))
+        return -1;
+    const struct trace_trailer* trailer = at(view, view->size - sizeof(struct trace_trailer));
+    if (memcmp(trailer->magic, TRACE_TRAILER_MAGIC, sizeof(TRACE_TRAILER_MAGIC)) != 0)
+        return -1;
+
+    uint64_t footer_end = view->size - sizeof(struct trace_trailer);
+    uint64_t offset = trailer->index_offset;
+    if (offset < sizeof(struct trace_file_header) || offset + sizeof(struct trace_index) > footer_end)
+        return -1;
+    const struct trace_index* index = at(view, offset);
+    if (index->header.type != TRACE_RECORD_INDEX
+        || index->count > (footer_end - offset - sizeof(*index)) / sizeof(struct trace_index_entry))
+        return -1;
+
+    uint64_t strings_offset = offset + sizeof(*index) + index->count * sizeof(struct trace_index_entry);
+    if (strings_offset + sizeof(struct trace_string_index) > footer_end)
+        return -1;
+    const struct trace_string_index* strings = at(view, strings_offset);
+    if (strings->header.type != TRACE_RECORD_STRING_INDEX
+        || strings->count > (footer_end - strings_offset - sizeof(*strings)) / sizeof(uint64_t))
+        return -1;
+
+    const uint64_t* offsets = (const uint64_t*)(strings + 1);
+    for (uint64_t i = 0; i < strings->count; i++) {
+        if (offsets[i] < sizeof(struct trace_file_header) || offsets[i] + sizeof(struct trace_string) > offset)
+            return -1;
+        const struct trace_string* string = at(view, offsets[i]);
+        if (string->header.type != TRACE_RECORD_STRING || string->id != i + 1
+            || offsets[i] + sizeof(*string) + string->len > offset)
+            return -1;
+    }
+
+    view->end = offset;
+    view->index = (const struct trace_index_entry*)(index + 1);
+    view->index_count = index->count;
+    view->strings = offsets;
+    view->strings_count = strings->count;
+    return 0;
+}
+
+// One pass over the record headers, building what the footer would hold
+static int scan(struct trace_view* view)
+{
+    size_t index_capacity = 0, strings_capacity = 0;
+    uint64_t intervals = 0;
+    struct trace_cursor cursor;
+    trace_cursor_seek(&cursor, view, 0);
+    uint64_t block_offset = cursor.offset;
+
+    struct trace_record record;
+    int ret;
+    while ((ret = trace_cursor_next(&cursor, &record)) > 0) {
+        if (record.type == TRACE_RECORD_STRING) {
+            uint32_t id = record.string->id;
+            if (id == 0)
+                continue;
+            if (id > strings_capacity) {
+                size_t capacity = strings_capacity ? strings_capacity : 4096;
+                while (capacity < id)
+                    capacity *= 2;
+                uint64_t* grown = realloc(view->built_strings, capacity * sizeof(uint64_t));
+                if (!grown)
+                    return -1;
+                memset(grown + strings_capacity, 0, (capacity - strings_capacity) * sizeof(uint64_t));
+                view->built_strings = grown;
+                strings_capacity = capacity;
+            }
+            view->built_strings[id - 1] = record.offset;
+            if (id > view->strings_count)
+                view->strings_count = id;
+        }
+        else if (record.type == TRACE_RECORD_INTERVAL) {
+            if (intervals++ % TRACE_INDEX_STRIDE == 0) {
+                if (view->index_count == index_capacity) {
+                    size_t capacity = index_capacity ? index_capacity * 2 : 1024;
+                    struct trace_index_entry* grown = realloc(view->built_index, capacity * sizeof(struct trace_index_entry));
+                    if (!grown)
+                        return -1;
+                    view->built_index = grown;
+                    index_capacity = capacity;
+                }
+                struct trace_index_entry* entry = &view->built_index[view->index_count++];
+                entry->timestamp_ns = record.interval->timestamp_ns - record.interval->duration_ns;
+                entry->offset = block_offset;
+            }
+            block_offset = cursor.offset;
+        }
+        else if (record.type == TRACE_RECORD_INDEX) {
+            // Version 2 footer, its index points at the interval records
+            cursor.offset = record.offset;
+            break;
+        }
+    }
+    view->end = cursor.offset;
+    view->index = view->built_index;
+    view->strings = view->built_strings;
+    view->scanned = 1;
+    return ret < 0 ? -1 : 0;
+}
+
+int trace_view_open(struct trace_view* view, const char* path)
+{
+    memset(view, 0, sizeof(*view));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct trace_file_header)) {
+        fprintf(stderr, "%s: not a dw-pid trace\n", path);
+        close(fd);
+        return -1;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+    view->data = data;
+    view->size = st.st_size;
+    view->end = st.st_size;
+    view->header = data;
+
+    if (memcmp(view->header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not an uncompressed dw-pid trace\n", path);
+        trace_view_close(view);
+        return -1;
+    }
+    // Version 1 samples lack the period, only trace_reader converts them
+    if (view->header->version < 2 || view->header->version > TRACE_VERSION) {
+        fprintf(stderr, "%s: unsupported trace version %u\n", path, view->header->version);
+        trace_view_close(view);
+        return -1;
+    }
+
+    if (load_footer(view) != 0 && scan(view) != 0) {
+        fprintf(stderr, "%s: could not index the trace\n", path);
+        trace_view_close(view);
+        return -1;
+    }
+    return 0;
+}
+
+void trace_view_close(struct trace_view* view)
+{
+    if (view->data)
+        munmap((void*)view->data, view->size);
+    free(view->built_index);
+    free(view->built_strings);
+    memset(view, 0, sizeof(*view));
+}
@@ -0,0 +1,59 @@
+#ifndef TRACE_VIEW_H
+#define TRACE_VIEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "trace_format.h"
+#include "trace_reader.h"
+
+// Random access to a binary trace mapped into memory. Records are read in
+// place, without copies, and the footer's sparse time index and string
+// index let a cursor start at any point in time with every symbol already
+// resolvable. Traces without a footer (version 2, or a killed tracer) are
+// indexed by one pass over the record headers when they are opened.
+// A view is read-only once open, so several threads may query it, one
+// cursor each. Compressed traces must be decompressed first.
+
+struct trace_view {
+    const char* data;
+    size_t size;
+    const struct trace_file_header* header;
+    uint64_t end;   // offset of the footer, or of the end of the last whole record
+
+    const struct trace_index_entry* index;
+    size_t index_count;
+    const uint64_t* strings; // offset of the STRING record with id i + 1, 0 if undefined
+    size_t strings_count;
+    int scanned;             // the indexes were built at open, not read from the footer
+
+    // What the scan allocated
+    struct trace_index_entry* built_index;
+    uint64_t* built_strings;
+};
+
+struct trace_cursor {
+    const struct trace_view* view;
+    uint64_t offset;
+    struct trace_interval interval; // older, shorter interval records zero-extended
+};
+
+// Returns -1 with the reason on stderr.
+int trace_view_open(struct trace_view* view, const char* path);
+
+void trace_view_close(struct trace_view* view);
+
+// Bytes of the string with the given id, not NUL terminated, or NULL.
+const char* trace_view_string(const struct trace_view* view, uint32_t id, uint32_t* len);
+
+// Place a cursor at the start of the index block holding time_ns
+// (CLOCK_REALTIME), from where it reaches the samples of every interval
+// ending after time_ns. 0 starts at the first record.
+void trace_cursor_seek(struct trace_cursor* cursor, const struct trace_view* view, uint64_t time_ns);
+
+// Same as trace_reader_next(), except that STRING records are not added to
+// any table and MMAP file names are not NUL terminated (their length is
+// mmap->filename_len). Returns 1, 0 at the end of the records, -1 when a
+// record is corrupt.
+int trace_cursor_next(struct trace_cursor* cursor, struct trace_record* record);
+
+#endif
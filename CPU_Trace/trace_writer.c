@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+#include "trace_writer.h"
+
+#define TRACE_WRITER_INITIAL_STRINGS 4096
+
+static const char padding[8] = { 0 };
+
+static uint64_t hash_str(const char* str, size_t len)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int write_bytes(struct trace_writer* writer, const void* data, size_t size)
+{
+    if (size && fwrite(data, 1, size, writer->out) != size)
+        return -1;
+    writer->offset += size;
+    return 0;
+}
+
+static int write_padding(struct trace_writer* writer, size_t size)
+{
+    return write_bytes(writer, padding, TRACE_ALIGN(size) - size);
+}
+
+int trace_writer_open(struct trace_writer* writer, FILE* out, pid_t pid, uint64_t start_ns)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->out = out;
+    writer->next_string_id = 1;
+    writer->strings_capacity = TRACE_WRITER_INITIAL_STRINGS;
+    writer->strings = calloc(writer->strings_capacity, sizeof(struct trace_writer_string));
+    if (!writer->strings)
+        return -1;
+
+    struct trace_file_header header = { 0 };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = TRACE_VERSION;
+    header.start_ns = start_ns;
+    header.pid = pid;
+    if (write_bytes(writer, &header, sizeof(header)) != 0)
+        return -1;
+    writer->block_offset = writer->offset;
+    return 0;
+}
+
+static int grow_strings(struct trace_writer* writer)
+{
+    size_t capacity = writer->strings_capacity * 2;
+    struct trace_writer_string* strings = calloc(capacity, sizeof(struct trace_writer_string));
+    if (!strings)
+        return -1;
+
+    for (size_t i = 0; i < writer->strings_capacity; i++) {
+        struct trace_writer_string* old = &writer->strings[i];
+        if (!old->id)
+            continue;
+        size_t slot = old->hash & (capacity - 1);
+        while (strings[slot].id)
+            slot = (slot + 1) & (capacity - 1);
+        strings[slot] = *old;
+    }
+
+    free(writer->strings);
+    writer->strings = strings;
+    writer->strings_capacity = capacity;
+    return 0;
+}
+
+uint32_t trace_writer_string(struct trace_writer* writer, const char* str, size_t len)
+{
+    uint64_t hash = hash_str(str, len);
+    size_t mask = writer->strings_capacity - 1;
+    size_t slot = hash & mask;
+    for (; writer->strings[slot].id; slot = (slot + 1) & mask) {
+        struct trace_writer_string* entry = &writer->strings[slot];
+        if (entry->hash == hash && entry->len == len && memcmp(entry->str, str, len) == 0)
+            return entry->id;
+    }
+
+    // Keep the load factor at or below 1/2
+    if (writer->next_string_id >= writer->strings_capacity / 2) {
+        if (grow_strings(writer) != 0)
+            return 0;
+        mask = writer->strings_capacity - 1;
+        for (slot = hash & mask; writer->strings[slot].id; slot = (slot + 1) & mask)
+            ;
+    }
+
+    if (writer->next_string_id > writer->string_offsets_capacity) {
+        size_t capacity = writer->string_offsets_capacity ? writer->string_offsets_capacity * 2 : TRACE_WRITER_INITIAL_STRINGS;
+        uint64_t* offsets = realloc(writer->string_offsets, capacity * sizeof(uint64_t));
+        if (!offsets)
+            return 0;
+        writer->string_offsets = offsets;
+        writer->string_offsets_capacity = capacity;
+    }
+    writer->string_offsets[writer->next_string_id - 1] = writer->offset;
+
+    struct trace_writer_string* entry = &writer->strings[slot];
+    entry->str = malloc(len);
+    if (!entry->str)
+        return 0;
+    memcpy(entry->str, str, len);
+    entry->len = len;
+    entry->hash = hash;
+    entry->id = writer->next_string_id++;
+
+    struct trace_string record = { 0 };
+    record.header.type = TRACE_RECORD_STRING;
+    record.header.size = TRACE_ALIGN(sizeof(record) + len);
+    record.id = entry->id;
+    record.len = len;
+    if (write_bytes(writer, &record, sizeof(record)) != 0
+        || write_bytes(writer, str, len) != 0
+        || write_padding(writer, sizeof(record) + len) != 0)
+        return 0;
+
+    return entry->id;
+}
+
+int trace_writer_sample(struct trace_writer* writer, const struct trace_sample* sample,
+    const uint64_t* ips, const uint32_t* symbols)
+{
+    struct trace_sample record = *sample;
+    size_t payload = record.nr * (sizeof(uint64_t) + sizeof(uint32_t));
+    record.header.type = TRACE_RECORD_SAMPLE;
+    record.header.size = TRACE_ALIGN(sizeof(record) + payload);
+
+    if (write_bytes(writer, &record, sizeof(record)) != 0
+        || write_bytes(writer, ips, record.nr * sizeof(uint64_t)) != 0
+        || write_bytes(writer, symbols, record.nr * sizeof(uint32_t)) != 0
+        || write_padding(writer, sizeof(record) + payload) != 0)
+        return -1;
+
+    writer->samples_in_interval++;
+    return 0;
+}
+
+int trace_writer_mmap(struct trace_writer* writer, uint32_t pid, uint32_t tid,
+    uint64_t addr, uint64_t len, uint64_t pgoff, const char* filename)
+{
+    size_t filename_len = strlen(filename);
+    struct trace_mmap record = { 0 };
+    record.header.type = TRACE_RECORD_MMAP;
+    record.header.size = TRACE_ALIGN(sizeof(record) + filename_len);
+    record.pid = pid;
+    record.tid = tid;
+    record.addr = addr;
+    record.len = len;
+    record.pgoff = pgoff;
+    record.filename_len = filename_len;
+
+    if (write_bytes(writer, &record, sizeof(record)) != 0
+        || write_bytes(writer, filename, filename_len) != 0
+        || write_padding(writer, sizeof(record) + filename_len) != 0)
+        return -1;
+    return 0;
+}
+
+int trace_writer_interval(struct trace_writer* writer, struct trace_interval* interval)
+{
+    if (writer->intervals++ % TRACE_INDEX_STRIDE == 0) {
+        if (writer->index_count == writer->index_capacity) {
+            size_t capacity = writer->index_capacity ? writer->index_capacity * 2 : 1024;
+            struct trace_index_entry* index = realloc(writer->index, capacity * sizeof(struct trace_index_entry));
+            if (!index)
+                return -1;
+            writer->index = index;
+            writer->index_capacity = capacity;
+        }
+        writer->index[writer->index_count].timestamp_ns = interval->timestamp_ns - interval->duration_ns;
+        writer->index[writer->index_count].offset = writer->block_offset;
+        writer->index_count++;
+    }
+
+    interval->header.type = TRACE_RECORD_INTERVAL;
+    interval->header.size = sizeof(*interval);
+    interval->nr_samples = writer->samples_in_interval;
+    writer->samples_in_interval = 0;
+    if (write_bytes(writer, interval, sizeof(*interval)) != 0)
+        return -1;
+    writer->block_offset = writer->offset;
+    return 0;
+}
+
+int trace_writer_close(struct trace_writer* writer)
+{
+    int ret = 0;
+
+    struct trace_index index = { 0 };
+    index.header.type = TRACE_RECORD_INDEX;
+    index.header.size = sizeof(index) + writer->index_count * sizeof(struct trace_index_entry);
+    index.count = writer->index_count;
+
+    struct trace_string_index strings = { 0 };
+    strings.header.type = TRACE_RECORD_STRING_INDEX;
+    strings.count = writer->next_string_id - 1;
+    strings.header.size = sizeof(strings) + strings.count * sizeof(uint64_t);
+
+    struct trace_trailer trailer = { 0 };
+    trailer.index_offset = writer->offset;
+    memcpy(trailer.magic, TRACE_TRAILER_MAGIC, sizeof(TRACE_TRAILER_MAGIC));
+
+    if (write_bytes(writer, &index, sizeof(index)) != 0
+        || write_bytes(writer, writer->index, writer->index_count * sizeof(struct trace_index_entry)) != 0
+        || write_bytes(writer, &strings, sizeof(strings)) != 0
+        || write_bytes(writer, writer->string_offsets, strings.count * sizeof(uint64_t)) != 0
+        || write_bytes(writer, &trailer, sizeof(trailer)) != 0
+        || fflush(writer->out) != 0)
+        ret = -1;
+
+    for (size_t i = 0; i < writer->strings_capacity; i++)
+        free(writer->strings[i].str);
+    free(writer->strings);
+    free(writer->string_offsets);
+    free(writer->index);
+    memset(writer, 0, sizeof(*writer));
+    return ret;
+}
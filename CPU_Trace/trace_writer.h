@@ -0,0 +1,54 @@
+#ifndef TRACE_WRITER_H
+#define TRACE_WRITER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "trace_format.h"
+
+struct trace_writer_string {
+    char* str;
+    size_t len;
+    uint64_t hash;
+    uint32_t id;
+};
+
+struct trace_writer {
+    FILE* out;
+    uint64_t offset;
+
+    // Strings already written, open addressing on the string contents
+    struct trace_writer_string* strings;
+    size_t strings_capacity;
+    uint32_t next_string_id;
+    uint64_t* string_offsets; // of each STRING record, by id - 1
+    size_t string_offsets_capacity;
+
+    // Sparse footer index, one entry per TRACE_INDEX_STRIDE intervals
+    struct trace_index_entry* index;
+    size_t index_count;
+    size_t index_capacity;
+    uint64_t intervals;
+    uint64_t block_offset; // where the records of the current interval start
+
+    uint32_t samples_in_interval;
+};
+
+// Start a trace on out (which stays owned by the caller) and write the file header.
+int trace_writer_open(struct trace_writer* writer, FILE* out, pid_t pid, uint64_t start_ns);
+
+// Return the string table id of str, writing a STRING record the first time it is seen.
+uint32_t trace_writer_string(struct trace_writer* writer, const char* str, size_t len);
+
+int trace_writer_sample(struct trace_writer* writer, const struct trace_sample* sample,
+    const uint64_t* ips, const uint32_t* symbols);
+
+int trace_writer_mmap(struct trace_writer* writer, uint32_t pid, uint32_t tid,
+    uint64_t addr, uint64_t len, uint64_t pgoff, const char* filename);
+
+int trace_writer_interval(struct trace_writer* writer, struct trace_interval* interval);
+
+// Write the footer index and trailer and release the writer. Does not close out.
+int trace_writer_close(struct trace_writer* writer);
+
+#endif
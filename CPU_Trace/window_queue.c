@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <string.h>
+#include "window_queue.h"
+
+int window_queue_init(struct window_queue* queue, size_t capacity, uint64_t start_ns)
+{
+    memset(queue, 0, sizeof(*queue));
+    if (capacity < 2)
+        capacity = 2;
+    queue->windows = calloc(capacity, sizeof(struct window));
+    if (!queue->windows)
+        return -1;
+    queue->capacity = capacity;
+    queue->count = 1;
+    queue->windows[0].start_ns = start_ns;
+    return 0;
+}
+
+static struct window* window_at(struct window_queue* queue, size_t i)
+{
+    return &queue->windows[(queue->head + i) % queue->capacity];
+}
+
+int window_queue_add(struct window_queue* queue, uint64_t time_ns, const void* record, size_t size)
+{
+    // Most records belong to the open window, so search from the newest
+    struct window* window = NULL;
+    for (size_t i = queue->count; i-- > 0;) {
+        window = window_at(queue, i);
+        if (time_ns >= window->start_ns)
+            break;
+    }
+    if (time_ns < window->start_ns)
+        queue->late++;
+
+    if (window->len + size > window->size) {
+        size_t new_size = window->size ? window->size : 4096;
+        while (new_size < window->len + size)
+            new_size *= 2;
+        char* records = realloc(window->records, new_size);
+        if (!records)
+            return -1;
+        window->records = records;
+        window->size = new_size;
+        queue->allocs++;
+    }
+    memcpy(window->records + window->len, record, size);
+    window->len += size;
+    return 0;
+}
+
+int window_queue_close(struct window_queue* queue, uint64_t end_ns, const struct trace_interval* interval)
+{
+    if (queue->count == queue->capacity)
+        return -1;
+
+    struct window* window = window_at(queue, queue->count - 1);
+    window->end_ns = end_ns;
+    window->interval = *interval;
+
+    struct window* next = window_at(queue, queue->count++);
+    next->start_ns = end_ns;
+    next->end_ns = 0;
+    next->len = 0;
+    return 0;
+}
+
+struct window* window_queue_oldest(struct window_queue* queue)
+{
+    return queue->count > 1 ? window_at(queue, 0) : NULL;
+}
+
+void window_queue_pop(struct window_queue* queue)
+{
+    if (queue->count < 2)
+        return;
+    window_at(queue, 0)->len = 0;
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+}
+
+void window_queue_free(struct window_queue* queue)
+{
+    for (size_t i = 0; i < queue->capacity; i++)
+        free(queue->windows[i].records);
+    free(queue->windows);
+    memset(queue, 0, sizeof(*queue));
+}
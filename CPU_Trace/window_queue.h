@@ -0,0 +1,50 @@
+#ifndef WINDOW_QUEUE_H
+#define WINDOW_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "trace_format.h"
+
+// Power windows waiting for their samples. Ring buffers are drained
+// whenever they pass their watermark, so records reach the tracer in
+// batches that do not line up with the power readings; each record is
+// parked in the window covering its timestamp until that window is old
+// enough to be reported.
+
+struct window {
+    uint64_t start_ns;  // CLOCK_MONOTONIC
+    uint64_t end_ns;    // 0 while the window is still open
+    struct trace_interval interval; // measurements taken when it closed
+    char* records;      // raw perf records, back to back
+    size_t len;
+    size_t size;
+};
+
+struct window_queue {
+    struct window* windows; // ring, oldest at head, the open window last
+    size_t capacity;
+    size_t head;
+    size_t count;
+    uint64_t late;          // records older than every pending window
+    unsigned long allocs;   // record buffer allocations, they are reused
+};
+
+// Starts with one open window at start_ns.
+int window_queue_init(struct window_queue* queue, size_t capacity, uint64_t start_ns);
+
+// Copy a perf record into the window covering time_ns.
+int window_queue_add(struct window_queue* queue, uint64_t time_ns, const void* record, size_t size);
+
+// Close the open window at end_ns and open the next one. Fails when the
+// queue is full; report the oldest window first.
+int window_queue_close(struct window_queue* queue, uint64_t end_ns, const struct trace_interval* interval);
+
+// Oldest closed window, or NULL when only the open window is pending.
+struct window* window_queue_oldest(struct window_queue* queue);
+
+// Drop the oldest closed window, keeping its buffer for reuse.
+void window_queue_pop(struct window_queue* queue);
+
+void window_queue_free(struct window_queue* queue);
+
+#endif
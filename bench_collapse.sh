@@ -0,0 +1,95 @@
+#!/bin/bash
+
+# Compare CPU_Trace/dw-collapse with collapse_report.py on a dw-pid CSV
+# (default Result/python/python.csv) and on a copy repeated 100 times.
+# Checks that both write the same sample counts and, within rounding, the
+# same joules per stack, then times dw-collapse on several files at once.
+
+INPUT="${1:-./Result/python/python.csv}"
+REPEAT="${REPEAT:-100}"
+FILES="${FILES:-8}"
+
+if [ ! -f "$INPUT" ]; then
+    echo "Usage: $0 [<dw-pid csv>]"
+    exit 1
+fi
+
+ROOT="$(cd "$(dirname "$0")" && pwd)"
+INPUT="$(cd "$(dirname "$INPUT")" && pwd)/$(basename "$INPUT")"
+( cd "$ROOT/CPU_Trace" && make dw-collapse ) || exit 1
+
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+TIMEFORMAT="%R s"
+
+# Repeat the rows, shifting the timestamps so the copies follow each other
+python3 - "$INPUT" "$WORK/bench_1x.csv" "$WORK/bench_${REPEAT}x.csv" "$REPEAT" <<'EOF'
+import sys
+from datetime import datetime, timedelta
+
+src, small, large, repeat = sys.argv[1], sys.argv[2], sys.argv[3], int(sys.argv[4])
+with open(src, errors='ignore') as f:
+    header = f.readline()
+    rows = [line.split(',', 1) for line in f if line.strip()]
+times = [datetime.fromisoformat(r[0].strip().rstrip('Z')) for r in rows]
+span = times[-1] - times[0] + timedelta(seconds=1)
+with open(small, 'w') as out:
+    out.write(header)
+    out.writelines(f"{t.isoformat(timespec='microseconds')}Z,{rest}" for t, (_, rest) in zip(times, rows))
+with open(large, 'w') as out:
+    out.write(header)
+    for k in range(repeat):
+        out.writelines(f"{(t + span * k).isoformat(timespec='microseconds')}Z,{rest}"
+                       for t, (_, rest) in zip(times, rows))
+EOF
+
+compare() {
+    local target=$1
+    if ! diff -q <(sort "$WORK/py/Result/$target/${target}_cpu.collapsed") \
+                 <(sort "$WORK/native/${target}_cpu.collapsed") > /dev/null; then
+        echo "  cpu.collapsed differs"
+        return 1
+    fi
+    python3 - "$WORK/py/Result/$target/${target}_joules.collapsed" "$WORK/native/${target}_joules.collapsed" <<'EOF'
+import sys
+
+def load(path):
+    stacks = {}
+    with open(path, errors='ignore') as f:
+        for line in f:
+            stack, value = line.rstrip('\n').rsplit(' ', 1)
+            stacks[stack] = float(value)
+    return stacks
+
+expected, actual = load(sys.argv[1]), load(sys.argv[2])
+worst = max((abs(expected[s] - actual.get(s, 0)) / max(abs(expected[s]), 1.0) for s in expected), default=0)
+if set(expected) != set(actual) or worst > 1e-6:
+    print(f"  joules.collapsed differs ({len(set(expected) ^ set(actual))} stacks, worst relative error {worst:g})")
+    sys.exit(1)
+print(f"  outputs match ({len(expected)} stacks)")
+EOF
+}
+
+STATUS=0
+mkdir -p "$WORK/py"
+for target in bench_1x "bench_${REPEAT}x"; do
+    echo "== $target ($(wc -l < "$WORK/$target.csv") rows, $(du -h "$WORK/$target.csv" | cut -f1))"
+    echo -n "  collapse_report.py: "
+    time ( cd "$WORK/py" && python3 "$ROOT/collapse_report.py" -e 6 "$WORK/$target.csv" > /dev/null 2>&1 )
+    echo -n "  dw-collapse:        "
+    time "$ROOT/CPU_Trace/dw-collapse" -e 6 -j 1 -o "$WORK/native" "$WORK/$target.csv" 2> /dev/null
+    compare "$target" || STATUS=1
+done
+
+# Several traces at once, one per thread
+mkdir -p "$WORK/many"
+for i in $(seq 1 "$FILES"); do
+    ln -s "$WORK/bench_${REPEAT}x.csv" "$WORK/many/bench_$i.csv"
+done
+echo "== $FILES x bench_${REPEAT}x"
+echo -n "  dw-collapse -j 1:   "
+time "$ROOT/CPU_Trace/dw-collapse" -e 6 -j 1 -o "$WORK/many_out" "$WORK"/many/*.csv 2> /dev/null
+echo -n "  dw-collapse -j $(nproc):   "
+time "$ROOT/CPU_Trace/dw-collapse" -e 6 -j "$(nproc)" -o "$WORK/many_out" "$WORK"/many/*.csv 2> /dev/null
+
+exit $STATUS
@@ -0,0 +1,79 @@
+#!/bin/bash
+
+# Compare CPU_Trace/dw-flamegraph with flamegraph.pl on a .collapsed file
+# (default Result/fluidsGL/fluidsGL_energy.collapsed) and on a larger copy
+# where every stack is repeated under TASKS different task frames. Checks
+# that both draw the same frames and times them, the native renderer on one
+# thread and on every CPU.
+
+INPUT="${1:-./Result/fluidsGL/fluidsGL_energy.collapsed}"
+TASKS="${TASKS:-300}"
+
+if [ ! -f "$INPUT" ]; then
+    echo "Usage: $0 [<collapsed file>]"
+    exit 1
+fi
+
+ROOT="$(cd "$(dirname "$0")" && pwd)"
+( cd "$ROOT/CPU_Trace" && make dw-flamegraph ) || exit 1
+
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+TIMEFORMAT="%R s"
+
+cp "$INPUT" "$WORK/bench_1x.collapsed"
+# Insert worker and task frames under the root, so the tree grows wide
+awk -v tasks="$TASKS" '{
+    lines[NR] = $0
+} END {
+    for (k = 0; k < tasks; k++)
+        for (i = 1; i <= NR; i++) {
+            line = lines[i]
+            split_at = index(line, ";")
+            if (split_at == 0)
+                print line
+            else
+                print substr(line, 1, split_at) "worker_" (k % 40) ";task_" k ";" substr(line, split_at + 1)
+        }
+}' "$INPUT" > "$WORK/bench_${TASKS}x.collapsed"
+
+# Frames as sets, since flamegraph.pl writes them in hash order. Counts
+# are summed in a different order, so the last digit may round apart.
+compare() {
+    python3 - "$1" "$2" <<'PY'
+import re
+import sys
+
+def frames(path):
+    with open(path, errors='ignore') as f:
+        svg = f.read()
+    head, _, body = svg.partition('<g id="frames">')
+    return head, body.replace('</g>\n</svg>\n', '').split('<g >\n')[1:]
+
+def shape(frame):
+    return re.sub(r'\(([\d,]+) ', '(', re.sub(r'x="[\d.]+"|width="[\d.]+"', '', frame))
+
+(head_a, a), (head_b, b) = frames(sys.argv[1]), frames(sys.argv[2])
+exact = len(set(a) ^ set(b))
+if head_a != head_b or len(a) != len(b) or sorted(map(shape, a)) != sorted(map(shape, b)):
+    print(f"  SVGs differ ({len(a)} and {len(b)} frames)")
+    sys.exit(1)
+print(f"  same {len(a)} frames" + (f", {exact // 2} with a position or count rounded apart" if exact else ", byte for byte"))
+PY
+}
+
+STATUS=0
+for target in bench_1x "bench_${TASKS}x"; do
+    IN="$WORK/$target.collapsed"
+    echo "== $target ($(wc -l < "$IN") stacks, $(du -h "$IN" | cut -f1))"
+    echo -n "  flamegraph.pl:        "
+    time "$ROOT/flamegraph.pl" "$IN" > "$WORK/$target.pl.svg" 2> /dev/null
+    echo -n "  dw-flamegraph -j 1:   "
+    time "$ROOT/CPU_Trace/dw-flamegraph" -j 1 "$IN" > "$WORK/$target.1.svg" 2> /dev/null
+    echo -n "  dw-flamegraph -j $(nproc):   "
+    time "$ROOT/CPU_Trace/dw-flamegraph" -j "$(nproc)" "$IN" > "$WORK/$target.n.svg" 2> /dev/null
+    compare "$WORK/$target.pl.svg" "$WORK/$target.1.svg" || STATUS=1
+    compare "$WORK/$target.pl.svg" "$WORK/$target.n.svg" || STATUS=1
+done
+
+exit $STATUS
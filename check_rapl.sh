@@ -0,0 +1,45 @@
+#!/bin/bash
+
+# Wraparound of the powercap energy counters read by CPU_Trace/rapl.c, on a
+# fake sysfs tree. The standalone power meter opens the tree, the counters
+# are moved past max_energy_range_uj while it sleeps, and the energy it
+# reports must be exactly what the counters advanced by.
+
+ROOT="$(cd "$(dirname "$0")" && pwd)"
+( cd "$ROOT/CPU_Trace" && make power ) || exit 1
+
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+
+# zone name max start end
+zone() {
+    mkdir -p "$WORK/intel-rapl/$1"
+    echo "$2" > "$WORK/intel-rapl/$1/name"
+    echo "$3" > "$WORK/intel-rapl/$1/max_energy_range_uj"
+    echo "$4" > "$WORK/intel-rapl/$1/energy_uj"
+}
+zone intel-rapl:0 package-0 1000000 999990
+zone intel-rapl:0/intel-rapl:0:0 dram 1000000 1000000
+zone intel-rapl:1 package-1 1000000 100
+
+"$ROOT/CPU_Trace/power" "$WORK" > "$WORK/out" &
+POWER=$!
+# power reads the counters again after one second
+sleep 0.4
+echo 5 > "$WORK/intel-rapl/intel-rapl:0/energy_uj"
+echo 0 > "$WORK/intel-rapl/intel-rapl:0/intel-rapl:0:0/energy_uj"
+echo 400 > "$WORK/intel-rapl/intel-rapl:1/energy_uj"
+wait $POWER || exit 1
+
+STATUS=0
+# max to 0 counts one microjoule
+for expected in "package-0: 16 " "package-0/dram: 1 " "package-1: 300 " "(all packages): 316 "; do
+    if ! grep -qF "$expected" "$WORK/out"; then
+        echo "expected \"${expected}microjoules\""
+        STATUS=1
+    fi
+done
+[ $STATUS -eq 0 ] || cat "$WORK/out"
+
+[ $STATUS -eq 0 ] && echo "rapl wraparound ok"
+exit $STATUS
@@ -0,0 +1,112 @@
+#!/bin/bash
+
+# Round trip of CPU_Trace/dw-symbolize on the CSV of `dw-pid -r`, in both
+# of its forms: full callchains (-F) and the interned #frame/#stack CSV.
+# The same raw samples, addresses of functions of an ELF file mapped by a
+# fake maps file, are written in each form and symbolized. Checks that every
+# #frame is resolved to its function and that dw-collapse folds the two
+# outputs into the same stacks.
+
+ROOT="$(cd "$(dirname "$0")" && pwd)"
+( cd "$ROOT/CPU_Trace" && make dw-symbolize dw-collapse ) || exit 1
+ELF="$ROOT/CPU_Trace/dw-collapse"
+
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+
+python3 - "$ELF" "$WORK" <<'EOF'
+import subprocess, sys
+
+elf, work = sys.argv[1], sys.argv[2]
+base = 0x555500000000
+
+# Load segments, to place each function at the address it runs at when the
+# whole file is mapped at base
+segments = []
+for line in subprocess.run(['readelf', '-lW', elf], capture_output=True, text=True, check=True).stdout.splitlines():
+    fields = line.split()
+    if fields and fields[0] == 'LOAD':
+        segments.append((int(fields[1], 16), int(fields[2], 16), int(fields[4], 16)))
+
+functions = []
+for line in subprocess.run(['nm', '--defined-only', '-S', elf], capture_output=True, text=True, check=True).stdout.splitlines():
+    fields = line.split()
+    if len(fields) == 4 and fields[2] in 'Tt' and int(fields[1], 16) > 1:
+        addr = int(fields[0], 16)
+        for offset, vaddr, filesz in segments:
+            if vaddr <= addr < vaddr + filesz:
+                functions.append((base + addr - vaddr + offset + 1, fields[3]))
+                break
+functions = sorted(set(functions))[:6]
+if len(functions) < 6:
+    sys.exit(f"{elf}: not enough function symbols")
+
+size = (max(offset + filesz for offset, _, filesz in segments) + 0xfff) & ~0xfff
+with open(f'{work}/raw.maps', 'w') as f:
+    f.write(f'{base:x}-{base + size:x} r-xp 00000000 00:00 0 {elf}\n')
+with open(f'{work}/expected', 'w') as f:
+    f.writelines(f'0x{ip:x} {name}\n' for ip, name in functions)
+
+# Callchains leaf first, one row per interval
+ips = [ip for ip, _ in functions]
+chains = [[ips[0], ips[1], ips[2]], [ips[3], ips[1], ips[2]], [ips[4], ips[5]], [ips[0], ips[1], ips[2]]]
+header = 'timestamp, callchains, power, resource_usage, gpu_power, lost_samples, throttled, duration\n'
+
+def row(i, callchains):
+    return f'2026-01-01T00:00:{i:02d}.000000Z, {callchains}, 10.000000, 100.00, 0.000000, 0, 0, 1.000000\n'
+
+def tag(i):
+    return f'@{1767225599000000000 + i * 1000000000}/0/1/1000;'
+
+with open(f'{work}/full.csv', 'w') as f:
+    f.write(header)
+    for i, chain in enumerate(chains):
+        f.write(row(i, tag(i) + ''.join(f'0x{ip:x};' for ip in chain) + '|'))
+
+# Interned as dw-pid prints it: definitions before the first row using them
+frames, stacks = {}, {}
+with open(f'{work}/interned.csv', 'w') as f:
+    f.write(header)
+    for i, chain in enumerate(chains):
+        node = 0
+        for ip in reversed(chain):
+            if ip not in frames:
+                frames[ip] = len(frames)
+                f.write(f'#frame,{frames[ip]},0x{ip:x}\n')
+            if (node, frames[ip]) not in stacks:
+                stacks[(node, frames[ip])] = len(stacks) + 1
+                f.write(f'#stack,{stacks[(node, frames[ip])]},{node},{frames[ip]}\n')
+            node = stacks[(node, frames[ip])]
+        f.write(row(i, f'{tag(i)}${node};|'))
+EOF
+[ $? -eq 0 ] || exit 1
+
+STATUS=0
+for form in full interned; do
+    "$ROOT/CPU_Trace/dw-symbolize" -m "$WORK/raw.maps" "$WORK/$form.csv" > "$WORK/${form}_sym.csv" 2> /dev/null || STATUS=1
+    "$ROOT/CPU_Trace/dw-collapse" -j 1 -o "$WORK/$form" "$WORK/${form}_sym.csv" 2> /dev/null || STATUS=1
+done
+
+if grep -q '^#frame,[0-9]*,0x' "$WORK/interned_sym.csv"; then
+    echo "interned: unresolved #frame lines left"
+    STATUS=1
+fi
+while read -r ip name; do
+    if ! grep -q ",$name\$" "$WORK/interned_sym.csv"; then
+        echo "interned: $ip not resolved to $name"
+        STATUS=1
+    fi
+done < "$WORK/expected"
+# The root frame is the name of the input
+if ! diff <(sed 's/^[^;]*;//' "$WORK/full/full_sym_cpu.collapsed" | sort) \
+          <(sed 's/^[^;]*;//' "$WORK/interned/interned_sym_cpu.collapsed" | sort); then
+    echo "full and interned CSV fold differently"
+    STATUS=1
+fi
+if grep -q 0x "$WORK/full/full_sym_cpu.collapsed"; then
+    echo "full: unresolved frames left"
+    STATUS=1
+fi
+
+[ $STATUS -eq 0 ] && echo "dw-symbolize round trip ok ($(wc -l < "$WORK/expected") functions, full and interned CSV)"
+exit $STATUS
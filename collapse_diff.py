@@ -0,0 +1,173 @@
+#!/usr/bin/python3
+
+import os
+import sys
+import argparse
+import subprocess
+from collapse_report import arg_file, read_csv_records, with_durations, COMPRESSED_SUFFIXES
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+
+def parse_args():
+    """Parse command-line arguments.
+
+    Both inputs are .collapsed files of the same target, e.g. the
+    <target>_energy.collapsed or <target>_joules.collapsed of an old and a
+    new run. The old run is scaled to the new one before comparing:
+      total    both runs sum to the same total (default), so the graph shows
+               where the energy moved
+      runtime  the old run is scaled by new runtime / old runtime, so runs
+               of different length compare per second
+      none     counts compared as they are, for runs of the same workload
+    """
+    parser = argparse.ArgumentParser(
+        description='Compare the energy per stack of two runs: differential flame graph and top regressions.'
+    )
+    parser.add_argument('old', type=arg_file,
+                        help='.collapsed file of the baseline run.')
+    parser.add_argument('new', type=arg_file,
+                        help='.collapsed file of the run to check.')
+    parser.add_argument('-n', '--normalize', choices=('total', 'runtime', 'none'), default='total',
+                        help='How the old run is scaled to the new one (default: total).')
+    parser.add_argument('--runtime', type=float, nargs=2, metavar=('OLD', 'NEW'),
+                        help='Run lengths in seconds for -n runtime, instead of reading them from '
+                             'the <target>.csv next to each input.')
+    parser.add_argument('-o', '--output',
+                        help='Prefix of the output files (default: <new without .collapsed>_diff).')
+    parser.add_argument('-t', '--top', type=int, default=20,
+                        help='Regressed stacks to print (default: 20).')
+    parser.add_argument('--countname', default='microjoules',
+                        help='Unit of the counts, for the flame graph labels (default: microjoules).')
+    parser.add_argument('--fail-above', type=float, metavar='PCT',
+                        help='Exit with status 1 when the total, or any one stack, grew by more than '
+                             'PCT percent of the old total.')
+    return parser.parse_args()
+
+def read_collapsed(path):
+    """Sum a .collapsed file per stack: "stack count", split at the last space."""
+    stacks = {}
+    with open(path, encoding='utf-8', errors='ignore') as f:
+        for line in f:
+            stack, _, count = line.rstrip('\n').rpartition(' ')
+            try:
+                value = float(count)
+            except ValueError:
+                continue
+            if stack:
+                stacks[stack] = stacks.get(stack, 0.0) + value
+    return stacks
+
+def run_csv(collapsed_path):
+    """The dw-pid CSV a .collapsed file was folded from: <target>.csv beside it."""
+    prefix = collapsed_path[:-len('.collapsed')] if collapsed_path.endswith('.collapsed') else collapsed_path
+    for suffix in ('_energy', '_joules', '_cpu'):
+        if prefix.endswith(suffix):
+            prefix = prefix[:-len(suffix)]
+            break
+    for suffix in ('',) + COMPRESSED_SUFFIXES:
+        if os.path.isfile(f'{prefix}.csv{suffix}'):
+            return f'{prefix}.csv{suffix}'
+    raise SystemExit(f"No {os.path.basename(prefix)}.csv next to {collapsed_path}, "
+                     "give the run lengths with --runtime")
+
+def runtime(csv_path):
+    """Seconds covered by the intervals of a dw-pid CSV."""
+    return sum(duration for _, duration in with_durations(read_csv_records(csv_path)))
+
+def scale_factor(args, old, new):
+    if args.normalize == 'total':
+        old_total = sum(old.values())
+        return sum(new.values()) / old_total if old_total else 1.0, 'total'
+    if args.normalize == 'runtime':
+        if args.runtime:
+            old_runtime, new_runtime = args.runtime
+        else:
+            old_runtime, new_runtime = runtime(run_csv(args.old)), runtime(run_csv(args.new))
+        if old_runtime <= 0 or new_runtime <= 0:
+            raise SystemExit("Run lengths must be positive")
+        return new_runtime / old_runtime, f'runtime ({old_runtime:.3f} s -> {new_runtime:.3f} s)'
+    return 1.0, 'none'
+
+def write_diff_folded(path, old, new):
+    """
+    Write "stack old new" lines, the differential input of flamegraph.pl
+    and dw-flamegraph: frames are as wide as in the new run and colored by
+    how much their own count changed.
+    """
+    with open(path, 'w') as f:
+        for stack in sorted(old.keys() | new.keys()):
+            f.write(f'{stack} {old.get(stack, 0.0):.6f} {new.get(stack, 0.0):.6f}\n')
+
+def write_table(path, rows, old_total):
+    """Every stack, largest increase first, as tab-separated values."""
+    with open(path, 'w') as f:
+        f.write('delta\tdelta_pct_of_old_total\tchange_pct\told\tnew\tstack\n')
+        for stack, before, after in rows:
+            change = f'{100 * (after - before) / before:.2f}' if before else 'new'
+            f.write(f'{after - before:.6f}\t{100 * (after - before) / old_total:.4f}\t{change}\t'
+                    f'{before:.6f}\t{after:.6f}\t{stack}\n')
+
+def short_stack(stack, frames=3):
+    parts = stack.split(';')
+    return stack if len(parts) <= frames + 1 else f'{parts[0]};...;' + ';'.join(parts[-frames:])
+
+def print_regressions(rows, old_total, top):
+    regressed = [row for row in rows[:top] if row[2] > row[1]]
+    if not regressed:
+        print("No stack regressed")
+        return
+    print(f"Top {len(regressed)} regressed stacks:")
+    print(f"{'delta':>14} {'% of old':>9} {'change':>9}  stack")
+    for stack, before, after in regressed:
+        change = f'{100 * (after - before) / before:+.1f}%' if before else 'new'
+        print(f"{after - before:>+14.6g} {100 * (after - before) / old_total:>+8.2f}% {change:>9}  {short_stack(stack)}")
+
+def flamegraph_command():
+    """flamegraph.pl, or dw-flamegraph with FLAMEGRAPH=native as in start_cgroup.sh."""
+    if os.environ.get('FLAMEGRAPH') == 'native':
+        subprocess.run(['make', '-s', '-C', os.path.join(ROOT, 'CPU_Trace'), 'dw-flamegraph'], check=True)
+        return os.path.join(ROOT, 'CPU_Trace', 'dw-flamegraph')
+    return os.path.join(ROOT, 'flamegraph.pl')
+
+def main():
+    args = parse_args()
+    old = read_collapsed(args.old)
+    new = read_collapsed(args.new)
+    if not old or not new:
+        raise SystemExit(f"No stacks in {args.old if not old else args.new}")
+
+    scale, normalization = scale_factor(args, old, new)
+    old = {stack: value * scale for stack, value in old.items()}
+    old_total = sum(old.values())
+    new_total = sum(new.values())
+    print(f"Old run scaled by {scale:.6g} ({normalization}): {old_total:.6f} -> {new_total:.6f} "
+          f"({100 * (new_total - old_total) / old_total:+.2f}%)")
+
+    prefix = args.output
+    if prefix is None:
+        base = args.new[:-len('.collapsed')] if args.new.endswith('.collapsed') else args.new
+        prefix = f'{base}_diff'
+
+    rows = sorted(((stack, old.get(stack, 0.0), new.get(stack, 0.0)) for stack in old.keys() | new.keys()),
+                  key=lambda row: row[2] - row[1], reverse=True)
+    write_table(f'{prefix}.tsv', rows, old_total)
+    print_regressions(rows, old_total, args.top)
+
+    # Stacks gone from the new run have no width, the table lists them
+    write_diff_folded(f'{prefix}.collapsed', old, new)
+    with open(f'{prefix}.svg', 'w') as svg:
+        subprocess.run([flamegraph_command(), '--title', 'Energy Difference',
+                        '--subtitle', f'{os.path.basename(args.old)} -> {os.path.basename(args.new)}, '
+                                      f'normalized by {args.normalize}',
+                        '--countname', args.countname, f'{prefix}.collapsed'], stdout=svg, check=True)
+    print(f"Differential flame graph written to {prefix}.svg, all stacks to {prefix}.tsv")
+
+    if args.fail_above is not None:
+        limit = args.fail_above * old_total / 100
+        worst = rows[0]
+        if new_total - old_total > limit or worst[2] - worst[1] > limit:
+            print(f"FAIL: energy grew by more than {args.fail_above}% of the old total", file=sys.stderr)
+            sys.exit(1)
+
+if __name__ == '__main__':
+    main()
@@ -1,12 +1,15 @@
 #!/usr/bin/python3
 
 import os
+import io
 import argparse
 import configparser
+import contextlib
 import csv
+import subprocess
 from collections import defaultdict
 import matplotlib.pyplot as plt
-from datetime import datetime
+from datetime import datetime, timezone
 
 def arg_file(arg):
     """Validate that the argument is a valid file."""
@@ -19,10 +22,16 @@ def parse_args():
     
     Now the input CSV file should contain:
       Column1: elapsed timestamp (seconds)
-      Column2: callchain records
+      Column2: callchain records, each optionally led by an
+               @<unix ns>/<cpu>/<tid>/<period> tag frame, either the
+               frames themselves or $<stack id> of an interned CSV
       Column3: total power consumption (CPU)
       Column4: percentage resource utilization
       Column5: gpu_power consumption
+      Column6: samples lost to ring buffer overflow (optional)
+      Column7: throttle events (optional)
+      Column8: interval duration in seconds (optional)
+    The file may be compressed with zstd or lz4 (dw-pid -Z).
     """
     parser = argparse.ArgumentParser(
         description='Collapse CSV power consumption data into a performance collapse report.'
@@ -30,25 +39,97 @@ def parse_args():
     parser.add_argument('input_csv', type=arg_file,
                         help='Path to input CSV file with raw data.')
     parser.add_argument('-e', '--scinot', type=int, default=0,
-                        help='Multiply power by 10^scinot for scientific notation.')
+                        help='Multiply energy by 10^scinot for scientific notation (6 gives microjoules).')
     return parser.parse_args()
 
-def read_csv_records(csv_path):
+class StackTable:
     """
-    Read CSV file and transform rows into a list of records.
+    Frames and stacks defined by the #frame and #stack lines of a CSV
+    written by dw-pid without -F. A stack is its parent stack with one frame
+    called on top; stack 0 is empty. Each stack is folded into its
+    "root;...;leaf" string once and then looked up by id.
+    """
+    def __init__(self):
+        self.frames = {}
+        self.stacks = {}
+        self.folded = {0: ''}
+
+    def define(self, row):
+        """Take a definition row, returns False for any other row."""
+        if row[0] == '#frame' and len(row) > 2:
+            # The name runs to the end of the line, commas included
+            self.frames[int(row[1])] = ','.join(row[2:])
+        elif row[0] == '#stack' and len(row) > 3:
+            self.stacks[int(row[1])] = (int(row[2]), int(row[3]))
+        else:
+            return False
+        return True
+
+    def fold(self, stack_id):
+        folded = self.folded.get(stack_id)
+        if folded is None:
+            # Walk down to the nearest folded ancestor, then fold back up
+            path = []
+            while folded is None:
+                parent, frame = self.stacks[stack_id]
+                path.append((stack_id, frame))
+                stack_id = parent
+                folded = self.folded.get(stack_id)
+            for stack_id, frame in reversed(path):
+                name = self.frames[frame]
+                folded = f'{folded};{name}' if folded else name
+                self.folded[stack_id] = folded
+        return folded
+
+# Magic numbers of the zstd and lz4 frames written by dw-pid -Z
+COMPRESSED_MAGIC = {b'\x28\xb5\x2f\xfd': 'zstd', b'\x04\x22\x4d\x18': 'lz4'}
+COMPRESSED_SUFFIXES = ('.zst', '.lz4')
+
+@contextlib.contextmanager
+def open_csv(csv_path):
+    """
+    Open a dw-pid CSV as text. Compressed files are streamed through the
+    zstd or lz4 command line tool, so they are never decompressed to disk.
+    """
+    with open(csv_path, 'rb') as file:
+        codec = COMPRESSED_MAGIC.get(file.read(4))
+    if codec is None:
+        with open(csv_path, newline='', encoding='utf-8', errors='ignore') as csvfile:
+            yield csvfile
+        return
+    try:
+        proc = subprocess.Popen([codec, '-dcq', csv_path], stdout=subprocess.PIPE)
+    except FileNotFoundError:
+        raise SystemExit(f"{csv_path} is {codec} compressed, the {codec} tool is needed to read it")
+    try:
+        yield io.TextIOWrapper(proc.stdout, encoding='utf-8', errors='ignore', newline='')
+    finally:
+        proc.stdout.close()
+        proc.wait()
+
+def read_csv_records(csv_path, stacks=None):
+    """
+    Read CSV file and yield its rows one record at a time. Definition rows
+    of an interned CSV go to stacks.
     Each record is a dictionary with keys:
       'timestamp'      -> elapsed time in seconds (string)
       'metadata'       -> dict containing 'callchain'
       'total_power'    -> CPU power consumption (string)
       'resource_util'  -> percentage resource utilization (string)
       'gpu_power'      -> GPU power consumption (string)
+      'lost_samples'   -> samples dropped by the kernel (string, '0' for older traces)
+      'throttled'      -> throttle events (string, '0' for older traces)
+      'duration'       -> interval length in seconds (string, None for older traces)
     Assumes the CSV file has a header row.
     """
-    records = []
-    with open(csv_path, newline='', encoding='utf-8', errors='ignore') as csvfile:
+    with open_csv(csv_path) as csvfile:
         reader = csv.reader(csvfile)
         header = next(reader)  # Skip header row
         for row in reader:
+            if row and row[0].startswith('#'):
+                if stacks is not None:
+                    stacks.define(row)
+                continue
             if len(row) < 5:
                 continue  # skip malformed rows
             r = {
@@ -56,81 +137,224 @@ def read_csv_records(csv_path):
                 'metadata': {'callchain': row[1]},
                 'total_power': row[2],
                 'resource_util': row[3],
-                'gpu_power': row[4]
+                'gpu_power': row[4],
+                'lost_samples': row[5] if len(row) > 5 else '0',
+                'throttled': row[6] if len(row) > 6 else '0',
+                'duration': row[7] if len(row) > 7 else None
+            }
+            yield r
+
+def parse_callchain(callchain, stacks=None):
+    """
+    Split one callchain into its folded "root;...;leaf" stack and its sample
+    tag. The tag is None for untagged chains, otherwise a dict with
+    'time_ns', 'cpu', 'tid' and 'period' (0 when dw-pid did not record it).
+    """
+    frames = callchain.strip().split(';')[:-1]
+    tag = None
+    if frames and frames[0].startswith('@'):
+        fields = frames[0][1:].split('/')
+        try:
+            tag = {
+                'time_ns': int(fields[0]),
+                'cpu': int(fields[1]),
+                'tid': int(fields[2]),
+                'period': int(fields[3]) if len(fields) > 3 else 0
             }
-            records.append(r)
-    return records
+        except (ValueError, IndexError):
+            tag = None
+        frames = frames[1:]
+    if len(frames) == 1 and frames[0].startswith('$') and stacks is not None:
+        return stacks.fold(int(frames[0][1:])), tag
+    return ';'.join(frames[::-1]), tag
+
+def parse_time(timestamp):
+    # The trailing Z means UTC, which sample tags use too
+    return datetime.fromisoformat(timestamp.rstrip('Z')).replace(tzinfo=timezone.utc).timestamp()
+
+def with_durations(records):
+    """
+    Pair every record with its interval length in seconds. dw-pid writes it
+    in the duration column; for older CSVs it is the gap to the previous
+    row, and the first row, held back one row, borrows the gap to the second.
+    """
+    first = None
+    prev_time = None
+    for record in records:
+        current_time = parse_time(record['timestamp'])
+        if record['duration'] is not None:
+            duration = float(record['duration'])
+        elif prev_time is not None:
+            duration = max(0.0, current_time - prev_time)
+        else:
+            first = record
+            prev_time = current_time
+            continue
+        if first is not None:
+            yield first, (duration if first['duration'] is None else float(first['duration']))
+            first = None
+        prev_time = current_time
+        yield record, duration
+    if first is not None:
+        yield first, 0.0
+
+class TimeSeries:
+    """
+    Power over time. Every interval is written to a CSV as it is read, and
+    at most max_points averaged points are kept for the plots: when the
+    buffer fills, neighbouring points are merged and each point covers twice
+    as many intervals from then on.
+    """
+    COLUMNS = ('time', 'total_power', 'effective_power', 'gpu_power', 'effective_cpu')
+
+    def __init__(self, path, max_points=4096):
+        self.file = open(path, 'w', newline='')
+        self.writer = csv.writer(self.file)
+        self.writer.writerow(self.COLUMNS)
+        self.max_points = max_points
+        self.stride = 1
+        self.points = []
+        self.pending = None
+        self.pending_count = 0
+
+    def add(self, values):
+        self.writer.writerow([f'{v:.6f}' for v in values])
+        if self.pending is None:
+            self.pending = list(values)
+        else:
+            self.pending = [a + b for a, b in zip(self.pending, values)]
+        self.pending_count += 1
+        if self.pending_count == self.stride:
+            self._flush()
 
-def process_records(records, scinot):
+    def _flush(self):
+        self.points.append([v / self.pending_count for v in self.pending])
+        self.pending = None
+        self.pending_count = 0
+        if len(self.points) == self.max_points:
+            self.points = [[(a + b) / 2 for a, b in zip(self.points[i], self.points[i + 1])]
+                           for i in range(0, len(self.points), 2)]
+            self.stride *= 2
+
+    def close(self):
+        if self.pending is not None:
+            self._flush()
+        self.file.close()
+
+    def series(self):
+        """One list per column, in COLUMNS order."""
+        return [list(column) for column in zip(*self.points)] if self.points else [[] for _ in self.COLUMNS]
+
+def sample_weights(tags, start_ns):
+    """
+    Share of the interval's energy owed to each sample.
+
+    A sample stands for the events counted since the previous sample of the
+    same event, so its period is its weight. Without periods, each sample
+    owns the time since the previous sample on the same CPU. Either way a
+    CPU contributes in proportion to how long the target ran on it. Untagged
+    chains fall back to an equal split.
+    """
+    if not tags or any(tag is None for tag in tags):
+        return [1.0] * len(tags)
+    if all(tag['period'] > 0 for tag in tags):
+        return [float(tag['period']) for tag in tags]
+
+    weights = [0.0] * len(tags)
+    last_on_cpu = {}
+    for i in sorted(range(len(tags)), key=lambda i: tags[i]['time_ns']):
+        tag = tags[i]
+        prev = last_on_cpu.get(tag['cpu'], start_ns)
+        weights[i] = float(max(0, tag['time_ns'] - prev))
+        last_on_cpu[tag['cpu']] = max(prev, tag['time_ns'])
+    if sum(weights) == 0:
+        return [1.0] * len(tags)
+    return weights
+
+def process_records(records, scinot, timeseries, stacks=None):
     """
-    Process CSV records to extract timestamps, CPU power consumption,
-    effective (actual) power consumption (CPU plus GPU), effective CPU power and aggregate callchain data.
+    Fold CSV records, one at a time, into per-callchain energy and sample
+    counts, writing the power series to timeseries as it goes.
     
     For each record:
       - Total power is from column3.
       - Effective CPU power = (resource_util / 100) * total_power.
       - Overall effective power = effective CPU power + gpu_power.
+      - Energy = overall effective power * interval duration (joules),
+        split among the interval's samples by sample_weights().
     """
-    if not records:
-        raise ValueError("No records found in CSV file.")
-
-
-    first_timestamp = datetime.fromisoformat(records[0]['timestamp'].rstrip('Z')).timestamp()
-    timestamps = []
-    total_power_series = []
-    effective_power_series = []
-    gpu_power_series = []
-    effective_cpu_series = []
-    callchain_power = defaultdict(float)
+    first_timestamp = None
+    callchain_energy = defaultdict(float)
     callchain_num = defaultdict(int)
+    lost_samples = 0
+    throttled = 0
+    total_energy = 0.0
+    total_duration = 0.0
+    unattributed_energy = 0.0
 
-    for record in records:
-        current_time = datetime.fromisoformat(record['timestamp'].rstrip('Z')).timestamp()
-        timestamps.append(current_time - first_timestamp)
+    for record, duration in with_durations(records):
+        lost_samples += int(record['lost_samples'])
+        throttled += int(record['throttled'])
+
+        current_time = parse_time(record['timestamp'])
+        if first_timestamp is None:
+            first_timestamp = current_time
         
         total_power = float(record['total_power'])
-        total_power_series.append(total_power)
-        
         resource_util = float(record['resource_util'])
         effective_cpu = (resource_util / 100.0) * total_power
-        effective_cpu_series.append(effective_cpu)
-        
         gpu_power = float(record['gpu_power'])
-        gpu_power_series.append(gpu_power)
-        
         overall_effective = effective_cpu + gpu_power
-        effective_power_series.append(overall_effective)
+        timeseries.add((current_time - first_timestamp, total_power, overall_effective, gpu_power, effective_cpu))
+
+        energy = overall_effective * duration
+        total_energy += energy
+        total_duration += duration
         
         # Process callchains: split and ignore the last empty element
         callchain_str = record['metadata']['callchain']
         callchains = callchain_str.split('|')[0:-1]
         if len(callchains) == 0:
+            unattributed_energy += energy
             continue
-        # Distribute overall effective power equally among callchains
-        ppc = overall_effective / len(callchains)
-        for callchain in callchains:
-            processed_chain = ';'.join(callchain.split(';')[:-1][::-1])
-            callchain_power[processed_chain] += ppc
+
+        parsed = [parse_callchain(callchain, stacks) for callchain in callchains]
+        start_ns = int((current_time - duration) * 1e9)
+        weights = sample_weights([tag for _, tag in parsed], start_ns)
+        total_weight = sum(weights)
+        for (processed_chain, _), weight in zip(parsed, weights):
+            callchain_energy[processed_chain] += energy * weight / total_weight
             callchain_num[processed_chain] += 1
 
-    # Apply scientific notation multiplier to callchain power values
-    for key in callchain_power:
-        callchain_power[key] *= (10 ** scinot)
+    if first_timestamp is None:
+        raise ValueError("No records found in CSV file.")
+
+    total_samples = sum(callchain_num.values())
+    if lost_samples or throttled:
+        print(f"Warning: {lost_samples} samples lost "
+              f"({100.0 * lost_samples / max(1, total_samples + lost_samples):.2f}%), "
+              f"{throttled} throttle events; consider a larger dw-pid ring buffer (-p)")
+    print(f"Energy: {total_energy:.6f} J over {total_duration:.3f} s, "
+          f"{unattributed_energy:.6f} J in intervals without samples")
+
+    # Apply scientific notation multiplier to callchain energy values
+    for key in callchain_energy:
+        callchain_energy[key] *= (10 ** scinot)
         
-    return timestamps, total_power_series, effective_power_series, gpu_power_series, effective_cpu_series, callchain_power, callchain_num
+    return callchain_energy, callchain_num
 
-def write_collapsed_files(target, directory, callchain_power, callchain_num):
+def write_collapsed_files(target, directory, callchain_energy, callchain_num):
     """
     Write collapsed energy and CPU data to files.
     Format for each file:
       target;callchain value
     """
-    # Write energy data (includes both CPU and GPU power)
-    #filename_energy = f'{target}_energy.collapsed'
-    #file_path_energy = os.path.join(directory, filename_energy)
-    #with open(file_path_energy, 'w') as file:
-    #    for callchain, power in callchain_power.items():
-    #        file.write(f'{target};{callchain} {power}\n')
+    # Write energy data in joules (times 10^scinot), CPU and GPU
+    filename_joules = f'{target}_joules.collapsed'
+    file_path_joules = os.path.join(directory, filename_joules)
+    with open(file_path_joules, 'w') as file:
+        for callchain, energy in callchain_energy.items():
+            file.write(f'{target};{callchain} {energy:.6f}\n')
 
     # Write CPU (number of calls) data
     filename_cpu = f'{target}_cpu.collapsed'
@@ -206,21 +430,29 @@ def main():
     # Parse command-line arguments
     args = parse_args()
 
-    # Read CSV records from the input file
-    records = read_csv_records(args.input_csv)
-    
-    # Process records to extract data and aggregate callchain data
-    (timestamps, total_power_series, effective_power_series, gpu_power_series,
-     effective_cpu_series, callchain_power, callchain_num) = process_records(records, args.scinot)
-
-    # Determine target name from the CSV file name (without extension)
-    target = os.path.splitext(os.path.basename(args.input_csv))[0]
+    # Determine target name from the CSV file name (without compression
+    # suffix and extension)
+    name = os.path.basename(args.input_csv)
+    if name.endswith(COMPRESSED_SUFFIXES):
+        name = name[:-4]
+    target = os.path.splitext(name)[0]
     
     # Ensure output directory exists
     target_clean, directory = ensure_directory(target)
 
+    # Read the CSV one row at a time, folding callchains and writing the
+    # power series as we go
+    stacks = StackTable()
+    records = read_csv_records(args.input_csv, stacks)
+    timeseries = TimeSeries(os.path.join(directory, f'{target_clean}_timeseries.csv'))
+    try:
+        callchain_energy, callchain_num = process_records(records, args.scinot, timeseries, stacks)
+    finally:
+        timeseries.close()
+    timestamps, total_power_series, effective_power_series, gpu_power_series, effective_cpu_series = timeseries.series()
+
     # Write collapsed data files
-    write_collapsed_files(target_clean, directory, callchain_power, callchain_num)
+    write_collapsed_files(target_clean, directory, callchain_energy, callchain_num)
 
     # Plot total CPU power consumption over time
     plot_power_consumption(timestamps, total_power_series, directory, target_clean)
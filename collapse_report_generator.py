@@ -2,31 +2,73 @@
 
 import json
 import csv
-from datetime import datetime
-import bisect
+from datetime import datetime, timedelta
+from collections import defaultdict
+import heapq
+import itertools
+import tempfile
 import sys
 import argparse
+from collapse_report import open_csv
 
 def parse_timestamp(ts_str):
     return datetime.strptime(ts_str, "%Y-%m-%dT%H:%M:%S.%fZ")
 
-def load_json_data(json_file_path):
+def iter_json_array(json_file_path, chunk_size=1 << 20):
+    """Yield the elements of a top-level JSON array without loading the whole file."""
+    decoder = json.JSONDecoder()
     with open(json_file_path) as f:
-        json_data = json.load(f)
-    
-    stacks = []
-    for entry in json_data:
-        stacks.append({
+        buf = ''
+        pos = 0
+        eof = False
+        started = False
+        while True:
+            while pos < len(buf) and buf[pos].isspace():
+                pos += 1
+            if pos < len(buf):
+                c = buf[pos]
+                if not started:
+                    if c != '[':
+                        raise ValueError(f"{json_file_path}: not a JSON array")
+                    started = True
+                    pos += 1
+                    continue
+                if c == ']':
+                    return
+                if c == ',':
+                    pos += 1
+                    continue
+                # An element is only complete once the ',' or ']' after it
+                # is in the buffer, otherwise e.g. a number may be cut short
+                try:
+                    value, end = decoder.raw_decode(buf, pos)
+                    after = end
+                    while after < len(buf) and buf[after].isspace():
+                        after += 1
+                    complete = after < len(buf) and buf[after] in ',]'
+                except ValueError:
+                    complete = False
+                if complete:
+                    yield value
+                    pos = end
+                    continue
+            if eof:
+                raise ValueError(f"{json_file_path}: truncated JSON array")
+            chunk = f.read(chunk_size)
+            eof = not chunk
+            buf = buf[pos:] + chunk
+            pos = 0
+
+def load_json_data(json_file_path):
+    for entry in iter_json_array(json_file_path):
+        yield {
             'stack': entry['stack'],
             'timestamp': parse_timestamp(entry['timestamp'])
-        })
-    return stacks
+        }
 
 def load_csv_data(csv_file_path):
-    power_data = []
-    
     try:
-        with open(csv_file_path, 'r') as f:
+        with open_csv(csv_file_path) as f:
             reader = csv.DictReader(f)
             for row in reader:
                 try:
@@ -40,48 +82,128 @@ def load_csv_data(csv_file_path):
                     if parsed_ts is None:
                         continue
                         
-                    power_data.append({
+                    yield {
                         'timestamp': parsed_ts,
                         'power': float(power.strip())
-                    })
+                    }
                 except (ValueError, KeyError, AttributeError):
                     continue
     except Exception as e:
         pass
-    
-    return power_data
 
-def match_stacks_with_power(stacks, power_data):
-    power_timestamps = [entry['timestamp'] for entry in power_data]
-    
-    matched_data = []
+# py-spy writes stacks close to time order. Stacks up to this far behind the
+# newest one are put back in order in memory.
+REORDER_WINDOW_S = 1.0
+
+# Stacks held in memory per sorted run of the external sort
+SORT_RUN_SIZE = 65536
+
+class ExternalSort:
+    """
+    Stacks sorted by timestamp with bounded memory: every SORT_RUN_SIZE
+    stacks are sorted and spilled to a temporary file, and the runs are
+    merged back as they are read.
+    """
+    def __init__(self):
+        self.runs = []
+        self.pending = []
+        self.count = 0
+
+    def add(self, stack):
+        self.pending.append(stack)
+        self.count += 1
+        if len(self.pending) == SORT_RUN_SIZE:
+            self._spill()
+
+    def _spill(self):
+        run = tempfile.TemporaryFile('w+')
+        for stack in sorted(self.pending, key=lambda entry: entry['timestamp']):
+            run.write(json.dumps([stack['timestamp'].isoformat(), stack['stack']]) + '\n')
+        run.seek(0)
+        self.runs.append(run)
+        self.pending = []
+
+    @staticmethod
+    def _read(run):
+        for line in run:
+            timestamp, stack = json.loads(line)
+            yield {'stack': stack, 'timestamp': datetime.fromisoformat(timestamp)}
+        run.close()
+
+    def sorted(self):
+        self.pending.sort(key=lambda entry: entry['timestamp'])
+        return heapq.merge(*(self._read(run) for run in self.runs), self.pending,
+                           key=lambda entry: entry['timestamp'])
+
+def reorder_stacks(stacks, window, late):
+    """
+    Yield the stacks in timestamp order, holding back only those within
+    window of the newest stack seen. A stack older than one already yielded
+    is too late to be put in place and goes to late instead.
+    """
+    heap = []
+    order = itertools.count()
+    newest = None
+    emitted = None
     for stack in stacks:
-        idx = bisect.bisect_left(power_timestamps, stack['timestamp'])
-        candidates = []
-        if idx > 0:
-            candidates.append(power_data[idx-1])
-        if idx < len(power_data):
-            candidates.append(power_data[idx])
-        
-        if candidates:
-            closest = min(candidates, 
-                         key=lambda x: abs((x['timestamp'] - stack['timestamp']).total_seconds()))
-            
-            matched_data.append({
-                'stack': stack['stack'],
-                'power': closest['power']
-            })
-    
-    return matched_data
+        timestamp = stack['timestamp']
+        if emitted is not None and timestamp < emitted:
+            late.add(stack)
+            continue
+        heapq.heappush(heap, (timestamp, next(order), stack))
+        if newest is None or timestamp > newest:
+            newest = timestamp
+        while heap[0][0] < newest - window:
+            emitted, _, ready = heapq.heappop(heap)
+            yield ready
+    while heap:
+        yield heapq.heappop(heap)[2]
+
+def match_sorted_stacks(stacks, power_data):
+    """Merge stacks and power rows, both in time order, in a single pass."""
+    power_rows = iter(power_data)
+    current = next(power_rows, None)
+    previous = None
+    for stack in stacks:
+        while current is not None and current['timestamp'] < stack['timestamp']:
+            previous = current
+            current = next(power_rows, None)
+        candidates = [row for row in (previous, current) if row is not None]
+        if not candidates:
+            continue
+        closest = min(candidates, key=lambda row: abs((row['timestamp'] - stack['timestamp']).total_seconds()))
+        yield {
+            'stack': stack['stack'],
+            'power': closest['power']
+        }
+
+def match_stacks_with_power(stacks, load_power_data, window_s=REORDER_WINDOW_S):
+    """Pair each py-spy stack with the power of the row nearest to it in time.
+
+    The candidates are the last row before the stack and the first row at or
+    after it, and a tie goes to the earlier one. Stacks before the first row
+    or after the last take that row. Power rows must be in time order, as
+    dw-pid writes them; load_power_data() returns a fresh iterator over them.
+
+    py-spy does not promise that its stacks are in order. Stacks at most
+    window_s behind the newest one are reordered in memory on the way. Later
+    ones are sorted on disk and matched in a second pass over the power rows.
+    """
+    late = ExternalSort()
+    yield from match_sorted_stacks(reorder_stacks(stacks, timedelta(seconds=window_s), late), load_power_data())
+    if late.count:
+        print(f"{late.count} py-spy stacks were more than {window_s} s out of order, matched in a second pass",
+              file=sys.stderr)
+        yield from match_sorted_stacks(late.sorted(), load_power_data())
 
 def generate_flamegraph_data(matched_data):
-    flamegraph_lines = []
-    
+    # Identical stacks are folded as they arrive; flamegraph.pl sums them anyway
+    folded = defaultdict(float)
     for entry in matched_data:
         stack_str = ';'.join(reversed(entry['stack']))
-        flamegraph_lines.append(f"{stack_str} {entry['power']}")
+        folded[stack_str] += entry['power']
     
-    return flamegraph_lines
+    return (f"{stack_str} {power}" for stack_str, power in folded.items())
 
 def main():
     parser = argparse.ArgumentParser(description='Generate flamegraph with power data')
@@ -89,13 +211,14 @@ def main():
     parser.add_argument('csv_file', help='Path to CSV file with power measurements')
     parser.add_argument('-o', '--output', default='flamegraph_data.txt',
                        help='Output file path (default: flamegraph_data.txt)')
+    parser.add_argument('-w', '--reorder-window', type=float, default=REORDER_WINDOW_S,
+                       help=f'Seconds a py-spy stack may lag the newest one and still be reordered in memory (default: {REORDER_WINDOW_S})')
     
     args = parser.parse_args()
     
     stacks = load_json_data(args.json_file)
-    power_data = load_csv_data(args.csv_file)
     
-    matched_data = match_stacks_with_power(stacks, power_data)
+    matched_data = match_stacks_with_power(stacks, lambda: load_csv_data(args.csv_file), args.reorder_window)
     #print("Matched Data: ")
     #print(matched_data)
     
@@ -104,7 +227,8 @@ def main():
     #print(flamegraph_data)
     
     with open(args.output, 'w') as f:
-        f.write('\n'.join(flamegraph_data))
+        for i, line in enumerate(flamegraph_data):
+            f.write(('\n' if i else '') + line)
     
     print(f"Flamegraph data written to {args.output}")
 
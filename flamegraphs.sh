@@ -24,6 +24,10 @@ echo "Running collapse_report.py..."
 echo "Running flamegraph.pl for Energy Flame Graph..."
 ./flamegraph.pl --title "Energy Flame Graph" --countname "microwatts" ./Result/$FNAME/$FNAME\_energy.collapsed > ./Result/$FNAME/$FNAME\_energy.svg
 
+# Echo before running flamegraph.pl for the joules flame graph
+echo "Running flamegraph.pl for Joules Flame Graph..."
+./flamegraph.pl --title "Energy Flame Graph (joules)" --countname "microjoules" ./Result/$FNAME/$FNAME\_joules.collapsed > ./Result/$FNAME/$FNAME\_joules.svg
+
 # Echo before running flamegraph.pl for CPU flame graph
 echo "Running flamegraph.pl for CPU Flame Graph..."
 ./flamegraph.pl --title "CPU Flame Graph" --countname "samples" ./Result/$FNAME/$FNAME\_cpu.collapsed > ./Result/$FNAME/$FNAME\_cpu.svg
\ No newline at end of file
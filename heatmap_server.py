@@ -0,0 +1,117 @@
+#!/usr/bin/python3
+
+import os
+import argparse
+import subprocess
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import urlparse, parse_qs
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+CPU_TRACE = os.path.join(ROOT, 'CPU_Trace')
+
+def arg_file(arg):
+    """Validate that the argument is a valid file."""
+    if os.path.isfile(arg):
+        return arg
+    raise argparse.ArgumentTypeError(f"Not a valid file: '{arg}'.")
+
+def parse_args():
+    """Parse command-line arguments.
+
+    Serves the energy heatmap of a binary trace (dw-pid -o) on localhost.
+    Selecting a range of cells opens the flame graph of that time window,
+    folded by trace-energy from the trace's bucket index.
+    """
+    parser = argparse.ArgumentParser(
+        description='Serve an energy heatmap of a binary trace, with a flame graph per selected time range.'
+    )
+    parser.add_argument('trace', type=arg_file,
+                        help='Path to the binary trace.')
+    parser.add_argument('-p', '--port', type=int, default=8000,
+                        help='Port on 127.0.0.1 to listen on (default: 8000).')
+    parser.add_argument('-b', '--bucket', type=int, default=100,
+                        help='Heatmap and index bucket length in ms, a divisor of 1000 (default: 100).')
+    parser.add_argument('-e', '--scinot', type=int, default=6,
+                        help='Multiply energy by 10^scinot in the flame graphs (default: 6, microjoules).')
+    return parser.parse_args()
+
+def build_tools():
+    targets = ['trace-heatmap', 'trace-energy']
+    if os.environ.get('FLAMEGRAPH') == 'native':
+        targets.append('dw-flamegraph')
+    subprocess.run(['make', '-s', '-C', CPU_TRACE] + targets, check=True)
+
+def flamegraph_command():
+    """flamegraph.pl, or dw-flamegraph with FLAMEGRAPH=native as in start_cgroup.sh."""
+    if os.environ.get('FLAMEGRAPH') == 'native':
+        return os.path.join(CPU_TRACE, 'dw-flamegraph')
+    return os.path.join(ROOT, 'flamegraph.pl')
+
+COUNTNAMES = {0: 'joules', 3: 'millijoules', 6: 'microjoules', 9: 'nanojoules'}
+
+class HeatmapHandler(BaseHTTPRequestHandler):
+    trace = None
+    scinot = 6
+    heatmap = b''
+
+    def reply(self, status, body, content_type='image/svg+xml'):
+        self.send_response(status)
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        if url.path in ('/', '/heatmap.svg'):
+            self.reply(200, self.heatmap)
+        elif url.path == '/flamegraph':
+            query = parse_qs(url.query)
+            try:
+                start, end = float(query['from'][0]), float(query['to'][0])
+            except (KeyError, ValueError):
+                start = end = -1
+            if start < 0 or end <= start:
+                self.reply(400, b'from and to must be seconds since the start of the trace, from < to\n', 'text/plain')
+                return
+            self.window_flamegraph(start, end)
+        else:
+            self.reply(404, b'Not found\n', 'text/plain')
+
+    def window_flamegraph(self, start, end):
+        """Fold [start, end) with trace-energy and render it."""
+        energy = subprocess.run([os.path.join(CPU_TRACE, 'trace-energy'), '-i', '-e', str(self.scinot),
+                                 self.trace, f'{start:.3f}', f'{end:.3f}'],
+                                stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        summary = energy.stderr.decode(errors='ignore').strip()
+        if energy.returncode != 0:
+            self.reply(500, summary.encode() + b'\n', 'text/plain')
+            return
+        countname = COUNTNAMES.get(self.scinot, f'joules x 1e{self.scinot}')
+        svg = subprocess.run([flamegraph_command(), '--title', f'Energy Flame Graph, {start:.3f} s to {end:.3f} s',
+                              '--subtitle', summary.split('\n')[0], '--countname', countname],
+                             input=energy.stdout, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+        self.reply(200, svg.stdout)
+
+def main():
+    args = parse_args()
+    build_tools()
+
+    # Built once; it also builds or refreshes the bucket index the
+    # flame graph queries read
+    heatmap = subprocess.run([os.path.join(CPU_TRACE, 'trace-heatmap'), '-b', str(args.bucket), args.trace],
+                             stdout=subprocess.PIPE, check=True)
+    HeatmapHandler.trace = args.trace
+    HeatmapHandler.scinot = args.scinot
+    HeatmapHandler.heatmap = heatmap.stdout
+
+    server = ThreadingHTTPServer(('127.0.0.1', args.port), HeatmapHandler)
+    print(f"Serving the heatmap of {args.trace} on http://127.0.0.1:{args.port}/")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    server.server_close()
+
+if __name__ == '__main__':
+    main()
@@ -2,6 +2,30 @@
 
 # sudo apt install nvidia-driver-550 libnvidia-ml-dev
 
+# Set SYMBOLIZE=offline to record raw instruction pointers and resolve them
+# with dw-symbolize after the run instead of inside the sampling loop.
+SYMBOLIZE="${SYMBOLIZE:-online}"
+
+# Set COLLAPSE=native to fold the CSV with CPU_Trace/dw-collapse instead of
+# collapse_report.py (same .collapsed files, without the plots).
+COLLAPSE="${COLLAPSE:-python}"
+
+# Set FLAMEGRAPH=native to render the SVGs with CPU_Trace/dw-flamegraph
+# instead of flamegraph.pl (same options and output, much faster).
+FLAMEGRAPH="${FLAMEGRAPH:-perl}"
+
+# Set COMPRESS=zstd or lz4, optionally with :level, to have dw-pid compress
+# its output. The tools reading it decompress it on the fly.
+COMPRESS="${COMPRESS:-}"
+
+# Set LIVE=N to have dw-pid keep the N stacks and functions drawing the most
+# power right now in ./Result/<name>/<name>.top, rewritten every second.
+LIVE="${LIVE:-}"
+
+# Set METRICS to a port, ip:port or unix:path to have dw-pid serve its
+# running counters in the Prometheus text format there.
+METRICS="${METRICS:-}"
+
 # Function to display usage information
 usage() {
     echo "Usage: $0 <executable_path> [<executable_args>...]"
@@ -47,7 +71,11 @@ run_executable() {
 
 # Function to start tracing using dw-pid and turbostat
 start_tracing() {
-    sudo ./CPU_Trace/dw-pid $PID > "./Result/${CGROUP_NAME}/${CGROUP_NAME}.csv" & DW_PID=$!
+    if [ "$SYMBOLIZE" = "offline" ]; then
+        sudo ./CPU_Trace/dw-pid -g "$CGROUP_PATH" $COMPRESS_ARGS $MONITOR_ARGS -r -o "./Result/${CGROUP_NAME}/${CGROUP_NAME}.bin${TRACE_SUFFIX}" $PID & DW_PID=$!
+    else
+        sudo ./CPU_Trace/dw-pid -g "$CGROUP_PATH" $COMPRESS_ARGS $MONITOR_ARGS $PID > "$CSV_PATH" & DW_PID=$!
+    fi
     echo "Tracing executable PID $PID with dw-pid..."
     sudo /home/prathamesh/.cargo/bin/py-spy record --pid $PID --native --output "./Result/${CGROUP_NAME}/${CGROUP_NAME}_pyspy.svg" & PYSPY_PID=$!
     echo "Tracing call stacks with modified PySpy..."
@@ -64,6 +92,12 @@ copy_pid_maps() {
     fi
 }
 
+# Function to resolve the raw instruction pointers recorded in offline mode
+symbolize_trace() {
+    echo "Symbolizing ./Result/${CGROUP_NAME}/${CGROUP_NAME}.bin${TRACE_SUFFIX}..."
+    ./CPU_Trace/dw-symbolize -m "./Result/${CGROUP_NAME}/${CGROUP_NAME}.maps" "./Result/${CGROUP_NAME}/${CGROUP_NAME}.bin${TRACE_SUFFIX}" > "$CSV_PATH"
+}
+
 # Function to clean up the cgroup on exit
 cleanup() {
     sudo rmdir /sys/fs/cgroup/$CONTROLLER/$CGROUP_NAME
@@ -73,6 +107,17 @@ cleanup() {
 # Main execution flow
 
 ( cd ./CPU_Trace && make dw-pid )
+if [ "$SYMBOLIZE" = "offline" ]; then
+    ( cd ./CPU_Trace && make dw-symbolize )
+fi
+if [ "$COLLAPSE" = "native" ]; then
+    ( cd ./CPU_Trace && make dw-collapse )
+fi
+FLAMEGRAPH_CMD=./flamegraph.pl
+if [ "$FLAMEGRAPH" = "native" ]; then
+    ( cd ./CPU_Trace && make dw-flamegraph )
+    FLAMEGRAPH_CMD=./CPU_Trace/dw-flamegraph
+fi
 
 # Check if sufficient arguments are provided
 if [ $# -lt 1 ]; then
@@ -86,7 +131,30 @@ shift
 BASENAME=$(basename "$EXECUTABLE_PATH")
 CGROUP_NAME="${BASENAME%.*}"
 
+# Compressed traces keep the codec's suffix, dw-symbolize writes plain CSV
+COMPRESS_ARGS=""
+TRACE_SUFFIX=""
+if [ -n "$COMPRESS" ]; then
+    COMPRESS_ARGS="-Z $COMPRESS"
+    case "$COMPRESS" in
+        lz4*) TRACE_SUFFIX=".lz4" ;;
+        *) TRACE_SUFFIX=".zst" ;;
+    esac
+fi
+MONITOR_ARGS=""
+if [ -n "$LIVE" ]; then
+    MONITOR_ARGS="-L $LIVE -S ./Result/${CGROUP_NAME}/${CGROUP_NAME}.top"
+fi
+if [ -n "$METRICS" ]; then
+    MONITOR_ARGS="$MONITOR_ARGS -M $METRICS"
+fi
+CSV_PATH="./Result/${CGROUP_NAME}/${CGROUP_NAME}.csv"
+if [ "$SYMBOLIZE" != "offline" ]; then
+    CSV_PATH="${CSV_PATH}${TRACE_SUFFIX}"
+fi
+
 CONTROLLER="perf_event"
+CGROUP_PATH="/sys/fs/cgroup/$CONTROLLER/$CGROUP_NAME"
 
 # Create a directory to store the result and trace RAPL data
 create_result_dir
@@ -115,24 +183,36 @@ copy_pid_maps "$PID"
 wait $PID
 wait $DW_PID
 wait $PYSPY_PID
+
+if [ "$SYMBOLIZE" = "offline" ]; then
+    symbolize_trace
+fi
 # Kill the tracing processes after the executable ends
 # sudo kill $DW_PID
 # sudo kill $TURBOSTAT_PID
 
 # Function to process results and generate reports
 process_results() {
-    # Execute collapse_report.py on the generated csv
-    ./collapse_report.py -e 6 "./Result/${CGROUP_NAME}/${CGROUP_NAME}.csv"
+    # Fold the generated csv into the cpu and joules collapsed files
+    if [ "$COLLAPSE" = "native" ]; then
+        ./CPU_Trace/dw-collapse -e 6 "$CSV_PATH"
+    else
+        ./collapse_report.py -e 6 "$CSV_PATH"
+    fi
     echo "Running collapse file generator to combine results from pyspy and energy measurements..."
-    python3 collapse_report_generator.py "./Result/${CGROUP_NAME}/${CGROUP_NAME}_pyspy_timestamps.json" "./Result/${CGROUP_NAME}/${CGROUP_NAME}.csv" -o "Result/${CGROUP_NAME}/${CGROUP_NAME}_energy.collapsed"
+    python3 collapse_report_generator.py "./Result/${CGROUP_NAME}/${CGROUP_NAME}_pyspy_timestamps.json" "$CSV_PATH" -o "Result/${CGROUP_NAME}/${CGROUP_NAME}_energy.collapsed"
     
     # Echo before running flamegraph.pl for energy flame graph
-    echo "Running flamegraph.pl for Energy Flame Graph..."
-    ./flamegraph.pl --title "Energy Flame Graph" --countname "microwatts" "./Result/${CGROUP_NAME}/${CGROUP_NAME}_energy.collapsed" > "./Result/${CGROUP_NAME}/${CGROUP_NAME}_energy.svg"
+    echo "Running $FLAMEGRAPH_CMD for Energy Flame Graph..."
+    "$FLAMEGRAPH_CMD" --title "Energy Flame Graph" --countname "microwatts" "./Result/${CGROUP_NAME}/${CGROUP_NAME}_energy.collapsed" > "./Result/${CGROUP_NAME}/${CGROUP_NAME}_energy.svg"
     
+    # Echo before running flamegraph.pl for the joules flame graph
+    echo "Running $FLAMEGRAPH_CMD for Joules Flame Graph..."
+    "$FLAMEGRAPH_CMD" --title "Energy Flame Graph (joules)" --countname "microjoules" "./Result/${CGROUP_NAME}/${CGROUP_NAME}_joules.collapsed" > "./Result/${CGROUP_NAME}/${CGROUP_NAME}_joules.svg"
+
     # Echo before running flamegraph.pl for CPU flame graph
-    echo "Running flamegraph.pl for CPU Flame Graph..."
-    ./flamegraph.pl --title "CPU Flame Graph" --countname "samples" "./Result/${CGROUP_NAME}/${CGROUP_NAME}_cpu.collapsed" > "./Result/${CGROUP_NAME}/${CGROUP_NAME}_cpu.svg"
+    echo "Running $FLAMEGRAPH_CMD for CPU Flame Graph..."
+    "$FLAMEGRAPH_CMD" --title "CPU Flame Graph" --countname "samples" "./Result/${CGROUP_NAME}/${CGROUP_NAME}_cpu.collapsed" > "./Result/${CGROUP_NAME}/${CGROUP_NAME}_cpu.svg"
 }
 
 # Run the function to process results after tracing is complete